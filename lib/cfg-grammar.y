@@ -199,14 +199,22 @@ extern struct _LogParser *last_parser;
 %token KW_FRAC_DIGITS                 10152
 
 %token KW_LOG_FIFO_SIZE               10160
+%token KW_LOG_FIFO_BYTES              10161
 %token KW_LOG_FETCH_LIMIT             10162
 %token KW_LOG_IW_SIZE                 10163
 %token KW_LOG_PREFIX                  10164
 %token KW_PROGRAM_OVERRIDE            10165
 %token KW_HOST_OVERRIDE               10166
+%token KW_LOG_FIFO_PRIORITY           10167
 
 %token KW_THROTTLE                    10170
 %token KW_THREADED                    10171
+%token KW_DISK_BUFFER                 10172
+%token KW_DISK_BUF_SIZE               10173
+%token KW_MEM_BUF_LENGTH              10174
+%token KW_DIR                         10175
+%token KW_OPTIMIZE_FILTERS            10176
+%token KW_ADAPTIVE_FILTERS            10177
 
 /* log statement options */
 %token KW_FLAGS                       10190
@@ -226,6 +234,7 @@ extern struct _LogParser *last_parser;
 
 /* destination options */
 %token KW_TMPL_ESCAPE                 10220
+%token KW_TEMPLATE_CACHE              10221
 
 /* driver specific options */
 %token KW_OPTIONAL                    10230
@@ -791,7 +800,11 @@ options_item
 	| KW_TIME_SLEEP '(' LL_NUMBER ')'	{}
 	| KW_SUPPRESS '(' LL_NUMBER ')'		{ configuration->suppress = $3; }
 	| KW_THREADED '(' yesno ')'		{ configuration->threaded = $3; }
+	| KW_TEMPLATE_CACHE '(' yesno ')'	{ configuration->template_cache = $3; }
+	| KW_OPTIMIZE_FILTERS '(' yesno ')'	{ configuration->optimize_filters = $3; }
+	| KW_ADAPTIVE_FILTERS '(' yesno ')'	{ configuration->adaptive_filters = $3; }
 	| KW_LOG_FIFO_SIZE '(' LL_NUMBER ')'	{ configuration->log_fifo_size = $3; }
+	| KW_LOG_FIFO_BYTES '(' LL_NUMBER ')'	{ configuration->log_fifo_bytes = $3; }
 	| KW_LOG_IW_SIZE '(' LL_NUMBER ')'	{ msg_error("Using a global log-iw-size() option was removed, please use a per-source log-iw-size()", NULL); }
 	| KW_LOG_FETCH_LIMIT '(' LL_NUMBER ')'	{ msg_error("Using a global log-fetch-limit() option was removed, please use a per-source log-fetch-limit()", NULL); }
 	| KW_LOG_MSG_SIZE '(' LL_NUMBER ')'	{ configuration->log_msg_size = $3; }
@@ -973,7 +986,13 @@ dest_driver_option
         /* NOTE: plugins need to set "last_driver" in order to incorporate this rule in their grammar */
 
 	: KW_LOG_FIFO_SIZE '(' LL_NUMBER ')'	{ ((LogDestDriver *) last_driver)->log_fifo_size = $3; }
+	| KW_LOG_FIFO_BYTES '(' LL_NUMBER ')'	{ ((LogDestDriver *) last_driver)->log_fifo_bytes = $3; }
+	| KW_LOG_FIFO_PRIORITY '(' yesno ')'	{ ((LogDestDriver *) last_driver)->log_fifo_priority = $3; }
 	| KW_THROTTLE '(' LL_NUMBER ')'         { ((LogDestDriver *) last_driver)->throttle = $3; }
+	| KW_DISK_BUFFER
+          { cfg_lexer_push_context(lexer, 0, disk_buffer_keywords, "disk-buffer"); }
+          '(' dest_driver_disk_buffer_options ')'
+          { cfg_lexer_pop_context(lexer); }
         | LL_IDENTIFIER
           {
             Plugin *p;
@@ -999,6 +1018,22 @@ dest_writer_options
 	|
 	;
 
+dest_driver_disk_buffer_options
+	: dest_driver_disk_buffer_option dest_driver_disk_buffer_options
+	|
+	;
+
+dest_driver_disk_buffer_option
+	: KW_DISK_BUF_SIZE '(' LL_NUMBER ')'	{ ((LogDestDriver *) last_driver)->disk_buf_size = $3; }
+	| KW_MEM_BUF_LENGTH '(' LL_NUMBER ')'	{ ((LogDestDriver *) last_driver)->mem_buf_length = $3; }
+	| KW_DIR '(' string ')'
+          {
+            g_free(((LogDestDriver *) last_driver)->disk_buf_dir);
+            ((LogDestDriver *) last_driver)->disk_buf_dir = g_strdup($3);
+            free($3);
+          }
+	;
+
 dest_writer_option
         /* NOTE: plugins need to set "last_writer_options" in order to incorporate this rule in their grammar */
 
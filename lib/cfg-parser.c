@@ -108,10 +108,15 @@ static CfgLexerKeyword main_keywords[] = {
   { "default_priority",   KW_DEFAULT_LEVEL, 0x0300 },
   { "default_facility",   KW_DEFAULT_FACILITY, 0x0300 },
   { "threaded",           KW_THREADED, 0x0303 },
+  { "template_cache",     KW_TEMPLATE_CACHE, 0x0304 },
+  { "optimize_filters",   KW_OPTIMIZE_FILTERS, 0x0304 },
+  { "adaptive_filters",   KW_ADAPTIVE_FILTERS, 0x0304 },
 
   { "value",              KW_VALUE, 0x0300 },
 
   { "log_fifo_size",      KW_LOG_FIFO_SIZE },
+  { "log_fifo_bytes",     KW_LOG_FIFO_BYTES, 0x0304 },
+  { "log_fifo_priority",  KW_LOG_FIFO_PRIORITY, 0x0304 },
   { "log_fetch_limit",    KW_LOG_FETCH_LIMIT },
   { "log_iw_size",        KW_LOG_IW_SIZE },
   { "log_msg_size",       KW_LOG_MSG_SIZE },
@@ -119,6 +124,7 @@ static CfgLexerKeyword main_keywords[] = {
   { "program_override",   KW_PROGRAM_OVERRIDE, 0x0300 },
   { "host_override",      KW_HOST_OVERRIDE, 0x0300 },
   { "throttle",           KW_THROTTLE },
+  { "disk_buffer",        KW_DISK_BUFFER, 0x0304 },
 
   { "create_dirs",        KW_CREATE_DIRS },
   { "optional",           KW_OPTIONAL },
@@ -150,6 +156,16 @@ static CfgLexerKeyword main_keywords[] = {
   { NULL, 0 }
 };
 
+/* the options of disk-buffer(), pushed on top of the keywords of the
+ * enclosing destination, so that generic names like "dir" are not
+ * reserved elsewhere */
+CfgLexerKeyword disk_buffer_keywords[] = {
+  { "disk_buf_size",      KW_DISK_BUF_SIZE, 0x0304 },
+  { "mem_buf_length",     KW_MEM_BUF_LENGTH, 0x0304 },
+  { "dir",                KW_DIR, 0x0304 },
+  { NULL, 0 }
+};
+
 
 CfgParser main_parser =
 {
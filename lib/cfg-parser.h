@@ -97,6 +97,7 @@ cfg_parser_cleanup(CfgParser *self, gpointer instance)
 }
 
 extern CfgParser main_parser;
+extern CfgLexerKeyword disk_buffer_keywords[];
 
 #define CFG_PARSER_DECLARE_LEXER_BINDING(parser_prefix, root_type)             \
     int                                                                        \
@@ -1036,6 +1036,121 @@ cfg_tree_compile(CfgTree *self)
   return TRUE;
 }
 
+/* upper limit of the DAG size, the per-message state is allocated on the stack */
+#define CFG_TREE_MAX_DECISION_NODES 4096
+
+/*
+ * cfg_tree_compile_decisions:
+ *
+ * Log paths often start with the same conditions: hundreds of log
+ * statements may refer to the same source, followed by the same
+ * filter(f_not_debug). Each of these is a separate branch of the
+ * source's LogMultiplexer, and each would evaluate the same filter
+ * again.
+ *
+ * This pass collects the filters at the head of each branch of @mpx
+ * (skipping the do-nothing pipes between them) and merges the
+ * identical prefixes into a DAG, which the multiplexer evaluates
+ * lazily, each node and each distinct filter expression at most once
+ * per message. Only filters that don't modify the message are
+ * collected, parsers and rewrite rules end the shared prefix.
+ *
+ * The branches themselves remain intact, along with the final/fallback
+ * flags attached to their heads, the message simply skips the pipes
+ * whose verdict is already known. Branches depending only on the
+ * priority of the message are further compiled into a routing table by
+ * the multiplexer.
+ *
+ * NOTE: this has to run after the pipes are initialized, as whether a
+ * filter modifies the message is only known by then.
+ */
+static void
+cfg_tree_compile_decisions(CfgTree *self, LogMultiplexer *mpx)
+{
+  GHashTable *condition_ids, *node_ids;
+  GPtrArray *conditions;
+  GArray *nodes;
+  LogMultiplexerBranch *branches;
+  gboolean shared = FALSE, pri_only = FALSE;
+  gint i;
+
+  if (mpx->next_hops->len < 2)
+    return;
+
+  condition_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+  node_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+  conditions = g_ptr_array_new();
+  nodes = g_array_new(FALSE, FALSE, sizeof(LogMultiplexerNode));
+  branches = g_new0(LogMultiplexerBranch, mpx->next_hops->len);
+
+  for (i = 0; i < mpx->next_hops->len; i++)
+    {
+      LogMultiplexerBranch *branch = &branches[i];
+      LogPipe *pipe;
+
+      branch->node = -1;
+      for (pipe = g_ptr_array_index(mpx->next_hops, i); pipe; pipe = pipe->pipe_next)
+        {
+          FilterExprNode *expr;
+          LogMultiplexerNode node;
+          gint condition, node_id;
+
+          if (pipe->flags & PIF_HARD_FLOW_CONTROL)
+            branch->flow_control = TRUE;
+          if (!pipe->queue)
+            continue;
+          if (!log_filter_pipe_is_shareable(pipe) || nodes->len >= CFG_TREE_MAX_DECISION_NODES)
+            break;
+
+          /* clones of the same filter rule share the expression */
+          expr = ((LogFilterPipe *) pipe)->expr;
+          condition = GPOINTER_TO_INT(g_hash_table_lookup(condition_ids, expr)) - 1;
+          if (condition < 0)
+            {
+              condition = conditions->len;
+              g_ptr_array_add(conditions, pipe);
+              g_hash_table_insert(condition_ids, expr, GINT_TO_POINTER(condition + 1));
+              pri_only |= filter_expr_is_pri_only(expr);
+            }
+          else
+            {
+              shared = TRUE;
+            }
+
+          node.parent = branch->node;
+          node.condition = condition;
+          node_id = GPOINTER_TO_INT(g_hash_table_lookup(node_ids, GUINT_TO_POINTER(((node.parent + 1) << 16) + condition))) - 1;
+          if (node_id < 0)
+            {
+              node_id = nodes->len;
+              g_array_append_val(nodes, node);
+              g_hash_table_insert(node_ids, GUINT_TO_POINTER(((node.parent + 1) << 16) + condition), GINT_TO_POINTER(node_id + 1));
+            }
+          branch->node = node_id;
+        }
+      branch->target = pipe;
+    }
+
+  g_hash_table_destroy(condition_ids);
+  g_hash_table_destroy(node_ids);
+
+  if (!shared && !pri_only)
+    {
+      /* each filter is evaluated once anyway */
+      g_ptr_array_free(conditions, TRUE);
+      g_array_free(nodes, TRUE);
+      g_free(branches);
+      return;
+    }
+
+  msg_debug("Sharing filter evaluation between log paths",
+            evt_tag_int("branches", mpx->next_hops->len),
+            evt_tag_int("filters", conditions->len),
+            evt_tag_int("nodes", nodes->len),
+            NULL);
+  log_multiplexer_set_decisions(mpx, conditions, nodes, branches);
+}
+
 gboolean
 cfg_tree_start(CfgTree *self)
 {
@@ -1059,6 +1174,17 @@ cfg_tree_start(CfgTree *self)
           return FALSE;
         }
     }
+
+  if (self->cfg->optimize_filters)
+    {
+      for (i = 0; i < self->initialized_pipes->len; i++)
+        {
+          LogPipe *pipe = g_ptr_array_index(self->initialized_pipes, i);
+
+          if (log_multiplexer_is_instance(pipe))
+            cfg_tree_compile_decisions(self, (LogMultiplexer *) pipe);
+        }
+    }
   return TRUE;
 }
 
@@ -303,6 +303,7 @@ cfg_new(gint version)
   self->time_reap = 60;
 
   self->log_fifo_size = 10000;
+  self->log_fifo_bytes = 0;
   self->log_msg_size = 8192;
 
   self->follow_freq = -1;
@@ -318,6 +319,9 @@ cfg_new(gint version)
   self->dns_cache_expire = 3600;
   self->dns_cache_expire_failed = 60;
   self->threaded = FALSE;
+  self->template_cache = FALSE;
+  self->optimize_filters = TRUE;
+  self->adaptive_filters = FALSE;
   
   log_template_options_defaults(&self->template_options);
   self->template_options.ts_format = TS_FMT_BSD;
@@ -419,6 +423,8 @@ cfg_free(GlobalConfig *self)
   g_list_free(self->plugins);
   plugin_free_candidate_modules(self);
   cfg_tree_free_instance(&self->tree);
+  if (self->filter_pattern_sets)
+    g_hash_table_destroy(self->filter_pattern_sets);
   g_free(self);
 }
 
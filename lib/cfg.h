@@ -69,6 +69,9 @@ struct _GlobalConfig
   gint mark_mode;
   gint flush_timeout;
   gboolean threaded;
+  gboolean template_cache;
+  gboolean optimize_filters;
+  gboolean adaptive_filters;
   gboolean chain_hostnames;
   gboolean normalize_hostnames;
   gboolean keep_hostname;
@@ -86,6 +89,7 @@ struct _GlobalConfig
   gint suppress;
 
   gint log_fifo_size;
+  gint64 log_fifo_bytes;
   gint log_msg_size;
 
   gint follow_freq;
@@ -114,6 +118,8 @@ struct _GlobalConfig
   
   CfgTree tree;
 
+  /* NVHandle -> LogMatcherSet, shared by the filters matching on the same value */
+  GHashTable *filter_pattern_sets;
 };
 
 gboolean cfg_allow_config_dups(GlobalConfig *self);
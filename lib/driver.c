@@ -24,6 +24,7 @@
   
 #include "driver.h"
 #include "logqueue-fifo.h"
+#include "logqueue-disk.h"
 #include "afinter.h"
 #include "cfg-tree.h"
 
@@ -196,11 +197,25 @@ log_dest_driver_acquire_queue_method(LogDestDriver *self, gchar *persist_name, g
   if (persist_name)
     queue = cfg_persist_config_fetch(cfg, persist_name);
 
+  if (!queue && self->disk_buf_size > 0 && persist_name)
+    {
+      queue = log_queue_disk_new(self->mem_buf_length < 0 ? cfg->log_fifo_size : self->mem_buf_length,
+                                 self->disk_buf_size, self->disk_buf_dir, cfg->state, persist_name);
+      if (queue)
+        log_queue_set_throttle(queue, self->throttle);
+      else
+        msg_error("Error initializing disk buffer, falling back to an in-memory queue",
+                  evt_tag_str("persist_name", persist_name),
+                  NULL);
+    }
+
   if (!queue)
     {
       queue = log_queue_fifo_new(self->log_fifo_size < 0 ? cfg->log_fifo_size : self->log_fifo_size, persist_name);
+      log_queue_fifo_set_priority(queue, self->log_fifo_priority);
       log_queue_set_throttle(queue, self->throttle);
     }
+  log_queue_set_memory_usage_limit(queue, self->log_fifo_bytes < 0 ? cfg->log_fifo_bytes : self->log_fifo_bytes);
   return queue;
 }
 
@@ -210,6 +225,10 @@ log_dest_driver_release_queue_method(LogDestDriver *self, LogQueue *q, gpointer
 {
   GlobalConfig *cfg = log_pipe_get_config(&self->super.super);
 
+  /* the queue may outlive the persistent state, e.g. it is freed after
+   * the configuration at shutdown */
+  log_queue_persist_state(q, cfg->state);
+
   /* we only save the LogQueue instance if it contains data */
   if (q->persist_name && log_queue_keep_on_reload(q) > 0)
     cfg_persist_config_add(cfg, q->persist_name, q, (GDestroyNotify) log_queue_unref, FALSE);
@@ -289,7 +308,10 @@ log_dest_driver_init_instance(LogDestDriver *self)
   self->acquire_queue = log_dest_driver_acquire_queue_method;
   self->release_queue = log_dest_driver_release_queue_method;
   self->log_fifo_size = -1;
+  self->log_fifo_bytes = -1;
   self->throttle = 0;
+  self->disk_buf_size = 0;
+  self->mem_buf_length = -1;
 }
 
 void
@@ -303,5 +325,6 @@ log_dest_driver_free(LogPipe *s)
       log_queue_unref((LogQueue *) l->data);
     }
   g_list_free(self->queues);
+  g_free(self->disk_buf_dir);
   log_driver_free(s);
 }
@@ -159,7 +159,14 @@ struct _LogDestDriver
   GList *queues;
 
   gint log_fifo_size;
+  gint64 log_fifo_bytes;
+  /* drain the in-memory queue in the order of severities */
+  gboolean log_fifo_priority;
   gint throttle;
+  /* disk-buffer() options, the disk queue is used if disk_buf_size > 0 */
+  gint64 disk_buf_size;
+  gint mem_buf_length;
+  gchar *disk_buf_dir;
   StatsCounterItem *queued_global_messages;
 };
 
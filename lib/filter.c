@@ -31,6 +31,7 @@
 #include "tags.h"
 #include "cfg-tree.h"
 #include "filter-expr-grammar.h"
+#include "timeutils.h"
 
 #include <regex.h>
 #include <string.h>
@@ -40,10 +41,27 @@
  * Filter expression nodes
  ****************************************************************/
 
+/* relative evaluation costs of the various filter nodes */
+enum
+{
+  FILTER_COST_PRI = 1,
+  FILTER_COST_NETMASK = 2,
+  FILTER_COST_TAGS = 2,
+  FILTER_COST_STRING = 10,
+  FILTER_COST_GLOB = 20,
+  FILTER_COST_CMP = 30,
+  FILTER_COST_PCRE = 40,
+  FILTER_COST_POSIX_RE = 50,
+  FILTER_COST_DEFAULT = 50,
+  /* the compatibility mode of match() formats a string for each message */
+  FILTER_COST_MATCH_COMPAT = 20,
+};
+
 void
 filter_expr_node_init(FilterExprNode *self)
 {
   self->ref_cnt = 1;
+  self->cost = FILTER_COST_DEFAULT;
 }
 
 gboolean
@@ -83,82 +101,323 @@ filter_expr_unref(FilterExprNode *self)
     }
 }
 
+/*
+ * AND/OR operations
+ *
+ * An operation holds any number of operands, evaluated in order until one
+ * of them decides the result (FALSE for AND, TRUE for OR).  When the
+ * configuration is initialized with optimize-filters(yes), nested
+ * operations of the same kind are flattened, constant operands are folded
+ * and the operands are ordered by their estimated cost, so that a cheap
+ * facility() or level() check can short-circuit an expensive regexp.
+ * Operands that modify the message are never moved, the reordering only
+ * happens between them.
+ *
+ * With adaptive-filters(yes) the operation also counts how often each
+ * operand decides the result, and periodically reorders the operands
+ * using this selectivity information.  The evaluation order is replaced
+ * atomically, the previous orders are only freed together with the node,
+ * as other threads may still be iterating them.
+ */
+
+/* evaluations between two reorderings */
+#define FOP_ADAPT_INTERVAL 4096
+/* the number of reorderings after which the order is considered final */
+#define FOP_ADAPT_MAX 32
+
+typedef struct _FilterOperand
+{
+  FilterExprNode *expr;
+  /* selectivity counters, updated without synchronization, a lost update
+   * only makes them less accurate */
+  guint32 evals;
+  guint32 decided;
+} FilterOperand;
+
 typedef struct _FilterOp
 {
   FilterExprNode super;
-  FilterExprNode *left, *right;
+  /* the operand result that stops the evaluation */
+  gboolean decisive;
+  gint num_operands;
+  /* in the order they were written in the configuration */
+  FilterOperand *operands;
+  /* evaluation order, points into operands */
+  FilterOperand **order;
+
+  gboolean adaptive;
+  guint32 evals;
+  guint32 last_adapt;
+  gint adaptations;
+  GList *retired_orders;
+  GStaticMutex adapt_lock;
 } FilterOp;
 
+static gdouble
+fop_operand_rank(FilterOperand *op)
+{
+  /* the expected cost of reaching a decision using this operand, without
+   * any statistics the probability of a decision is assumed to be 1/2 */
+  return (gdouble) MAX(op->expr->cost, 1) * (op->evals + 2) / (op->decided + 1);
+}
+
 static void
-fop_init(FilterExprNode *s, GlobalConfig *cfg)
+fop_sort_order(FilterOp *self, FilterOperand **order)
 {
-  FilterOp *self = (FilterOp *) s;
+  gint i, j, start = 0;
+
+  /* insertion sort, stable and the number of operands is small */
+  for (i = 0; i < self->num_operands; i++)
+    {
+      FilterOperand *op = order[i];
+      gdouble rank;
 
-  if (self->left && self->left->init)
-    self->left->init(self->left, cfg);
-  if (self->right && self->right->init)
-    self->right->init(self->right, cfg);
+      if (op->expr->modify)
+        {
+          start = i + 1;
+          continue;
+        }
+      rank = fop_operand_rank(op);
+      for (j = i; j > start && fop_operand_rank(order[j - 1]) > rank; j--)
+        order[j] = order[j - 1];
+      order[j] = op;
+    }
 }
 
 static void
-fop_free(FilterExprNode *s)
+fop_adapt(FilterOp *self)
+{
+  FilterOperand **order, **new_order;
+  gint i;
+
+  if (!g_static_mutex_trylock(&self->adapt_lock))
+    return;
+
+  if (self->evals - self->last_adapt >= FOP_ADAPT_INTERVAL)
+    {
+      order = self->order;
+      new_order = g_memdup(order, self->num_operands * sizeof(order[0]));
+      fop_sort_order(self, new_order);
+      if (memcmp(order, new_order, self->num_operands * sizeof(order[0])) != 0)
+        {
+          self->retired_orders = g_list_prepend(self->retired_orders, order);
+          g_atomic_pointer_set(&self->order, new_order);
+          if (++self->adaptations >= FOP_ADAPT_MAX)
+            self->adaptive = FALSE;
+        }
+      else
+        {
+          g_free(new_order);
+        }
+
+      /* age the counters so that the order follows changes in the traffic */
+      for (i = 0; i < self->num_operands; i++)
+        {
+          self->operands[i].evals /= 2;
+          self->operands[i].decided /= 2;
+        }
+      self->last_adapt = self->evals;
+    }
+  g_static_mutex_unlock(&self->adapt_lock);
+}
+
+static gboolean
+fop_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
 {
   FilterOp *self = (FilterOp *) s;
-  
-  filter_expr_unref(self->left);
-  filter_expr_unref(self->right);
+  FilterOperand **order = g_atomic_pointer_get(&self->order);
+  gboolean result = !self->decisive;
+  gint i;
+
+  for (i = 0; i < self->num_operands; i++)
+    {
+      FilterOperand *op = order[i];
+      gboolean res = !!filter_expr_eval_with_context(op->expr, msgs, num_msg);
+
+      if (G_UNLIKELY(self->adaptive))
+        {
+          op->evals++;
+          op->decided += (res == self->decisive);
+        }
+      if (res == self->decisive)
+        {
+          result = res;
+          break;
+        }
+    }
+  if (G_UNLIKELY(self->adaptive) && ++self->evals - self->last_adapt >= FOP_ADAPT_INTERVAL)
+    fop_adapt(self);
+  return result ^ s->comp;
 }
 
 static void
-fop_init_instance(FilterOp *self)
+fop_free_operands(FilterOp *self)
 {
-  filter_expr_node_init(&self->super);
-  self->super.init = fop_init;
-  self->super.free_fn = fop_free;
+  gint i;
+
+  for (i = 0; i < self->num_operands; i++)
+    filter_expr_unref(self->operands[i].expr);
+  g_free(self->operands);
+  g_free(self->order);
+  while (self->retired_orders)
+    {
+      g_free(self->retired_orders->data);
+      self->retired_orders = g_list_delete_link(self->retired_orders, self->retired_orders);
+    }
 }
 
-static gboolean
-fop_or_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
+static void
+fop_set_operands(FilterOp *self, FilterExprNode **exprs, gint num_exprs)
+{
+  gint i;
+
+  fop_free_operands(self);
+  self->num_operands = num_exprs;
+  self->operands = g_new0(FilterOperand, num_exprs);
+  self->order = g_new(FilterOperand *, num_exprs);
+  self->super.modify = FALSE;
+  self->super.cost = 0;
+  for (i = 0; i < num_exprs; i++)
+    {
+      self->operands[i].expr = exprs[i];
+      self->order[i] = &self->operands[i];
+      self->super.modify |= exprs[i]->modify;
+      self->super.cost += exprs[i]->cost;
+    }
+}
+
+static void
+fop_optimize(FilterOp *self, gboolean adaptive)
+{
+  GPtrArray *exprs = g_ptr_array_sized_new(self->num_operands);
+  gboolean modify = FALSE;
+  gint i, j;
+
+  /* flatten nested operations of the same kind, these are already
+   * optimized as the operands are initialized first */
+  for (i = 0; i < self->num_operands; i++)
+    {
+      FilterExprNode *expr = self->operands[i].expr;
+
+      if (expr->eval == fop_eval && ((FilterOp *) expr)->decisive == self->decisive && !expr->comp)
+        {
+          FilterOp *child = (FilterOp *) expr;
+
+          for (j = 0; j < child->num_operands; j++)
+            g_ptr_array_add(exprs, filter_expr_ref(child->operands[j].expr));
+        }
+      else
+        {
+          g_ptr_array_add(exprs, filter_expr_ref(expr));
+        }
+      modify |= expr->modify;
+    }
+
+  /* fold constants: operands that can't change the result are dropped, an
+   * operand that always decides makes the whole operation constant,
+   * unless there's an operand that modifies the message */
+  self->super.constant = FALSE;
+  for (i = 0; i < exprs->len; )
+    {
+      FilterExprNode *expr = g_ptr_array_index(exprs, i);
+
+      if (expr->constant && !expr->modify)
+        {
+          if ((expr->const_result ^ expr->comp) != self->decisive)
+            {
+              g_ptr_array_remove_index(exprs, i);
+              filter_expr_unref(expr);
+              continue;
+            }
+          else if (!modify)
+            {
+              for (j = 0; j < exprs->len; j++)
+                {
+                  if (j != i)
+                    filter_expr_unref(g_ptr_array_index(exprs, j));
+                }
+              g_ptr_array_index(exprs, 0) = expr;
+              g_ptr_array_set_size(exprs, 1);
+              self->super.constant = TRUE;
+              self->super.const_result = self->decisive;
+              break;
+            }
+        }
+      i++;
+    }
+  if (exprs->len == 0)
+    {
+      self->super.constant = TRUE;
+      self->super.const_result = !self->decisive;
+    }
+
+  fop_set_operands(self, (FilterExprNode **) exprs->pdata, exprs->len);
+  g_ptr_array_free(exprs, TRUE);
+
+  fop_sort_order(self, self->order);
+  self->adaptive = adaptive && self->num_operands > 1;
+  self->evals = self->last_adapt = 0;
+  self->adaptations = 0;
+}
+
+static void
+fop_init(FilterExprNode *s, GlobalConfig *cfg)
 {
   FilterOp *self = (FilterOp *) s;
-  
-  return (filter_expr_eval_with_context(self->left, msgs, num_msg) || filter_expr_eval_with_context(self->right, msgs, num_msg)) ^ s->comp;
+  gint i;
+
+  for (i = 0; i < self->num_operands; i++)
+    {
+      FilterExprNode *expr = self->operands[i].expr;
+
+      if (expr->init)
+        expr->init(expr, cfg);
+    }
+  if (cfg->optimize_filters)
+    fop_optimize(self, cfg->adaptive_filters);
 }
 
-FilterExprNode *
-fop_or_new(FilterExprNode *e1, FilterExprNode *e2)
+static void
+fop_free(FilterExprNode *s)
+{
+  FilterOp *self = (FilterOp *) s;
+
+  fop_free_operands(self);
+  g_static_mutex_free(&self->adapt_lock);
+}
+
+static FilterExprNode *
+fop_new(FilterExprNode *e1, FilterExprNode *e2, gboolean decisive)
 {
   FilterOp *self = g_new0(FilterOp, 1);
-  
-  fop_init_instance(self);
-  self->super.eval = fop_or_eval;
-  self->super.modify = e1->modify || e2->modify;
-  self->left = e1;
-  self->right = e2;
-  self->super.type = "OR";
+  FilterExprNode *exprs[] = { e1, e2 };
+
+  filter_expr_node_init(&self->super);
+  self->super.init = fop_init;
+  self->super.eval = fop_eval;
+  self->super.free_fn = fop_free;
+  self->decisive = decisive;
+  g_static_mutex_init(&self->adapt_lock);
+  fop_set_operands(self, exprs, 2);
   return &self->super;
 }
 
-static gboolean
-fop_and_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
+FilterExprNode *
+fop_or_new(FilterExprNode *e1, FilterExprNode *e2)
 {
-  FilterOp *self = (FilterOp *) s;
-  
-  return (filter_expr_eval_with_context(self->left, msgs, num_msg) && filter_expr_eval_with_context(self->right, msgs, num_msg)) ^ s->comp;
+  FilterExprNode *self = fop_new(e1, e2, TRUE);
+
+  self->type = "OR";
+  return self;
 }
 
 FilterExprNode *
 fop_and_new(FilterExprNode *e1, FilterExprNode *e2)
 {
-  FilterOp *self = g_new0(FilterOp, 1);
-  
-  fop_init_instance(self);
-  self->super.eval = fop_and_eval;
-  self->super.modify = e1->modify || e2->modify;
-  self->left = e1;
-  self->right = e2;
-  self->super.type = "AND";
-  return &self->super;
+  FilterExprNode *self = fop_new(e1, e2, FALSE);
+
+  self->type = "AND";
+  return self;
 }
 
 #define FCMP_EQ  0x0001
@@ -241,6 +500,7 @@ fop_cmp_new(LogTemplate *left, LogTemplate *right, gint op)
   self->left_buf = g_string_sized_new(32);
   self->right_buf = g_string_sized_new(32);
   self->super.type = "CMP";
+  self->super.cost = FILTER_COST_CMP;
 
   switch (op)
     {
@@ -318,6 +578,7 @@ filter_facility_new(guint32 facilities)
   self->super.eval = filter_facility_eval;
   self->valid = facilities;
   self->super.type = "facility";
+  self->super.cost = FILTER_COST_PRI;
   return &self->super;
 }
 
@@ -341,6 +602,13 @@ filter_level_new(guint32 levels)
   self->super.eval = filter_level_eval;
   self->valid = levels;
   self->super.type = "level";
+  self->super.cost = FILTER_COST_PRI;
+  if ((levels & 0xff) == 0xff)
+    {
+      /* all levels selected */
+      self->super.constant = TRUE;
+      self->super.const_result = TRUE;
+    }
   return &self->super;
 }
 
@@ -363,18 +631,70 @@ filter_re_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   LogMessage *msg = msgs[0];
   gssize len = 0;
   
+  gboolean res;
+
   value = log_msg_get_value(msg, self->value_handle, &len);
-  
+
+  if (self->pattern_set && log_matcher_set_lookup(self->pattern_set, self->pattern_index, msg, value, len, &res))
+    return res ^ self->super.comp;
+
   APPEND_ZERO(value, value, len);
   return filter_re_eval_string(s, msg, self->value_handle, value, len);
 }
 
 
+static void
+filter_re_init(FilterExprNode *s, GlobalConfig *cfg)
+{
+  FilterRE *self = (FilterRE *) s;
+
+  switch (self->matcher ? self->matcher->type : LMR_POSIX_REGEXP)
+    {
+    case LMR_STRING:
+      self->super.cost = FILTER_COST_STRING;
+      break;
+    case LMR_GLOB:
+      self->super.cost = FILTER_COST_GLOB;
+      break;
+    case LMR_PCRE_REGEXP:
+      self->super.cost = FILTER_COST_PCRE;
+      break;
+    default:
+      self->super.cost = FILTER_COST_POSIX_RE;
+      break;
+    }
+
+  /* filters looking at the same value share a single scan of it, unless
+   * they need the match results stored */
+  if (cfg && cfg->optimize_filters && self->matcher && self->value_handle && !self->super.modify && !self->pattern_set)
+    {
+      LogMatcherSet *set;
+      gint index;
+
+      if (!cfg->filter_pattern_sets)
+        cfg->filter_pattern_sets = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) log_matcher_set_unref);
+      set = g_hash_table_lookup(cfg->filter_pattern_sets, GUINT_TO_POINTER(self->value_handle));
+      if (!set)
+        {
+          set = log_matcher_set_new();
+          g_hash_table_insert(cfg->filter_pattern_sets, GUINT_TO_POINTER(self->value_handle), set);
+        }
+      index = log_matcher_set_add(set, self->matcher);
+      if (index >= 0)
+        {
+          self->pattern_set = log_matcher_set_ref(set);
+          self->pattern_index = index;
+        }
+    }
+}
+
 static void
 filter_re_free(FilterExprNode *s)
 {
   FilterRE *self = (FilterRE *) s;
-  
+
+  if (self->pattern_set)
+    log_matcher_set_unref(self->pattern_set);
   log_matcher_unref(self->matcher);
 }
 
@@ -420,6 +740,7 @@ filter_re_new(NVHandle value_handle)
 
   filter_expr_node_init(&self->super);
   self->value_handle = value_handle;
+  self->super.init = filter_re_init;
   self->super.eval = filter_re_eval;
   self->super.free_fn = filter_re_free;
   return &self->super;
@@ -457,12 +778,23 @@ filter_match_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   return res;
 }
 
+static void
+filter_match_init(FilterExprNode *s, GlobalConfig *cfg)
+{
+  FilterRE *self = (FilterRE *) s;
+
+  filter_re_init(s, cfg);
+  if (!self->value_handle)
+    self->super.cost += FILTER_COST_MATCH_COMPAT;
+}
+
 FilterExprNode *
 filter_match_new()
 {
   FilterRE *self = g_new0(FilterRE, 1);
 
   filter_expr_node_init(&self->super);
+  self->super.init = filter_match_init;
   self->super.free_fn = filter_re_free;
   self->super.eval = filter_match_eval;
   return &self->super;
@@ -509,12 +841,18 @@ filter_call_init(FilterExprNode *s, GlobalConfig *cfg)
 
 
       self->filter_expr = ((LogFilterPipe *) rule->children->object)->expr;
+      self->super.cost = self->filter_expr->cost;
+      self->super.modify = self->filter_expr->modify;
+      self->super.constant = self->filter_expr->constant;
+      self->super.const_result = self->filter_expr->const_result ^ self->filter_expr->comp;
     }
   else
     {
       msg_error("Referenced filter rule not found in filter() expression",
                 evt_tag_str("rule", self->rule),
                 NULL);
+      self->super.constant = TRUE;
+      self->super.const_result = FALSE;
     }
 }
 
@@ -607,6 +945,7 @@ filter_netmask_new(gchar *cidr)
     }
   self->address.s_addr &= self->netmask.s_addr;
   self->super.eval = filter_netmask_eval;
+  self->super.cost = FILTER_COST_NETMASK;
   return &self->super;
 }
 
@@ -667,14 +1006,52 @@ filter_tags_new(GList *tags)
 
   self->super.eval = filter_tags_eval;
   self->super.free_fn = filter_tags_free;
+  self->super.cost = FILTER_COST_TAGS;
   return &self->super;
 }
 
+/*
+ * Returns TRUE if the result of the expression only depends on the
+ * priority of the message (e.g. it consists of facility() and level()
+ * filters), in which case the result can be tabulated for all priority
+ * values.  Filter references are only resolved by init, so this is only
+ * meaningful once the expression is initialized.
+ */
+gboolean
+filter_expr_is_pri_only(FilterExprNode *self)
+{
+  gint i;
+
+  if (self->modify)
+    return FALSE;
+  if (self->constant)
+    return TRUE;
+  if (self->eval == filter_facility_eval || self->eval == filter_level_eval)
+    return TRUE;
+  if (self->eval == fop_eval)
+    {
+      FilterOp *op = (FilterOp *) self;
+
+      for (i = 0; i < op->num_operands; i++)
+        {
+          if (!filter_expr_is_pri_only(op->operands[i].expr))
+            return FALSE;
+        }
+      return TRUE;
+    }
+  if (self->eval == filter_call_eval)
+    return !((FilterCall *) self)->filter_expr || filter_expr_is_pri_only(((FilterCall *) self)->filter_expr);
+  return FALSE;
+}
+
 
 /*******************************************************************
  * LogFilterPipe
  *******************************************************************/
 
+/* only every Nth evaluation is timed, the time spent is extrapolated from these */
+#define FILTER_TIMING_SAMPLE 64
+
 static gboolean
 log_filter_pipe_init(LogPipe *s)
 {
@@ -685,30 +1062,85 @@ log_filter_pipe_init(LogPipe *s)
     self->expr->init(self->expr, log_pipe_get_config(s));
   if (!self->name)
     self->name = cfg_tree_get_rule_name(&cfg->tree, ENC_FILTER, s->expr_node);
+
+  stats_lock();
+  stats_register_counter(3, SCS_FILTER, self->name, NULL, SC_TYPE_PROCESSED, &self->evaluated_messages);
+  stats_register_counter(3, SCS_FILTER, self->name, NULL, SC_TYPE_MATCHED, &self->matched_messages);
+  stats_register_counter(3, SCS_FILTER, self->name, NULL, SC_TYPE_EVAL_TIME, &self->eval_time);
+  stats_unlock();
   return TRUE;
 }
 
-static void
-log_filter_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+static gboolean
+log_filter_pipe_deinit(LogPipe *s)
+{
+  LogFilterPipe *self = (LogFilterPipe *) s;
+
+  stats_lock();
+  stats_unregister_counter(SCS_FILTER, self->name, NULL, SC_TYPE_PROCESSED, &self->evaluated_messages);
+  stats_unregister_counter(SCS_FILTER, self->name, NULL, SC_TYPE_MATCHED, &self->matched_messages);
+  stats_unregister_counter(SCS_FILTER, self->name, NULL, SC_TYPE_EVAL_TIME, &self->eval_time);
+  stats_unlock();
+  return TRUE;
+}
+
+static gboolean
+log_filter_pipe_eval(LogFilterPipe *self, LogMessage *msg)
+{
+  GTimeVal start, end;
+  glong diff;
+  gboolean res;
+
+  if (G_LIKELY(!self->eval_time) || (++self->eval_count % FILTER_TIMING_SAMPLE) != 0)
+    return filter_expr_eval(self->expr, msg);
+
+  g_get_current_time(&start);
+  res = filter_expr_eval(self->expr, msg);
+  g_get_current_time(&end);
+  diff = g_time_val_diff(&end, &start);
+  if (diff > 0)
+    stats_counter_add(self->eval_time, diff * FILTER_TIMING_SAMPLE);
+  return res;
+}
+
+/*
+ * Evaluates the filter on @msg without passing it on, it is used by
+ * LogMultiplexer to evaluate a filter shared by several log paths
+ * only once.
+ */
+gboolean
+log_filter_pipe_evaluate(LogPipe *s, LogMessage *msg)
 {
   LogFilterPipe *self = (LogFilterPipe *) s;
   gchar buf[128];
   gboolean res;
-  
+
   msg_debug("Filter rule evaluation begins",
             evt_tag_str("rule", self->name),
             evt_tag_str("location", log_expr_node_format_location(s->expr_node, buf, sizeof(buf))),
             NULL);
-  if (self->expr->modify)
-    log_msg_make_writable(&msg, path_options);
 
-  res = filter_expr_eval(self->expr, msg);
+  res = log_filter_pipe_eval(self, msg);
+  stats_counter_inc(self->evaluated_messages);
   msg_debug("Filter rule evaluation result",
             evt_tag_str("result", res ? "match" : "not-match"),
             evt_tag_str("rule", self->name),
             evt_tag_str("location", log_expr_node_format_location(s->expr_node, buf, sizeof(buf))),
             NULL);
   if (res)
+    stats_counter_inc(self->matched_messages);
+  return res;
+}
+
+static void
+log_filter_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  LogFilterPipe *self = (LogFilterPipe *) s;
+
+  if (self->expr->modify)
+    log_msg_make_writable(&msg, path_options);
+
+  if (log_filter_pipe_evaluate(s, msg))
     {
       log_pipe_forward_msg(s, msg, path_options);
     }
@@ -720,6 +1152,14 @@ log_filter_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_op
     }
 }
 
+/* the result of filters that don't modify the message only depends on
+ * the message, thus it can be shared between log paths */
+gboolean
+log_filter_pipe_is_shareable(LogPipe *s)
+{
+  return s->queue == log_filter_pipe_queue && !((LogFilterPipe *) s)->expr->modify;
+}
+
 static LogPipe *
 log_filter_pipe_clone(LogPipe *s)
 {
@@ -745,6 +1185,7 @@ log_filter_pipe_new(FilterExprNode *expr)
 
   log_pipe_init_instance(&self->super);
   self->super.init = log_filter_pipe_init;
+  self->super.deinit = log_filter_pipe_deinit;
   self->super.queue = log_filter_pipe_queue;
   self->super.free_fn = log_filter_pipe_free;
   self->super.clone = log_filter_pipe_clone;
@@ -31,6 +31,7 @@
 #include "messages.h"
 #include "logmatcher.h"
 #include "cfg-parser.h"
+#include "stats.h"
 
 struct _GlobalConfig;
 typedef struct _FilterExprNode FilterExprNode;
@@ -39,7 +40,11 @@ struct _FilterExprNode
 {
   guint32 ref_cnt;
   guint32 comp:1,   /* this not is negated */
-          modify:1; /* this filter changes the log message */
+          modify:1, /* this filter changes the log message */
+          constant:1, /* the result doesn't depend on the message */
+          const_result:1; /* the result of a constant node, before applying comp */
+  /* estimated relative cost of evaluating this node, used to order the operands of AND/OR */
+  guint32 cost;
   const gchar *type;
   void (*init)(FilterExprNode *self, GlobalConfig *cfg);
   gboolean (*eval)(FilterExprNode *self, LogMessage **msg, gint num_msg);
@@ -48,6 +53,7 @@ struct _FilterExprNode
 
 gboolean filter_expr_eval(FilterExprNode *self, LogMessage *msg);
 gboolean filter_expr_eval_with_context(FilterExprNode *self, LogMessage **msgs, gint num_msg);
+gboolean filter_expr_is_pri_only(FilterExprNode *self);
 void filter_expr_unref(FilterExprNode *self);
 
 typedef struct _FilterRE
@@ -55,6 +61,8 @@ typedef struct _FilterRE
   FilterExprNode super;
   NVHandle value_handle;
   LogMatcher *matcher;
+  LogMatcherSet *pattern_set;
+  gint pattern_index;
 } FilterRE;
 
 typedef struct _FilterMatch FilterMatch;
@@ -89,9 +97,15 @@ typedef struct _LogFilterPipe
   LogPipe super;
   FilterExprNode *expr;
   gchar *name;
+  StatsCounterItem *evaluated_messages;
+  StatsCounterItem *matched_messages;
+  StatsCounterItem *eval_time;
+  guint32 eval_count;
 } LogFilterPipe;
 
 
 LogPipe *log_filter_pipe_new(FilterExprNode *expr);
+gboolean log_filter_pipe_evaluate(LogPipe *s, LogMessage *msg);
+gboolean log_filter_pipe_is_shareable(LogPipe *s);
 
 #endif
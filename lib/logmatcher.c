@@ -877,6 +877,675 @@ log_matcher_unref(LogMatcher *s)
     {
       if (s->free_fn)
         s->free_fn(s);
+      g_free(s->pattern);
       g_free(s);
     }
 }
+
+/*
+ * LogMatcherSet
+ *
+ * A set of matchers applied to the same value, e.g. the match() filters of
+ * all log paths on $MESSAGE.  When the set is first used, a literal is
+ * extracted from each pattern and all of them are compiled into a single
+ * Aho-Corasick automaton.  A single pass over the value then tells:
+ *
+ *   - the result of string matchers, regardless of their flags
+ *   - whether a regexp or glob pattern can match at all, as the literal
+ *     extracted from these is required for a match (e.g. "failed" in
+ *     "^session [0-9]+ failed"), only the candidates need to be run
+ *
+ * The results are attached to the message as a memo, so that all filters
+ * evaluating the same message reuse them.  Matchers added after the set
+ * was compiled are not part of it, these are always evaluated on their
+ * own.
+ */
+
+enum
+{
+  /* no literal could be extracted, the matcher has to be run */
+  LMS_ALWAYS,
+  /* the literal is required for a match, the matcher decides */
+  LMS_PREFILTER,
+  /* string matchers, the literal decides the result */
+  LMS_EXACT,
+  LMS_PREFIX,
+  LMS_SUBSTRING,
+};
+
+typedef struct _LogMatcherSetMember
+{
+  LogMatcher *matcher;
+  gint kind;
+  gboolean icase;
+  /* lowercase if icase is set */
+  gchar *literal;
+  gint literal_len;
+} LogMatcherSetMember;
+
+typedef struct _LogMatcherSetOutput
+{
+  gint member;
+  gint next;
+} LogMatcherSetOutput;
+
+struct _LogMatcherSet
+{
+  gint ref_cnt;
+  GStaticMutex lock;
+  gint compiled;
+  GArray *members;
+
+  /* the automaton works on case folded byte classes, transitions are
+   * indexed by state * num_classes + class */
+  guint8 byte_class[256];
+  gint num_classes;
+  guint32 *transitions;
+  /* the first output of each state, -1 if there's none */
+  gint *outputs;
+  /* the nearest state with outputs, including the state itself, following
+   * the failure links; 0 if there's none (the root has no outputs) */
+  guint32 *reports;
+  guint32 *report_links;
+  GArray *output_entries;
+
+  gint bitmap_len;
+  /* the bits of the members that are always candidates */
+  guint32 *initial_bits;
+};
+
+typedef struct _LogMatcherSetMemo
+{
+  LogMessageMemo super;
+  LogMatcherSet *set;
+  guint32 bits[0];
+} LogMatcherSetMemo;
+
+/* skips a bracket expression, returns NULL if it is not understood */
+static const gchar *
+log_matcher_literal_skip_bracket(const gchar *p)
+{
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+  while (*p && *p != ']')
+    {
+      /* escapes are interpreted differently by POSIX and PCRE */
+      if (*p == '\\')
+        return NULL;
+      if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+        {
+          gchar term = p[1];
+
+          p += 2;
+          while (*p && !(*p == term && p[1] == ']'))
+            p++;
+          if (!*p)
+            return NULL;
+          p++;
+        }
+      p++;
+    }
+  return *p ? p + 1 : NULL;
+}
+
+static const gchar *
+log_matcher_literal_skip_group(const gchar *p)
+{
+  gint depth = 0;
+
+  do
+    {
+      switch (*p)
+        {
+        case '\\':
+          if (!p[1])
+            return NULL;
+          p += 2;
+          continue;
+        case '[':
+          p = log_matcher_literal_skip_bracket(p);
+          if (!p)
+            return NULL;
+          continue;
+        case '(':
+          depth++;
+          break;
+        case ')':
+          depth--;
+          break;
+        case 0:
+          return NULL;
+        }
+      p++;
+    }
+  while (depth > 0);
+  return p;
+}
+
+static void
+log_matcher_literal_end_run(GString *run, GString *best)
+{
+  if (run->len > best->len)
+    g_string_assign(best, run->str);
+  g_string_truncate(run, 0);
+}
+
+/*
+ * Returns the longest string that must occur in any value matching the
+ * regular expression @re, or NULL if there's no such string or the
+ * expression is not understood.  Only the top level of the expression is
+ * considered: groups, classes, quantified characters and escape sequences
+ * all terminate a literal run.  Non-ASCII characters also terminate runs,
+ * so that a quantifier never applies to a partial UTF-8 sequence.
+ */
+static gchar *
+log_matcher_regexp_literal(LogMatcher *matcher, gboolean *icase)
+{
+  const gchar *p = matcher->pattern;
+  GString *run, *best;
+  gchar lit;
+
+  if (p[0] == '(' && p[1] == '?')
+    {
+      const gchar *end = strchr(p, ')');
+
+      if (matcher->type == LMR_POSIX_REGEXP)
+        {
+          /* log_matcher_posix_re_compile() strips the leading group, an "i" in it means ignore-case */
+          if (!end)
+            return NULL;
+          if (memchr(p, 'i', end - p))
+            *icase = TRUE;
+          p = end + 1;
+        }
+      else if (end && strspn(p + 2, "imsxUXJ-") == end - p - 2)
+        {
+          /* PCRE option setting */
+          if (memchr(p, 'x', end - p))
+            return NULL;
+          if (memchr(p, 'i', end - p))
+            *icase = TRUE;
+          p = end + 1;
+        }
+    }
+  if (matcher->type == LMR_PCRE_REGEXP && strstr(p, "(*"))
+    return NULL;
+
+  run = g_string_sized_new(32);
+  best = g_string_sized_new(32);
+  while (*p)
+    {
+      switch (*p)
+        {
+        case '|':
+          /* alternatives at the top level, nothing is required */
+        case ')':
+          goto exit_error;
+        case '(':
+          /* an option setting changes the interpretation of the rest */
+          if (p[1] == '?' && p[2 + strspn(p + 2, "imsxUXJ-")] == ')')
+            goto exit_error;
+          p = log_matcher_literal_skip_group(p);
+          if (!p)
+            goto exit_error;
+          log_matcher_literal_end_run(run, best);
+          continue;
+        case '[':
+          p = log_matcher_literal_skip_bracket(p);
+          if (!p)
+            goto exit_error;
+          log_matcher_literal_end_run(run, best);
+          continue;
+        case '{':
+          p = strchr(p, '}');
+          if (!p)
+            goto exit_error;
+          p++;
+          log_matcher_literal_end_run(run, best);
+          continue;
+        case '.':
+        case '^':
+        case '$':
+        case '*':
+        case '+':
+        case '?':
+          p++;
+          log_matcher_literal_end_run(run, best);
+          continue;
+        case '\\':
+          if (!p[1])
+            goto exit_error;
+          if (g_ascii_isalnum(p[1]))
+            {
+              /* character classes, anchors, back references, etc. */
+              p += 2;
+              log_matcher_literal_end_run(run, best);
+              continue;
+            }
+          lit = p[1];
+          p += 2;
+          break;
+        default:
+          lit = *p;
+          p++;
+          break;
+        }
+
+      if (lit & 0x80 || *p == '?' || *p == '*' || *p == '{')
+        {
+          /* the character is optional */
+          log_matcher_literal_end_run(run, best);
+          continue;
+        }
+      g_string_append_c(run, *icase ? g_ascii_tolower(lit) : lit);
+      if (*p == '+')
+        log_matcher_literal_end_run(run, best);
+    }
+  log_matcher_literal_end_run(run, best);
+  g_string_free(run, TRUE);
+  if (best->len == 0)
+    {
+      g_string_free(best, TRUE);
+      return NULL;
+    }
+  return g_string_free(best, FALSE);
+
+ exit_error:
+  g_string_free(run, TRUE);
+  g_string_free(best, TRUE);
+  return NULL;
+}
+
+/* the longest run of characters without wildcards */
+static gchar *
+log_matcher_glob_literal(LogMatcher *matcher)
+{
+  const gchar *p = matcher->pattern;
+  const gchar *best = NULL;
+  gsize best_len = 0;
+
+  while (*p)
+    {
+      gsize len = strcspn(p, "*?");
+
+      if (len > best_len)
+        {
+          best = p;
+          best_len = len;
+        }
+      p += len;
+      if (*p)
+        p++;
+    }
+  return best_len ? g_strndup(best, best_len) : NULL;
+}
+
+static void
+log_matcher_set_member_init(LogMatcherSetMember *member, LogMatcher *matcher)
+{
+  member->matcher = log_matcher_ref(matcher);
+  member->kind = LMS_ALWAYS;
+  member->icase = !!(matcher->flags & LMF_ICASE);
+
+  switch (matcher->type)
+    {
+    case LMR_STRING:
+      if (matcher->flags & LMF_PREFIX)
+        member->kind = LMS_PREFIX;
+      else if (matcher->flags & LMF_SUBSTRING)
+        member->kind = LMS_SUBSTRING;
+      else
+        member->kind = LMS_EXACT;
+      member->literal = member->icase ? g_ascii_strdown(matcher->pattern, -1) : g_strdup(matcher->pattern);
+      break;
+    case LMR_GLOB:
+      member->literal = log_matcher_glob_literal(matcher);
+      break;
+    case LMR_PCRE_REGEXP:
+    case LMR_POSIX_REGEXP:
+      member->literal = log_matcher_regexp_literal(matcher, &member->icase);
+      /* caseless matching in UTF-8 mode follows Unicode case folding (e.g.
+       * "(?i)disk" matches "diſk"), which an ASCII folded literal would
+       * reject, whether icase comes from the flags or from the pattern */
+      if (matcher->type == LMR_PCRE_REGEXP && member->icase && (matcher->flags & LMF_UTF8))
+        {
+          g_free(member->literal);
+          member->literal = NULL;
+        }
+      break;
+    }
+
+  member->literal_len = member->literal ? strlen(member->literal) : 0;
+  if (member->literal_len == 0)
+    member->kind = LMS_ALWAYS;
+  else if (member->kind == LMS_ALWAYS)
+    member->kind = LMS_PREFILTER;
+}
+
+/*
+ * Adds @matcher to the set and returns its index, or -1 if the set is
+ * already in use.
+ */
+gint
+log_matcher_set_add(LogMatcherSet *self, LogMatcher *matcher)
+{
+  LogMatcherSetMember member = { 0 };
+  gint index = -1;
+
+  g_static_mutex_lock(&self->lock);
+  if (!self->compiled && matcher->pattern)
+    {
+      log_matcher_set_member_init(&member, matcher);
+      g_array_append_val(self->members, member);
+      index = self->members->len - 1;
+    }
+  g_static_mutex_unlock(&self->lock);
+  return index;
+}
+
+static guint32
+log_matcher_set_new_state(LogMatcherSet *self, GArray *transitions)
+{
+  guint32 state = transitions->len / self->num_classes;
+
+  g_array_set_size(transitions, transitions->len + self->num_classes);
+  return state;
+}
+
+static void
+log_matcher_set_compile(LogMatcherSet *self)
+{
+  GArray *transitions;
+  guint32 *fail, *queue;
+  gint num_states, head, tail;
+  gint i, j, c;
+
+  if (g_atomic_int_get(&self->compiled))
+    return;
+
+  g_static_mutex_lock(&self->lock);
+  if (self->compiled)
+    goto exit;
+
+  self->bitmap_len = (self->members->len + 31) / 32;
+  self->initial_bits = g_new0(guint32, MAX(self->bitmap_len, 1));
+
+  /* byte classes of the case folded characters of the literals, class 0
+   * is for characters not used by any of them */
+  memset(self->byte_class, 0, sizeof(self->byte_class));
+  self->num_classes = 1;
+  for (i = 0; i < self->members->len; i++)
+    {
+      LogMatcherSetMember *member = &g_array_index(self->members, LogMatcherSetMember, i);
+
+      if (member->kind == LMS_ALWAYS)
+        self->initial_bits[i / 32] |= 1U << (i % 32);
+      for (j = 0; j < member->literal_len; j++)
+        {
+          guchar ch = g_ascii_tolower(member->literal[j]);
+
+          if (!self->byte_class[ch])
+            self->byte_class[ch] = self->num_classes++;
+        }
+    }
+  for (c = 'A'; c <= 'Z'; c++)
+    self->byte_class[c] = self->byte_class[(guchar) g_ascii_tolower(c)];
+
+  /* the trie of the literals, 0 is the root and also means no transition */
+  transitions = g_array_new(FALSE, TRUE, sizeof(guint32));
+  self->output_entries = g_array_new(FALSE, FALSE, sizeof(LogMatcherSetOutput));
+  log_matcher_set_new_state(self, transitions);
+  for (i = 0; i < self->members->len; i++)
+    {
+      LogMatcherSetMember *member = &g_array_index(self->members, LogMatcherSetMember, i);
+      LogMatcherSetOutput output;
+      guint32 state = 0;
+
+      if (member->kind == LMS_ALWAYS)
+        continue;
+
+      for (j = 0; j < member->literal_len; j++)
+        {
+          guint32 *next = &g_array_index(transitions, guint32, state * self->num_classes + self->byte_class[(guchar) member->literal[j]]);
+
+          if (!*next)
+            {
+              guint32 new_state = log_matcher_set_new_state(self, transitions);
+
+              /* the array may have been reallocated */
+              g_array_index(transitions, guint32, state * self->num_classes + self->byte_class[(guchar) member->literal[j]]) = new_state;
+              state = new_state;
+            }
+          else
+            {
+              state = *next;
+            }
+        }
+      output.member = i;
+      output.next = state;
+      g_array_append_val(self->output_entries, output);
+    }
+
+  num_states = transitions->len / self->num_classes;
+  self->transitions = (guint32 *) g_array_free(transitions, FALSE);
+  self->outputs = g_new(gint, num_states);
+  for (i = 0; i < num_states; i++)
+    self->outputs[i] = -1;
+  for (i = 0; i < self->output_entries->len; i++)
+    {
+      LogMatcherSetOutput *output = &g_array_index(self->output_entries, LogMatcherSetOutput, i);
+      guint32 state = output->next;
+
+      output->next = self->outputs[state];
+      self->outputs[state] = i;
+    }
+
+  /* breadth first traversal to compute the failure links and to turn the
+   * trie into a complete automaton */
+  fail = g_new0(guint32, num_states);
+  queue = g_new(guint32, num_states);
+  self->reports = g_new0(guint32, num_states);
+  self->report_links = g_new0(guint32, num_states);
+  head = tail = 0;
+  queue[tail++] = 0;
+  while (head < tail)
+    {
+      guint32 state = queue[head++];
+
+      for (c = 0; c < self->num_classes; c++)
+        {
+          guint32 *next = &self->transitions[state * self->num_classes + c];
+
+          if (*next)
+            {
+              guint32 child = *next;
+
+              fail[child] = state ? self->transitions[fail[state] * self->num_classes + c] : 0;
+              self->report_links[child] = self->reports[fail[child]];
+              self->reports[child] = self->outputs[child] >= 0 ? child : self->report_links[child];
+              queue[tail++] = child;
+            }
+          else if (state)
+            {
+              *next = self->transitions[fail[state] * self->num_classes + c];
+            }
+        }
+    }
+  g_free(fail);
+  g_free(queue);
+
+  g_atomic_int_set(&self->compiled, TRUE);
+ exit:
+  g_static_mutex_unlock(&self->lock);
+}
+
+static void
+log_matcher_set_report(LogMatcherSet *self, guint32 state, const gchar *value, gsize value_len, gsize end, gboolean nul_seen, guint32 *bits)
+{
+  for (; state; state = self->report_links[state])
+    {
+      gint i;
+
+      for (i = self->outputs[state]; i >= 0; i = g_array_index(self->output_entries, LogMatcherSetOutput, i).next)
+        {
+          gint index = g_array_index(self->output_entries, LogMatcherSetOutput, i).member;
+          LogMatcherSetMember *member = &g_array_index(self->members, LogMatcherSetMember, index);
+          gsize start = end - member->literal_len;
+
+          if (bits[index / 32] & (1U << (index % 32)))
+            continue;
+          if (!member->icase && memcmp(value + start, member->literal, member->literal_len) != 0)
+            continue;
+
+          switch (member->kind)
+            {
+            case LMS_EXACT:
+              if (start != 0 || (end != value_len && value[end] != 0))
+                continue;
+              break;
+            case LMS_PREFIX:
+              if (start != 0)
+                continue;
+              break;
+            case LMS_SUBSTRING:
+              /* the string matcher doesn't look beyond a NUL character */
+              if (nul_seen)
+                continue;
+              break;
+            }
+          bits[index / 32] |= 1U << (index % 32);
+        }
+    }
+}
+
+static void
+log_matcher_set_scan(LogMatcherSet *self, const gchar *value, gsize value_len, guint32 *bits)
+{
+  guint32 state = 0;
+  gboolean nul_seen = FALSE;
+  gsize i;
+
+  memcpy(bits, self->initial_bits, self->bitmap_len * sizeof(guint32));
+  for (i = 0; i < value_len; i++)
+    {
+      guchar ch = value[i];
+
+      if (G_UNLIKELY(ch == 0))
+        nul_seen = TRUE;
+      state = self->transitions[state * self->num_classes + self->byte_class[ch]];
+      if (self->reports[state])
+        log_matcher_set_report(self, self->reports[state], value, value_len, i + 1, nul_seen, bits);
+    }
+}
+
+static void
+log_matcher_set_memo_free(LogMessageMemo *s)
+{
+  LogMatcherSetMemo *self = (LogMatcherSetMemo *) s;
+
+  log_matcher_set_unref(self->set);
+  g_free(self);
+}
+
+/*
+ * Tries to decide whether the @index-th member of the set matches @value
+ * without running the matcher itself.  Returns TRUE and stores the result
+ * in @result if that's possible, FALSE if the matcher has to be run.
+ *
+ * The results of the set are attached to the message, they are reused by
+ * the other members until the message is changed.
+ */
+gboolean
+log_matcher_set_lookup(LogMatcherSet *self, gint index, LogMessage *msg, const gchar *value, gssize value_len, gboolean *result)
+{
+  LogMatcherSetMember *member;
+  LogMessageMemo *memo;
+  LogMatcherSetMemo *smemo = NULL;
+  gboolean candidate;
+  gint generation;
+
+  log_matcher_set_compile(self);
+  generation = log_msg_get_memo_generation(msg);
+  for (memo = log_msg_get_memos(msg); memo; memo = memo->next)
+    {
+      if (memo->free_fn == log_matcher_set_memo_free && memo->generation == generation &&
+          ((LogMatcherSetMemo *) memo)->set == self)
+        {
+          smemo = (LogMatcherSetMemo *) memo;
+          break;
+        }
+    }
+  if (!smemo)
+    {
+      if (value_len < 0)
+        value_len = strlen(value);
+      smemo = g_malloc(sizeof(LogMatcherSetMemo) + self->bitmap_len * sizeof(guint32));
+      smemo->super.free_fn = log_matcher_set_memo_free;
+      smemo->super.generation = generation;
+      smemo->set = log_matcher_set_ref(self);
+      log_matcher_set_scan(self, value, value_len, smemo->bits);
+      log_msg_add_memo(msg, &smemo->super);
+    }
+  candidate = !!(smemo->bits[index / 32] & (1U << (index % 32)));
+
+  member = &g_array_index(self->members, LogMatcherSetMember, index);
+  if (!candidate)
+    {
+      *result = FALSE;
+      return TRUE;
+    }
+  if (member->kind >= LMS_EXACT)
+    {
+      *result = TRUE;
+      return TRUE;
+    }
+  return FALSE;
+}
+
+LogMatcherSet *
+log_matcher_set_new(void)
+{
+  LogMatcherSet *self = g_new0(LogMatcherSet, 1);
+
+  self->ref_cnt = 1;
+  g_static_mutex_init(&self->lock);
+  self->members = g_array_new(FALSE, FALSE, sizeof(LogMatcherSetMember));
+  return self;
+}
+
+LogMatcherSet *
+log_matcher_set_ref(LogMatcherSet *self)
+{
+  g_atomic_int_inc(&self->ref_cnt);
+  return self;
+}
+
+void
+log_matcher_set_unref(LogMatcherSet *self)
+{
+  gint i;
+
+  if (!g_atomic_int_dec_and_test(&self->ref_cnt))
+    return;
+
+  for (i = 0; i < self->members->len; i++)
+    {
+      LogMatcherSetMember *member = &g_array_index(self->members, LogMatcherSetMember, i);
+
+      log_matcher_unref(member->matcher);
+      g_free(member->literal);
+    }
+  g_array_free(self->members, TRUE);
+  if (self->output_entries)
+    g_array_free(self->output_entries, TRUE);
+  g_free(self->transitions);
+  g_free(self->outputs);
+  g_free(self->reports);
+  g_free(self->report_links);
+  g_free(self->initial_bits);
+  g_static_mutex_free(&self->lock);
+  g_free(self);
+}
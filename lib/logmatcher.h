@@ -63,6 +63,8 @@ struct _LogMatcher
   gint ref_cnt;
   gint type;
   gint flags;
+  /* the pattern as it was passed to log_matcher_compile() */
+  gchar *pattern;
   gboolean (*compile)(LogMatcher *s, const gchar *re);
   /* value_len can be -1 to indicate unknown length */
   gboolean (*match)(LogMatcher *s, LogMessage *msg, gint value_handle, const gchar *value, gssize value_len);
@@ -74,6 +76,8 @@ struct _LogMatcher
 static inline gboolean 
 log_matcher_compile(LogMatcher *s, const gchar *re)
 {
+  g_free(s->pattern);
+  s->pattern = g_strdup(re);
   return s->compile(s, re);
 }
 
@@ -109,4 +113,14 @@ LogMatcher *log_matcher_new(const gchar *type);
 LogMatcher *log_matcher_ref(LogMatcher *s);
 void log_matcher_unref(LogMatcher *s);
 
+/* a set of matchers applied to the same value, evaluated in a single pass */
+typedef struct _LogMatcherSet LogMatcherSet;
+
+gint log_matcher_set_add(LogMatcherSet *self, LogMatcher *matcher);
+gboolean log_matcher_set_lookup(LogMatcherSet *self, gint index, LogMessage *msg, const gchar *value, gssize value_len, gboolean *result);
+
+LogMatcherSet *log_matcher_set_new(void);
+LogMatcherSet *log_matcher_set_ref(LogMatcherSet *self);
+void log_matcher_set_unref(LogMatcherSet *self);
+
 #endif
@@ -23,7 +23,17 @@
  */
 
 #include "logmpx.h"
+#include "filter.h"
 
+#include <string.h>
+
+/* results of the decision DAG nodes and conditions while a message is being dispatched */
+enum
+{
+  LMD_UNKNOWN = 0,
+  LMD_MATCH,
+  LMD_NO_MATCH,
+};
 
 void
 log_multiplexer_add_next_hop(LogMultiplexer *self, LogPipe *next_hop)
@@ -49,12 +59,184 @@ log_multiplexer_init(LogPipe *s)
   return TRUE;
 }
 
+static void
+log_multiplexer_clear_decisions(LogMultiplexer *self)
+{
+  if (!self->branches)
+    return;
+  g_ptr_array_free(self->conditions, TRUE);
+  g_array_free(self->nodes, TRUE);
+  g_free(self->branches);
+  g_free(self->pri_routes);
+  self->conditions = NULL;
+  self->nodes = NULL;
+  self->branches = NULL;
+  self->pri_routes = NULL;
+}
+
+/* a bitmap of all priority values */
+#define PRI_WORDS (LOG_MULTIPLEXER_PRI_ROUTES / 32)
+
+/*
+ * Branches whose conditions only look at the priority of the message
+ * (e.g. classic facility()/level() routing) don't need to evaluate
+ * anything at all: the results are tabulated for each priority value,
+ * and dispatching becomes a lookup in pri_routes.
+ */
+static void
+log_multiplexer_compile_pri_routes(LogMultiplexer *self)
+{
+  gint num_conditions = self->conditions->len, num_nodes = self->nodes->len;
+  gboolean *condition_pri_only = g_new0(gboolean, num_conditions);
+  gboolean *node_pri_only = g_new0(gboolean, num_nodes);
+  guint32 *condition_pris = g_new0(guint32, num_conditions * PRI_WORDS);
+  guint32 *node_pris = g_new0(guint32, num_nodes * PRI_WORDS);
+  LogMessage *msg = NULL;
+  gboolean routed = FALSE;
+  gint i, w, pri;
+
+  for (i = 0; i < num_conditions; i++)
+    {
+      FilterExprNode *expr = ((LogFilterPipe *) g_ptr_array_index(self->conditions, i))->expr;
+
+      if (!filter_expr_is_pri_only(expr))
+        continue;
+
+      condition_pri_only[i] = TRUE;
+      if (!msg)
+        msg = log_msg_new_empty();
+      for (pri = 0; pri < LOG_MULTIPLEXER_PRI_ROUTES; pri++)
+        {
+          msg->pri = pri;
+          if (filter_expr_eval(expr, msg))
+            condition_pris[i * PRI_WORDS + pri / 32] |= 1U << (pri % 32);
+        }
+    }
+
+  /* parents always precede their children */
+  for (i = 0; i < num_nodes; i++)
+    {
+      LogMultiplexerNode *node = &g_array_index(self->nodes, LogMultiplexerNode, i);
+
+      if (!condition_pri_only[node->condition] || (node->parent >= 0 && !node_pri_only[node->parent]))
+        continue;
+
+      node_pri_only[i] = TRUE;
+      for (w = 0; w < PRI_WORDS; w++)
+        node_pris[i * PRI_WORDS + w] = condition_pris[node->condition * PRI_WORDS + w] &
+                                       (node->parent >= 0 ? node_pris[node->parent * PRI_WORDS + w] : ~0U);
+    }
+
+  for (i = 0; i < self->next_hops->len; i++)
+    {
+      LogMultiplexerBranch *branch = &self->branches[i];
+
+      branch->pri_routed = (branch->node >= 0 && node_pri_only[branch->node]);
+      routed |= branch->pri_routed;
+    }
+
+  if (routed)
+    {
+      self->pri_route_words = (self->next_hops->len + 31) / 32;
+      self->pri_routes = g_new0(guint32, LOG_MULTIPLEXER_PRI_ROUTES * self->pri_route_words);
+      for (i = 0; i < self->next_hops->len; i++)
+        {
+          LogMultiplexerBranch *branch = &self->branches[i];
+
+          if (!branch->pri_routed)
+            continue;
+          for (pri = 0; pri < LOG_MULTIPLEXER_PRI_ROUTES; pri++)
+            {
+              if (node_pris[branch->node * PRI_WORDS + pri / 32] & (1U << (pri % 32)))
+                self->pri_routes[pri * self->pri_route_words + i / 32] |= 1U << (i % 32);
+            }
+        }
+    }
+
+  if (msg)
+    log_msg_unref(msg);
+  g_free(condition_pri_only);
+  g_free(node_pri_only);
+  g_free(condition_pris);
+  g_free(node_pris);
+}
+
+/*
+ * Takes over the decision DAG built by cfg-tree: branches is an array
+ * with an element for each next hop.  Messages skip the conditions at
+ * the head of a branch, these are evaluated here instead, each at most
+ * once per message.
+ */
+void
+log_multiplexer_set_decisions(LogMultiplexer *self, GPtrArray *conditions, GArray *nodes, LogMultiplexerBranch *branches)
+{
+  log_multiplexer_clear_decisions(self);
+  self->conditions = conditions;
+  self->nodes = nodes;
+  self->branches = branches;
+  log_multiplexer_compile_pri_routes(self);
+}
+
 static gboolean 
-log_multiplexer_deinit(LogPipe *self)
+log_multiplexer_deinit(LogPipe *s)
 {
+  LogMultiplexer *self = (LogMultiplexer *) s;
+
+  log_multiplexer_clear_decisions(self);
   return TRUE;
 }
 
+static gboolean
+log_multiplexer_eval_node(LogMultiplexer *self, gint node, LogMessage *msg, guint8 *node_results, guint8 *condition_results)
+{
+  LogMultiplexerNode *n = &g_array_index(self->nodes, LogMultiplexerNode, node);
+  gboolean res = TRUE;
+
+  if (node_results[node] != LMD_UNKNOWN)
+    return node_results[node] == LMD_MATCH;
+
+  if (n->parent >= 0)
+    res = log_multiplexer_eval_node(self, n->parent, msg, node_results, condition_results);
+  if (res)
+    {
+      if (condition_results[n->condition] == LMD_UNKNOWN)
+        condition_results[n->condition] = log_filter_pipe_evaluate(g_ptr_array_index(self->conditions, n->condition), msg) ? LMD_MATCH : LMD_NO_MATCH;
+      res = (condition_results[n->condition] == LMD_MATCH);
+    }
+  node_results[node] = res ? LMD_MATCH : LMD_NO_MATCH;
+  return res;
+}
+
+static gboolean
+log_multiplexer_eval_branch(LogMultiplexer *self, gint index, LogMessage *msg, guint8 *node_results, guint8 *condition_results)
+{
+  LogMultiplexerBranch *branch = &self->branches[index];
+
+  if (branch->pri_routed && msg->pri < LOG_MULTIPLEXER_PRI_ROUTES)
+    return !!(self->pri_routes[msg->pri * self->pri_route_words + index / 32] & (1U << (index % 32)));
+  return log_multiplexer_eval_node(self, branch->node, msg, node_results, condition_results);
+}
+
+static void
+log_multiplexer_queue_branch(LogMultiplexerBranch *branch, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogPathOptions local_options;
+
+  if (!branch->target)
+    {
+      log_msg_drop(msg, path_options);
+      return;
+    }
+
+  if (G_UNLIKELY(branch->flow_control))
+    {
+      local_options = *path_options;
+      local_options.flow_control_requested = 1;
+      path_options = &local_options;
+    }
+  log_pipe_queue(branch->target, msg, path_options);
+}
+
 static void
 log_multiplexer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
 {
@@ -65,13 +247,22 @@ log_multiplexer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_op
   gboolean delivered = FALSE;
   gboolean last_delivery;
   gint fallback;
-  
+  guint8 *node_results = NULL, *condition_results = NULL;
+
+  if (self->branches)
+    {
+      node_results = g_newa(guint8, self->nodes->len + self->conditions->len);
+      memset(node_results, LMD_UNKNOWN, self->nodes->len + self->conditions->len);
+      condition_results = node_results + self->nodes->len;
+    }
+
   local_options.matched = &matched;
   for (fallback = 0; (fallback == 0) || (fallback == 1 && self->fallback_exists && !delivered); fallback++)
     {
       for (i = 0; i < self->next_hops->len; i++)
         {
           LogPipe *next_hop = g_ptr_array_index(self->next_hops, i);
+          LogMultiplexerBranch *branch = NULL;
 
           if (G_UNLIKELY(fallback == 0 && (next_hop->flags & PIF_BRANCH_FALLBACK) != 0))
             {
@@ -82,9 +273,6 @@ log_multiplexer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_op
               continue;
             }
 
-          matched = TRUE;
-          log_msg_add_ack(msg, &local_options);
-          
           /* NOTE: this variable indicates that the upcoming message
            * delivery is the last one, thus we don't need to retain an an
            * unmodified copy to be sent to further paths.  The current
@@ -97,7 +285,25 @@ log_multiplexer_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_op
           
           if (!last_delivery)
             log_msg_write_protect(msg);
-          log_pipe_queue(next_hop, log_msg_ref(msg), &local_options);
+
+          if (self->branches && self->branches[i].node >= 0)
+            {
+              branch = &self->branches[i];
+              if (!log_multiplexer_eval_branch(self, i, msg, node_results, condition_results))
+                {
+                  /* one of the shared conditions would have dropped the message */
+                  if (!last_delivery)
+                    log_msg_write_unprotect(msg);
+                  continue;
+                }
+            }
+
+          matched = TRUE;
+          log_msg_add_ack(msg, &local_options);
+          if (branch)
+            log_multiplexer_queue_branch(branch, log_msg_ref(msg), &local_options);
+          else
+            log_pipe_queue(next_hop, log_msg_ref(msg), &local_options);
           if (!last_delivery)
             log_msg_write_unprotect(msg);
           
@@ -117,10 +323,17 @@ log_multiplexer_free(LogPipe *s)
 {
   LogMultiplexer *self = (LogMultiplexer *) s;
 
+  log_multiplexer_clear_decisions(self);
   g_ptr_array_free(self->next_hops, TRUE);
   log_pipe_free_method(s);
 }
 
+gboolean
+log_multiplexer_is_instance(LogPipe *s)
+{
+  return s->queue == log_multiplexer_queue;
+}
+
 LogMultiplexer *
 log_multiplexer_new(guint32 flags)
 {
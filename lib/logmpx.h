@@ -36,15 +36,53 @@
  * This object is used for example for each source to send messages to all
  * log pipelines that refer to the source.
  **/
+
+/* a node in the decision DAG: the prefix of a branch ending with
+ * @condition (an index into LogMultiplexer->conditions), @parent is the
+ * node of the preceding prefix or -1 */
+typedef struct _LogMultiplexerNode
+{
+  gint parent;
+  gint condition;
+} LogMultiplexerNode;
+
+typedef struct _LogMultiplexerBranch
+{
+  /* the node of the conditions heading the branch, -1 if there are none */
+  gint node;
+  /* the pipe the branch continues with, once its conditions matched */
+  LogPipe *target;
+  /* one of the skipped pipes requested hard flow control */
+  gboolean flow_control;
+  /* the conditions only depend on the priority, see pri_routes */
+  gboolean pri_routed;
+} LogMultiplexerBranch;
+
+/* the number of priority values covered by the routing table */
+#define LOG_MULTIPLEXER_PRI_ROUTES 256
+
 typedef struct _LogMultiplexer
 {
   LogPipe super;
   GPtrArray *next_hops;
   gboolean fallback_exists;
+
+  /* the conditions shared by the branches, as compiled by cfg-tree,
+   * branches is NULL if there's nothing to share */
+  GPtrArray *conditions;
+  GArray *nodes;
+  LogMultiplexerBranch *branches;
+
+  /* a bitmap of the matching pri_routed branches for each priority,
+   * pri_route_words long */
+  guint32 *pri_routes;
+  gint pri_route_words;
 } LogMultiplexer;
 
 LogMultiplexer *log_multiplexer_new(guint32 flags);
 void log_multiplexer_add_next_hop(LogMultiplexer *self, LogPipe *next_hop);
+void log_multiplexer_set_decisions(LogMultiplexer *self, GPtrArray *conditions, GArray *nodes, LogMultiplexerBranch *branches);
+gboolean log_multiplexer_is_instance(LogPipe *s);
 
 
 #endif
@@ -109,6 +109,60 @@
  * stuff, but that shouldn't have that much of an overhead.
  */
 
+/*
+ * LogMessage allocation cache
+ *
+ * A LogMessage is allocated as a single block, along with its queue nodes
+ * and the initial payload.  Blocks of the most common sizes are rounded up
+ * to a few size classes and are recycled through per-thread free lists
+ * instead of returning them to malloc, so that a worker thread usually
+ * gets a block that is still hot in its CPU cache.  The payload is given
+ * all the space left in the block.
+ *
+ * Messages are usually freed by a different thread (the destination)
+ * than the one allocating them (the source), so a free list growing above
+ * LOGMSG_ALLOC_CACHE_MAX blocks hands over LOGMSG_ALLOC_BATCH blocks to a
+ * global depot, where threads with an empty free list pick them up.  The
+ * depot is protected by a mutex, but it is only touched once per batch.
+ *
+ * Cache hits and misses are counted per thread and are only added to the
+ * global stats counters every LOGMSG_ALLOC_STATS_BATCH allocations, to
+ * keep atomic operations out of the allocation path.
+ */
+
+#define LOGMSG_ALLOC_CLASSES          5
+#define LOGMSG_ALLOC_MIN_SIZE       512  /* the size of the smallest class, each class doubles it */
+#define LOGMSG_ALLOC_BATCH           32
+#define LOGMSG_ALLOC_CACHE_MAX       (2 * LOGMSG_ALLOC_BATCH)
+#define LOGMSG_ALLOC_DEPOT_MAX       64  /* in number of batches, per class */
+#define LOGMSG_ALLOC_UNCACHED      0xFF  /* alloc_class of blocks not fitting any classes */
+#define LOGMSG_ALLOC_STATS_BATCH   1024  /* number of allocations after which the thread's hits/misses are published */
+
+#define LOGMSG_ALLOC_CLASS_SIZE(cls)   (LOGMSG_ALLOC_MIN_SIZE << (cls))
+
+typedef struct _LogMessageFreeBlock LogMessageFreeBlock;
+
+struct _LogMessageFreeBlock
+{
+  LogMessageFreeBlock *next;
+  /* next batch in the depot, only valid in the first block of a batch */
+  LogMessageFreeBlock *next_batch;
+};
+
+typedef struct _LogMessageFreeList
+{
+  LogMessageFreeBlock *head;
+  gint len;
+} LogMessageFreeList;
+
+static GStaticMutex logmsg_alloc_depot_lock = G_STATIC_MUTEX_INIT;
+/* deferred parses are serialized by a lock picked by the address of the
+ * message, see log_msg_get_lazy_parse_lock() */
+#define LOGMSG_LAZY_PARSE_LOCKS 16
+static GStaticMutex logmsg_lazy_parse_locks[LOGMSG_LAZY_PARSE_LOCKS];
+static LogMessageFreeBlock *logmsg_alloc_depot[LOGMSG_ALLOC_CLASSES];
+static gint logmsg_alloc_depot_len[LOGMSG_ALLOC_CLASSES];
+
 TLS_BLOCK_START
 {
   /* message that is being processed by the current thread. Its ack/ref changes are cached */
@@ -121,6 +175,15 @@ TLS_BLOCK_START
   gint logmsg_cached_refs;
   /* number of cached acks by the current thread */
   gint logmsg_cached_acks;
+
+  /* free LogMessage blocks, one list for each size class */
+  LogMessageFreeList logmsg_free_lists[LOGMSG_ALLOC_CLASSES];
+  /* alloc cache hits/misses not yet added to the stats counters */
+  gint logmsg_alloc_cache_hits;
+  gint logmsg_alloc_cache_misses;
+
+  /* message whose deferred parsing is in progress in the current thread */
+  LogMessage *logmsg_lazy_parse_current;
 }
 TLS_BLOCK_END;
 
@@ -128,6 +191,10 @@ TLS_BLOCK_END;
 #define logmsg_cached_refs          __tls_deref(logmsg_cached_refs)
 #define logmsg_cached_acks          __tls_deref(logmsg_cached_acks)
 #define logmsg_cached_ack_needed    __tls_deref(logmsg_cached_ack_needed)
+#define logmsg_free_lists           __tls_deref(logmsg_free_lists)
+#define logmsg_alloc_cache_hits     __tls_deref(logmsg_alloc_cache_hits)
+#define logmsg_alloc_cache_misses   __tls_deref(logmsg_alloc_cache_misses)
+#define logmsg_lazy_parse_current   __tls_deref(logmsg_lazy_parse_current)
 
 #define LOGMSG_REFCACHE_BIAS                  0x00004000 /* the BIAS we add to the ref counter in refcache_start */
 #define LOGMSG_REFCACHE_ACK_SHIFT                     16 /* number of bits to shift to get the ACK counter */
@@ -188,12 +255,15 @@ gint logmsg_queue_node_max = 1;
 static StatsCounterItem *count_msg_clones;
 static StatsCounterItem *count_payload_reallocs;
 static StatsCounterItem *count_sdata_updates;
+static StatsCounterItem *count_msg_alloc_cache_hits;
+static StatsCounterItem *count_msg_alloc_cache_misses;
 static GStaticPrivate priv_macro_value = G_STATIC_PRIVATE_INIT;
 
 static inline gboolean
 log_msg_is_write_protected(LogMessage *self)
 {
-  return self->protect_cnt > 0;
+  /* a deferred parse only fills the fields the message already has */
+  return self->protect_cnt > 0 && logmsg_lazy_parse_current != self;
 }
 
 void
@@ -208,6 +278,40 @@ log_msg_write_unprotect(LogMessage *self)
   self->protect_cnt--;
 }
 
+static void
+log_msg_free_memos(LogMessageMemo *memo)
+{
+  LogMessageMemo *next;
+
+  while (memo)
+    {
+      next = memo->next;
+      memo->free_fn(memo);
+      memo = next;
+    }
+}
+
+/*
+ * Attaches @memo to the message, which takes over its ownership.
+ * memo->generation has to be set to the memo generation queried before
+ * the result was derived, so that a change of the message in the meantime
+ * makes the memo stale.  Can be called from multiple threads in parallel,
+ * and the memos are only freed along with the message, so the list can be
+ * walked without locking by anyone holding a reference.
+ */
+void
+log_msg_add_memo(LogMessage *self, LogMessageMemo *memo)
+{
+  LogMessageMemo *head;
+
+  do
+    {
+      head = (LogMessageMemo *) g_atomic_pointer_get((gpointer *) &self->memos);
+      memo->next = head;
+    }
+  while (!g_atomic_pointer_compare_and_exchange((gpointer *) &self->memos, head, memo));
+}
+
 LogMessage *
 log_msg_make_writable(LogMessage **pself, const LogPathOptions *path_options)
 {
@@ -219,6 +323,13 @@ log_msg_make_writable(LogMessage **pself, const LogPathOptions *path_options)
       log_msg_unref(*pself);
       *pself = new;
     }
+  else if (log_msg_get_memos(*pself))
+    {
+      /* the message is about to be changed in place, other holders of a
+       * reference may still be walking the memos, so they are only made
+       * stale */
+      g_atomic_int_inc(&(*pself)->memo_generation);
+    }
   return *pself;
 }
 
@@ -418,6 +529,8 @@ log_msg_init_queue_node(LogMessage *msg, LogMessageQueueNode *node, const LogPat
 {
   INIT_IV_LIST_HEAD(&node->list);
   node->ack_needed = path_options->ack_needed;
+  node->flow_control_requested = path_options->flow_control_requested;
+  node->size = log_msg_get_size(msg);
   node->msg = log_msg_ref(msg);
   log_msg_write_protect(msg);
 }
@@ -478,6 +591,34 @@ log_msg_free_queue_node(LogMessageQueueNode *node)
     g_slice_free(LogMessageQueueNode, node);
 }
 
+/*
+ * Returns the approximate amount of memory used by the message, this is
+ * what the memory limits of LogQueues are based on.  The payload is
+ * counted in full, even if it is shared with other messages.
+ */
+gsize
+log_msg_get_size(LogMessage *self)
+{
+  return sizeof(LogMessage) +
+         self->num_nodes * sizeof(LogMessageQueueNode) +
+         (self->payload ? self->payload->size : 0) +
+         self->alloc_sdata * sizeof(self->sdata[0]) +
+         self->num_tags * sizeof(self->tags[0]);
+}
+
+/* values are stored by reference if they point into the buffer of the
+ * message and are NUL terminated there, as callers of log_msg_get_value()
+ * may use them as C strings. The byte at data[size] is always allocated,
+ * see log_msg_buffer_new(). */
+static inline gboolean
+log_msg_is_value_in_buffer(LogMessage *self, const gchar *value, gssize value_len)
+{
+  return self->buffer &&
+         (const guchar *) value >= self->buffer->data &&
+         (const guchar *) value + value_len <= self->buffer->data + self->buffer->size &&
+         value[value_len] == 0;
+}
+
 void
 log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize value_len)
 {
@@ -490,6 +631,11 @@ log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize
   if (handle == LM_V_NONE)
     return;
 
+  /* the values set by the source are not produced by the parser, the
+   * rest would be overwritten by a deferred parse */
+  if (handle != LM_V_HOST_FROM && handle != LM_V_SOURCE)
+    log_msg_ensure_parsed(self);
+
   name = log_msg_get_value_name(handle, &name_len);
 
   if (value_len < 0)
@@ -504,7 +650,9 @@ log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize
   /* we need a loop here as a single realloc may not be enough. Might help
    * if we pass how much bytes we need though. */
 
-  while (!nv_table_add_value(self->payload, handle, name, name_len, value, value_len, &new_entry))
+  while (!(log_msg_is_value_in_buffer(self, value, value_len)
+           ? nv_table_add_value_external(self->payload, handle, name, name_len, value, value_len, &new_entry)
+           : nv_table_add_value(self->payload, handle, name, name_len, value, value_len, &new_entry)))
     {
       /* error allocating string in payload, reallocate */
       if (!nv_table_realloc(self->payload, &self->payload))
@@ -539,6 +687,7 @@ log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handl
 
   g_assert(handle >= LM_V_MAX);
 
+  log_msg_ensure_parsed(self);
   name = log_msg_get_value_name(handle, &name_len);
 
   if (!log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD))
@@ -799,6 +948,8 @@ log_msg_append_format_sdata(LogMessage *self, GString *result,  guint32 seq_num)
   const gchar *sdata_name, *sdata_elem, *sdata_param, *cur_elem = NULL, *dot;
   gssize sdata_name_len, sdata_elem_len, sdata_param_len, cur_elem_len = 0, len;
   gint i;
+
+  log_msg_ensure_parsed(self);
   static NVHandle meta_seqid = 0;
   gssize seqid_length;
   gboolean has_seq_num = FALSE;
@@ -1020,12 +1171,185 @@ log_msg_clear(LogMessage *self)
   self->flags |= LF_STATE_OWN_MASK;
 }
 
+static inline guint8
+log_msg_get_alloc_class(gsize size)
+{
+  gint cls;
+
+  for (cls = 0; cls < LOGMSG_ALLOC_CLASSES; cls++)
+    {
+      if (size <= LOGMSG_ALLOC_CLASS_SIZE(cls))
+        return cls;
+    }
+  return LOGMSG_ALLOC_UNCACHED;
+}
+
+static void
+log_msg_flush_alloc_stats(void)
+{
+  stats_counter_add(count_msg_alloc_cache_hits, logmsg_alloc_cache_hits);
+  stats_counter_add(count_msg_alloc_cache_misses, logmsg_alloc_cache_misses);
+  logmsg_alloc_cache_hits = 0;
+  logmsg_alloc_cache_misses = 0;
+}
+
+static inline void
+log_msg_account_alloc(void)
+{
+  if (G_UNLIKELY(logmsg_alloc_cache_hits + logmsg_alloc_cache_misses >= LOGMSG_ALLOC_STATS_BATCH))
+    log_msg_flush_alloc_stats();
+}
+
+/*
+ * Allocates a block of at least *size bytes, *size is updated to the
+ * real size of the block.
+ */
+static gpointer
+log_msg_alloc_block(gsize *size, guint8 *alloc_class)
+{
+  LogMessageFreeList *free_list;
+  LogMessageFreeBlock *block;
+  guint8 cls;
+
+  cls = log_msg_get_alloc_class(*size);
+  *alloc_class = cls;
+  if (cls == LOGMSG_ALLOC_UNCACHED)
+    return g_malloc(*size);
+
+  *size = LOGMSG_ALLOC_CLASS_SIZE(cls);
+  free_list = &logmsg_free_lists[cls];
+  if (G_UNLIKELY(!free_list->head) && logmsg_alloc_depot_len[cls] > 0)
+    {
+      /* refill the free list from the depot, the unlocked check above is
+       * only an optimization */
+      g_static_mutex_lock(&logmsg_alloc_depot_lock);
+      block = logmsg_alloc_depot[cls];
+      if (block)
+        {
+          logmsg_alloc_depot[cls] = block->next_batch;
+          logmsg_alloc_depot_len[cls]--;
+          free_list->head = block;
+          free_list->len = LOGMSG_ALLOC_BATCH;
+        }
+      g_static_mutex_unlock(&logmsg_alloc_depot_lock);
+    }
+
+  block = free_list->head;
+  if (!block)
+    {
+      logmsg_alloc_cache_misses++;
+      log_msg_account_alloc();
+      return g_malloc(*size);
+    }
+  free_list->head = block->next;
+  free_list->len--;
+  logmsg_alloc_cache_hits++;
+  log_msg_account_alloc();
+  return block;
+}
+
+static void
+log_msg_free_block_list(LogMessageFreeBlock *block)
+{
+  LogMessageFreeBlock *next;
+
+  while (block)
+    {
+      next = block->next;
+      g_free(block);
+      block = next;
+    }
+}
+
+static void
+log_msg_free_block(gpointer p, guint8 alloc_class)
+{
+  LogMessageFreeList *free_list;
+  LogMessageFreeBlock *block = (LogMessageFreeBlock *) p;
+  LogMessageFreeBlock *last;
+  gint i;
+
+  if (alloc_class == LOGMSG_ALLOC_UNCACHED)
+    {
+      g_free(p);
+      return;
+    }
+
+  free_list = &logmsg_free_lists[alloc_class];
+  block->next = free_list->head;
+  free_list->head = block;
+  free_list->len++;
+  if (G_LIKELY(free_list->len < LOGMSG_ALLOC_CACHE_MAX))
+    return;
+
+  /* the free list is full, hand over a batch to the depot */
+  block = free_list->head;
+  last = block;
+  for (i = 1; i < LOGMSG_ALLOC_BATCH; i++)
+    last = last->next;
+  free_list->head = last->next;
+  free_list->len -= LOGMSG_ALLOC_BATCH;
+  last->next = NULL;
+
+  g_static_mutex_lock(&logmsg_alloc_depot_lock);
+  if (logmsg_alloc_depot_len[alloc_class] < LOGMSG_ALLOC_DEPOT_MAX)
+    {
+      block->next_batch = logmsg_alloc_depot[alloc_class];
+      logmsg_alloc_depot[alloc_class] = block;
+      logmsg_alloc_depot_len[alloc_class]++;
+      block = NULL;
+    }
+  g_static_mutex_unlock(&logmsg_alloc_depot_lock);
+
+  log_msg_free_block_list(block);
+}
+
+/*
+ * Releases the LogMessage blocks cached by the current thread, should be
+ * called before a thread that allocates or frees messages exits.  Also
+ * publishes the alloc cache statistics counted by the thread.
+ */
+void
+log_msg_free_thread_cache(void)
+{
+  gint cls;
+
+  log_msg_flush_alloc_stats();
+  for (cls = 0; cls < LOGMSG_ALLOC_CLASSES; cls++)
+    {
+      log_msg_free_block_list(logmsg_free_lists[cls].head);
+      logmsg_free_lists[cls].head = NULL;
+      logmsg_free_lists[cls].len = 0;
+    }
+}
+
+static void
+log_msg_free_alloc_depot(void)
+{
+  gint cls;
+
+  g_static_mutex_lock(&logmsg_alloc_depot_lock);
+  for (cls = 0; cls < LOGMSG_ALLOC_CLASSES; cls++)
+    {
+      while (logmsg_alloc_depot[cls])
+        {
+          LogMessageFreeBlock *batch = logmsg_alloc_depot[cls];
+
+          logmsg_alloc_depot[cls] = batch->next_batch;
+          log_msg_free_block_list(batch);
+        }
+      logmsg_alloc_depot_len[cls] = 0;
+    }
+  g_static_mutex_unlock(&logmsg_alloc_depot_lock);
+}
+
 static inline LogMessage *
 log_msg_alloc(gsize payload_size)
 {
   LogMessage *msg;
   gsize payload_space = payload_size ? nv_table_get_alloc_size(LM_V_MAX, 16, payload_size) : 0;
   gsize alloc_size, payload_ofs = 0;
+  guint8 alloc_class;
 
   /* NOTE: logmsg_node_max is updated from parallel threads without locking. */
   gint nodes = (volatile gint) logmsg_queue_node_max;
@@ -1038,14 +1362,16 @@ log_msg_alloc(gsize payload_size)
       payload_ofs = alloc_size;
       alloc_size += payload_space;
     }
-  msg = g_malloc(alloc_size);
+  msg = log_msg_alloc_block(&alloc_size, &alloc_class);
 
   memset(msg, 0, sizeof(LogMessage));
 
+  /* the payload gets the slack at the end of the block too */
   if (payload_size)
-    msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, payload_space, LM_V_MAX);
+    msg->payload = nv_table_init_borrowed(((gchar *) msg) + payload_ofs, alloc_size - payload_ofs, LM_V_MAX);
 
   msg->num_nodes = nodes;
+  msg->alloc_class = alloc_class;
   return msg;
 }
 
@@ -1078,6 +1404,154 @@ log_msg_new(const gchar *msg, gint length,
   return self;
 }
 
+void
+log_msg_set_unparsed(LogMessage *self, MsgFormatLazyOptions *lazy_options)
+{
+  self->lazy_options = msg_format_lazy_options_ref(lazy_options);
+  self->flags |= LF_STATE_UNPARSED;
+}
+
+static inline GStaticMutex *
+log_msg_get_lazy_parse_lock(LogMessage *self)
+{
+  return &logmsg_lazy_parse_locks[(GPOINTER_TO_SIZE(self) / sizeof(LogMessage)) % LOGMSG_LAZY_PARSE_LOCKS];
+}
+
+/* the flags of a shared message are only changed here, the
+ * compare-and-exchange publishes the results of the parse to the threads
+ * checking log_msg_is_unparsed() without the lock */
+static void
+log_msg_clear_unparsed(LogMessage *self)
+{
+  guint32 flags;
+
+  do
+    {
+      flags = (guint32) g_atomic_int_get((gint *) &self->flags);
+    }
+  while (!g_atomic_int_compare_and_exchange((gint *) &self->flags, (gint) flags, (gint) (flags & ~LF_STATE_UNPARSED)));
+}
+
+/**
+ * log_msg_parse_deferred:
+ *
+ * Parses the message stored in $MESSAGE with the options it was received
+ * with. The message may already be shared between threads, which is why
+ * the parse is serialized and LF_STATE_UNPARSED is only cleared after it
+ * finished.
+ **/
+void
+log_msg_parse_deferred(LogMessage *self)
+{
+  MsgFormatOptions *parse_options;
+  GStaticMutex *lock;
+  const gchar *value;
+  gchar *raw;
+  gssize raw_len, len;
+
+  /* the parser itself uses the accessors of the message */
+  if (logmsg_lazy_parse_current == self || !log_msg_is_unparsed(self))
+    return;
+
+  lock = log_msg_get_lazy_parse_lock(self);
+  g_static_mutex_lock(lock);
+  if (self->flags & LF_STATE_UNPARSED)
+    {
+      logmsg_lazy_parse_current = self;
+      parse_options = &self->lazy_options->options;
+
+      value = __nv_table_get_value(self->payload, LM_V_MESSAGE, LM_V_MAX, &raw_len);
+      raw = g_strndup(value, raw_len);
+      log_msg_set_value(self, LM_V_MESSAGE, "", 0);
+      parse_options->format_handler->parse(parse_options, (guchar *) raw, raw_len, self);
+      g_free(raw);
+
+      /* the source left the fallback of an empty $HOST to us, see
+       * log_source_mangle_hostname() */
+      log_msg_get_value(self, LM_V_HOST, &len);
+      if (len == 0)
+        {
+          value = log_msg_get_value(self, LM_V_HOST_FROM, &len);
+          if (len > 0)
+            {
+              gchar *host = g_strndup(value, len);
+
+              log_msg_set_value(self, LM_V_HOST, host, len);
+              g_free(host);
+            }
+        }
+
+      /* lazy_options is kept until the message is freed, as it is
+       * looked at without the lock */
+      logmsg_lazy_parse_current = NULL;
+      log_msg_clear_unparsed(self);
+    }
+  g_static_mutex_unlock(lock);
+}
+
+/**
+ * log_msg_append_unparsed:
+ *
+ * Appends the message as it was received to @result, provided that its
+ * parsing is still deferred. Returns FALSE otherwise.
+ **/
+gboolean
+log_msg_append_unparsed(LogMessage *self, GString *result)
+{
+  GStaticMutex *lock;
+  const gchar *value;
+  gssize len;
+  gboolean success = FALSE;
+
+  if (!log_msg_is_unparsed(self))
+    return FALSE;
+
+  lock = log_msg_get_lazy_parse_lock(self);
+  g_static_mutex_lock(lock);
+  if (self->flags & LF_STATE_UNPARSED)
+    {
+      value = __nv_table_get_value(self->payload, LM_V_MESSAGE, LM_V_MAX, &len);
+      g_string_append_len(result, value, len);
+      success = TRUE;
+    }
+  g_static_mutex_unlock(lock);
+  return success;
+}
+
+/**
+ * log_msg_new_from_buffer:
+ * @msg: message to parse, pointing into @buffer
+ * @length: length of @msg
+ * @saddr: sender address
+ * @parse_options: parse options
+ * @buffer: the buffer @msg was read from
+ *
+ * Same as log_msg_new(), but the values parsed from @msg are not copied,
+ * the message references @buffer instead.
+ **/
+LogMessage *
+log_msg_new_from_buffer(const gchar *msg, gint length,
+                        GSockAddr *saddr,
+                        MsgFormatOptions *parse_options,
+                        LogMessageBuffer *buffer)
+{
+  /* only the names of dynamic values and the rewritten values are stored in the payload */
+  LogMessage *self = log_msg_alloc(256);
+
+  log_msg_init(self, saddr);
+  self->buffer = log_msg_buffer_ref(buffer);
+
+  if (G_LIKELY(parse_options->format_handler))
+    {
+      parse_options->format_handler->parse(parse_options, (guchar *) msg, length, self);
+    }
+  else
+    {
+      log_msg_set_value(self, LM_V_MESSAGE, "Error parsing message, format module is not loaded", -1);
+    }
+  return self;
+}
+
 LogMessage *
 log_msg_new_empty(void)
 {
@@ -1106,8 +1580,13 @@ LogMessage *
 log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
 {
   LogMessage *self = log_msg_alloc(0);
+  guint8 num_nodes = self->num_nodes;
+  guint8 alloc_class = self->alloc_class;
 
   stats_counter_inc(count_msg_clones);
+
+  /* the clone would not see the results of a deferred parse */
+  log_msg_ensure_parsed(msg);
   if ((msg->flags & LF_STATE_OWN_MASK) == 0 || ((msg->flags & LF_STATE_OWN_MASK) == LF_STATE_OWN_TAGS && msg->num_tags == 0))
     {
       /* the message we're cloning has no original content, everything
@@ -1123,9 +1602,14 @@ log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
   /* every field _must_ be initialized explicitly if its direct
    * copying would cause problems (like copying a pointer by value) */
 
-  /* reference the original message */
+  /* reference the original message, which also keeps its buffer alive */
   self->original = log_msg_ref(msg);
+  self->buffer = NULL;
+  self->memos = NULL;
+  self->memo_generation = 0;
   self->ack_and_ref = LOGMSG_REFCACHE_REF_TO_VALUE(1) + LOGMSG_REFCACHE_ACK_TO_VALUE(0);
+  self->num_nodes = num_nodes;
+  self->alloc_class = alloc_class;
   self->cur_node = 0;
   self->protect_cnt = 0;
 
@@ -1212,8 +1696,38 @@ log_msg_free(LogMessage *self)
 
   if (self->original)
     log_msg_unref(self->original);
+  if (self->buffer)
+    log_msg_buffer_unref(self->buffer);
+  if (self->lazy_options)
+    msg_format_lazy_options_unref(self->lazy_options);
+  log_msg_free_memos(self->memos);
 
-  g_free(self);
+  log_msg_free_block(self, self->alloc_class);
+}
+
+LogMessageBuffer *
+log_msg_buffer_new(gsize size)
+{
+  /* one extra byte to be able to terminate a value ending at the end of the buffer */
+  LogMessageBuffer *self = g_malloc(sizeof(LogMessageBuffer) + size + 1);
+
+  g_atomic_counter_set(&self->ref_cnt, 1);
+  self->size = size;
+  return self;
+}
+
+LogMessageBuffer *
+log_msg_buffer_ref(LogMessageBuffer *self)
+{
+  g_atomic_counter_inc(&self->ref_cnt);
+  return self;
+}
+
+void
+log_msg_buffer_unref(LogMessageBuffer *self)
+{
+  if (self && g_atomic_counter_dec_and_test(&self->ref_cnt))
+    g_free(self);
 }
 
 /**
@@ -1519,6 +2033,189 @@ log_msg_refcache_stop(void)
   logmsg_current = NULL;
 }
 
+/*
+ * Serialization of LogMessage instances
+ *
+ * The serialized format is used by persistent queues and is independent
+ * of the NVHandle values of the running process: name-value pairs, SDATA
+ * elements and tags are stored by their names, so that a message written
+ * by one instance of syslog-ng can be read back by another.
+ */
+
+#define LOGMSG_SERIALIZE_VERSION 1
+
+static gboolean
+log_msg_write_value(NVHandle handle, const gchar *name, const gchar *value, gssize value_len, gpointer user_data)
+{
+  SerializeArchive *sa = (SerializeArchive *) user_data;
+
+  /* SDATA values are written separately, in the order of the sdata array */
+  if (nv_registry_get_handle_flags(logmsg_registry, handle) & LM_VF_SDATA)
+    return FALSE;
+
+  return !(serialize_write_cstring(sa, name, -1) &&
+           serialize_write_cstring(sa, value, value_len));
+}
+
+static gboolean
+log_msg_write_tag(LogMessage *self, LogTagId tag_id, const gchar *name, gpointer user_data)
+{
+  SerializeArchive *sa = (SerializeArchive *) user_data;
+
+  serialize_write_cstring(sa, name, -1);
+  return TRUE;
+}
+
+static gboolean
+log_msg_write_stamp(SerializeArchive *sa, LogStamp *stamp)
+{
+  return serialize_write_uint64(sa, (guint64) stamp->tv_sec) &&
+         serialize_write_uint32(sa, stamp->tv_usec) &&
+         serialize_write_uint32(sa, (guint32) stamp->zone_offset);
+}
+
+static gboolean
+log_msg_read_stamp(SerializeArchive *sa, LogStamp *stamp)
+{
+  guint64 tv_sec;
+  guint32 tv_usec;
+  guint32 zone_offset;
+
+  if (!serialize_read_uint64(sa, &tv_sec) ||
+      !serialize_read_uint32(sa, &tv_usec) ||
+      !serialize_read_uint32(sa, &zone_offset))
+    return FALSE;
+  stamp->tv_sec = (time_t) (gint64) tv_sec;
+  stamp->tv_usec = tv_usec;
+  stamp->zone_offset = (gint32) zone_offset;
+  return TRUE;
+}
+
+gboolean
+log_msg_write(LogMessage *self, SerializeArchive *sa)
+{
+  gint i;
+
+  log_msg_ensure_parsed(self);
+  serialize_write_uint16(sa, LOGMSG_SERIALIZE_VERSION);
+  serialize_write_uint32(sa, self->flags & ~LF_STATE_MASK);
+  serialize_write_uint16(sa, self->pri);
+  for (i = 0; i < LM_TS_MAX; i++)
+    log_msg_write_stamp(sa, &self->timestamps[i]);
+
+  if (self->saddr)
+    {
+      serialize_write_uint32(sa, self->saddr->salen);
+      serialize_write_blob(sa, g_sockaddr_get_sa(self->saddr), self->saddr->salen);
+    }
+  else
+    {
+      serialize_write_uint32(sa, 0);
+    }
+  serialize_write_uint8(sa, self->num_matches);
+
+  /* name-value pairs, terminated by an empty name */
+  nv_table_foreach(self->payload, logmsg_registry, log_msg_write_value, sa);
+  for (i = 0; i < self->num_sdata; i++)
+    {
+      const gchar *name, *value;
+      gssize value_len;
+
+      name = log_msg_get_value_name(self->sdata[i], NULL);
+      value = log_msg_get_value(self, self->sdata[i], &value_len);
+      serialize_write_cstring(sa, name, -1);
+      serialize_write_cstring(sa, value, value_len);
+    }
+  serialize_write_cstring(sa, "", 0);
+
+  /* tags, terminated by an empty name */
+  log_msg_tags_foreach(self, log_msg_write_tag, sa);
+  return serialize_write_cstring(sa, "", 0);
+}
+
+/*
+ * Reads back a message written by log_msg_write() into @self, which
+ * should be a freshly allocated message as returned by
+ * log_msg_new_empty().
+ */
+gboolean
+log_msg_read(LogMessage *self, SerializeArchive *sa)
+{
+  guint16 version;
+  guint32 flags;
+  guint32 salen;
+  guint8 num_matches;
+  gchar *name, *value;
+  gsize name_len, value_len;
+  gint i;
+
+  if (!serialize_read_uint16(sa, &version) || version != LOGMSG_SERIALIZE_VERSION)
+    return FALSE;
+
+  if (!serialize_read_uint32(sa, &flags) ||
+      !serialize_read_uint16(sa, &self->pri))
+    return FALSE;
+
+  for (i = 0; i < LM_TS_MAX; i++)
+    {
+      if (!log_msg_read_stamp(sa, &self->timestamps[i]))
+        return FALSE;
+    }
+
+  if (!serialize_read_uint32(sa, &salen))
+    return FALSE;
+  if (salen > 0)
+    {
+      struct sockaddr_storage ss;
+
+      if (salen < sizeof(struct sockaddr) || salen > sizeof(ss) ||
+          !serialize_read_blob(sa, &ss, salen))
+        return FALSE;
+      g_sockaddr_unref(self->saddr);
+      self->saddr = g_sockaddr_new((struct sockaddr *) &ss, salen);
+    }
+  if (!serialize_read_uint8(sa, &num_matches))
+    return FALSE;
+
+  while (1)
+    {
+      if (!serialize_read_cstring(sa, &name, &name_len))
+        return FALSE;
+      if (name_len == 0)
+        {
+          g_free(name);
+          break;
+        }
+      if (!serialize_read_cstring(sa, &value, &value_len))
+        {
+          g_free(name);
+          return FALSE;
+        }
+      log_msg_set_value(self, log_msg_get_value_handle(name), value, value_len);
+      g_free(name);
+      g_free(value);
+    }
+  self->num_matches = num_matches;
+
+  while (1)
+    {
+      if (!serialize_read_cstring(sa, &name, &name_len))
+        return FALSE;
+      if (name_len == 0)
+        {
+          g_free(name);
+          break;
+        }
+      log_msg_set_tag_by_name(self, name);
+      g_free(name);
+    }
+
+  /* NOTE: flags are restored last, as setting some of the values (e.g.
+   * PROGRAM) adjusts them */
+  self->flags = (self->flags & LF_STATE_MASK) | (flags & ~LF_STATE_MASK);
+  return TRUE;
+}
+
 void
 log_msg_registry_init(void)
 {
@@ -1561,11 +2258,17 @@ log_msg_registry_deinit(void)
 void
 log_msg_global_init(void)
 {
+  gint i;
+
+  for (i = 0; i < LOGMSG_LAZY_PARSE_LOCKS; i++)
+    g_static_mutex_init(&logmsg_lazy_parse_locks[i]);
   log_msg_registry_init();
   stats_lock();
   stats_register_counter(0, SCS_GLOBAL, "msg_clones", NULL, SC_TYPE_PROCESSED, &count_msg_clones);
   stats_register_counter(0, SCS_GLOBAL, "payload_reallocs", NULL, SC_TYPE_PROCESSED, &count_payload_reallocs);
   stats_register_counter(0, SCS_GLOBAL, "sdata_updates", NULL, SC_TYPE_PROCESSED, &count_sdata_updates);
+  stats_register_counter(0, SCS_GLOBAL, "msg_alloc_cache_hits", NULL, SC_TYPE_PROCESSED, &count_msg_alloc_cache_hits);
+  stats_register_counter(0, SCS_GLOBAL, "msg_alloc_cache_misses", NULL, SC_TYPE_PROCESSED, &count_msg_alloc_cache_misses);
   stats_unlock();
 }
 
@@ -1584,5 +2287,11 @@ log_msg_nv_table_foreach(NVTable *self, NVTableForeachFunc func, gpointer user_d
 void
 log_msg_global_deinit(void)
 {
+  gint i;
+
+  log_msg_free_thread_cache();
+  log_msg_free_alloc_depot();
   log_msg_registry_deinit();
+  for (i = 0; i < LOGMSG_LAZY_PARSE_LOCKS; i++)
+    g_static_mutex_free(&logmsg_lazy_parse_locks[i]);
 }
@@ -100,6 +100,11 @@ enum
   LF_STATE_OWN_TAGS    = 0x0040,
   LF_STATE_OWN_SDATA   = 0x0080,
   LF_STATE_OWN_MASK    = 0x00F0,
+  /* only the PRI field was parsed, $MESSAGE holds the message as received, see LP_LAZY_PARSE */
+  LF_STATE_UNPARSED    = 0x0100,
+  /* the unparsed message was found to start with a timestamp and a
+   * hostname, so it can be forwarded as received */
+  LF_STATE_UNPARSED_HEADER = 0x0200,
 
   LF_CHAINED_HOSTNAME  = 0x00010000,
 
@@ -111,11 +116,47 @@ enum
   LF_LEGACY_MSGHDR    = 0x00020000,
 };
 
+/* A reference counted buffer the values of a LogMessage may point to,
+ * instead of copying them into the payload. Used to avoid copying the
+ * data of the buffer the message was read from. */
+struct _LogMessageBuffer
+{
+  GAtomicCounter ref_cnt;
+  gsize size;
+  /* size + 1 bytes, values borrowed from the buffer are NUL terminated */
+  guchar data[0];
+};
+
+LogMessageBuffer *log_msg_buffer_new(gsize size);
+LogMessageBuffer *log_msg_buffer_ref(LogMessageBuffer *self);
+void log_msg_buffer_unref(LogMessageBuffer *self);
+
+static inline gboolean
+log_msg_buffer_is_shared(LogMessageBuffer *self)
+{
+  return g_atomic_counter_get(&self->ref_cnt) > 1;
+}
+
+/* results derived from a message (e.g. a formatted template), reused by
+ * the consumers of the message as long as the message is not changed.
+ * Memos are only freed together with the message, a change only makes
+ * them stale by bumping the memo generation of the message. */
+typedef struct _LogMessageMemo LogMessageMemo;
+struct _LogMessageMemo
+{
+  LogMessageMemo *next;
+  void (*free_fn)(LogMessageMemo *self);
+  /* the memo generation of the message the result was derived from */
+  gint generation;
+};
+
 typedef struct _LogMessageQueueNode
 {
   struct iv_list_head list;
   LogMessage *msg;
-  gboolean ack_needed:1, embedded:1;
+  gboolean ack_needed:1, embedded:1, flow_control_requested:1;
+  /* the size of the message at queue time, see log_msg_get_size() */
+  guint32 size;
 } LogMessageQueueNode;
 
 
@@ -143,6 +184,14 @@ struct _LogMessage
   LMAckFunc ack_func;
   gpointer ack_userdata;
   LogMessage *original;
+  /* values pointing into this buffer are not copied, see log_msg_new_from_buffer() */
+  LogMessageBuffer *buffer;
+  /* the options to parse the message with if LF_STATE_UNPARSED is set, kept until the message is freed */
+  MsgFormatLazyOptions *lazy_options;
+  /* list of LogMessageMemo instances, only ever prepended to */
+  LogMessageMemo *memos;
+  /* bumped whenever the message is changed in place, see log_msg_make_writable() */
+  gint memo_generation;
 
   /* message parts */ 
   
@@ -172,6 +221,8 @@ struct _LogMessage
   guint8 num_nodes;
   guint8 cur_node;
   guint8 protect_cnt;
+  /* size class of the allocated block, see log_msg_alloc() */
+  guint8 alloc_class;
 
   /* preallocated LogQueueNodes used to insert this message into a LogQueue */
   LogMessageQueueNode nodes[0];
@@ -205,11 +256,52 @@ gboolean log_msg_is_handle_match(NVHandle handle);
 
 const gchar *log_msg_get_macro_value(LogMessage *self, gint id, gssize *value_len);
 
+void log_msg_set_unparsed(LogMessage *self, MsgFormatLazyOptions *lazy_options);
+void log_msg_parse_deferred(LogMessage *self);
+gboolean log_msg_append_unparsed(LogMessage *self, GString *result);
+
+void log_msg_add_memo(LogMessage *self, LogMessageMemo *memo);
+
+static inline LogMessageMemo *
+log_msg_get_memos(LogMessage *self)
+{
+  return (LogMessageMemo *) g_atomic_pointer_get((gpointer *) &self->memos);
+}
+
+/* has to be queried before deriving the result stored in a memo */
+static inline gint
+log_msg_get_memo_generation(LogMessage *self)
+{
+  return g_atomic_int_get(&self->memo_generation);
+}
+
+static inline gboolean
+log_msg_memo_is_valid(LogMessage *self, LogMessageMemo *memo)
+{
+  return memo->generation == log_msg_get_memo_generation(self);
+}
+
+/* the flag is cleared by another thread if it parses a shared message */
+static inline gboolean
+log_msg_is_unparsed(LogMessage *self)
+{
+  return (g_atomic_int_get((gint *) &self->flags) & LF_STATE_UNPARSED) != 0;
+}
+
+/* completes parsing the message if it was deferred at reception */
+static inline void
+log_msg_ensure_parsed(LogMessage *self)
+{
+  if (G_UNLIKELY(log_msg_is_unparsed(self)))
+    log_msg_parse_deferred(self);
+}
+
 static inline const gchar *
 log_msg_get_value(LogMessage *self, NVHandle handle, gssize *value_len)
 {
   guint16 flags;
 
+  log_msg_ensure_parsed(self);
   flags = nv_registry_get_handle_flags(logmsg_registry, handle);
   if ((flags & LM_VF_MACRO) == 0)
     return __nv_table_get_value(self->payload, handle, LM_V_MAX, value_len);
@@ -241,11 +333,16 @@ void log_msg_print_tags(LogMessage *self, GString *result);
 LogMessageQueueNode *log_msg_alloc_queue_node(LogMessage *msg, const LogPathOptions *path_options);
 LogMessageQueueNode *log_msg_alloc_dynamic_queue_node(LogMessage *msg, const LogPathOptions *path_options);
 void log_msg_free_queue_node(LogMessageQueueNode *node);
+gsize log_msg_get_size(LogMessage *self);
 
 void log_msg_clear(LogMessage *self);
 LogMessage *log_msg_new(const gchar *msg, gint length,
                         GSockAddr *saddr,
                         MsgFormatOptions *parse_options);
+LogMessage *log_msg_new_from_buffer(const gchar *msg, gint length,
+                                    GSockAddr *saddr,
+                                    MsgFormatOptions *parse_options,
+                                    LogMessageBuffer *buffer);
 LogMessage *log_msg_new_mark(void);
 LogMessage *log_msg_new_internal(gint prio, const gchar *msg);
 LogMessage *log_msg_new_empty(void);
@@ -263,6 +360,7 @@ void log_msg_registry_init();
 void log_msg_registry_deinit();
 void log_msg_global_init();
 void log_msg_global_deinit(void);
+void log_msg_free_thread_cache(void);
 
 gboolean log_msg_nv_table_foreach(NVTable *self, NVTableForeachFunc func, gpointer user_data);
 
@@ -44,6 +44,7 @@ log_parser_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
   gchar buf[128];
   gboolean success;
 
+  log_msg_ensure_parsed(msg);
   if (G_LIKELY(!self->template))
     {
       NVTable *payload = nv_table_ref(msg->payload);
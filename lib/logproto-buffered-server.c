@@ -24,6 +24,7 @@
 #include "logproto-buffered-server.h"
 #include "messages.h"
 #include "serialize.h"
+#include "logmsg.h"
 
 #include <sys/stat.h>
 #include <stdlib.h>
@@ -51,6 +52,126 @@ log_proto_buffered_server_put_state(LogProtoBufferedServer *self)
     persist_state_unmap_entry(self->persist_state, self->persist_handle);
 }
 
+static void
+log_proto_buffered_server_set_chunk(LogProtoBufferedServer *self, LogMessageBuffer *chunk)
+{
+  log_msg_buffer_unref(self->buffer_chunk);
+  self->buffer_chunk = chunk;
+  self->buffer = chunk->data;
+  self->buffer_borrowed_end = 0;
+}
+
+static void
+log_proto_buffered_server_alloc_buffer(LogProtoBufferedServer *self, gsize size)
+{
+  if (self->super.options->zero_copy)
+    log_proto_buffered_server_set_chunk(self, log_msg_buffer_new(size));
+  else
+    self->buffer = g_malloc(size);
+}
+
+/* grows the buffer to @size, keeping its first @keep_len bytes */
+static void
+log_proto_buffered_server_resize_buffer(LogProtoBufferedServer *self, gsize size, gsize keep_len)
+{
+  LogMessageBuffer *chunk;
+
+  if (!self->super.options->zero_copy)
+    {
+      self->buffer = g_realloc(self->buffer, size);
+      return;
+    }
+
+  if (self->buffer_chunk && !log_msg_buffer_is_shared(self->buffer_chunk))
+    {
+      chunk = g_realloc(self->buffer_chunk, sizeof(LogMessageBuffer) + size + 1);
+      chunk->size = size;
+      self->buffer_chunk = chunk;
+      self->buffer = chunk->data;
+      self->buffer_borrowed_end = 0;
+      return;
+    }
+
+  chunk = log_msg_buffer_new(size);
+  if (self->buffer)
+    memcpy(chunk->data, self->buffer, keep_len);
+  log_proto_buffered_server_set_chunk(self, chunk);
+}
+
+/**
+ * log_proto_buffered_server_unshare_buffer:
+ *
+ * Moves the data between @keep_from and @keep_from + @keep_len to the
+ * start of a new buffer if messages still reference the current one.
+ * Returns FALSE if the buffer was not shared, in which case it is up to
+ * the caller to move the data.
+ **/
+gboolean
+log_proto_buffered_server_unshare_buffer(LogProtoBufferedServer *self, gsize keep_from, gsize keep_len)
+{
+  LogMessageBuffer *chunk;
+
+  if (!self->buffer_chunk)
+    return FALSE;
+
+  if (!log_msg_buffer_is_shared(self->buffer_chunk))
+    {
+      self->buffer_borrowed_end = 0;
+      return FALSE;
+    }
+
+  chunk = log_msg_buffer_new(self->buffer_chunk->size);
+  memcpy(chunk->data, self->buffer + keep_from, keep_len);
+  log_proto_buffered_server_set_chunk(self, chunk);
+  return TRUE;
+}
+
+/* makes sure that writing the buffer from @ofs does not clobber the
+ * values of messages still in flight */
+static inline void
+log_proto_buffered_server_prepare_write(LogProtoBufferedServer *self, gsize ofs, gsize keep_len)
+{
+  if (ofs < self->buffer_borrowed_end)
+    log_proto_buffered_server_unshare_buffer(self, 0, keep_len);
+}
+
+/* values are only borrowed from the buffer if they are NUL terminated,
+ * terminate the message in place if the byte following it has already
+ * been consumed (or is past the data, buffers have a byte to spare) */
+static void
+log_proto_buffered_server_terminate_msg(LogProtoBufferedServer *self, const guchar *msg, gsize msg_len)
+{
+  LogProtoBufferedServerState *state;
+  gsize msg_end;
+
+  if (!self->buffer_chunk || msg < self->buffer || msg + msg_len > self->buffer + self->buffer_chunk->size)
+    return;
+
+  state = log_proto_buffered_server_get_state(self);
+  msg_end = msg + msg_len - self->buffer;
+  if (msg_end < state->pending_buffer_pos || msg_end >= state->pending_buffer_end)
+    {
+      self->buffer[msg_end] = 0;
+      self->buffer_borrowed_end = MAX(self->buffer_borrowed_end, msg_end + 1);
+    }
+  log_proto_buffered_server_put_state(self);
+}
+
+static LogMessageBuffer *
+log_proto_buffered_server_get_buffer(LogProtoServer *s)
+{
+  LogProtoBufferedServer *self = (LogProtoBufferedServer *) s;
+  LogProtoBufferedServerState *state;
+
+  if (!self->buffer_chunk)
+    return NULL;
+
+  state = log_proto_buffered_server_get_state(self);
+  self->buffer_borrowed_end = MAX(self->buffer_borrowed_end, state->pending_buffer_end);
+  log_proto_buffered_server_put_state(self);
+  return log_msg_buffer_ref(self->buffer_chunk);
+}
+
 static gboolean
 log_proto_buffered_server_convert_from_raw(LogProtoBufferedServer *self, const guchar *raw_buffer, gsize raw_buffer_len)
 {
@@ -62,6 +183,7 @@ log_proto_buffered_server_convert_from_raw(LogProtoBufferedServer *self, const g
   gboolean success = FALSE;
   LogProtoBufferedServerState *state = log_proto_buffered_server_get_state(self);
 
+  log_proto_buffered_server_prepare_write(self, state->pending_buffer_end, state->pending_buffer_end);
   do
     {
       avail_out = state->buffer_size - state->pending_buffer_end;
@@ -118,7 +240,7 @@ log_proto_buffered_server_convert_from_raw(LogProtoBufferedServer *self, const g
                   if (state->buffer_size > self->super.options->max_buffer_size)
                     state->buffer_size = self->super.options->max_buffer_size;
 
-                  self->buffer = g_realloc(self->buffer, state->buffer_size);
+                  log_proto_buffered_server_resize_buffer(self, state->buffer_size, state->pending_buffer_end);
 
                   /* recalculate the out pointer, and add what we have now */
                   ret = -1;
@@ -173,8 +295,9 @@ log_proto_buffered_server_apply_state(LogProtoBufferedServer *self, PersistEntry
 
   if (!self->buffer)
     {
-      self->buffer = g_malloc(state->buffer_size);
+      log_proto_buffered_server_alloc_buffer(self, state->buffer_size);
     }
+  log_proto_buffered_server_prepare_write(self, 0, 0);
   state->pending_buffer_end = 0;
 
   if (state->file_inode &&
@@ -397,10 +520,12 @@ log_proto_buffered_server_convert_state(LogProtoBufferedServer *self, guint8 per
       if (!self->buffer || state->buffer_size < buffer_len)
         {
           gsize buffer_size = MAX(self->super.options->init_buffer_size, buffer_len);
-          self->buffer = g_realloc(self->buffer, buffer_size);
+          log_proto_buffered_server_resize_buffer(self, buffer_size, 0);
         }
       serialize_archive_free(archive);
 
+      log_proto_buffered_server_prepare_write(self, 0, 0);
+
       memcpy(self->buffer, buffer, buffer_len);
       state->buffer_pos = 0;
       state->pending_buffer_end = buffer_len;
@@ -589,6 +714,8 @@ log_proto_buffered_server_fetch_from_buf(LogProtoBufferedServer *self, const guc
     }
 
   success = self->fetch_from_buf(self, buffer_start, buffer_bytes, msg, msg_len, flush_the_rest);
+  if (success && self->buffer_chunk)
+    log_proto_buffered_server_terminate_msg(self, *msg, *msg_len);
  exit:
   log_proto_buffered_server_put_state(self);
   return success;
@@ -610,7 +737,7 @@ log_proto_buffered_server_fetch(LogProtoServer *s, const guchar **msg, gsize *ms
   if (G_UNLIKELY(!self->buffer))
     {
       state->buffer_size = self->super.options->init_buffer_size;
-      self->buffer = g_malloc(state->buffer_size);
+      log_proto_buffered_server_alloc_buffer(self, state->buffer_size);
     }
 
   if (sa)
@@ -636,6 +763,7 @@ log_proto_buffered_server_fetch(LogProtoServer *s, const guchar **msg, gsize *ms
       if (self->convert == (GIConv) -1)
         {
           /* no conversion, we read directly into our buffer */
+          log_proto_buffered_server_prepare_write(self, state->pending_buffer_end, state->pending_buffer_end);
           raw_buffer = self->buffer + state->pending_buffer_end;
           avail = state->buffer_size - state->pending_buffer_end;
         }
@@ -788,7 +916,10 @@ log_proto_buffered_server_free_method(LogProtoServer *s)
 
   g_sockaddr_unref(self->prev_saddr);
 
-  g_free(self->buffer);
+  if (self->buffer_chunk)
+    log_msg_buffer_unref(self->buffer_chunk);
+  else
+    g_free(self->buffer);
   if (self->state1)
     {
       g_free(self->state1);
@@ -803,6 +934,7 @@ log_proto_buffered_server_init(LogProtoBufferedServer *self, LogTransport *trans
   self->super.prepare = log_proto_buffered_server_prepare;
   self->super.fetch = log_proto_buffered_server_fetch;
   self->super.queued = log_proto_buffered_server_queued;
+  self->super.get_buffer = log_proto_buffered_server_get_buffer;
   self->super.free_fn = log_proto_buffered_server_free_method;
   self->super.transport = transport;
   self->super.restart_with_state = log_proto_buffered_server_restart_with_state;
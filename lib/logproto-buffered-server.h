@@ -86,12 +86,17 @@ struct _LogProtoBufferedServer
   PersistEntryHandle persist_handle;
   GIConv convert;
   guchar *buffer;
+  /* in zero-copy mode buffer points into buffer_chunk, messages
+   * referencing bytes below buffer_borrowed_end may still be alive */
+  LogMessageBuffer *buffer_chunk;
+  gsize buffer_borrowed_end;
   GSockAddr *prev_saddr;
 };
 
 gboolean log_proto_buffered_server_prepare(LogProtoServer *s, gint *fd, GIOCondition *cond);
 LogProtoBufferedServerState *log_proto_buffered_server_get_state(LogProtoBufferedServer *self);
 void log_proto_buffered_server_put_state(LogProtoBufferedServer *self);
+gboolean log_proto_buffered_server_unshare_buffer(LogProtoBufferedServer *self, gsize keep_from, gsize keep_len);
 
 
 /* LogProtoBufferedServer */
@@ -24,12 +24,27 @@
 #include "logproto-dgram-server.h"
 #include "logproto-buffered-server.h"
 
+#include <string.h>
+#include <errno.h>
+
+/* the receive ring of a batched LogProtoDGramServer is limited to this
+ * many datagrams and this many bytes */
+#define LOG_PROTO_DGRAM_SERVER_MAX_BATCH 32
+#define LOG_PROTO_DGRAM_SERVER_MAX_BATCH_BYTES (256 * 1024)
+
 /* proto that reads the input in datagrams (e.g. the underlying transport
  * determines record sizes, such as UDP) */
 typedef struct _LogProtoDGramServer LogProtoDGramServer;
 struct _LogProtoDGramServer
 {
   LogProtoBufferedServer super;
+
+  /* if the transport supports it, datagrams are received in batches
+   * into this ring and passed on one-by-one by read_data() */
+  LogTransportDatagram *batch;
+  guchar *batch_buffer;
+  gint batch_size;
+  gint batch_pos, batch_len;
 };
 
 static gboolean
@@ -47,6 +62,75 @@ log_proto_dgram_server_fetch_from_buf(LogProtoBufferedServer *s, const guchar *b
   return TRUE;
 }
 
+static void
+log_proto_dgram_server_alloc_batch(LogProtoDGramServer *self)
+{
+  gsize slot_size = self->super.super.options->init_buffer_size;
+  gint i;
+
+  self->batch_size = CLAMP(LOG_PROTO_DGRAM_SERVER_MAX_BATCH_BYTES / slot_size, 1, LOG_PROTO_DGRAM_SERVER_MAX_BATCH);
+  self->batch = g_new0(LogTransportDatagram, self->batch_size);
+  self->batch_buffer = g_malloc(self->batch_size * slot_size);
+  for (i = 0; i < self->batch_size; i++)
+    {
+      self->batch[i].buf = self->batch_buffer + i * slot_size;
+      self->batch[i].buflen = slot_size;
+    }
+}
+
+static gint
+log_proto_dgram_server_read_data(LogProtoBufferedServer *s, guchar *buf, gsize len, GSockAddr **sa)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+  LogTransportDatagram *dgram;
+  gint rc;
+
+  if (self->batch_pos == self->batch_len)
+    {
+      if (G_UNLIKELY(!self->batch))
+        log_proto_dgram_server_alloc_batch(self);
+
+      rc = log_transport_read_batch(self->super.super.transport, self->batch, self->batch_size);
+      if (rc <= 0)
+        return rc;
+      self->batch_pos = 0;
+      self->batch_len = rc;
+    }
+
+  dgram = &self->batch[self->batch_pos++];
+  rc = MIN(dgram->len, len);
+  memcpy(buf, dgram->buf, rc);
+  if (sa)
+    *sa = dgram->sa;
+  else
+    g_sockaddr_unref(dgram->sa);
+  dgram->sa = NULL;
+  return rc;
+}
+
+static gboolean
+log_proto_dgram_server_prepare(LogProtoServer *s, gint *fd, GIOCondition *cond)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+
+  log_proto_buffered_server_prepare(s, fd, cond);
+
+  /* datagrams still in the ring are not signalled by poll() */
+  return self->batch_pos < self->batch_len;
+}
+
+static void
+log_proto_dgram_server_free(LogProtoServer *s)
+{
+  LogProtoDGramServer *self = (LogProtoDGramServer *) s;
+
+  for (; self->batch_pos < self->batch_len; self->batch_pos++)
+    g_sockaddr_unref(self->batch[self->batch_pos].sa);
+  g_free(self->batch);
+  g_free(self->batch_buffer);
+  log_proto_buffered_server_free_method(s);
+}
+
 LogProtoServer *
 log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions *options)
 {
@@ -55,5 +139,11 @@ log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions
   log_proto_buffered_server_init(&self->super, transport, options);
   self->super.fetch_from_buf = log_proto_dgram_server_fetch_from_buf;
   self->super.stream_based = FALSE;
+  if (log_transport_can_read_batch(transport))
+    {
+      self->super.super.prepare = log_proto_dgram_server_prepare;
+      self->super.super.free_fn = log_proto_dgram_server_free;
+      self->super.read_data = log_proto_dgram_server_read_data;
+    }
   return &self->super.super;
 }
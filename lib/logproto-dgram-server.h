@@ -30,7 +30,10 @@
  * LogProtoDGramServer
  *
  * This class reads input as datagrams, each datagram is a separate
- * message, regardless of embedded EOL/NUL characters.
+ * message, regardless of embedded EOL/NUL characters.  If the transport
+ * can receive several datagrams at once (log_transport_read_batch()), a
+ * batch is received with a single call and returned one message at a
+ * time.
  */
 LogProtoServer *log_proto_dgram_server_new(LogTransport *transport, const LogProtoServerOptions *options);
 
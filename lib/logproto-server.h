@@ -27,6 +27,7 @@
 
 #include "logproto.h"
 #include "persist-state.h"
+#include "str-scan.h"
 
 typedef struct _LogProtoServer LogProtoServer;
 typedef struct _LogProtoServerOptions LogProtoServerOptions;
@@ -43,6 +44,8 @@ struct _LogProtoServerOptions
   gint max_msg_size;
   gint max_buffer_size;
   gint init_buffer_size;
+  /* messages reference the read buffer instead of copying their values */
+  gboolean zero_copy;
 };
 
 typedef union LogProtoServerOptionsStorage
@@ -69,6 +72,7 @@ struct _LogProtoServer
   gboolean (*restart_with_state)(LogProtoServer *s, PersistState *state, const gchar *persist_name);
   LogProtoStatus (*fetch)(LogProtoServer *s, const guchar **msg, gsize *msg_len, GSockAddr **sa, gboolean *may_read);
   void (*queued)(LogProtoServer *s);
+  LogMessageBuffer *(*get_buffer)(LogProtoServer *s);
   gboolean (*validate_options)(LogProtoServer *s);
   void (*free_fn)(LogProtoServer *s);
 };
@@ -119,6 +123,16 @@ log_proto_server_queued(LogProtoServer *s)
     s->queued(s);
 }
 
+/* returns a reference to the buffer the last fetched message points
+ * into, or NULL if the message needs to be copied */
+static inline LogMessageBuffer *
+log_proto_server_get_buffer(LogProtoServer *s)
+{
+  if (s->get_buffer)
+    return s->get_buffer(s);
+  return NULL;
+}
+
 static inline gint
 log_proto_server_get_fd(LogProtoServer *s)
 {
@@ -171,6 +185,4 @@ log_proto_server_factory_construct(LogProtoServerFactory *self, LogTransport *tr
 
 LogProtoServerFactory *log_proto_server_get_factory(GlobalConfig *cfg, const gchar *name);
 
-const guchar *find_eom(const guchar *s, gsize n);
-
 #endif
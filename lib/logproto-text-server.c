@@ -242,10 +242,12 @@ log_proto_text_server_fetch_from_buf(LogProtoBufferedServer *s, const guchar *bu
       gsize raw_split_size;
 
       /* buffer is not full, but no EOL is present, move partial line
-       * to the beginning of the buffer to make space for new data.
+       * to the beginning of the buffer to make space for new data. If
+       * messages still reference the buffer, it goes to a new one.
        */
 
-      memmove(self->super.buffer, buffer_start, buffer_bytes);
+      if (!log_proto_buffered_server_unshare_buffer(&self->super, buffer_start - self->super.buffer, buffer_bytes))
+        memmove(self->super.buffer, buffer_start, buffer_bytes);
       state->pending_buffer_pos = 0;
       state->pending_buffer_end = buffer_bytes;
 
@@ -257,7 +259,7 @@ log_proto_text_server_fetch_from_buf(LogProtoBufferedServer *s, const guchar *bu
              duplicate some data */
 
           if (self->super.super.options->encoding)
-            raw_split_size = log_proto_text_server_get_raw_size_of_buffer(self, buffer_start, buffer_bytes);
+            raw_split_size = log_proto_text_server_get_raw_size_of_buffer(self, self->super.buffer, buffer_bytes);
           else
             raw_split_size = buffer_bytes;
 
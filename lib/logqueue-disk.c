@@ -0,0 +1,1152 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "logqueue-disk.h"
+#include "logpipe.h"
+#include "messages.h"
+#include "misc.h"
+#include "serialize.h"
+#include "stats.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * LogQueueDisk is a LogQueue implementation that stores messages in
+ * append-only segment files, so that a destination can absorb long
+ * outages without keeping the messages in memory.
+ *
+ *   - there's a small in-memory output queue (qout) that is used as long
+ *     as the disk part of the queue is empty. This is the fastpath, as it
+ *     doesn't need to serialize messages.
+ *
+ *   - once qout is full, messages are serialized using log_msg_write() and
+ *     appended to the current write segment. A segment is a fixed size,
+ *     mmap()-ed file, containing a header and a series of length-prefixed
+ *     records. A record becomes visible once its length is stored, which
+ *     happens after the payload was copied.
+ *
+ *   - the output thread first consumes qout, then reads the records from
+ *     the disk in order.
+ *
+ * Three positions are tracked on disk:
+ *
+ *     ack_pos <= read_pos <= write_pos
+ *
+ * Records before ack_pos were delivered, segments entirely before it are
+ * removed.  Records between ack_pos and read_pos were read but not yet
+ * acknowledged (they are in the backlog), records between read_pos and
+ * write_pos are still waiting to be sent.
+ *
+ * Messages stored on disk are acknowledged to their source as soon as they
+ * are written, e.g. flow-control is decoupled from the destination in this
+ * case.
+ *
+ * The ack and write positions are saved into the persistent state when
+ * the queue is released by its driver (the queue itself never holds onto
+ * the PersistState, as it may outlive it).  When syslog-ng restarts,
+ * messages are read starting at the saved ack position, segments removed
+ * since then are skipped. Records written after the last state update are
+ * recovered by scanning forward from the saved write position, thus the
+ * in-memory messages (qout and backlog) can simply be appended to the disk
+ * when the queue is freed.  Messages acked after the last state update
+ * (e.g. before a crash) are delivered again.
+ *
+ * Threading assumptions:
+ *   - push_tail is called from the input threads, it always grabs the queue lock
+ *   - everything else is called from the output thread, the disk and qout
+ *     are accessed under the protection of the queue lock, the backlog is
+ *     only touched by the output thread.
+ */
+
+#define LQD_SEGMENT_MAGIC       "SLQD"
+#define LQD_SEGMENT_VERSION     1
+#define LQD_SEGMENT_MAX_SIZE    (64 * 1024 * 1024)
+#define LQD_SEGMENT_MIN_SIZE    (256 * 1024)
+#define LQD_STATE_VERSION       0
+
+/* special record length values */
+#define LQD_RECORD_EMPTY        0
+#define LQD_RECORD_NEXT_SEGMENT 0xFFFFFFFF
+
+/* the size of a record with its length prefix, aligned to 4 bytes */
+#define LQD_RECORD_SIZE(len)    ((sizeof(guint32) + (len) + 0x3) & ~0x3)
+
+typedef struct _LogQueueDiskSegmentHeader
+{
+  gchar magic[4];
+  guint8 version;
+  guint8 big_endian;
+  guint8 __padding[2];
+  guint32 id;
+  guint32 size;
+} LogQueueDiskSegmentHeader;
+
+#define LQD_SEGMENT_HDR_SIZE    sizeof(LogQueueDiskSegmentHeader)
+
+typedef struct _LogQueueDiskState
+{
+  /* NOTE: the segment files are stored in native byte order, thus the
+   * state is not converted if the byte order doesn't match. */
+  guint8 version;
+  guint8 big_endian:1;
+  guint8 __padding[2];
+  guint32 segment_size;
+  guint32 ack_segment;
+  guint32 ack_offset;
+  guint32 write_segment;
+  guint32 write_offset;
+} LogQueueDiskState;
+
+typedef struct _LogQueueDiskPosition
+{
+  guint32 segment;
+  guint32 offset;
+} LogQueueDiskPosition;
+
+typedef struct _LogQueueDiskSegment
+{
+  gint ref_cnt;
+  guint32 id;
+  gint fd;
+  gchar *map;
+} LogQueueDiskSegment;
+
+typedef struct _LogQueueDiskNode
+{
+  struct iv_list_head list;
+  LogMessage *msg;
+  /* the end of the on-disk record of this message, segment is 0 if the
+   * message is only kept in memory */
+  LogQueueDiskPosition end;
+  gboolean ack_needed;
+  /* accounted to the memory usage of the queue */
+  gsize size;
+} LogQueueDiskNode;
+
+typedef struct _LogQueueDisk
+{
+  LogQueue super;
+
+  struct iv_list_head qout;
+  gint qout_len;
+  gint qout_size; /* in number of elements */
+
+  struct iv_list_head qbacklog;   /* entries that were sent but not acked yet */
+  gint qbacklog_len;
+
+  gchar *dir;
+  gchar *file_prefix;
+  gsize segment_size;
+  guint32 max_segments;
+
+  LogQueueDiskPosition ack_pos, read_pos, write_pos;
+  LogQueueDiskSegment *read_segment, *write_segment;
+  /* number of records between read_pos and write_pos */
+  gint64 disk_length;
+
+  GString *serialized;
+} LogQueueDisk;
+
+static LogQueueDiskNode *
+log_queue_disk_node_new(LogQueueDisk *self, LogMessage *msg, gboolean ack_needed, const LogQueueDiskPosition *end)
+{
+  LogQueueDiskNode *node = g_slice_new(LogQueueDiskNode);
+
+  INIT_IV_LIST_HEAD(&node->list);
+  node->msg = msg;
+  node->ack_needed = ack_needed;
+  if (end)
+    node->end = *end;
+  else
+    node->end.segment = node->end.offset = 0;
+  node->size = log_msg_get_size(msg);
+  log_queue_memory_usage_add(&self->super, node->size);
+  return node;
+}
+
+static void
+log_queue_disk_node_free(LogQueueDisk *self, LogQueueDiskNode *node)
+{
+  log_queue_memory_usage_add(&self->super, -(gssize) node->size);
+  g_slice_free(LogQueueDiskNode, node);
+}
+
+/****************************************************************************
+ * Segment files
+ ****************************************************************************/
+
+static gchar *
+log_queue_disk_segment_filename(LogQueueDisk *self, guint32 id)
+{
+  return g_strdup_printf("%s/%s-%08x.qseg", self->dir, self->file_prefix, id);
+}
+
+static gboolean
+log_queue_disk_segment_exists(LogQueueDisk *self, guint32 id)
+{
+  gchar *filename = log_queue_disk_segment_filename(self, id);
+  gboolean result;
+
+  result = g_file_test(filename, G_FILE_TEST_EXISTS);
+  g_free(filename);
+  return result;
+}
+
+static LogQueueDiskSegment *
+log_queue_disk_segment_open(LogQueueDisk *self, guint32 id, gboolean create)
+{
+  LogQueueDiskSegment *segment;
+  LogQueueDiskSegmentHeader *hdr;
+  gchar *filename;
+  struct stat st;
+  gchar *map;
+  gint fd;
+
+  filename = log_queue_disk_segment_filename(self, id);
+  fd = open(filename, O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0600);
+  if (fd < 0)
+    {
+      msg_error("Error opening disk queue segment",
+                evt_tag_str(EVT_TAG_FILENAME, filename),
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      goto error;
+    }
+  g_fd_set_cloexec(fd, TRUE);
+
+  if (create)
+    {
+      if (ftruncate(fd, self->segment_size) < 0)
+        {
+          msg_error("Error allocating disk queue segment",
+                    evt_tag_str(EVT_TAG_FILENAME, filename),
+                    evt_tag_errno(EVT_TAG_OSERROR, errno),
+                    NULL);
+          goto error_close;
+        }
+    }
+  else if (fstat(fd, &st) < 0 || st.st_size != self->segment_size)
+    {
+      msg_error("Disk queue segment has an invalid size, ignoring",
+                evt_tag_str(EVT_TAG_FILENAME, filename),
+                evt_tag_int("segment_size", self->segment_size),
+                NULL);
+      goto error_close;
+    }
+
+  map = mmap(NULL, self->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    {
+      msg_error("Error mapping disk queue segment",
+                evt_tag_str(EVT_TAG_FILENAME, filename),
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      goto error_close;
+    }
+
+  hdr = (LogQueueDiskSegmentHeader *) map;
+  if (create)
+    {
+      memcpy(hdr->magic, LQD_SEGMENT_MAGIC, sizeof(hdr->magic));
+      hdr->version = LQD_SEGMENT_VERSION;
+      hdr->big_endian = (G_BYTE_ORDER == G_BIG_ENDIAN);
+      hdr->id = id;
+      hdr->size = self->segment_size;
+    }
+  else if (memcmp(hdr->magic, LQD_SEGMENT_MAGIC, sizeof(hdr->magic)) != 0 ||
+           hdr->version != LQD_SEGMENT_VERSION ||
+           hdr->big_endian != (G_BYTE_ORDER == G_BIG_ENDIAN) ||
+           hdr->id != id ||
+           hdr->size != self->segment_size)
+    {
+      msg_error("Disk queue segment has an invalid header, ignoring",
+                evt_tag_str(EVT_TAG_FILENAME, filename),
+                NULL);
+      munmap(map, self->segment_size);
+      goto error_close;
+    }
+  g_free(filename);
+
+  segment = g_new0(LogQueueDiskSegment, 1);
+  segment->ref_cnt = 1;
+  segment->id = id;
+  segment->fd = fd;
+  segment->map = map;
+  return segment;
+
+ error_close:
+  close(fd);
+ error:
+  g_free(filename);
+  return NULL;
+}
+
+static LogQueueDiskSegment *
+log_queue_disk_segment_ref(LogQueueDiskSegment *segment)
+{
+  segment->ref_cnt++;
+  return segment;
+}
+
+static void
+log_queue_disk_segment_unref(LogQueueDisk *self, LogQueueDiskSegment *segment)
+{
+  if (segment && --segment->ref_cnt == 0)
+    {
+      munmap(segment->map, self->segment_size);
+      close(segment->fd);
+      g_free(segment);
+    }
+}
+
+static void
+log_queue_disk_segment_unlink(LogQueueDisk *self, guint32 id)
+{
+  gchar *filename = log_queue_disk_segment_filename(self, id);
+
+  if (unlink(filename) < 0 && errno != ENOENT)
+    {
+      msg_error("Error removing disk queue segment",
+                evt_tag_str(EVT_TAG_FILENAME, filename),
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+    }
+  g_free(filename);
+}
+
+static inline guint32
+log_queue_disk_segment_get_record_len(LogQueueDisk *self, LogQueueDiskSegment *segment, guint32 offset)
+{
+  if (offset + sizeof(guint32) > self->segment_size)
+    return LQD_RECORD_NEXT_SEGMENT;
+  return *(guint32 *) (segment->map + offset);
+}
+
+/****************************************************************************
+ * Disk positions
+ ****************************************************************************/
+
+static gchar *
+log_queue_disk_format_persist_key(LogQueueDisk *self)
+{
+  return g_strdup_printf("%s.disk_queue", self->super.persist_name);
+}
+
+static void
+log_queue_disk_save_state(LogQueueDisk *self, PersistState *persist_state)
+{
+  LogQueueDiskState *state;
+  PersistEntryHandle handle;
+  gchar *persist_key;
+  gsize size;
+  guint8 version;
+
+  if (!persist_state || !self->super.persist_name)
+    return;
+
+  persist_key = log_queue_disk_format_persist_key(self);
+  handle = persist_state_lookup_entry(persist_state, persist_key, &size, &version);
+  if (!handle || size < sizeof(LogQueueDiskState))
+    handle = persist_state_alloc_entry(persist_state, persist_key, sizeof(LogQueueDiskState));
+  g_free(persist_key);
+  if (!handle)
+    return;
+
+  state = persist_state_map_entry(persist_state, handle);
+  memset(state, 0, sizeof(*state));
+  state->version = LQD_STATE_VERSION;
+  state->big_endian = (G_BYTE_ORDER == G_BIG_ENDIAN);
+  state->segment_size = self->segment_size;
+  state->ack_segment = self->ack_pos.segment;
+  state->ack_offset = self->ack_pos.offset;
+  state->write_segment = self->write_pos.segment;
+  state->write_offset = self->write_pos.offset;
+  persist_state_unmap_entry(persist_state, handle);
+}
+
+/* NOTE: called with self->super.lock held */
+static gboolean
+log_queue_disk_switch_write_segment(LogQueueDisk *self)
+{
+  LogQueueDiskSegment *segment;
+  guint32 next = self->write_pos.segment + 1;
+
+  if (next - self->ack_pos.segment >= self->max_segments)
+    return FALSE;
+
+  segment = log_queue_disk_segment_open(self, next, TRUE);
+  if (!segment)
+    return FALSE;
+
+  /* the marker is only written once the next segment exists, the reader
+   * would get stuck otherwise */
+  if (self->write_pos.offset + sizeof(guint32) <= self->segment_size)
+    *(guint32 *) (self->write_segment->map + self->write_pos.offset) = LQD_RECORD_NEXT_SEGMENT;
+
+  log_queue_disk_segment_unref(self, self->write_segment);
+  self->write_segment = segment;
+  self->write_pos.segment = next;
+  self->write_pos.offset = LQD_SEGMENT_HDR_SIZE;
+  return TRUE;
+}
+
+/* NOTE: called with self->super.lock held */
+static gboolean
+log_queue_disk_switch_read_segment(LogQueueDisk *self)
+{
+  LogQueueDiskSegment *segment;
+  guint32 next = self->read_pos.segment + 1;
+
+  if (next == self->write_pos.segment)
+    segment = log_queue_disk_segment_ref(self->write_segment);
+  else
+    segment = log_queue_disk_segment_open(self, next, FALSE);
+
+  if (!segment)
+    {
+      msg_error("Error reading the next disk queue segment, skipping unread messages",
+                evt_tag_int("segment", next),
+                evt_tag_printf("skipped", "%" G_GINT64_FORMAT, self->disk_length),
+                NULL);
+      segment = log_queue_disk_segment_ref(self->write_segment);
+      next = self->write_pos.segment;
+      self->disk_length = 0;
+      log_queue_disk_segment_unref(self, self->read_segment);
+      self->read_segment = segment;
+      self->read_pos = self->write_pos;
+      return FALSE;
+    }
+
+  log_queue_disk_segment_unref(self, self->read_segment);
+  self->read_segment = segment;
+  self->read_pos.segment = next;
+  self->read_pos.offset = LQD_SEGMENT_HDR_SIZE;
+  return TRUE;
+}
+
+/* NOTE: called with self->super.lock held */
+static void
+log_queue_disk_ack_position(LogQueueDisk *self, const LogQueueDiskPosition *end)
+{
+  guint32 id;
+
+  if (self->ack_pos.segment == end->segment)
+    {
+      self->ack_pos = *end;
+      return;
+    }
+
+  /* the saved state may still reference the removed segments, they are
+   * skipped when the queue is loaded */
+  for (id = self->ack_pos.segment; id < end->segment; id++)
+    log_queue_disk_segment_unlink(self, id);
+  self->ack_pos = *end;
+}
+
+/****************************************************************************
+ * Records
+ ****************************************************************************/
+
+/* NOTE: called with self->super.lock held */
+static gboolean
+log_queue_disk_write_message(LogQueueDisk *self, LogMessage *msg)
+{
+  SerializeArchive *sa;
+  guint32 record_size;
+  gchar *record;
+
+  if (!self->write_segment)
+    return FALSE;
+
+  g_string_truncate(self->serialized, 0);
+  sa = serialize_string_archive_new(self->serialized);
+  log_msg_write(msg, sa);
+  serialize_archive_free(sa);
+
+  record_size = LQD_RECORD_SIZE(self->serialized->len);
+  if (record_size > self->segment_size - LQD_SEGMENT_HDR_SIZE)
+    {
+      msg_error("Message is too large to be stored in the disk queue, dropping",
+                evt_tag_int("size", self->serialized->len),
+                evt_tag_int("segment_size", self->segment_size),
+                NULL);
+      return FALSE;
+    }
+
+  if (self->write_pos.offset + record_size > self->segment_size &&
+      !log_queue_disk_switch_write_segment(self))
+    return FALSE;
+
+  record = self->write_segment->map + self->write_pos.offset;
+  memcpy(record + sizeof(guint32), self->serialized->str, self->serialized->len);
+  /* the length is stored last, it makes the record visible */
+  *(guint32 *) record = self->serialized->len;
+
+  self->write_pos.offset += record_size;
+  self->disk_length++;
+  return TRUE;
+}
+
+/* NOTE: called with self->super.lock held */
+static LogMessage *
+log_queue_disk_read_message(LogQueueDisk *self, LogQueueDiskPosition *end)
+{
+  while (self->disk_length > 0)
+    {
+      SerializeArchive *sa;
+      LogMessage *msg;
+      gboolean success;
+      guint32 len;
+
+      len = log_queue_disk_segment_get_record_len(self, self->read_segment, self->read_pos.offset);
+      if (len == LQD_RECORD_NEXT_SEGMENT)
+        {
+          if (!log_queue_disk_switch_read_segment(self))
+            break;
+          continue;
+        }
+      if (len == LQD_RECORD_EMPTY || self->read_pos.offset + LQD_RECORD_SIZE(len) > self->segment_size)
+        {
+          msg_error("Disk queue segment is corrupted, skipping unread messages",
+                    evt_tag_int("segment", self->read_pos.segment),
+                    evt_tag_int("offset", self->read_pos.offset),
+                    evt_tag_printf("skipped", "%" G_GINT64_FORMAT, self->disk_length),
+                    NULL);
+          self->disk_length = 0;
+          break;
+        }
+
+      msg = log_msg_new_empty();
+      sa = serialize_buffer_archive_new(self->read_segment->map + self->read_pos.offset + sizeof(guint32), len);
+      success = log_msg_read(msg, sa);
+      serialize_archive_free(sa);
+
+      self->read_pos.offset += LQD_RECORD_SIZE(len);
+      self->disk_length--;
+      if (success)
+        {
+          *end = self->read_pos;
+          return msg;
+        }
+
+      msg_error("Error deserializing message from the disk queue, dropping",
+                evt_tag_int("segment", self->read_pos.segment),
+                evt_tag_int("offset", self->read_pos.offset),
+                NULL);
+      stats_counter_inc(self->super.dropped_messages);
+      stats_counter_dec(self->super.stored_messages);
+      log_msg_unref(msg);
+    }
+  return NULL;
+}
+
+/****************************************************************************
+ * LogQueue methods
+ ****************************************************************************/
+
+/* NOTE: this is inherently racy, just like log_queue_fifo_get_length() */
+static gint64
+log_queue_disk_get_length(LogQueue *s)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+
+  return self->qout_len + self->disk_length;
+}
+
+/*
+ * Can be called from any of the input threads.
+ *
+ * NOTE: It consumes the reference passed by the caller.
+ */
+static void
+log_queue_disk_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+  LogQueueDiskNode *node;
+
+  g_static_mutex_lock(&self->super.lock);
+  if (self->disk_length == 0 && self->qout_len < self->qout_size &&
+      !log_queue_memory_usage_exceeded(&self->super, log_msg_get_size(msg)))
+    {
+      /* fastpath, nothing is waiting on the disk, keep the message in memory */
+      node = log_queue_disk_node_new(self, msg, path_options->ack_needed, NULL);
+      iv_list_add_tail(&node->list, &self->qout);
+      self->qout_len++;
+      stats_counter_inc(self->super.stored_messages);
+      log_queue_push_notify(&self->super);
+      g_static_mutex_unlock(&self->super.lock);
+      return;
+    }
+
+  if (log_queue_disk_write_message(self, msg))
+    {
+      stats_counter_inc(self->super.stored_messages);
+      log_queue_push_notify(&self->super);
+      g_static_mutex_unlock(&self->super.lock);
+
+      /* the message is safely stored, acknowledge it right away */
+      log_msg_ack(msg, path_options);
+      log_msg_unref(msg);
+      return;
+    }
+
+  stats_counter_inc(self->super.dropped_messages);
+  g_static_mutex_unlock(&self->super.lock);
+  log_msg_drop(msg, path_options);
+
+  msg_debug("Destination disk queue full, dropping message",
+            evt_tag_int("queue_len", log_queue_disk_get_length(&self->super)),
+            evt_tag_int("mem_buf_length", self->qout_size),
+            evt_tag_int("max_segments", self->max_segments),
+            NULL);
+}
+
+/*
+ * Put an item back to the front of the queue.
+ *
+ * This is assumed to be called only from the output thread.
+ *
+ * NOTE: It consumes the reference passed by the caller.
+ */
+static void
+log_queue_disk_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *path_options)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+  LogQueueDiskNode *node;
+
+  log_queue_assert_output_thread(s);
+
+  /* no limits are checked here, see log_queue_fifo_push_head() */
+  node = log_queue_disk_node_new(self, msg, path_options->ack_needed, NULL);
+
+  g_static_mutex_lock(&self->super.lock);
+  iv_list_add(&node->list, &self->qout);
+  self->qout_len++;
+  g_static_mutex_unlock(&self->super.lock);
+
+  stats_counter_inc(self->super.stored_messages);
+}
+
+/*
+ * Can only run from the output thread.
+ *
+ * NOTE: this returns a reference which the caller must take care to free.
+ */
+static gboolean
+log_queue_disk_pop_head(LogQueue *s, LogMessage **msg, LogPathOptions *path_options, gboolean push_to_backlog, gboolean ignore_throttle)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+  LogQueueDiskNode *node = NULL;
+
+  log_queue_assert_output_thread(s);
+
+  if (!ignore_throttle && self->super.throttle && self->super.throttle_buckets == 0)
+    {
+      return FALSE;
+    }
+
+  g_static_mutex_lock(&self->super.lock);
+  if (self->qout_len > 0)
+    {
+      node = iv_list_entry(self->qout.next, LogQueueDiskNode, list);
+      iv_list_del_init(&node->list);
+      self->qout_len--;
+    }
+  else if (self->disk_length > 0)
+    {
+      LogQueueDiskPosition end;
+      LogMessage *m;
+
+      m = log_queue_disk_read_message(self, &end);
+      if (m)
+        node = log_queue_disk_node_new(self, m, FALSE, &end);
+    }
+
+  if (node && !push_to_backlog && node->end.segment)
+    {
+      /* the caller takes over the responsibility for this message, it
+       * doesn't need to stay on disk */
+      log_queue_disk_ack_position(self, &node->end);
+    }
+  g_static_mutex_unlock(&self->super.lock);
+
+  if (!node)
+    return FALSE;
+
+  *msg = node->msg;
+  path_options->ack_needed = node->ack_needed;
+  stats_counter_dec(self->super.stored_messages);
+
+  if (push_to_backlog)
+    {
+      log_msg_ref(*msg);
+      iv_list_add_tail(&node->list, &self->qbacklog);
+      self->qbacklog_len++;
+    }
+  else
+    {
+      log_queue_disk_node_free(self, node);
+    }
+
+  if (!ignore_throttle && self->super.throttle_buckets > 0)
+    {
+      self->super.throttle_buckets--;
+    }
+  return TRUE;
+}
+
+/*
+ * Can only run from the output thread.
+ */
+static void
+log_queue_disk_ack_backlog(LogQueue *s, gint n)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  struct iv_list_head acked;
+  gint i;
+
+  log_queue_assert_output_thread(s);
+
+  INIT_IV_LIST_HEAD(&acked);
+
+  /* advance the on-disk positions under the lock, but call the ack
+   * callbacks without holding it */
+  g_static_mutex_lock(&self->super.lock);
+  for (i = 0; i < n && self->qbacklog_len > 0; i++)
+    {
+      LogQueueDiskNode *node;
+
+      node = iv_list_entry(self->qbacklog.next, LogQueueDiskNode, list);
+      iv_list_del(&node->list);
+      iv_list_add_tail(&node->list, &acked);
+      self->qbacklog_len--;
+
+      if (node->end.segment)
+        log_queue_disk_ack_position(self, &node->end);
+    }
+  g_static_mutex_unlock(&self->super.lock);
+
+  while (!iv_list_empty(&acked))
+    {
+      LogQueueDiskNode *node;
+
+      node = iv_list_entry(acked.next, LogQueueDiskNode, list);
+      iv_list_del(&node->list);
+
+      path_options.ack_needed = node->ack_needed;
+      log_msg_ack(node->msg, &path_options);
+      log_msg_unref(node->msg);
+      log_queue_disk_node_free(self, node);
+    }
+}
+
+/*
+ * Move items on our backlog back to the front of qout, messages read from
+ * the disk keep their on-disk position, so acking them again advances
+ * the ack position as usual.
+ *
+ * NOTE: this is assumed to be called from the output thread.
+ */
+static void
+log_queue_disk_rewind_backlog(LogQueue *s)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+
+  log_queue_assert_output_thread(s);
+
+  g_static_mutex_lock(&self->super.lock);
+  iv_list_splice_init(&self->qbacklog, &self->qout);
+  self->qout_len += self->qbacklog_len;
+  g_static_mutex_unlock(&self->super.lock);
+
+  stats_counter_add(self->super.stored_messages, self->qbacklog_len);
+  self->qbacklog_len = 0;
+}
+
+static gint
+log_queue_disk_free_queue(LogQueueDisk *self, struct iv_list_head *q)
+{
+  gint lost = 0;
+
+  while (!iv_list_empty(q))
+    {
+      LogQueueDiskNode *node;
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+
+      node = iv_list_entry(q->next, LogQueueDiskNode, list);
+      iv_list_del(&node->list);
+
+      /* messages only kept in memory are appended to the disk, so that
+       * they survive a restart. Messages read from the disk are still
+       * there as they were not acked. */
+      if (node->end.segment == 0 && !log_queue_disk_write_message(self, node->msg))
+        lost++;
+
+      path_options.ack_needed = node->ack_needed;
+      log_msg_ack(node->msg, &path_options);
+      log_msg_unref(node->msg);
+      log_queue_disk_node_free(self, node);
+    }
+  return lost;
+}
+
+/*
+ * Called by the driver when it releases the queue, the PersistState is
+ * only valid during this call.
+ */
+static void
+log_queue_disk_persist_state(LogQueue *s, PersistState *persist_state)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+
+  g_static_mutex_lock(&self->super.lock);
+  log_queue_disk_save_state(self, persist_state);
+  g_static_mutex_unlock(&self->super.lock);
+}
+
+/*
+ * The PersistState is usually gone by the time the queue is freed, the
+ * in-memory messages appended here are found by
+ * log_queue_disk_recover_tail() at the next startup.
+ */
+static void
+log_queue_disk_free(LogQueue *s)
+{
+  LogQueueDisk *self = (LogQueueDisk *) s;
+  gint lost;
+
+  lost = log_queue_disk_free_queue(self, &self->qbacklog);
+  lost += log_queue_disk_free_queue(self, &self->qout);
+  if (lost)
+    {
+      msg_error("Error saving in-memory messages of the disk queue, messages lost",
+                evt_tag_str("persist_name", self->super.persist_name),
+                evt_tag_int("lost", lost),
+                NULL);
+    }
+
+  log_queue_disk_segment_unref(self, self->read_segment);
+  log_queue_disk_segment_unref(self, self->write_segment);
+  g_string_free(self->serialized, TRUE);
+  g_free(self->dir);
+  g_free(self->file_prefix);
+  log_queue_free_method(s);
+}
+
+/****************************************************************************
+ * Loading the queue
+ ****************************************************************************/
+
+/* records written after the last state update are found by scanning
+ * forward from the saved write position */
+static void
+log_queue_disk_recover_tail(LogQueueDisk *self)
+{
+  gint64 recovered = 0;
+
+  while (1)
+    {
+      guint32 len;
+
+      len = log_queue_disk_segment_get_record_len(self, self->write_segment, self->write_pos.offset);
+      if (len == LQD_RECORD_NEXT_SEGMENT)
+        {
+          LogQueueDiskSegment *segment;
+
+          if (!log_queue_disk_segment_exists(self, self->write_pos.segment + 1))
+            break;
+          segment = log_queue_disk_segment_open(self, self->write_pos.segment + 1, FALSE);
+          if (!segment)
+            break;
+          log_queue_disk_segment_unref(self, self->write_segment);
+          self->write_segment = segment;
+          self->write_pos.segment++;
+          self->write_pos.offset = LQD_SEGMENT_HDR_SIZE;
+          continue;
+        }
+      if (len == LQD_RECORD_EMPTY || self->write_pos.offset + LQD_RECORD_SIZE(len) > self->segment_size)
+        break;
+
+      self->write_pos.offset += LQD_RECORD_SIZE(len);
+      recovered++;
+    }
+
+  if (recovered)
+    {
+      msg_verbose("Recovered unsaved messages of the disk queue",
+                  evt_tag_str("persist_name", self->super.persist_name),
+                  evt_tag_printf("recovered", "%" G_GINT64_FORMAT, recovered),
+                  NULL);
+    }
+}
+
+/* looks for the segment with the smallest id not less than @from */
+static gboolean
+log_queue_disk_find_first_segment(LogQueueDisk *self, guint32 from, guint32 *first)
+{
+  const gchar *filename;
+  gboolean found = FALSE;
+  gsize prefix_len = strlen(self->file_prefix);
+  GDir *dir;
+
+  dir = g_dir_open(self->dir, 0, NULL);
+  if (!dir)
+    return FALSE;
+
+  while ((filename = g_dir_read_name(dir)))
+    {
+      gchar *end;
+      guint32 id;
+
+      if (strncmp(filename, self->file_prefix, prefix_len) != 0 || filename[prefix_len] != '-')
+        continue;
+      id = strtoul(filename + prefix_len + 1, &end, 16);
+      if (strcmp(end, ".qseg") != 0 || id < from)
+        continue;
+      if (!found || id < *first)
+        *first = id;
+      found = TRUE;
+    }
+  g_dir_close(dir);
+  return found;
+}
+
+static gboolean
+log_queue_disk_load_state(LogQueueDisk *self, PersistState *persist_state)
+{
+  LogQueueDiskState *state;
+  PersistEntryHandle handle;
+  gchar *persist_key;
+  gsize size;
+  guint8 version;
+  gboolean loaded = FALSE;
+
+  if (!persist_state || !self->super.persist_name)
+    return FALSE;
+
+  persist_key = log_queue_disk_format_persist_key(self);
+  handle = persist_state_lookup_entry(persist_state, persist_key, &size, &version);
+  g_free(persist_key);
+  if (!handle || size < sizeof(LogQueueDiskState))
+    return FALSE;
+
+  state = persist_state_map_entry(persist_state, handle);
+  if (state->version == LQD_STATE_VERSION &&
+      state->big_endian == (G_BYTE_ORDER == G_BIG_ENDIAN) &&
+      state->segment_size >= LQD_SEGMENT_MIN_SIZE)
+    {
+      self->segment_size = state->segment_size;
+      self->ack_pos.segment = state->ack_segment;
+      self->ack_pos.offset = state->ack_offset;
+      self->write_pos.segment = state->write_segment;
+      self->write_pos.offset = state->write_offset;
+      loaded = TRUE;
+    }
+  else
+    {
+      msg_error("Incompatible disk queue state, starting with an empty queue",
+                evt_tag_str("persist_name", self->super.persist_name),
+                NULL);
+    }
+  persist_state_unmap_entry(persist_state, handle);
+  return loaded;
+}
+
+/*
+ * Counts the records between the read and write positions, the saved
+ * state only contains the positions. Returns FALSE if the records are
+ * not intact.
+ */
+static gboolean
+log_queue_disk_count_records(LogQueueDisk *self)
+{
+  LogQueueDiskSegment *segment = log_queue_disk_segment_ref(self->read_segment);
+  LogQueueDiskPosition pos = self->read_pos;
+  gboolean success = TRUE;
+
+  self->disk_length = 0;
+  while (pos.segment != self->write_pos.segment || pos.offset != self->write_pos.offset)
+    {
+      guint32 len;
+
+      len = log_queue_disk_segment_get_record_len(self, segment, pos.offset);
+      if (len == LQD_RECORD_NEXT_SEGMENT && pos.segment < self->write_pos.segment)
+        {
+          log_queue_disk_segment_unref(self, segment);
+          pos.segment++;
+          pos.offset = LQD_SEGMENT_HDR_SIZE;
+          if (pos.segment == self->write_pos.segment)
+            segment = log_queue_disk_segment_ref(self->write_segment);
+          else
+            segment = log_queue_disk_segment_open(self, pos.segment, FALSE);
+          if (!segment)
+            return FALSE;
+          continue;
+        }
+      if (len == LQD_RECORD_EMPTY || len == LQD_RECORD_NEXT_SEGMENT ||
+          pos.offset + LQD_RECORD_SIZE(len) > self->segment_size)
+        {
+          success = FALSE;
+          break;
+        }
+      pos.offset += LQD_RECORD_SIZE(len);
+      self->disk_length++;
+    }
+  log_queue_disk_segment_unref(self, segment);
+  return success;
+}
+
+static gboolean
+log_queue_disk_load(LogQueueDisk *self, PersistState *persist_state)
+{
+  self->ack_pos.segment = self->write_pos.segment = 1;
+  self->ack_pos.offset = self->write_pos.offset = LQD_SEGMENT_HDR_SIZE;
+
+  if (log_queue_disk_load_state(self, persist_state))
+    {
+      guint32 first;
+
+      /* segments acked after the state was saved are already removed */
+      if (log_queue_disk_find_first_segment(self, self->ack_pos.segment, &first) &&
+          first != self->ack_pos.segment)
+        {
+          self->ack_pos.segment = first;
+          self->ack_pos.offset = LQD_SEGMENT_HDR_SIZE;
+          if (self->write_pos.segment < first)
+            self->write_pos = self->ack_pos;
+        }
+
+      self->write_segment = log_queue_disk_segment_open(self, self->write_pos.segment, FALSE);
+      if (self->write_segment)
+        {
+          log_queue_disk_recover_tail(self);
+        }
+      else
+        {
+          msg_error("Error opening the last segment of the disk queue, starting with an empty queue",
+                    evt_tag_str("persist_name", self->super.persist_name),
+                    NULL);
+          self->write_pos.segment++;
+          self->write_pos.offset = LQD_SEGMENT_HDR_SIZE;
+          self->ack_pos = self->write_pos;
+        }
+    }
+
+  if (!self->write_segment)
+    self->write_segment = log_queue_disk_segment_open(self, self->write_pos.segment, TRUE);
+  if (!self->write_segment)
+    return FALSE;
+
+  self->read_pos = self->ack_pos;
+  if (self->read_pos.segment == self->write_pos.segment)
+    self->read_segment = log_queue_disk_segment_ref(self->write_segment);
+  else
+    self->read_segment = log_queue_disk_segment_open(self, self->read_pos.segment, FALSE);
+
+  if (!self->read_segment || !log_queue_disk_count_records(self))
+    {
+      msg_error("Error reading the stored messages of the disk queue, skipping unread messages",
+                evt_tag_str("persist_name", self->super.persist_name),
+                NULL);
+      self->ack_pos = self->read_pos = self->write_pos;
+      self->disk_length = 0;
+      log_queue_disk_segment_unref(self, self->read_segment);
+      self->read_segment = log_queue_disk_segment_ref(self->write_segment);
+    }
+  log_queue_disk_save_state(self, persist_state);
+
+  if (self->disk_length > 0)
+    {
+      msg_notice("Disk queue loaded, resuming delivery of stored messages",
+                 evt_tag_str("persist_name", self->super.persist_name),
+                 evt_tag_printf("queued_messages", "%" G_GINT64_FORMAT, self->disk_length),
+                 NULL);
+    }
+  return TRUE;
+}
+
+static gchar *
+log_queue_disk_format_file_prefix(const gchar *persist_name)
+{
+  gchar *prefix = g_strdup(persist_name ? persist_name : "syslog-ng");
+  gchar *p;
+
+  for (p = prefix; *p; p++)
+    {
+      if (!g_ascii_isalnum(*p) && *p != '-' && *p != '_' && *p != '.')
+        *p = '_';
+    }
+  return prefix;
+}
+
+/*
+ * Returns NULL if the disk queue cannot be initialized, the caller
+ * should fall back to an in-memory queue in that case.
+ */
+LogQueue *
+log_queue_disk_new(gint qout_size, gint64 disk_buf_size, const gchar *dir, PersistState *state, const gchar *persist_name)
+{
+  LogQueueDisk *self;
+
+  self = g_new0(LogQueueDisk, 1);
+
+  log_queue_init_instance(&self->super, persist_name);
+  self->super.get_length = log_queue_disk_get_length;
+  self->super.push_tail = log_queue_disk_push_tail;
+  self->super.push_head = log_queue_disk_push_head;
+  self->super.pop_head = log_queue_disk_pop_head;
+  self->super.ack_backlog = log_queue_disk_ack_backlog;
+  self->super.rewind_backlog = log_queue_disk_rewind_backlog;
+  self->super.persist_state = log_queue_disk_persist_state;
+  self->super.free_fn = log_queue_disk_free;
+
+  INIT_IV_LIST_HEAD(&self->qout);
+  INIT_IV_LIST_HEAD(&self->qbacklog);
+  self->qout_size = qout_size;
+
+  /* the disk buffer is split to segments, so that the space of delivered
+   * messages can be released while the rest is still in use */
+  disk_buf_size = MAX(disk_buf_size, LOG_QUEUE_DISK_MIN_SIZE);
+  self->segment_size = CLAMP(disk_buf_size / 8, LQD_SEGMENT_MIN_SIZE, LQD_SEGMENT_MAX_SIZE) & ~0xFFF;
+  self->max_segments = MAX(2, disk_buf_size / self->segment_size);
+
+  self->dir = g_strdup(dir ? dir : PATH_QDISK);
+  self->file_prefix = log_queue_disk_format_file_prefix(persist_name);
+  self->serialized = g_string_sized_new(1024);
+
+  if (!log_queue_disk_load(self, state))
+    {
+      log_queue_unref(&self->super);
+      return NULL;
+    }
+  return &self->super;
+}
@@ -24,10 +24,12 @@
 
 #include "logqueue.h"
 #include "logpipe.h"
+#include "logsource.h"
 #include "messages.h"
 #include "serialize.h"
 #include "stats.h"
 #include "mainloop.h"
+#include "syslog-names.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -41,27 +43,46 @@
  *
  *   - has a per-thread, unlocked input queue where threads can put their items
  *
- *   - has a locked wait-queue where items go once the per-thread input
+ *   - has a lock-free wait-queue where items go once the per-thread input
  *     would be overflown or if the input thread goes to sleep (e.g.  one
- *     lock acquisition per a longer period)
+ *     atomic operation per a longer period)
  *
  *   - has an unlocked output queue where items from the wait queue go, once
  *     it becomes depleted.
  *
  * This means that items flow in this sequence from one list to the next:
  *
- *    input queue (per-thread) -> wait queue (locked) -> output queue (single-threaded)
+ *    input queue (per-thread) -> wait queue (lock-free) -> output queue (single-threaded)
+ *
+ * The wait queue is a multi-producer/single-consumer stack of batches.  An
+ * input thread wraps its whole input queue into a batch and pushes it to
+ * the top of the stack using compare-and-swap.  The output thread takes
+ * the complete stack at once (again using compare-and-swap), reverses it
+ * and appends the batches to the output queue.  As the consumer always
+ * takes the whole stack, a batch is never removed while a producer is
+ * looking at it, thus the usual ABA problem of lock-free stacks does not
+ * apply here.  Ordering is preserved within a batch and between the
+ * batches of the same input thread.
  *
  * Fastpath is:
  *   - input threads putting elements on their per-thread queue (lockless)
+ *   - input threads pushing their batch to the wait queue (lockless)
  *   - output threads removing elements from the output queue (lockless)
  *
  * Slowpath:
- *   - input queue is overflown (or the input thread goes to sleep), wait
- *     queue mutex is grabbed, all elements are put to the wait queue.
+ *   - the output thread is waiting for items (e.g. a parallel push
+ *     callback is registered), the input thread grabs the queue lock to
+ *     wake it up.
+ *
+ * Priority mode:
+ *   - the output queue is split into lanes, one for each syslog severity.
+ *     Lanes are drained in the order of severity, e.g. emerg messages
+ *     are sent first.
  *
- *   - output queue is depleted, wait queue mutex is grabbed, all elements
- *     on the wait queue is put to the output queue
+ *   - when the queue is full, input threads still admit messages as long
+ *     as there are enough less important messages in the queue, those are
+ *     dropped by the output thread once it moves the wait queue to the
+ *     lanes.  Thus the queue may temporarily grow up to twice its size.
  *
  * Threading assumptions:
  *   - the head of the queue is only manipulated from the output thread
@@ -69,18 +90,36 @@
  *
  */
 
+/* one lane for each syslog severity, in priority mode */
+#define LOG_QUEUE_FIFO_LANES 8
+
+typedef struct _LogQueueFifoBatch LogQueueFifoBatch;
+
+struct _LogQueueFifoBatch
+{
+  LogQueueFifoBatch *next;
+  struct iv_list_head items;
+  gint len;
+  gssize size;
+};
 
 typedef struct _LogQueueFifo
 {
   LogQueue super;
   
   /* scalable qoverflow implementation */
-  struct iv_list_head qoverflow_output;
-  struct iv_list_head qoverflow_wait;
-  gint qoverflow_wait_len;
+  struct iv_list_head qoverflow_output[LOG_QUEUE_FIFO_LANES];
+  LogQueueFifoBatch *qoverflow_wait;  /* top of the lock-free stack of batches */
+  gint qoverflow_wait_len;            /* updated atomically */
   gint qoverflow_output_len;
   gint qoverflow_size; /* in number of elements */
 
+  /* only lane 0 is used unless priority mode is enabled */
+  gboolean priority;
+  /* number of messages per lane in the wait and output queues, updated
+   * atomically, only maintained in priority mode */
+  gint lane_len[LOG_QUEUE_FIFO_LANES];
+
   struct iv_list_head qbacklog;    /* entries that were sent but not acked yet */
   gint qbacklog_len;
 
@@ -88,17 +127,19 @@ typedef struct _LogQueueFifo
   {
     struct iv_list_head items;
     MainLoopIOWorkerFinishCallback cb;
+    gssize size;
     guint16 len;
     guint16 finish_cb_registered;
   } qoverflow_input[0];
 } LogQueueFifo;
 
-/* NOTE: this is inherently racy. If the LogQueue->lock is taken, then the
- * race is limited to the changes in qoverflow_output queue changes.
+/* NOTE: this is inherently racy. The wait queue can grow at any time as
+ * the input threads push their batches without locking.
  *
- * In the output thread, this means that this can get race-free. In the
- * input thread, the qoverflow_output can change because of a
- * log_queue_fifo_push_head() or log_queue_fifo_rewind_backlog().
+ * In the output thread, this means that the returned value is a lower
+ * bound. In the input thread, the qoverflow_output can change because of
+ * a log_queue_fifo_push_head(), log_queue_fifo_rewind_backlog() or
+ * log_queue_fifo_pop_head().
  *
  */
 static gint64
@@ -106,7 +147,7 @@ log_queue_fifo_get_length(LogQueue *s)
 {
   LogQueueFifo *self = (LogQueueFifo *) s;
 
-  return self->qoverflow_wait_len + self->qoverflow_output_len;
+  return g_atomic_int_get(&self->qoverflow_wait_len) + self->qoverflow_output_len;
 }
 
 /* NOTE: this is inherently racy, can only be called if log processing is suspended (e.g. reload time) */
@@ -116,15 +157,159 @@ log_queue_fifo_keep_on_reload(LogQueue *s)
   return log_queue_fifo_get_length(s) > 0;
 }
 
-/* move items from the per-thread input queue to the lock-protected "wait" queue */
+static inline gint
+log_queue_fifo_get_lane(LogQueueFifo *self, LogMessage *msg)
+{
+  return self->priority ? (msg->pri & LOG_PRIMASK) : 0;
+}
+
+/* returns the first message of the most important non-empty lane */
+static inline LogMessageQueueNode *
+log_queue_fifo_peek_output(LogQueueFifo *self)
+{
+  gint lane;
+
+  for (lane = 0; lane < LOG_QUEUE_FIFO_LANES; lane++)
+    {
+      if (!iv_list_empty(&self->qoverflow_output[lane]))
+        return iv_list_entry(self->qoverflow_output[lane].next, LogMessageQueueNode, list);
+      if (!self->priority)
+        break;
+    }
+  return NULL;
+}
+
+/* accounts a message added to (@diff > 0) or removed from the wait or output queues */
+static inline void
+log_queue_fifo_lane_len_add(LogQueueFifo *self, LogMessage *msg, gint diff)
+{
+  if (self->priority)
+    g_atomic_int_add(&self->lane_len[msg->pri & LOG_PRIMASK], diff);
+}
+
+/* NOTE: racy, the number of queued messages less important than @lane */
+static gint
+log_queue_fifo_get_lower_lanes_len(LogQueueFifo *self, gint lane)
+{
+  gint len = 0;
+
+  for (lane++; lane < LOG_QUEUE_FIFO_LANES; lane++)
+    len += g_atomic_int_get(&self->lane_len[lane]);
+  return len;
+}
+
+/* push a batch to the top of the wait queue, can be called from any thread */
+static void
+log_queue_fifo_push_wait_batch(LogQueueFifo *self, LogQueueFifoBatch *batch)
+{
+  LogQueueFifoBatch *top;
+
+  stats_counter_add(self->super.stored_messages, batch->len);
+  log_queue_memory_usage_add(&self->super, batch->size);
+  g_atomic_int_add(&self->qoverflow_wait_len, batch->len);
+  do
+    {
+      top = g_atomic_pointer_get((gpointer *) &self->qoverflow_wait);
+      batch->next = top;
+    }
+  while (!g_atomic_pointer_compare_and_exchange((gpointer *) &self->qoverflow_wait, top, batch));
+
+  /* The output thread registers its callback first and checks the queue
+   * length afterwards (see log_queue_check_items()), while we publish the
+   * batch first and check the callback afterwards.  Both sides use full
+   * memory barriers, thus at least one of them notices the other.
+   *
+   * The lock is only needed if the output thread is waiting for items. */
+  if (g_atomic_pointer_get((gpointer *) &self->super.parallel_push_notify))
+    {
+      g_static_mutex_lock(&self->super.lock);
+      log_queue_push_notify(&self->super);
+      g_static_mutex_unlock(&self->super.lock);
+    }
+}
+
+static void
+log_queue_fifo_drop_input_node(LogQueueFifo *self, gint thread_id, LogMessageQueueNode *node)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg = node->msg;
+
+  iv_list_del(&node->list);
+  self->qoverflow_input[thread_id].len--;
+  self->qoverflow_input[thread_id].size -= node->size;
+  path_options.ack_needed = node->ack_needed;
+  stats_counter_inc(self->super.dropped_messages);
+  log_msg_free_queue_node(node);
+  log_msg_drop(msg, &path_options);
+}
+
+/*
+ * Priority mode admission: a message is admitted to a full queue only if
+ * there are enough less important messages queued, which are dropped by
+ * log_queue_fifo_trim_lanes() in exchange.  This is racy just like the
+ * plain queue_len check.
+ */
+static void
+log_queue_fifo_drop_input_by_priority(LogQueueFifo *self, gint thread_id, gint queue_len)
+{
+  gint lane_len[LOG_QUEUE_FIFO_LANES];
+  struct iv_list_head *lh, *lh_next;
+  gint excess, lane, n = 0;
+
+  excess = queue_len - self->qoverflow_size;
+  if (excess + self->qoverflow_input[thread_id].len <= 0)
+    return;
+
+  for (lane = 0; lane < LOG_QUEUE_FIFO_LANES; lane++)
+    lane_len[lane] = g_atomic_int_get(&self->lane_len[lane]);
+
+  iv_list_for_each_safe(lh, lh_next, &self->qoverflow_input[thread_id].items)
+    {
+      LogMessageQueueNode *node = iv_list_entry(lh, LogMessageQueueNode, list);
+      gint node_lane = node->msg->pri & LOG_PRIMASK;
+
+      if (excess >= 0)
+        {
+          gint lower = 0;
+
+          for (lane = node_lane + 1; lane < LOG_QUEUE_FIFO_LANES; lane++)
+            lower += lane_len[lane];
+
+          if (lower <= excess)
+            {
+              log_queue_fifo_drop_input_node(self, thread_id, node);
+              n++;
+              continue;
+            }
+        }
+      lane_len[node_lane]++;
+      excess++;
+    }
+
+  if (n > 0)
+    {
+      msg_debug("Destination queue full, dropping messages",
+                evt_tag_int("queue_len", queue_len),
+                evt_tag_int("log_fifo_size", self->qoverflow_size),
+                evt_tag_int("count", n),
+                NULL);
+    }
+}
+
+/* move items from the per-thread input queue to the lock-free "wait" queue */
 static void
-log_queue_fifo_move_input_unlocked(LogQueueFifo *self, gint thread_id)
+log_queue_fifo_move_input_batch(LogQueueFifo *self, gint thread_id)
 {
+  LogQueueFifoBatch *batch;
   gint queue_len;
 
+  if (self->qoverflow_input[thread_id].len == 0)
+    return;
+
   /* since we're in the input thread, queue_len will be racy. It can
-   * increase due to log_queue_fifo_push_head() and can also decrease as
-   * items are removed from the output queue using log_queue_pop_head().
+   * increase due to log_queue_fifo_push_head() or other input threads
+   * pushing their batches and can also decrease as items are removed
+   * from the output queue using log_queue_pop_head().
    *
    * The only reason we're using it here is to check for qoverflow
    * overflows, however the only side-effect of the race (if lost) is that
@@ -136,11 +321,14 @@ log_queue_fifo_move_input_unlocked(LogQueueFifo *self, gint thread_id)
    */
 
   queue_len = log_queue_fifo_get_length(&self->super);
-  if (queue_len + self->qoverflow_input[thread_id].len > self->qoverflow_size)
+  if (self->priority)
+    {
+      log_queue_fifo_drop_input_by_priority(self, thread_id, queue_len);
+    }
+  else if (queue_len + self->qoverflow_input[thread_id].len > self->qoverflow_size)
     {
       /* slow path, the input thread's queue would overflow the queue, let's drop some messages */
 
-      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
       gint i;
       gint n;
 
@@ -151,14 +339,8 @@ log_queue_fifo_move_input_unlocked(LogQueueFifo *self, gint thread_id)
       for (i = 0; i < n; i++)
         {
           LogMessageQueueNode *node = iv_list_entry(self->qoverflow_input[thread_id].items.next, LogMessageQueueNode, list);
-          LogMessage *msg = node->msg;
 
-          iv_list_del(&node->list);
-          self->qoverflow_input[thread_id].len--;
-          path_options.ack_needed = node->ack_needed;
-          stats_counter_inc(self->super.dropped_messages);
-          log_msg_free_queue_node(node);
-          log_msg_drop(msg, &path_options);
+          log_queue_fifo_drop_input_node(self, thread_id, node);
         }
       msg_debug("Destination queue full, dropping messages",
                 evt_tag_int("queue_len", queue_len),
@@ -166,16 +348,76 @@ log_queue_fifo_move_input_unlocked(LogQueueFifo *self, gint thread_id)
                 evt_tag_int("count", n),
                 NULL);
     }
-  stats_counter_add(self->super.stored_messages, self->qoverflow_input[thread_id].len);
-  iv_list_splice_tail_init(&self->qoverflow_input[thread_id].items, &self->qoverflow_wait);
-  self->qoverflow_wait_len += self->qoverflow_input[thread_id].len;
+
+  if (log_queue_memory_usage_exceeded(&self->super, self->qoverflow_input[thread_id].size))
+    {
+      /* the batch would exceed the memory limit, drop the oldest messages
+       * until it fits. Flow-controlled messages are kept, but their
+       * sources are suspended until the queue is drained. This has to
+       * happen before the batch is published, so that their acks cannot
+       * overtake the suspension. */
+
+      struct iv_list_head *lh, *lh_next;
+      gint n = 0;
+
+      iv_list_for_each_safe(lh, lh_next, &self->qoverflow_input[thread_id].items)
+        {
+          LogMessageQueueNode *node = iv_list_entry(lh, LogMessageQueueNode, list);
+
+          if (!log_queue_memory_usage_exceeded(&self->super, self->qoverflow_input[thread_id].size))
+            break;
+          if (node->flow_control_requested)
+            {
+              log_source_flow_control_suspend(node->msg);
+              continue;
+            }
+
+          log_queue_fifo_drop_input_node(self, thread_id, node);
+          n++;
+        }
+      msg_debug("Destination queue memory limit reached, dropping messages",
+                evt_tag_printf("memory_usage", "%" G_GSSIZE_FORMAT, self->super.memory_usage),
+                evt_tag_printf("log_fifo_bytes", "%" G_GSSIZE_FORMAT, self->super.memory_usage_limit),
+                evt_tag_int("count", n),
+                NULL);
+    }
+
+  if (self->qoverflow_input[thread_id].len == 0)
+    return;
+
+  if (self->priority)
+    {
+      gint lane_len[LOG_QUEUE_FIFO_LANES] = { 0 };
+      struct iv_list_head *lh;
+      gint lane;
+
+      iv_list_for_each(lh, &self->qoverflow_input[thread_id].items)
+        {
+          LogMessageQueueNode *node = iv_list_entry(lh, LogMessageQueueNode, list);
+
+          lane_len[node->msg->pri & LOG_PRIMASK]++;
+        }
+      for (lane = 0; lane < LOG_QUEUE_FIFO_LANES; lane++)
+        {
+          if (lane_len[lane])
+            g_atomic_int_add(&self->lane_len[lane], lane_len[lane]);
+        }
+    }
+
+  batch = g_slice_new(LogQueueFifoBatch);
+  INIT_IV_LIST_HEAD(&batch->items);
+  iv_list_splice_tail_init(&self->qoverflow_input[thread_id].items, &batch->items);
+  batch->len = self->qoverflow_input[thread_id].len;
+  batch->size = self->qoverflow_input[thread_id].size;
   self->qoverflow_input[thread_id].len = 0;
+  self->qoverflow_input[thread_id].size = 0;
+
+  log_queue_fifo_push_wait_batch(self, batch);
 }
 
-/* move items from the per-thread input queue to the lock-protected
- * "wait" queue, but grabbing locks first. This is registered as a
- * callback to be called when the input worker thread finishes its
- * job.
+/* move items from the per-thread input queue to the "wait" queue. This
+ * is registered as a callback to be called when the input worker thread
+ * finishes its job.
  */
 static gpointer
 log_queue_fifo_move_input(gpointer user_data)
@@ -187,14 +429,113 @@ log_queue_fifo_move_input(gpointer user_data)
 
   g_assert(thread_id >= 0);
 
-  g_static_mutex_lock(&self->super.lock);
-  log_queue_fifo_move_input_unlocked(self, thread_id);
-  log_queue_push_notify(&self->super);
-  g_static_mutex_unlock(&self->super.lock);
+  log_queue_fifo_move_input_batch(self, thread_id);
   self->qoverflow_input[thread_id].finish_cb_registered = FALSE;
   return NULL;
 }
 
+/* drop the least important messages while the queue is over its
+ * size, can only be called from the output thread in priority mode */
+static void
+log_queue_fifo_trim_lanes(LogQueueFifo *self)
+{
+  gint lane = LOG_QUEUE_FIFO_LANES - 1;
+  gssize released = 0;
+  gint n = 0;
+
+  while (self->qoverflow_output_len > self->qoverflow_size && lane >= 0)
+    {
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessageQueueNode *node;
+      LogMessage *msg;
+
+      if (iv_list_empty(&self->qoverflow_output[lane]))
+        {
+          lane--;
+          continue;
+        }
+
+      /* drop the newest message of the lane */
+      node = iv_list_entry(self->qoverflow_output[lane].prev, LogMessageQueueNode, list);
+      msg = node->msg;
+      iv_list_del(&node->list);
+      self->qoverflow_output_len--;
+      g_atomic_int_add(&self->lane_len[lane], -1);
+      released += node->size;
+      path_options.ack_needed = node->ack_needed;
+      log_msg_free_queue_node(node);
+      log_msg_drop(msg, &path_options);
+      n++;
+    }
+
+  if (n > 0)
+    {
+      stats_counter_add(self->super.dropped_messages, n);
+      stats_counter_add(self->super.stored_messages, -n);
+      log_queue_memory_usage_add(&self->super, -released);
+      msg_debug("Destination queue full, dropping less important messages",
+                evt_tag_int("log_fifo_size", self->qoverflow_size),
+                evt_tag_int("count", n),
+                NULL);
+    }
+}
+
+/* take all batches from the wait queue and append them to the output
+ * queue, can only be called from the output thread */
+static void
+log_queue_fifo_move_wait(LogQueueFifo *self)
+{
+  LogQueueFifoBatch *top, *batch, *reversed = NULL;
+  gint len = 0;
+
+  do
+    {
+      top = g_atomic_pointer_get((gpointer *) &self->qoverflow_wait);
+      if (!top)
+        return;
+    }
+  while (!g_atomic_pointer_compare_and_exchange((gpointer *) &self->qoverflow_wait, top, NULL));
+
+  /* the stack returns the batches newest first, restore the original order */
+  while (top)
+    {
+      batch = top;
+      top = batch->next;
+      batch->next = reversed;
+      reversed = batch;
+    }
+
+  while (reversed)
+    {
+      batch = reversed;
+      reversed = batch->next;
+      if (!self->priority)
+        {
+          iv_list_splice_tail_init(&batch->items, &self->qoverflow_output[0]);
+        }
+      else
+        {
+          while (!iv_list_empty(&batch->items))
+            {
+              LogMessageQueueNode *node = iv_list_entry(batch->items.next, LogMessageQueueNode, list);
+
+              iv_list_del(&node->list);
+              iv_list_add_tail(&node->list, &self->qoverflow_output[node->msg->pri & LOG_PRIMASK]);
+            }
+        }
+      len += batch->len;
+      g_slice_free(LogQueueFifoBatch, batch);
+    }
+
+  /* increase the output queue first, so that the racy get_length() in the
+   * input threads doesn't underestimate the queue */
+  self->qoverflow_output_len += len;
+  g_atomic_int_add(&self->qoverflow_wait_len, -len);
+
+  if (self->priority)
+    log_queue_fifo_trim_lanes(self);
+}
+
 /**
  * Assumed to be called from one of the input threads. If the thread_id
  * cannot be determined, the item is put directly in the wait queue.
@@ -243,39 +584,42 @@ log_queue_fifo_push_tail(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
       node = log_msg_alloc_queue_node(msg, path_options);
       iv_list_add_tail(&node->list, &self->qoverflow_input[thread_id].items);
       self->qoverflow_input[thread_id].len++;
+      self->qoverflow_input[thread_id].size += node->size;
       log_msg_unref(msg);
       return;
     }
 
-  /* slow path, put the pending item and the whole input queue to the wait_queue */
+  /* slow path, put the pending item to the wait_queue as a single-item batch */
 
-  g_static_mutex_lock(&self->super.lock);
-  
-  if (thread_id >= 0)
-    log_queue_fifo_move_input_unlocked(self, thread_id);
-  
-  if (log_queue_fifo_get_length(s) < self->qoverflow_size)
+  if ((log_queue_fifo_get_length(s) < self->qoverflow_size ||
+       (self->priority && log_queue_fifo_get_lower_lanes_len(self, msg->pri & LOG_PRIMASK) >
+                          log_queue_fifo_get_length(s) - self->qoverflow_size)) &&
+      (path_options->flow_control_requested || !log_queue_memory_usage_exceeded(s, log_msg_get_size(msg))))
     {
-      node = log_msg_alloc_queue_node(msg, path_options);
-
-      iv_list_add_tail(&node->list, &self->qoverflow_wait);
-      self->qoverflow_wait_len++;
-      log_queue_push_notify(&self->super);
+      LogQueueFifoBatch *batch;
 
-      stats_counter_inc(self->super.stored_messages);
-      g_static_mutex_unlock(&self->super.lock);
+      if (path_options->flow_control_requested && log_queue_memory_usage_exceeded(s, log_msg_get_size(msg)))
+        log_source_flow_control_suspend(msg);
+      log_queue_fifo_lane_len_add(self, msg, 1);
+      node = log_msg_alloc_queue_node(msg, path_options);
+      batch = g_slice_new(LogQueueFifoBatch);
+      INIT_IV_LIST_HEAD(&batch->items);
+      iv_list_add_tail(&node->list, &batch->items);
+      batch->len = 1;
+      batch->size = node->size;
 
       log_msg_unref(msg);
+      log_queue_fifo_push_wait_batch(self, batch);
     }
   else
     {
       stats_counter_inc(self->super.dropped_messages);
-      g_static_mutex_unlock(&self->super.lock);
       log_msg_drop(msg, path_options);
 
       msg_debug("Destination queue full, dropping message",
                 evt_tag_int("queue_len", log_queue_fifo_get_length(&self->super)),
                 evt_tag_int("log_fifo_size", self->qoverflow_size),
+                evt_tag_printf("memory_usage", "%" G_GSSIZE_FORMAT, self->super.memory_usage),
                 NULL);
     }
   return;
@@ -301,11 +645,13 @@ log_queue_fifo_push_head(LogQueue *s, LogMessage *msg, const LogPathOptions *pat
   log_queue_assert_output_thread(s);
 
   node = log_msg_alloc_dynamic_queue_node(msg, path_options);
-  iv_list_add(&node->list, &self->qoverflow_output);
+  iv_list_add(&node->list, &self->qoverflow_output[log_queue_fifo_get_lane(self, msg)]);
   self->qoverflow_output_len++;
+  log_queue_fifo_lane_len_add(self, msg, 1);
   log_msg_unref(msg);
 
   stats_counter_inc(self->super.stored_messages);
+  log_queue_memory_usage_add(s, node->size);
 }
 
 /*
@@ -326,26 +672,25 @@ log_queue_fifo_pop_head(LogQueue *s, LogMessage **msg, LogPathOptions *path_opti
       return FALSE;
     }
     
-  if (self->qoverflow_output_len == 0)
+  if (self->qoverflow_output_len == 0 || self->priority)
     {
-      /* slow path, output queue is empty, get some elements from the wait queue */
-      g_static_mutex_lock(&self->super.lock);
-      iv_list_splice_tail_init(&self->qoverflow_wait, &self->qoverflow_output);
-      self->qoverflow_output_len = self->qoverflow_wait_len;
-      self->qoverflow_wait_len = 0;
-      g_static_mutex_unlock(&self->super.lock);
+      /* slow path, output queue is empty, get some elements from the wait
+       * queue. In priority mode, a more important message may be waiting. */
+      log_queue_fifo_move_wait(self);
     }
 
   if (self->qoverflow_output_len > 0)
     {
-      node = iv_list_entry(self->qoverflow_output.next, LogMessageQueueNode, list);
+      node = log_queue_fifo_peek_output(self);
 
       *msg = node->msg;
       path_options->ack_needed = node->ack_needed;
       self->qoverflow_output_len--;
+      log_queue_fifo_lane_len_add(self, node->msg, -1);
       if (!push_to_backlog)
         {
           iv_list_del(&node->list);
+          log_queue_memory_usage_add(s, -(gssize) node->size);
           log_msg_free_queue_node(node);
         }
       else
@@ -381,6 +726,64 @@ log_queue_fifo_pop_head(LogQueue *s, LogMessage **msg, LogPathOptions *path_opti
   return TRUE;
 }
 
+/*
+ * Same as log_queue_fifo_pop_head(), but pops at most @max messages at
+ * once, adjusting the counters only once per batch.
+ *
+ * Can only run from the output thread.
+ */
+static gint
+log_queue_fifo_pop_head_batch(LogQueue *s, LogMessage **msgs, LogPathOptions *path_options, gint max, gboolean push_to_backlog, gboolean ignore_throttle)
+{
+  LogQueueFifo *self = (LogQueueFifo *) s;
+  gssize released = 0;
+  gint count = 0;
+
+  log_queue_assert_output_thread(s);
+
+  if (!ignore_throttle && self->super.throttle)
+    max = MIN(max, self->super.throttle_buckets);
+
+  if (self->qoverflow_output_len < max || self->priority)
+    log_queue_fifo_move_wait(self);
+
+  while (count < max && self->qoverflow_output_len > 0)
+    {
+      LogMessageQueueNode *node;
+
+      node = log_queue_fifo_peek_output(self);
+      msgs[count] = node->msg;
+      path_options[count].ack_needed = node->ack_needed;
+      self->qoverflow_output_len--;
+      log_queue_fifo_lane_len_add(self, node->msg, -1);
+
+      if (push_to_backlog)
+        {
+          log_msg_ref(node->msg);
+          iv_list_del(&node->list);
+          iv_list_add_tail(&node->list, &self->qbacklog);
+        }
+      else
+        {
+          iv_list_del(&node->list);
+          released += node->size;
+          log_msg_free_queue_node(node);
+        }
+      count++;
+    }
+
+  if (count == 0)
+    return 0;
+
+  stats_counter_add(self->super.stored_messages, -count);
+  log_queue_memory_usage_add(s, -released);
+  if (push_to_backlog)
+    self->qbacklog_len += count;
+  if (!ignore_throttle && self->super.throttle_buckets > 0)
+    self->super.throttle_buckets -= count;
+  return count;
+}
+
 /*
  * Can only run from the output thread.
  */
@@ -390,6 +793,7 @@ log_queue_fifo_ack_backlog(LogQueue *s, gint n)
   LogQueueFifo *self = (LogQueueFifo *) s;
   LogMessage *msg;
   LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gssize released = 0;
   gint i;
 
   log_queue_assert_output_thread(s);
@@ -401,6 +805,7 @@ log_queue_fifo_ack_backlog(LogQueue *s, gint n)
       node = iv_list_entry(self->qbacklog.next, LogMessageQueueNode, list);
       msg = node->msg;
       path_options.ack_needed = node->ack_needed;
+      released += node->size;
 
       iv_list_del(&node->list);
       log_msg_free_queue_node(node);
@@ -409,6 +814,7 @@ log_queue_fifo_ack_backlog(LogQueue *s, gint n)
       log_msg_ack(msg, &path_options);
       log_msg_unref(msg);
     }
+  log_queue_memory_usage_add(s, -released);
 }
 
 
@@ -420,6 +826,9 @@ log_queue_fifo_ack_backlog(LogQueue *s, gint n)
  * somewhere. The backlog is emptied as that will be filled if we send the
  * items again.
  *
+ * In priority mode the items are put back to the front of their lanes,
+ * as they were taken from there.
+ *
  * NOTE: this is assumed to be called from the output thread.
  */
 static void
@@ -429,7 +838,21 @@ log_queue_fifo_rewind_backlog(LogQueue *s)
 
   log_queue_assert_output_thread(s);
 
-  iv_list_splice_tail_init(&self->qbacklog, &self->qoverflow_output);
+  if (!self->priority)
+    {
+      iv_list_splice_tail_init(&self->qbacklog, &self->qoverflow_output[0]);
+    }
+  else
+    {
+      while (!iv_list_empty(&self->qbacklog))
+        {
+          LogMessageQueueNode *node = iv_list_entry(self->qbacklog.prev, LogMessageQueueNode, list);
+
+          iv_list_del(&node->list);
+          iv_list_add(&node->list, &self->qoverflow_output[node->msg->pri & LOG_PRIMASK]);
+          log_queue_fifo_lane_len_add(self, node->msg, 1);
+        }
+    }
   self->qoverflow_output_len += self->qbacklog_len;
   stats_counter_add(self->super.stored_messages, self->qbacklog_len);
   self->qbacklog_len = 0;
@@ -464,8 +887,9 @@ log_queue_fifo_free(LogQueue *s)
   for (i = 0; i < log_queue_max_threads; i++)
     log_queue_fifo_free_queue(&self->qoverflow_input[i].items);
 
-  log_queue_fifo_free_queue(&self->qoverflow_wait);
-  log_queue_fifo_free_queue(&self->qoverflow_output);
+  log_queue_fifo_move_wait(self);
+  for (i = 0; i < LOG_QUEUE_FIFO_LANES; i++)
+    log_queue_fifo_free_queue(&self->qoverflow_output[i]);
   log_queue_fifo_free_queue(&self->qbacklog);
   log_queue_free_method(s);
 }
@@ -484,6 +908,7 @@ log_queue_fifo_new(gint qoverflow_size, const gchar *persist_name)
   self->super.push_tail = log_queue_fifo_push_tail;
   self->super.push_head = log_queue_fifo_push_head;
   self->super.pop_head = log_queue_fifo_pop_head;
+  self->super.pop_head_batch = log_queue_fifo_pop_head_batch;
   self->super.ack_backlog = log_queue_fifo_ack_backlog;
   self->super.rewind_backlog = log_queue_fifo_rewind_backlog;
 
@@ -496,10 +921,20 @@ log_queue_fifo_new(gint qoverflow_size, const gchar *persist_name)
       self->qoverflow_input[i].cb.user_data = self;
       self->qoverflow_input[i].cb.func = log_queue_fifo_move_input;
     }
-  INIT_IV_LIST_HEAD(&self->qoverflow_wait);
-  INIT_IV_LIST_HEAD(&self->qoverflow_output);
+  for (i = 0; i < LOG_QUEUE_FIFO_LANES; i++)
+    INIT_IV_LIST_HEAD(&self->qoverflow_output[i]);
   INIT_IV_LIST_HEAD(&self->qbacklog);
 
   self->qoverflow_size = qoverflow_size;
   return &self->super;
 }
+
+/* NOTE: can only be changed while the queue is empty */
+void
+log_queue_fifo_set_priority(LogQueue *s, gboolean priority)
+{
+  LogQueueFifo *self = (LogQueueFifo *) s;
+
+  g_assert(log_queue_fifo_get_length(s) == 0 && self->qbacklog_len == 0);
+  self->priority = priority;
+}
@@ -28,6 +28,56 @@
 
 gint log_queue_max_threads = 0;
 
+/* the number of bytes used by all queues */
+static gssize log_queue_total_memory_usage = 0;
+StatsCounterItem *log_queue_total_memory_usage_counter;
+
+/* GLib doesn't have pointer sized atomic add in older versions */
+static inline gssize
+_atomic_ssize_add(gssize *value, gssize add)
+{
+  gssize old;
+
+  do
+    {
+      old = (gssize) g_atomic_pointer_get((gpointer *) value);
+    }
+  while (!g_atomic_pointer_compare_and_exchange((gpointer *) value, (gpointer) old, (gpointer) (old + add)));
+  return old + add;
+}
+
+/* the 32 bit stats counter receives the change of @value in KiB, as in
+ * bytes it would wrap at 2GiB */
+static inline void
+_counter_add_kib(StatsCounterItem *counter, gssize *value, gssize size)
+{
+  gssize new_value = _atomic_ssize_add(value, size);
+  gssize diff = (new_value >> 10) - ((new_value - size) >> 10);
+
+  if (diff != 0)
+    stats_counter_add(counter, diff);
+}
+
+/*
+ * Accounts @size bytes (negative if released) to the queue and to the
+ * global memory usage. Can be called from any thread.
+ */
+void
+log_queue_memory_usage_add(LogQueue *self, gssize size)
+{
+  if (size == 0)
+    return;
+
+  _counter_add_kib(self->memory_usage_counter, &self->memory_usage, size);
+  _counter_add_kib(log_queue_total_memory_usage_counter, &log_queue_total_memory_usage, size);
+}
+
+gssize
+log_queue_get_total_memory_usage(void)
+{
+  return (gssize) g_atomic_pointer_get((gpointer *) &log_queue_total_memory_usage);
+}
+
 /*
  * When this is called, it is assumed that the output thread is currently
  * not running (since this is the function that wakes it up), thus we can
@@ -110,7 +160,6 @@ log_queue_check_items(LogQueue *self, gint batch_items, gboolean *partial_batch,
   num_elements = log_queue_get_length(self);
   if (num_elements == 0 || num_elements < batch_items)
     {
-      self->parallel_push_notify = parallel_push_notify;
       self->parallel_push_data = user_data;
       self->parallel_push_data_destroy = user_data_destroy;
       if (num_elements == 0)
@@ -133,8 +182,20 @@ log_queue_check_items(LogQueue *self, gint batch_items, gboolean *partial_batch,
             *partial_batch = TRUE;
           self->parallel_push_notify_limit = batch_items;
         }
-      g_static_mutex_unlock(&self->lock);
-      return FALSE;
+
+      /* NOTE: queue implementations may add items without grabbing
+       * self->lock and only take it if a callback is registered, thus the
+       * callback is published first and the length is checked again
+       * afterwards, with a full memory barrier in between. */
+      g_atomic_pointer_set((gpointer *) &self->parallel_push_notify, parallel_push_notify);
+      num_elements = log_queue_get_length(self);
+      if (num_elements < self->parallel_push_notify_limit)
+        {
+          g_static_mutex_unlock(&self->lock);
+          return FALSE;
+        }
+      if (partial_batch)
+        *partial_batch = FALSE;
     }
 
   /* consume the user_data reference as we won't use the callback */
@@ -196,17 +257,31 @@ log_queue_check_items(LogQueue *self, gint batch_items, gboolean *partial_batch,
 }
 
 void
-log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsCounterItem *dropped_messages)
+log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsCounterItem *dropped_messages, StatsCounterItem *memory_usage)
 {
   self->stored_messages = stored_messages;
   self->dropped_messages = dropped_messages;
+  self->memory_usage_counter = memory_usage;
   stats_counter_set(self->stored_messages, log_queue_get_length(self));
+  stats_counter_set(self->memory_usage_counter, (gssize) g_atomic_pointer_get((gpointer *) &self->memory_usage) >> 10);
+}
+
+/* generic implementation for queues that have no specialized batch method */
+static gint
+log_queue_pop_head_batch_method(LogQueue *self, LogMessage **msgs, LogPathOptions *path_options, gint max, gboolean push_to_backlog, gboolean ignore_throttle)
+{
+  gint count = 0;
+
+  while (count < max && self->pop_head(self, &msgs[count], &path_options[count], push_to_backlog, ignore_throttle))
+    count++;
+  return count;
 }
 
 void
 log_queue_init_instance(LogQueue *self, const gchar *persist_name)
 {
   self->ref_cnt = 1;
+  self->pop_head_batch = log_queue_pop_head_batch_method;
   self->free_fn = log_queue_free_method;
 
   self->persist_name = persist_name ? g_strdup(persist_name) : NULL;
@@ -216,6 +291,8 @@ log_queue_init_instance(LogQueue *self, const gchar *persist_name)
 void
 log_queue_free_method(LogQueue *self)
 {
+  /* messages still in the queue are released without accounting */
+  log_queue_memory_usage_add(self, -self->memory_usage);
   g_free(self->persist_name);
   g_free(self);
 }
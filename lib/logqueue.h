@@ -27,8 +27,10 @@
 
 #include "logmsg.h"
 #include "stats.h"
+#include "persist-state.h"
 
 extern gint log_queue_max_threads;
+extern StatsCounterItem *log_queue_total_memory_usage_counter;
 
 typedef void (*LogQueuePushNotifyFunc)(gpointer user_data);
 
@@ -46,6 +48,12 @@ struct _LogQueue
   gchar *persist_name;
   StatsCounterItem *stored_messages;
   StatsCounterItem *dropped_messages;
+  StatsCounterItem *memory_usage_counter;
+
+  /* the number of bytes used by the queued messages (including the
+   * backlog), updated atomically, limited by memory_usage_limit if nonzero */
+  gssize memory_usage;
+  gssize memory_usage_limit;
 
   GStaticMutex lock;
   gint parallel_push_notify_limit;
@@ -59,8 +67,11 @@ struct _LogQueue
   void (*push_tail)(LogQueue *self, LogMessage *msg, const LogPathOptions *path_options);
   void (*push_head)(LogQueue *self, LogMessage *msg, const LogPathOptions *path_options);
   gboolean (*pop_head)(LogQueue *self, LogMessage **msg, LogPathOptions *path_options, gboolean push_to_backlog, gboolean ignore_throttle);
+  gint (*pop_head_batch)(LogQueue *self, LogMessage **msgs, LogPathOptions *path_options, gint max, gboolean push_to_backlog, gboolean ignore_throttle);
   void (*ack_backlog)(LogQueue *self, gint n);
   void (*rewind_backlog)(LogQueue *self);
+  /* saves the state of the queue when it is released by its driver */
+  void (*persist_state)(LogQueue *self, PersistState *state);
 
   void (*free_fn)(LogQueue *self);
 };
@@ -97,6 +108,27 @@ log_queue_pop_head(LogQueue *self, LogMessage **msg, LogPathOptions *path_option
   return self->pop_head(self, msg, path_options, push_to_backlog, ignore_throttle);
 }
 
+/*
+ * Pops at most @max messages into @msgs, with the associated path options
+ * in the @path_options array. Returns the number of messages popped, each
+ * of them is a reference which the caller must take care to free.
+ */
+static inline gint
+log_queue_pop_head_batch(LogQueue *self, LogMessage **msgs, LogPathOptions *path_options, gint max, gboolean push_to_backlog, gboolean ignore_throttle)
+{
+  return self->pop_head_batch(self, msgs, path_options, max, push_to_backlog, ignore_throttle);
+}
+
+/* puts back a batch of messages (or its unprocessed tail) in the original order */
+static inline void
+log_queue_push_head_batch(LogQueue *self, LogMessage **msgs, LogPathOptions *path_options, gint count)
+{
+  gint i;
+
+  for (i = count - 1; i >= 0; i--)
+    self->push_head(self, msgs[i], &path_options[i]);
+}
+
 static inline void
 log_queue_rewind_backlog(LogQueue *self)
 {
@@ -109,6 +141,13 @@ log_queue_ack_backlog(LogQueue *self, gint n)
   return self->ack_backlog(self, n);
 }
 
+static inline void
+log_queue_persist_state(LogQueue *self, PersistState *state)
+{
+  if (self->persist_state)
+    self->persist_state(self, state);
+}
+
 static inline LogQueue *
 log_queue_ref(LogQueue *self)
 {
@@ -123,6 +162,20 @@ log_queue_unref(LogQueue *self)
     self->free_fn(self);
 }
 
+static inline void
+log_queue_set_memory_usage_limit(LogQueue *self, gssize limit)
+{
+  self->memory_usage_limit = limit;
+}
+
+/* NOTE: this is racy, just like the queue length checks in the input threads */
+static inline gboolean
+log_queue_memory_usage_exceeded(LogQueue *self, gssize size)
+{
+  return self->memory_usage_limit > 0 &&
+         (gssize) g_atomic_pointer_get((gpointer *) &self->memory_usage) + size > self->memory_usage_limit;
+}
+
 static inline void
 log_queue_set_throttle(LogQueue *self, gint throttle)
 {
@@ -150,7 +203,9 @@ void log_queue_push_notify(LogQueue *self);
 void log_queue_reset_parallel_push(LogQueue *self);
 void log_queue_set_parallel_push(LogQueue *self, gint notify_limit, LogQueuePushNotifyFunc parallel_push_notify, gpointer user_data, GDestroyNotify user_data_destroy);
 gboolean log_queue_check_items(LogQueue *self, gint batch_items, gboolean *partial_batch, gint *timeout, LogQueuePushNotifyFunc parallel_push_notify, gpointer user_data, GDestroyNotify user_data_destroy);
-void log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsCounterItem *dropped_messages);
+void log_queue_set_counters(LogQueue *self, StatsCounterItem *stored_messages, StatsCounterItem *dropped_messages, StatsCounterItem *memory_usage);
+void log_queue_memory_usage_add(LogQueue *self, gssize size);
+gssize log_queue_get_total_memory_usage(void);
 void log_queue_init_instance(LogQueue *self, const gchar *persist_name);
 void log_queue_free_method(LogQueue *self);
 
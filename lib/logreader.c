@@ -525,15 +525,31 @@ static gboolean
 log_reader_handle_line(LogReader *self, const guchar *line, gint length, GSockAddr *saddr)
 {
   LogMessage *m;
+  LogMessageBuffer *buffer = NULL;
   LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
   
   msg_debug("Incoming log entry", 
             evt_tag_printf("line", "%.*s", length, line),
             NULL);
+
+  if (self->options->flags & LR_ZERO_COPY)
+    buffer = log_proto_server_get_buffer(self->proto);
+
   /* use the current time to get the time zone offset */
-  m = log_msg_new((gchar *) line, length,
-                  saddr,
-                  &self->options->parse_options);
+  if (buffer)
+    {
+      m = log_msg_new_from_buffer((gchar *) line, length,
+                                  saddr,
+                                  &self->options->parse_options,
+                                  buffer);
+      log_msg_buffer_unref(buffer);
+    }
+  else
+    {
+      m = log_msg_new((gchar *) line, length,
+                      saddr,
+                      &self->options->parse_options);
+    }
 
   log_msg_refcache_start_producer(m);
   if (!m->saddr && self->peer_addr)
@@ -872,6 +888,8 @@ log_reader_options_init(LogReaderOptions *options, GlobalConfig *cfg, const gcha
     }
   if (options->proto_options.super.encoding)
     options->parse_options.flags |= LP_ASSUME_UTF8;
+  if (options->flags & LR_ZERO_COPY)
+    options->proto_options.super.zero_copy = TRUE;
   if (cfg->threaded)
     options->flags |= LR_THREADED;
   options->initialized = TRUE;
@@ -894,6 +912,7 @@ CfgFlagHandler log_reader_flag_handlers[] =
   { "kernel",                     CFH_SET, offsetof(LogReaderOptions, flags),               LR_KERNEL },
   { "empty-lines",                CFH_SET, offsetof(LogReaderOptions, flags),               LR_EMPTY_LINES },
   { "threaded",                   CFH_SET, offsetof(LogReaderOptions, flags),               LR_THREADED },
+  { "zero-copy",                  CFH_SET, offsetof(LogReaderOptions, flags),               LR_ZERO_COPY },
   { NULL },
 };
 
@@ -54,7 +54,8 @@ log_source_msg_ack(LogMessage *msg, gpointer user_data)
   guint32 cur_ack_count, last_ack_count;
   
   old_window_size = g_atomic_counter_exchange_and_add(&self->window_size, 1);
-  if (old_window_size == 0)
+  if (old_window_size == 0 ||
+      (g_atomic_int_get(&self->suspended) && g_atomic_int_compare_and_exchange(&self->suspended, TRUE, FALSE)))
     {
       log_source_wakeup(self);
     }
@@ -120,6 +121,19 @@ log_source_msg_ack(LogMessage *msg, gpointer user_data)
   log_pipe_unref(&self->super);
 }
 
+/* whether the header of a message can be left unparsed while it passes
+ * the source, that is nothing here looks at or changes it */
+static inline gboolean
+log_source_can_defer_parse(LogSource *self)
+{
+  return self->options->keep_hostname &&
+         !self->options->chain_hostnames &&
+         self->options->keep_timestamp &&
+         !self->options->program_override &&
+         !self->options->host_override &&
+         !stats_check_level(2);
+}
+
 void
 log_source_mangle_hostname(LogSource *self, LogMessage *msg)
 {
@@ -130,6 +144,11 @@ log_source_mangle_hostname(LogSource *self, LogMessage *msg)
   resolve_sockaddr(resolved_name, &resolved_name_len, msg->saddr, self->options->use_dns, self->options->use_fqdn, self->options->use_dns_cache, self->options->normalize_hostnames);
   log_msg_set_value(msg, LM_V_HOST_FROM, resolved_name, resolved_name_len);
 
+  /* keep-hostname(yes) without chaining, the deferred parse falls back to
+   * $HOST_FROM if the message has no hostname, see log_source_can_defer_parse() */
+  if (msg->flags & LF_STATE_UNPARSED)
+    return;
+
   orig_host = log_msg_get_value(msg, LM_V_HOST, NULL);
   if (!self->options->keep_hostname || !orig_host || !orig_host[0])
     {
@@ -207,6 +226,10 @@ log_source_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
   
   msg_set_context(msg);
 
+  if ((msg->flags & LF_STATE_UNPARSED) && !log_source_can_defer_parse(self))
+    log_msg_parse_deferred(msg);
+
+  /* the stamp of an unparsed message is overwritten by the deferred parse */
   if (msg->timestamps[LM_TS_STAMP].tv_sec == -1 || !self->options->keep_timestamp)
     msg->timestamps[LM_TS_STAMP] = msg->timestamps[LM_TS_RECVD];
     
@@ -303,6 +326,24 @@ log_source_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
 
 }
 
+/**
+ * log_source_flow_control_suspend:
+ *
+ * Stops reading from the source of @msg until one of its messages is
+ * acked, used by destination queues that are over their memory limit.
+ * @msg itself has not been acked yet, thus there is always an ack that
+ * resumes the source.
+ **/
+void
+log_source_flow_control_suspend(LogMessage *msg)
+{
+  while (msg->original)
+    msg = msg->original;
+
+  if (msg->ack_func == log_source_msg_ack)
+    g_atomic_int_set(&((LogSource *) msg->ack_userdata)->suspended, TRUE);
+}
+
 void
 log_source_set_options(LogSource *self, LogSourceOptions *options, gint stats_level, gint stats_source, const gchar *stats_id, const gchar *stats_instance, gboolean threaded)
 {
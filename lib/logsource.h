@@ -68,6 +68,8 @@ struct _LogSource
   gchar *stats_id;
   gchar *stats_instance;
   GAtomicCounter window_size;
+  /* set by a destination queue over its memory limit, cleared by the next ack */
+  gint suspended;
   StatsCounterItem *last_message_seen;
   StatsCounterItem *recvd_messages;
   guint32 last_ack_count;
@@ -81,7 +83,7 @@ struct _LogSource
 static inline gboolean
 log_source_free_to_send(LogSource *self)
 {
-  return g_atomic_counter_get(&self->window_size) > 0;
+  return g_atomic_counter_get(&self->window_size) > 0 && !g_atomic_int_get(&self->suspended);
 }
 
 gboolean log_source_init(LogPipe *s);
@@ -89,6 +91,7 @@ gboolean log_source_deinit(LogPipe *s);
 
 void log_source_set_options(LogSource *self, LogSourceOptions *options, gint stats_level, gint stats_source, const gchar *stats_id, const gchar *stats_instance, gboolean threaded);
 void log_source_mangle_hostname(LogSource *self, LogMessage *msg);
+void log_source_flow_control_suspend(LogMessage *msg);
 void log_source_init_instance(LogSource *self);
 void log_source_options_defaults(LogSourceOptions *options);
 void log_source_options_init(LogSourceOptions *options, GlobalConfig *cfg, const gchar *group_name);
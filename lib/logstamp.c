@@ -26,6 +26,30 @@
 #include "messages.h"
 #include "timeutils.h"
 #include "str-format.h"
+#include "tls-support.h"
+
+#include <string.h>
+
+/* the part of a formatted timestamp that only changes once a second,
+ * the fraction is appended to the cached prefix for each message */
+typedef struct _LogStampFormatCache
+{
+  gboolean valid;
+  time_t when;
+  glong zone_offset;
+  gint prefix_len;
+  gchar prefix[32];
+  gint suffix_len;
+  gchar suffix[8];
+} LogStampFormatCache;
+
+TLS_BLOCK_START
+{
+  LogStampFormatCache log_stamp_format_cache[TS_FMT_UNIX + 1];
+}
+TLS_BLOCK_END;
+
+#define log_stamp_format_cache  __tls_deref(log_stamp_format_cache)
 
 static void
 log_stamp_append_frac_digits(LogStamp *stamp, GString *target, gint frac_digits)
@@ -61,9 +85,12 @@ log_stamp_append_frac_digits(LogStamp *stamp, GString *target, gint frac_digits)
 void
 log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong zone_offset, gint frac_digits)
 {
+  LogStampFormatCache *cache;
   glong target_zone_offset = 0;
   struct tm *tm, tm_storage;
   char buf[8];
+  gint buf_len = 0;
+  gsize prefix_start;
   time_t t;
   
   if (zone_offset != -1)
@@ -71,9 +98,20 @@ log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong
   else
     target_zone_offset = stamp->zone_offset;
 
+  g_assert(ts_format >= 0 && ts_format <= TS_FMT_UNIX);
+  cache = &log_stamp_format_cache[ts_format];
+  if (G_LIKELY(cache->valid && cache->when == stamp->tv_sec && cache->zone_offset == target_zone_offset))
+    {
+      g_string_append_len(target, cache->prefix, cache->prefix_len);
+      log_stamp_append_frac_digits(stamp, target, frac_digits);
+      g_string_append_len(target, cache->suffix, cache->suffix_len);
+      return;
+    }
+
   t = stamp->tv_sec + target_zone_offset;
   cached_gmtime(&t, &tm_storage);
   tm = &tm_storage;
+  prefix_start = target->len;
   switch (ts_format)
     {
     case TS_FMT_BSD:
@@ -86,7 +124,6 @@ log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong
       format_uint32_padded(target, 2, '0', 10, tm->tm_min);
       g_string_append_c(target, ':');
       format_uint32_padded(target, 2, '0', 10, tm->tm_sec);
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
       break;
     case TS_FMT_ISO:
       format_uint32_padded(target, 0, 0, 10, tm->tm_year + 1900);
@@ -101,9 +138,7 @@ log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong
       g_string_append_c(target, ':');
       format_uint32_padded(target, 2, '0', 10, tm->tm_sec);
 
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
-      format_zone_info(buf, sizeof(buf), target_zone_offset);
-      g_string_append(target, buf);
+      buf_len = format_zone_info(buf, sizeof(buf), target_zone_offset);
       break;
     case TS_FMT_FULL:
       format_uint32_padded(target, 0, 0, 10, tm->tm_year + 1900);
@@ -117,17 +152,32 @@ log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong
       format_uint32_padded(target, 2, '0', 10, tm->tm_min);
       g_string_append_c(target, ':');
       format_uint32_padded(target, 2, '0', 10, tm->tm_sec);
-
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
       break;
     case TS_FMT_UNIX:
       format_uint32_padded(target, 0, 0, 10, (int) stamp->tv_sec);
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
       break;
     default:
       g_assert_not_reached();
       break;
     }
+
+  if (target->len - prefix_start < sizeof(cache->prefix) && buf_len < (gint) sizeof(cache->suffix))
+    {
+      cache->valid = TRUE;
+      cache->when = stamp->tv_sec;
+      cache->zone_offset = target_zone_offset;
+      cache->prefix_len = target->len - prefix_start;
+      memcpy(cache->prefix, target->str + prefix_start, cache->prefix_len);
+      cache->suffix_len = buf_len;
+      memcpy(cache->suffix, buf, buf_len);
+    }
+  else
+    {
+      cache->valid = FALSE;
+    }
+
+  log_stamp_append_frac_digits(stamp, target, frac_digits);
+  g_string_append_len(target, buf, buf_len);
 }
 
 void
@@ -28,6 +28,8 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <string.h>
+#include <sys/socket.h>
 
 void
 log_transport_free_method(LogTransport *s)
@@ -224,20 +226,56 @@ struct _LogTransportSocket
   LogTransport super;
 };
 
-static gssize
-log_transport_dgram_socket_read_method(LogTransport *s, gpointer buf, gsize buflen, GSockAddr **sa)
-{
-  LogTransportSocket *self = (LogTransportSocket *) s;
-  gint rc;
+/* number of peer addresses remembered by a datagram socket */
+#define LOG_TRANSPORT_DGRAM_SADDR_CACHE_SIZE 4
 
-  union
-  {
+typedef union _LogTransportSockAddrStorage
+{
 #if HAVE_STRUCT_SOCKADDR_STORAGE
-    struct sockaddr_storage __sas;
+  struct sockaddr_storage __sas;
 #endif
-    struct sockaddr __sa;
-  } sas;
+  struct sockaddr __sa;
+} LogTransportSockAddrStorage;
+
+typedef struct _LogTransportDGramSocket LogTransportDGramSocket;
+struct _LogTransportDGramSocket
+{
+  LogTransport super;
+  /* datagrams usually arrive from a handful of peers, reuse their
+   * GSockAddr instead of allocating a new one for each datagram */
+  GSockAddr *saddr_cache[LOG_TRANSPORT_DGRAM_SADDR_CACHE_SIZE];
+  gint saddr_cache_next;
+};
+
+static GSockAddr *
+log_transport_dgram_socket_lookup_saddr(LogTransportDGramSocket *self, struct sockaddr *sa, socklen_t salen)
+{
+  GSockAddr *addr;
+  gint i;
+
+  for (i = 0; i < LOG_TRANSPORT_DGRAM_SADDR_CACHE_SIZE; i++)
+    {
+      addr = self->saddr_cache[i];
+      if (addr && addr->salen == salen && memcmp(&addr->sa, sa, salen) == 0)
+        return g_sockaddr_ref(addr);
+    }
 
+  addr = g_sockaddr_new(sa, salen);
+  if (addr)
+    {
+      g_sockaddr_unref(self->saddr_cache[self->saddr_cache_next]);
+      self->saddr_cache[self->saddr_cache_next] = g_sockaddr_ref(addr);
+      self->saddr_cache_next = (self->saddr_cache_next + 1) % LOG_TRANSPORT_DGRAM_SADDR_CACHE_SIZE;
+    }
+  return addr;
+}
+
+static gssize
+log_transport_dgram_socket_read_method(LogTransport *s, gpointer buf, gsize buflen, GSockAddr **sa)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+  gint rc;
+  LogTransportSockAddrStorage sas;
   socklen_t salen = sizeof(sas);
 
   do
@@ -247,20 +285,71 @@ log_transport_dgram_socket_read_method(LogTransport *s, gpointer buf, gsize bufl
     }
   while (rc == -1 && errno == EINTR);
   if (rc != -1 && salen && sa)
-    (*sa) = g_sockaddr_new((struct sockaddr *) &sas, salen);
+    (*sa) = log_transport_dgram_socket_lookup_saddr(self, (struct sockaddr *) &sas, salen);
+  if (rc == 0)
+    {
+      /* DGRAM sockets should never return EOF, they just need to be read again */
+      rc = -1;
+      errno = EAGAIN;
+    }
+  return rc;
+}
+
+#if HAVE_RECVMMSG
+
+/* upper limit of datagrams received by a single recvmmsg() call */
+#define LOG_TRANSPORT_DGRAM_MAX_BATCH 64
+
+static gint
+log_transport_dgram_socket_read_batch_method(LogTransport *s, LogTransportDatagram *dgrams, gint count)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+  struct mmsghdr msgs[LOG_TRANSPORT_DGRAM_MAX_BATCH];
+  struct iovec iovs[LOG_TRANSPORT_DGRAM_MAX_BATCH];
+  LogTransportSockAddrStorage addrs[LOG_TRANSPORT_DGRAM_MAX_BATCH];
+  gint i, rc;
+
+  count = MIN(count, LOG_TRANSPORT_DGRAM_MAX_BATCH);
+  memset(msgs, 0, sizeof(msgs[0]) * count);
+  for (i = 0; i < count; i++)
+    {
+      iovs[i].iov_base = dgrams[i].buf;
+      iovs[i].iov_len = dgrams[i].buflen;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+  do
+    {
+      rc = recvmmsg(self->super.fd, msgs, count, 0, NULL);
+    }
+  while (rc == -1 && errno == EINTR);
+
   if (rc == 0)
     {
       /* DGRAM sockets should never return EOF, they just need to be read again */
       rc = -1;
       errno = EAGAIN;
     }
+
+  for (i = 0; i < rc; i++)
+    {
+      dgrams[i].len = msgs[i].msg_len;
+      dgrams[i].sa = NULL;
+      if (msgs[i].msg_hdr.msg_namelen)
+        dgrams[i].sa = log_transport_dgram_socket_lookup_saddr(self, (struct sockaddr *) &addrs[i], msgs[i].msg_hdr.msg_namelen);
+    }
   return rc;
 }
 
+#endif
+
 static gssize
 log_transport_dgram_socket_write_method(LogTransport *s, const gpointer buf, gsize buflen)
 {
-  LogTransportSocket *self = (LogTransportSocket *) s;
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
   gint rc;
 
   do
@@ -283,15 +372,29 @@ log_transport_dgram_socket_write_method(LogTransport *s, const gpointer buf, gsi
   return rc;
 }
 
+static void
+log_transport_dgram_socket_free_method(LogTransport *s)
+{
+  LogTransportDGramSocket *self = (LogTransportDGramSocket *) s;
+  gint i;
+
+  for (i = 0; i < LOG_TRANSPORT_DGRAM_SADDR_CACHE_SIZE; i++)
+    g_sockaddr_unref(self->saddr_cache[i]);
+  log_transport_free_method(s);
+}
 
 LogTransport *
 log_transport_dgram_socket_new(gint fd)
 {
-  LogTransportSocket *self = g_new0(LogTransportSocket, 1);
-  
+  LogTransportDGramSocket *self = g_new0(LogTransportDGramSocket, 1);
+
   log_transport_init_method(&self->super, fd);
   self->super.read = log_transport_dgram_socket_read_method;
+#if HAVE_RECVMMSG
+  self->super.read_batch = log_transport_dgram_socket_read_batch_method;
+#endif
   self->super.write = log_transport_dgram_socket_write_method;
+  self->super.free_fn = log_transport_dgram_socket_free_method;
   return &self->super;
 }
 
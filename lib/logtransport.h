@@ -30,11 +30,24 @@
 
 typedef struct _LogTransport LogTransport;
 
+/* a datagram received by log_transport_read_batch(), the caller sets
+ * @buf/@buflen, the transport fills @len and @sa (a reference owned by
+ * the caller) */
+typedef struct _LogTransportDatagram
+{
+  gpointer buf;
+  gsize buflen;
+  gsize len;
+  GSockAddr *sa;
+} LogTransportDatagram;
+
 struct _LogTransport
 {
   gint fd;
   GIOCondition cond;
   gssize (*read)(LogTransport *self, gpointer buf, gsize count, GSockAddr **sa);
+  /* receives up to @count datagrams at once, NULL if not supported */
+  gint (*read_batch)(LogTransport *self, LogTransportDatagram *dgrams, gint count);
   gssize (*write)(LogTransport *self, const gpointer buf, gsize count);
   void (*free_fn)(LogTransport *self);
 };
@@ -51,6 +64,19 @@ log_transport_read(LogTransport *self, gpointer buf, gsize count, GSockAddr **sa
   return self->read(self, buf, count, sa);
 }
 
+static inline gboolean
+log_transport_can_read_batch(LogTransport *self)
+{
+  return self->read_batch != NULL;
+}
+
+/* returns the number of datagrams received, 0 on EOF or -1 on error */
+static inline gint
+log_transport_read_batch(LogTransport *self, LogTransportDatagram *dgrams, gint count)
+{
+  return self->read_batch(self, dgrams, count);
+}
+
 void log_transport_init_method(LogTransport *s, gint fd);
 void log_transport_free_method(LogTransport *s);
 void log_transport_free(LogTransport *s);
@@ -40,6 +40,9 @@
 #include <iv_event.h>
 #include <iv_work.h>
 
+/* the number of messages fetched from the queue at once in log_writer_flush() */
+#define LOG_WRITER_FLUSH_BATCH 64
+
 typedef enum
 {
   /* flush modes */
@@ -62,6 +65,7 @@ struct _LogWriter
   StatsCounterItem *suppressed_messages;
   StatsCounterItem *processed_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
   LogPipe *control;
   LogWriterOptions *options;
   LogMessage *last_msg;
@@ -742,6 +746,24 @@ log_writer_do_padding(LogWriter *self, GString *result)
   memset(result->str + len - 1, '\0', padd_bytes);
 }
 
+/* Messages whose parsing was deferred and that nothing looked at are
+ * forwarded as received, if the default BSD format was requested and
+ * the message was received in that format as well.  The message has to
+ * carry its own timestamp and hostname, the parser fills in the missing
+ * ones (e.g. $HOST from $HOST_FROM). */
+static inline gboolean
+log_writer_can_forward_unparsed(LogWriter *self, LogMessage *lm)
+{
+  return log_msg_is_unparsed(lm) &&
+         (lm->flags & LF_STATE_UNPARSED_HEADER) &&
+         (self->flags & LW_FORMAT_PROTO) &&
+         !(self->flags & LW_SYSLOG_PROTOCOL) &&
+         !(self->options->options & LWO_SYSLOG_PROTOCOL) &&
+         !self->options->template &&
+         !self->options->proto_template &&
+         !(lm->lazy_options->options.flags & LP_SYSLOG_PROTOCOL);
+}
+
 void
 log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
 {
@@ -753,6 +775,15 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
   if (!meta_seqid)
     meta_seqid = log_msg_get_value_handle(".SDATA.meta.sequenceId");
 
+  g_string_truncate(result, 0);
+  if (log_writer_can_forward_unparsed(self, lm) && log_msg_append_unparsed(lm, result))
+    {
+      g_string_append_c(result, '\n');
+      log_writer_do_padding(self, result);
+      goto exit;
+    }
+  log_msg_ensure_parsed(lm);
+
   if (lm->flags & LF_LOCAL)
     {
       seq_num = self->seq_num;
@@ -773,8 +804,6 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
   /* no template was specified, use default */
   stamp = &lm->timestamps[LM_TS_STAMP];
 
-  g_string_truncate(result, 0);
-
   if ((self->flags & LW_SYSLOG_PROTOCOL) || (self->options->options & LWO_SYSLOG_PROTOCOL))
     {
       gint len;
@@ -818,11 +847,16 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
           g_string_append_c(result, ' ');
           if (lm->flags & LF_UTF8)
             g_string_append_len(result, "\xEF\xBB\xBF", 3);
-          log_template_append_format(self->options->template, lm, 
-                                     &self->options->template_options,
-                                     LTZ_SEND,
-                                     seq_num, NULL,
-                                     result);
+          if (self->options->options & LWO_TEMPLATE_CACHE)
+            log_template_append_format_cached(self->options->template, lm,
+                                              &self->options->template_options,
+                                              LTZ_SEND, seq_num, result);
+          else
+            log_template_append_format(self->options->template, lm, 
+                                       &self->options->template_options,
+                                       LTZ_SEND,
+                                       seq_num, NULL,
+                                       result);
         }
       else
         {
@@ -858,7 +892,13 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
           template = self->options->proto_template;
         }
       
-      if (template)
+      if (template && (self->options->options & LWO_TEMPLATE_CACHE))
+        {
+          log_template_format_cached(template, lm,
+                                     &self->options->template_options,
+                                     LTZ_SEND, seq_num, result);
+        }
+      else if (template)
         {
           log_template_format(template, lm, 
                               &self->options->template_options,
@@ -922,6 +962,7 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
           log_writer_do_padding(self, result);
         }
     }
+ exit:
   if (self->options->options & LWO_NO_MULTI_LINE)
     {
       gchar *p;
@@ -981,69 +1022,83 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
 
   while (!main_loop_io_worker_job_quit() || flush_mode >= LW_FLUSH_QUEUE)
     {
-      LogMessage *lm;
-      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
-      gboolean consumed = FALSE;
-      
-      if (!log_queue_pop_head(self->queue, &lm, &path_options, FALSE, ignore_throttle))
+      LogMessage *batch[LOG_WRITER_FLUSH_BATCH];
+      LogPathOptions batch_path_options[LOG_WRITER_FLUSH_BATCH];
+      LogPathOptions path_options_init = LOG_PATH_OPTIONS_INIT;
+      gint batch_len, i;
+
+      for (i = 0; i < LOG_WRITER_FLUSH_BATCH; i++)
+        batch_path_options[i] = path_options_init;
+
+      batch_len = log_queue_pop_head_batch(self->queue, batch, batch_path_options, LOG_WRITER_FLUSH_BATCH, FALSE, ignore_throttle);
+      if (batch_len == 0)
         {
           /* no more items are available */
           break;
         }
 
-      log_msg_refcache_start_consumer(lm, &path_options);
-      msg_set_context(lm);
-
-      log_writer_format_log(self, lm, self->line_buffer);
-      
-      if (self->line_buffer->len)
+      for (i = 0; i < batch_len; i++)
         {
-          LogProtoStatus status;
+          LogMessage *lm = batch[i];
+          LogPathOptions *path_options = &batch_path_options[i];
+          gboolean consumed = FALSE;
+
+          log_msg_refcache_start_consumer(lm, path_options);
+          msg_set_context(lm);
+
+          log_writer_format_log(self, lm, self->line_buffer);
 
-          status = log_proto_client_post(proto, (guchar *) self->line_buffer->str, self->line_buffer->len, &consumed);
-          if (status == LPS_ERROR)
+          if (self->line_buffer->len)
             {
-              if ((self->options->options & LWO_IGNORE_ERRORS) == 0)
+              LogProtoStatus status;
+
+              status = log_proto_client_post(proto, (guchar *) self->line_buffer->str, self->line_buffer->len, &consumed);
+              if (status == LPS_ERROR)
                 {
-                  msg_set_context(NULL);
-                  log_msg_refcache_stop();
-                  return FALSE;
+                  if ((self->options->options & LWO_IGNORE_ERRORS) == 0)
+                    {
+                      msg_set_context(NULL);
+                      log_msg_refcache_stop();
+                      log_queue_push_head_batch(self->queue, &batch[i + 1], &batch_path_options[i + 1], batch_len - i - 1);
+                      return FALSE;
+                    }
+                  else
+                    {
+                      if (!consumed)
+                        g_free(self->line_buffer->str);
+                      consumed = TRUE;
+                    }
                 }
-              else
+              if (consumed)
                 {
-		  if (!consumed)
-	            g_free(self->line_buffer->str);
-                  consumed = TRUE;
+                  self->line_buffer->str = g_malloc(self->line_buffer->allocated_len);
+                  self->line_buffer->str[0] = 0;
+                  self->line_buffer->len = 0;
                 }
             }
           if (consumed)
             {
-              self->line_buffer->str = g_malloc(self->line_buffer->allocated_len);
-              self->line_buffer->str[0] = 0;
-              self->line_buffer->len = 0;
+              if (lm->flags & LF_LOCAL)
+                step_sequence_number(&self->seq_num);
+              log_msg_ack(lm, path_options);
+              log_msg_unref(lm);
             }
-        }
-      if (consumed)
-        {
-          if (lm->flags & LF_LOCAL)
-            step_sequence_number(&self->seq_num);
-          log_msg_ack(lm, &path_options);
-          log_msg_unref(lm);
-        }
-      else
-        {
-          /* push back to the queue */
-          log_queue_push_head(self->queue, lm, &path_options);
+          else
+            {
+              /* push back to the queue, along with the rest of the batch */
+              msg_set_context(NULL);
+              log_msg_refcache_stop();
+              log_queue_push_head_batch(self->queue, &batch[i], &batch_path_options[i], batch_len - i);
+              goto flush;
+            }
+
           msg_set_context(NULL);
           log_msg_refcache_stop();
-          break;
+          count++;
         }
-        
-      msg_set_context(NULL);
-      log_msg_refcache_stop();
-      count++;
     }
 
+ flush:
   if (flush_mode >= LW_FLUSH_BUFFER || count == 0)
     {
       if (log_proto_client_flush(proto) == LPS_ERROR)
@@ -1105,9 +1160,10 @@ log_writer_init(LogPipe *s)
       stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->processed_messages);
       
       stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_STORED, &self->stored_messages);
+      stats_register_counter(self->stats_level, self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_MEMORY_USAGE, &self->memory_usage);
       stats_unlock();
     }
-  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages, self->memory_usage);
   if (self->proto)
     {
       LogProtoClient *proto;
@@ -1146,13 +1202,14 @@ log_writer_deinit(LogPipe *s)
 
   ml_batched_timer_unregister(&self->suppress_timer);
   ml_batched_timer_unregister(&self->mark_timer);
-  log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_counters(self->queue, NULL, NULL, NULL);
 
   stats_lock();
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_DROPPED, &self->dropped_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_SUPPRESSED, &self->suppressed_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->processed_messages);
   stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_STORED, &self->stored_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->stats_id, self->stats_instance, SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
   
   return TRUE;
@@ -1413,6 +1470,8 @@ log_writer_options_init(LogWriterOptions *options, GlobalConfig *cfg, guint32 op
   options->proto_template = log_template_ref(cfg->proto_template);
   if (cfg->threaded)
     options->options |= LWO_THREADED;
+  if (cfg->template_cache)
+    options->options |= LWO_TEMPLATE_CACHE;
   /* per-destination MARK messages */
   if (options->mark_mode == MM_GLOBAL)
     {
@@ -47,6 +47,8 @@
 #define LWO_SHARE_STATS     0x0008
 #define LWO_THREADED        0x0010
 #define LWO_IGNORE_ERRORS   0x0020
+/* share formatted templates with other destinations through the message */
+#define LWO_TEMPLATE_CACHE  0x0040
 
 typedef struct _LogWriterOptions
 {
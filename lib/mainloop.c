@@ -42,7 +42,6 @@
 #include <resolv.h>
 #include <iv.h>
 #include <iv_signal.h>
-#include <iv_work.h>
 #include <iv_event.h>
 
 /**
@@ -265,7 +264,9 @@ stats_timer_kickoff(GlobalConfig *cfg)
  ************************************************************************************/
 
 static struct iv_task main_loop_io_workers_reenable_jobs_task;
-static struct iv_work_pool main_loop_io_workers;
+static MlWorkerPool *main_loop_io_workers;
+static gint main_loop_io_workers_max_threads;
+static gboolean main_loop_io_workers_affinity;
 static void (*main_loop_io_workers_sync_func)(void);
 
 /* number of I/O worker jobs running */
@@ -278,52 +279,29 @@ volatile gboolean main_loop_io_workers_quit;
 
 #define MAIN_LOOP_MAX_WORKER_THREADS 64
 
-static GStaticMutex main_loop_io_workers_idmap_lock = G_STATIC_MUTEX_INIT;
-static guint64 main_loop_io_workers_idmap;
-
 /* the thread id is shifted by one, to make 0 the uninitialized state,
  * e.g. everything that sets it adds +1, everything that queries it
  * subtracts 1 */
 #define main_loop_io_worker_id __tls_deref(main_loop_io_worker_id)
 
-void
-main_loop_io_worker_thread_start(void *cookie)
+/* NOTE: the worker pool assigns a fixed id to each of its threads,
+ * starting at 0, these are used as indexes to the per-thread input queues
+ * of LogQueueFifo, which is why the number of threads is limited to
+ * MAIN_LOOP_MAX_WORKER_THREADS */
+static void
+main_loop_io_worker_thread_start(gint id)
 {
-  gint id;
-
   dns_cache_init();
-  g_static_mutex_lock(&main_loop_io_workers_idmap_lock);
-  /* NOTE: this algorithm limits the number of I/O worker threads to 64,
-   * since the ID map is stored in a single 64 bit integer.  If we ever need
-   * more threads than that, we can generalize this algorithm further. */
-
-  main_loop_io_worker_id = 0;
-  for (id = 0; id < main_loop_io_workers.max_threads && id < MAIN_LOOP_MAX_WORKER_THREADS; id++)
-    {
-      if ((main_loop_io_workers_idmap & (1 << id)) == 0)
-        {
-          /* id not yet used */
-
-          main_loop_io_worker_id = id + 1;
-          main_loop_io_workers_idmap |= (1 << id);
-          break;
-        }
-    }
-  g_static_mutex_unlock(&main_loop_io_workers_idmap_lock);
+  main_loop_io_worker_id = id + 1;
 }
 
-void
-main_loop_io_worker_thread_stop(void *cookie)
+static void
+main_loop_io_worker_thread_stop(gint id)
 {
-  g_static_mutex_lock(&main_loop_io_workers_idmap_lock);
-  if (main_loop_io_worker_id)
-    {
-      main_loop_io_workers_idmap &= ~(1 << (main_loop_io_worker_id - 1));
-      main_loop_io_worker_id = 0;
-    }
-  g_static_mutex_unlock(&main_loop_io_workers_idmap_lock);
+  main_loop_io_worker_id = 0;
   dns_cache_destroy();
   scratch_buffers_free();
+  log_msg_free_thread_cache();
 
   if (call_info.cond)
     g_cond_free(call_info.cond);
@@ -357,7 +335,7 @@ main_loop_io_worker_job_submit(MainLoopIOWorkerJob *self)
     return;
   main_loop_io_workers_running++;
   self->working = TRUE;
-  iv_work_pool_submit_work(&main_loop_io_workers, &self->work_item);
+  ml_worker_pool_submit(main_loop_io_workers, &self->work_item);
 }
 
 static void
@@ -439,10 +417,10 @@ main_loop_io_worker_register_finish_callback(MainLoopIOWorkerFinishCallback *cb)
 void
 main_loop_io_worker_job_init(MainLoopIOWorkerJob *self)
 {
-  IV_WORK_ITEM_INIT(&self->work_item);
+  ml_work_item_init(&self->work_item);
   self->work_item.cookie = self;
-  self->work_item.work = (void (*)(void *)) main_loop_io_worker_job_start;
-  self->work_item.completion = (void (*)(void *)) main_loop_io_worker_job_complete;
+  self->work_item.work = (void (*)(gpointer)) main_loop_io_worker_job_start;
+  self->work_item.completion = (void (*)(gpointer)) main_loop_io_worker_job_complete;
   INIT_IV_LIST_HEAD(&self->finish_callbacks);
 }
 
@@ -667,12 +645,13 @@ main_loop_init(void)
 {
   app_startup();
   setup_signals();
-  main_loop_io_workers.thread_start = main_loop_io_worker_thread_start;
-  main_loop_io_workers.thread_stop = main_loop_io_worker_thread_stop;
-  iv_work_pool_create(&main_loop_io_workers);
+  main_loop_io_workers = ml_worker_pool_new(MIN(main_loop_io_workers_max_threads, MAIN_LOOP_MAX_WORKER_THREADS),
+                                            main_loop_io_workers_affinity,
+                                            main_loop_io_worker_thread_start,
+                                            main_loop_io_worker_thread_stop);
   IV_TASK_INIT(&main_loop_io_workers_reenable_jobs_task);
   main_loop_io_workers_reenable_jobs_task.handler = main_loop_io_worker_reenable_jobs;
-  log_queue_set_max_threads(MIN(main_loop_io_workers.max_threads, MAIN_LOOP_MAX_WORKER_THREADS));
+  log_queue_set_max_threads(MIN(main_loop_io_workers_max_threads, MAIN_LOOP_MAX_WORKER_THREADS));
   main_loop_call_init();
 
   current_configuration = cfg_new(0);
@@ -740,6 +719,10 @@ main_loop_run(void)
   cfg_deinit(current_configuration);
   cfg_free(current_configuration);
   current_configuration = NULL;
+
+  /* no I/O jobs are running at this point, see main_loop_exit_finish() */
+  ml_worker_pool_free(main_loop_io_workers);
+  main_loop_io_workers = NULL;
   return 0;
 }
 
@@ -749,7 +732,8 @@ static GOptionEntry main_loop_options[] =
   { "cfgfile",           'f',         0, G_OPTION_ARG_STRING, &cfgfilename, "Set config file name, default=" PATH_SYSLOG_NG_CONF, "<config>" },
   { "persist-file",      'R',         0, G_OPTION_ARG_STRING, &persist_file, "Set the name of the persistent configuration file, default=" PATH_PERSIST_CONFIG, "<fname>" },
   { "preprocess-into",     0,         0, G_OPTION_ARG_STRING, &preprocess_into, "Write the preprocessed configuration file to the file specified", "output" },
-  { "worker-threads",      0,         0, G_OPTION_ARG_INT, &main_loop_io_workers.max_threads, "Set the number of I/O worker threads", "<max>" },
+  { "worker-threads",      0,         0, G_OPTION_ARG_INT, &main_loop_io_workers_max_threads, "Set the number of I/O worker threads", "<max>" },
+  { "worker-threads-affinity", 0,   0, G_OPTION_ARG_NONE, &main_loop_io_workers_affinity, "Bind each I/O worker thread to a separate CPU", NULL },
   { "syntax-only",       's',         0, G_OPTION_ARG_NONE, &syntax_only, "Only read and parse config file", NULL},
   { "control",           'c',         0, G_OPTION_ARG_STRING, &ctlfilename, "Set syslog-ng control socket, default=" PATH_CONTROL_SOCKET, "<ctlpath>" },
   { NULL },
@@ -759,9 +743,9 @@ void
 main_loop_add_options(GOptionContext *ctx)
 {
 #ifdef _SC_NPROCESSORS_ONLN
-  main_loop_io_workers.max_threads = MIN(MAX(2, sysconf(_SC_NPROCESSORS_ONLN)), MAIN_LOOP_MAX_WORKER_THREADS);
+  main_loop_io_workers_max_threads = MIN(MAX(2, sysconf(_SC_NPROCESSORS_ONLN)), MAIN_LOOP_MAX_WORKER_THREADS);
 #else
-  main_loop_io_workers.max_threads = 2;
+  main_loop_io_workers_max_threads = 2;
 #endif
 
   g_option_context_add_main_entries(ctx, main_loop_options, NULL);
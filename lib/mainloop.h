@@ -25,8 +25,7 @@
 #define MAINLOOP_H_INCLUDED
 
 #include "syslog-ng.h"
-
-#include <iv_work.h>
+#include "ml-worker-pool.h"
 
 extern volatile gboolean main_loop_io_workers_quit;
 extern gboolean syntax_only;
@@ -53,7 +52,7 @@ typedef struct _MainLoopIOWorkerJob
   void (*completion)(gpointer user_data);
   gpointer user_data;
   gboolean working:1;
-  struct iv_work_item work_item;
+  MlWorkItem work_item;
 
   /* function to be called back when the current job is finished. */
   struct iv_list_head finish_callbacks;
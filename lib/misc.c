@@ -452,78 +452,6 @@ format_hex_string(gpointer data, gsize data_len, gchar *result, gsize result_len
   return result;
 }
 
-/**
- * Find CR or LF characters in the log message.
- *
- * It uses an algorithm similar to what there's in libc memchr/strchr.
- **/
-gchar *
-find_cr_or_lf(gchar *s, gsize n)
-{
-  gchar *char_ptr;
-  gulong *longword_ptr;
-  gulong longword, magic_bits, cr_charmask, lf_charmask;
-  const char CR = '\r';
-  const char LF = '\n';
-
-  /* align input to long boundary */
-  for (char_ptr = s; n > 0 && ((gulong) char_ptr & (sizeof(longword) - 1)) != 0; ++char_ptr, n--)
-    {
-      if (*char_ptr == CR || *char_ptr == LF)
-        return char_ptr;
-      else if (*char_ptr == 0)
-        return NULL;
-    }
-    
-  longword_ptr = (gulong *) char_ptr;
-
-#if GLIB_SIZEOF_LONG == 8
-  magic_bits = 0x7efefefefefefeffL;
-#elif GLIB_SIZEOF_LONG == 4
-  magic_bits = 0x7efefeffL; 
-#else
-  #error "unknown architecture"
-#endif
-  memset(&cr_charmask, CR, sizeof(cr_charmask));
-  memset(&lf_charmask, LF, sizeof(lf_charmask));
-    
-  while (n > sizeof(longword))
-    {
-      longword = *longword_ptr++;
-      if ((((longword + magic_bits) ^ ~longword) & ~magic_bits) != 0 ||
-          ((((longword ^ cr_charmask) + magic_bits) ^ ~(longword ^ cr_charmask)) & ~magic_bits) != 0 || 
-          ((((longword ^ lf_charmask) + magic_bits) ^ ~(longword ^ lf_charmask)) & ~magic_bits) != 0)
-        {
-          gint i;
-
-          char_ptr = (gchar *) (longword_ptr - 1);
-          
-          for (i = 0; i < sizeof(longword); i++)
-            {
-              if (*char_ptr == CR || *char_ptr == LF)
-                return char_ptr;
-              else if (*char_ptr == 0)
-                return NULL;
-              char_ptr++;
-            }
-        }
-      n -= sizeof(longword);
-    }
-
-  char_ptr = (gchar *) longword_ptr;
-
-  while (n-- > 0)
-    {
-      if (*char_ptr == CR || *char_ptr == LF)
-        return char_ptr;
-      else if (*char_ptr == 0)
-        return NULL;
-      ++char_ptr;
-    }
-
-  return NULL;
-}
-
 GList *
 string_array_to_list(const gchar *strlist[])
 {
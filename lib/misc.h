@@ -27,6 +27,7 @@
 
 #include "syslog-ng.h"
 #include "gsockaddr.h"
+#include "str-scan.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -50,7 +51,6 @@ void resolve_sockaddr(gchar *result, gsize *result_len, GSockAddr *saddr, gboole
 gboolean resolve_hostname(GSockAddr **addr, gchar *name);
 
 gchar *format_hex_string(gpointer str, gsize str_len, gchar *result, gsize result_len);
-gchar *find_cr_or_lf(gchar *s, gsize n);
 
 gchar *find_file_in_path(const gchar *path, const gchar *filename, GFileTest test);
 
@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2002-2012 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2012 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "ml-worker-pool.h"
+#include "stats.h"
+#include "messages.h"
+#include "timeutils.h"
+
+#include <iv_event.h>
+#include <string.h>
+#include <errno.h>
+#if HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+/*
+ * I/O worker threads with per-worker run queues.
+ *
+ * Each worker has its own queue of work items, an item is queued to the
+ * worker that ran it the last time, so that a given LogReader/LogWriter
+ * keeps running on the same thread (and the same CPU when workers are
+ * pinned), keeping its per-thread queue and buffers cache-warm.  New items
+ * are distributed round-robin.
+ *
+ * A worker that runs out of work steals items from the tail of the run
+ * queue of a worker that is busy running something else, so stickiness
+ * never causes an item to wait while another worker idles.
+ *
+ * Items are submitted from the main thread, their completion callback is
+ * also called there, using an iv_event posted by the workers.
+ *
+ * Worker threads are started lazily, when the first item is submitted to
+ * them.  If no thread can be started at all, items are run in the main
+ * thread.
+ */
+
+typedef struct _MlWorker
+{
+  MlWorkerPool *pool;
+  gint id;
+  GThread *thread;
+
+  /* protects run_queue, sleeping is only changed while holding it */
+  GMutex *lock;
+  GCond *cond;
+  struct iv_list_head run_queue;
+  gint queue_len;
+  gint running;
+  gint sleeping;
+
+  guint64 busy_usec;
+  guint64 busy_sec_reported;
+  StatsCounterItem *processed;
+  StatsCounterItem *stolen;
+  StatsCounterItem *busy_time;
+} MlWorker;
+
+struct _MlWorkerPool
+{
+  gint num_workers;
+  gint next_worker;
+  gboolean affinity;
+  gint quit;
+  /* incremented whenever an item is queued behind a busy worker, an idle
+   * worker whose steal attempt started before that tries again instead of
+   * going to sleep */
+  gint steal_seq;
+  void (*thread_start)(gint id);
+  void (*thread_stop)(gint id);
+
+  GStaticMutex completion_lock;
+  struct iv_list_head completed;
+  struct iv_event completion_event;
+
+  MlWorker workers[0];
+};
+
+static void
+ml_worker_set_affinity(MlWorker *self)
+{
+#if HAVE_SCHED_SETAFFINITY
+  cpu_set_t allowed, cpus;
+  gint cpu, nth;
+
+  /* pin the Nth worker to the Nth CPU we are allowed to run on */
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0)
+    return;
+
+  nth = self->id % CPU_COUNT(&allowed);
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (CPU_ISSET(cpu, &allowed) && nth-- == 0)
+        break;
+    }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+    {
+      msg_error("Error binding I/O worker thread to CPU",
+                evt_tag_int("worker", self->id),
+                evt_tag_int("cpu", cpu),
+                evt_tag_errno("error", errno),
+                NULL);
+    }
+#endif
+}
+
+static MlWorkItem *
+ml_worker_dequeue(MlWorker *self, gboolean tail)
+{
+  MlWorkItem *item;
+
+  if (iv_list_empty(&self->run_queue))
+    return NULL;
+
+  item = iv_list_entry(tail ? self->run_queue.prev : self->run_queue.next, MlWorkItem, list);
+  iv_list_del_init(&item->list);
+  g_atomic_int_add(&self->queue_len, -1);
+  return item;
+}
+
+static MlWorkItem *
+ml_worker_steal(MlWorker *self)
+{
+  MlWorkerPool *pool = self->pool;
+  MlWorkItem *item;
+  gint i;
+
+  for (i = 1; i < pool->num_workers; i++)
+    {
+      MlWorker *victim = &pool->workers[(self->id + i) % pool->num_workers];
+
+      /* an idle victim picks up its own items, leave them there */
+      if (!g_atomic_int_get(&victim->running) || !g_atomic_int_get(&victim->queue_len))
+        continue;
+
+      g_mutex_lock(victim->lock);
+      item = ml_worker_dequeue(victim, TRUE);
+      g_mutex_unlock(victim->lock);
+      if (item)
+        {
+          stats_counter_inc(self->stolen);
+          return item;
+        }
+    }
+  return NULL;
+}
+
+/* returns the next item to run or NULL if the pool is being destroyed */
+static MlWorkItem *
+ml_worker_fetch(MlWorker *self)
+{
+  MlWorkerPool *pool = self->pool;
+  MlWorkItem *item = NULL;
+  gint steal_seq;
+
+  g_mutex_lock(self->lock);
+  while (!g_atomic_int_get(&pool->quit))
+    {
+      item = ml_worker_dequeue(self, FALSE);
+      if (item)
+        break;
+
+      steal_seq = g_atomic_int_get(&pool->steal_seq);
+      g_mutex_unlock(self->lock);
+      item = ml_worker_steal(self);
+      g_mutex_lock(self->lock);
+      if (item)
+        break;
+
+      if (iv_list_empty(&self->run_queue) && !g_atomic_int_get(&pool->quit))
+        {
+          /* ml_worker_pool_wake_idle() bumps steal_seq before it looks at
+           * sleeping, so either it signals us, or we notice the item it
+           * wanted stolen while we were looking elsewhere */
+          g_atomic_int_set(&self->sleeping, TRUE);
+          if (g_atomic_int_exchange_and_add(&pool->steal_seq, 0) == steal_seq)
+            g_cond_wait(self->cond, self->lock);
+          g_atomic_int_set(&self->sleeping, FALSE);
+        }
+    }
+  if (item)
+    g_atomic_int_set(&self->running, TRUE);
+  g_mutex_unlock(self->lock);
+  return item;
+}
+
+static void
+ml_worker_account(MlWorker *self, glong usec)
+{
+  guint64 busy_sec;
+
+  stats_counter_inc(self->processed);
+
+  /* busy_time is reported in seconds, so that the 32 bit counter does not
+   * wrap, the sub-second parts are accumulated locally */
+  self->busy_usec += usec;
+  busy_sec = self->busy_usec / G_USEC_PER_SEC;
+  if (busy_sec != self->busy_sec_reported)
+    {
+      stats_counter_add(self->busy_time, busy_sec - self->busy_sec_reported);
+      self->busy_sec_reported = busy_sec;
+    }
+}
+
+static void
+ml_worker_pool_complete(MlWorkerPool *self, MlWorkItem *item)
+{
+  gboolean posted;
+
+  g_static_mutex_lock(&self->completion_lock);
+  /* if the list is not empty, an event is already pending */
+  posted = !iv_list_empty(&self->completed);
+  iv_list_add_tail(&item->list, &self->completed);
+  g_static_mutex_unlock(&self->completion_lock);
+
+  if (!posted)
+    iv_event_post(&self->completion_event);
+}
+
+static gpointer
+ml_worker_thread(gpointer s)
+{
+  MlWorker *self = (MlWorker *) s;
+  MlWorkerPool *pool = self->pool;
+  MlWorkItem *item;
+  GTimeVal start, end;
+
+  iv_init();
+  if (pool->affinity)
+    ml_worker_set_affinity(self);
+  if (pool->thread_start)
+    pool->thread_start(self->id);
+
+  while ((item = ml_worker_fetch(self)))
+    {
+      item->worker = self->id;
+      g_get_current_time(&start);
+      item->work(item->cookie);
+      g_get_current_time(&end);
+      g_atomic_int_set(&self->running, FALSE);
+
+      ml_worker_account(self, g_time_val_diff(&end, &start));
+      ml_worker_pool_complete(pool, item);
+    }
+
+  if (pool->thread_stop)
+    pool->thread_stop(self->id);
+  iv_deinit();
+  return NULL;
+}
+
+static gboolean
+ml_worker_start(MlWorker *self)
+{
+  GError *error = NULL;
+
+  self->thread = g_thread_create(ml_worker_thread, self, TRUE, &error);
+  if (!self->thread)
+    {
+      msg_error("Error starting I/O worker thread",
+                evt_tag_int("worker", self->id),
+                evt_tag_str("error", error->message),
+                NULL);
+      g_clear_error(&error);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/* wake up a sleeping worker (or start a new one), so that it steals the
+ * work queued behind a busy worker */
+static void
+ml_worker_pool_wake_idle(MlWorkerPool *self, MlWorker *busy)
+{
+  gint i;
+
+  g_atomic_int_inc(&self->steal_seq);
+  for (i = 0; i < self->num_workers; i++)
+    {
+      MlWorker *worker = &self->workers[i];
+
+      if (worker == busy)
+        continue;
+
+      if (!worker->thread)
+        {
+          ml_worker_start(worker);
+          return;
+        }
+      if (g_atomic_int_get(&worker->sleeping))
+        {
+          g_mutex_lock(worker->lock);
+          g_cond_signal(worker->cond);
+          g_mutex_unlock(worker->lock);
+          return;
+        }
+    }
+}
+
+/* NOTE: must be called from the main thread */
+void
+ml_worker_pool_submit(MlWorkerPool *self, MlWorkItem *item)
+{
+  MlWorker *worker;
+  gboolean busy;
+
+  if (item->worker < 0 || item->worker >= self->num_workers)
+    {
+      item->worker = self->next_worker;
+      self->next_worker = (self->next_worker + 1) % self->num_workers;
+    }
+  worker = &self->workers[item->worker];
+
+  if (!worker->thread && !ml_worker_start(worker))
+    {
+      /* fall back to the first worker, which is always possible to start
+       * unless we're unable to start threads at all */
+      item->worker = 0;
+      worker = &self->workers[0];
+      if (!worker->thread && !ml_worker_start(worker))
+        {
+          msg_error("No I/O worker thread could be started, running the job in the main thread",
+                    NULL);
+          item->worker = -1;
+          item->work(item->cookie);
+          /* the completion is still deferred, as it may submit the item again */
+          ml_worker_pool_complete(self, item);
+          return;
+        }
+    }
+
+  g_mutex_lock(worker->lock);
+  iv_list_add_tail(&item->list, &worker->run_queue);
+  g_atomic_int_inc(&worker->queue_len);
+  if (worker->sleeping)
+    g_cond_signal(worker->cond);
+  busy = g_atomic_int_get(&worker->running);
+  g_mutex_unlock(worker->lock);
+
+  if (busy)
+    ml_worker_pool_wake_idle(self, worker);
+}
+
+static void
+ml_worker_pool_complete_items(gpointer s)
+{
+  MlWorkerPool *self = (MlWorkerPool *) s;
+  struct iv_list_head completed;
+
+  INIT_IV_LIST_HEAD(&completed);
+  g_static_mutex_lock(&self->completion_lock);
+  iv_list_splice_tail_init(&self->completed, &completed);
+  g_static_mutex_unlock(&self->completion_lock);
+
+  while (!iv_list_empty(&completed))
+    {
+      MlWorkItem *item = iv_list_entry(completed.next, MlWorkItem, list);
+
+      /* the completion callback may submit the item again */
+      iv_list_del_init(&item->list);
+      item->completion(item->cookie);
+    }
+}
+
+MlWorkerPool *
+ml_worker_pool_new(gint num_workers, gboolean affinity, void (*thread_start)(gint id), void (*thread_stop)(gint id))
+{
+  MlWorkerPool *self;
+  gint i;
+
+  num_workers = MAX(num_workers, 1);
+  self = g_malloc0(sizeof(MlWorkerPool) + num_workers * sizeof(MlWorker));
+  self->num_workers = num_workers;
+  self->thread_start = thread_start;
+  self->thread_stop = thread_stop;
+
+#if HAVE_SCHED_SETAFFINITY
+  self->affinity = affinity;
+#else
+  if (affinity)
+    msg_error("Binding I/O worker threads to CPUs is not supported on this platform, ignoring",
+              NULL);
+#endif
+
+  g_static_mutex_init(&self->completion_lock);
+  INIT_IV_LIST_HEAD(&self->completed);
+  IV_EVENT_INIT(&self->completion_event);
+  self->completion_event.cookie = self;
+  self->completion_event.handler = ml_worker_pool_complete_items;
+  iv_event_register(&self->completion_event);
+
+  stats_lock();
+  for (i = 0; i < num_workers; i++)
+    {
+      MlWorker *worker = &self->workers[i];
+      gchar instance[16];
+
+      worker->pool = self;
+      worker->id = i;
+      worker->lock = g_mutex_new();
+      worker->cond = g_cond_new();
+      INIT_IV_LIST_HEAD(&worker->run_queue);
+
+      g_snprintf(instance, sizeof(instance), "%d", i);
+      stats_register_counter(0, SCS_GLOBAL, "io_worker", instance, SC_TYPE_PROCESSED, &worker->processed);
+      stats_register_counter(0, SCS_GLOBAL, "io_worker", instance, SC_TYPE_STOLEN, &worker->stolen);
+      stats_register_counter(0, SCS_GLOBAL, "io_worker", instance, SC_TYPE_BUSY_TIME, &worker->busy_time);
+    }
+  stats_unlock();
+  return self;
+}
+
+/* NOTE: the workers must be idle by the time this is called */
+void
+ml_worker_pool_free(MlWorkerPool *self)
+{
+  gint i;
+
+  for (i = 0; i < self->num_workers; i++)
+    {
+      MlWorker *worker = &self->workers[i];
+
+      g_mutex_lock(worker->lock);
+      g_atomic_int_set(&self->quit, TRUE);
+      g_cond_signal(worker->cond);
+      g_mutex_unlock(worker->lock);
+    }
+
+  for (i = 0; i < self->num_workers; i++)
+    {
+      MlWorker *worker = &self->workers[i];
+
+      if (worker->thread)
+        g_thread_join(worker->thread);
+      g_mutex_free(worker->lock);
+      g_cond_free(worker->cond);
+    }
+
+  stats_lock();
+  for (i = 0; i < self->num_workers; i++)
+    {
+      MlWorker *worker = &self->workers[i];
+      gchar instance[16];
+
+      g_snprintf(instance, sizeof(instance), "%d", i);
+      stats_unregister_counter(SCS_GLOBAL, "io_worker", instance, SC_TYPE_PROCESSED, &worker->processed);
+      stats_unregister_counter(SCS_GLOBAL, "io_worker", instance, SC_TYPE_STOLEN, &worker->stolen);
+      stats_unregister_counter(SCS_GLOBAL, "io_worker", instance, SC_TYPE_BUSY_TIME, &worker->busy_time);
+    }
+  stats_unlock();
+
+  iv_event_unregister(&self->completion_event);
+  g_free(self);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2002-2012 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2012 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef ML_WORKER_POOL_H_INCLUDED
+#define ML_WORKER_POOL_H_INCLUDED
+
+#include "syslog-ng.h"
+
+#include <iv.h>
+#include <iv_list.h>
+
+typedef struct _MlWorkerPool MlWorkerPool;
+
+/* a unit of work, @work is run in one of the worker threads, @completion
+ * in the main thread once @work returned.  @worker is the worker that ran
+ * the item the last time, the item is submitted to the same worker again
+ * unless that one is busy and another worker steals it. */
+typedef struct _MlWorkItem
+{
+  struct iv_list_head list;
+  gint worker;
+  gpointer cookie;
+  void (*work)(gpointer cookie);
+  void (*completion)(gpointer cookie);
+} MlWorkItem;
+
+static inline void
+ml_work_item_init(MlWorkItem *self)
+{
+  INIT_IV_LIST_HEAD(&self->list);
+  self->worker = -1;
+}
+
+void ml_worker_pool_submit(MlWorkerPool *self, MlWorkItem *item);
+
+MlWorkerPool *ml_worker_pool_new(gint num_workers, gboolean affinity, void (*thread_start)(gint id), void (*thread_stop)(gint id));
+void ml_worker_pool_free(MlWorkerPool *self);
+
+#endif
@@ -26,6 +26,43 @@
 #include "cfg.h"
 #include "plugin.h"
 
+static MsgFormatLazyOptions *
+msg_format_lazy_options_new(MsgFormatOptions *options, GlobalConfig *cfg)
+{
+  MsgFormatLazyOptions *self = g_new0(MsgFormatLazyOptions, 1);
+
+  g_atomic_counter_set(&self->ref_cnt, 1);
+  self->options = *options;
+  self->options.flags &= ~LP_LAZY_PARSE;
+  self->options.format = g_strdup(options->format);
+  self->options.recv_time_zone = g_strdup(options->recv_time_zone);
+  self->options.recv_time_zone_info = time_zone_info_new(options->recv_time_zone);
+  self->options.bad_hostname = NULL;
+  if (options->bad_hostname && regcomp(&self->bad_hostname, cfg->bad_hostname_re, REG_NOSUB | REG_EXTENDED) == 0)
+    self->options.bad_hostname = &self->bad_hostname;
+  self->options.lazy_options = NULL;
+  return self;
+}
+
+MsgFormatLazyOptions *
+msg_format_lazy_options_ref(MsgFormatLazyOptions *self)
+{
+  g_atomic_counter_inc(&self->ref_cnt);
+  return self;
+}
+
+void
+msg_format_lazy_options_unref(MsgFormatLazyOptions *self)
+{
+  if (self && g_atomic_counter_dec_and_test(&self->ref_cnt))
+    {
+      if (self->options.bad_hostname)
+        regfree(&self->bad_hostname);
+      msg_format_options_destroy(&self->options);
+      g_free(self);
+    }
+}
+
 void
 msg_format_options_defaults(MsgFormatOptions *options)
 {
@@ -59,6 +96,8 @@ msg_format_options_init(MsgFormatOptions *options, GlobalConfig *cfg)
   p = plugin_find(cfg, LL_CONTEXT_FORMAT, options->format);
   if (p)
     options->format_handler = plugin_construct(p, cfg, LL_CONTEXT_FORMAT, options->format);
+  if ((options->flags & LP_LAZY_PARSE) && !options->lazy_options)
+    options->lazy_options = msg_format_lazy_options_new(options, cfg);
   options->initialized = TRUE;
 }
 
@@ -80,6 +119,11 @@ msg_format_options_destroy(MsgFormatOptions *options)
       time_zone_info_free(options->recv_time_zone_info);
       options->recv_time_zone_info = NULL;
     }
+  if (options->lazy_options)
+    {
+      msg_format_lazy_options_unref(options->lazy_options);
+      options->lazy_options = NULL;
+    }
   options->initialized = FALSE;
 }
 
@@ -95,6 +139,7 @@ CfgFlagHandler msg_format_flag_handlers[] =
   { "dont-store-legacy-msghdr", CFH_CLEAR, offsetof(MsgFormatOptions, flags), LP_STORE_LEGACY_MSGHDR },
   { "expect-hostname",            CFH_SET, offsetof(MsgFormatOptions, flags), LP_EXPECT_HOSTNAME },
   { "no-hostname",              CFH_CLEAR, offsetof(MsgFormatOptions, flags), LP_EXPECT_HOSTNAME },
+  { "lazy-parse",                 CFH_SET, offsetof(MsgFormatOptions, flags), LP_LAZY_PARSE },
 
   { NULL },
 };
@@ -28,6 +28,7 @@
 #include "syslog-ng.h"
 #include "timeutils.h"
 #include "logproto-server.h"
+#include "atomic.h"
 
 #include <regex.h>
 
@@ -51,9 +52,12 @@ enum
   LP_EXPECT_HOSTNAME = 0x0080,
   /* message is locally generated and should be marked with LF_LOCAL */
   LP_LOCAL = 0x0100,
+  /* only parse the PRI field on reception, the rest of the header is parsed when first used */
+  LP_LAZY_PARSE = 0x0200,
 };
 
 typedef struct _MsgFormatHandler MsgFormatHandler;
+typedef struct _MsgFormatLazyOptions MsgFormatLazyOptions;
 
 typedef struct _MsgFormatOptions
 {
@@ -66,8 +70,23 @@ typedef struct _MsgFormatOptions
   TimeZoneInfo *recv_time_zone_info;
   regex_t *bad_hostname;
   gint sdata_param_value_max;
+  MsgFormatLazyOptions *lazy_options;
 } MsgFormatOptions;
 
+/* A private copy of MsgFormatOptions, referenced by the messages whose
+ * parsing was deferred (see LP_LAZY_PARSE). The messages may outlive the
+ * configuration they were received with, thus it cannot point into
+ * either the options or the configuration. */
+struct _MsgFormatLazyOptions
+{
+  GAtomicCounter ref_cnt;
+  MsgFormatOptions options;
+  regex_t bad_hostname;
+};
+
+MsgFormatLazyOptions *msg_format_lazy_options_ref(MsgFormatLazyOptions *self);
+void msg_format_lazy_options_unref(MsgFormatLazyOptions *self);
+
 struct _MsgFormatHandler
 {
   /* this method has a chance to change the LogProto related options to
@@ -150,6 +150,10 @@ nv_registry_free(NVRegistry *self)
 #define NV_TABLE_DYNVALUE_HANDLE(x) ((x).handle)
 #define NV_TABLE_DYNVALUE_OFS(x)    ((x).ofs)
 
+/* the dynamic value index is built when the table reaches this many dynamic values */
+#define NV_TABLE_INDEX_THRESHOLD    16
+#define NV_TABLE_INDEX_MIN_SIZE     64
+
 
 static inline gchar *
 nv_table_get_bottom(NVTable *self)
@@ -157,11 +161,19 @@ nv_table_get_bottom(NVTable *self)
   return nv_table_get_top(self) - self->used;
 }
 
+static inline gsize
+nv_table_get_header_size(NVTable *self)
+{
+  return sizeof(NVTable) +
+         self->num_static_entries * sizeof(self->static_entries[0]) +
+         self->index_size * sizeof(guint16) +
+         self->num_dyn_entries * sizeof(NVDynValue);
+}
+
 static inline gchar *
 nv_table_get_ofs_table_top(NVTable *self)
 {
-  return (gchar *) &self->data[self->num_static_entries * sizeof(self->static_entries[0]) +
-                               self->num_dyn_entries * sizeof(NVDynValue)];
+  return NV_TABLE_ADDR(self, nv_table_get_header_size(self));
 }
 
 static inline NVEntry *
@@ -172,10 +184,16 @@ nv_table_get_entry_at_ofs(NVTable *self, guint32 ofs)
   return (NVEntry *) (nv_table_get_top(self) - ofs);
 }
 
+static inline guint16 *
+nv_table_get_index(NVTable *self)
+{
+  return (guint16 *) &self->static_entries[self->num_static_entries];
+}
+
 static inline NVDynValue *
 nv_table_get_dyn_entries(NVTable *self)
 {
-  return (NVDynValue *) &self->static_entries[self->num_static_entries];
+  return (NVDynValue *) (nv_table_get_index(self) + self->index_size);
 }
 
 static inline gboolean
@@ -201,6 +219,7 @@ nv_table_alloc_value(NVTable *self, gsize alloc_size)
   entry->alloc_len = alloc_size;
   entry->indirect = FALSE;
   entry->referenced = FALSE;
+  entry->external = FALSE;
   return entry;
 }
 
@@ -229,7 +248,13 @@ nv_table_resolve_indirect(NVTable *self, NVEntry *entry, gssize *length)
 static const inline gchar *
 nv_table_resolve_entry(NVTable *self, NVEntry *entry, gssize *length)
 {
-  if (!entry->indirect)
+  if (entry->external)
+    {
+      if (length)
+        *length = entry->vexternal.value_len;
+      return nv_entry_get_external_value(entry);
+    }
+  else if (!entry->indirect)
     {
       if (length)
         *length = entry->vdirect.value_len;
@@ -239,6 +264,51 @@ nv_table_resolve_entry(NVTable *self, NVEntry *entry, gssize *length)
     return nv_table_resolve_indirect(self, entry, length);
 }
 
+/* returns the position of @handle in the dynamic values array or -1 */
+static inline gint
+nv_table_index_lookup(NVTable *self, NVHandle handle)
+{
+  guint16 *index = nv_table_get_index(self);
+  NVDynValue *dyn_entries = nv_table_get_dyn_entries(self);
+  guint32 mask = self->index_size - 1;
+  guint32 slot;
+
+  for (slot = handle & mask; index[slot]; slot = (slot + 1) & mask)
+    {
+      if (NV_TABLE_DYNVALUE_HANDLE(dyn_entries[index[slot] - 1]) == handle)
+        return index[slot] - 1;
+    }
+  return -1;
+}
+
+static inline void
+nv_table_index_insert(NVTable *self, gint ndx)
+{
+  guint16 *index = nv_table_get_index(self);
+  NVDynValue *dyn_entries = nv_table_get_dyn_entries(self);
+  guint32 mask = self->index_size - 1;
+  guint32 slot;
+
+  for (slot = NV_TABLE_DYNVALUE_HANDLE(dyn_entries[ndx]) & mask; index[slot]; slot = (slot + 1) & mask)
+    ;
+  index[slot] = ndx + 1;
+}
+
+/* (re)builds the index with @index_size slots, the caller must make sure
+ * that the table has enough free space */
+static void
+nv_table_rebuild_index(NVTable *self, guint32 index_size)
+{
+  NVDynValue *dyn_entries = nv_table_get_dyn_entries(self);
+  gint i;
+
+  memmove(nv_table_get_index(self) + index_size, dyn_entries, self->num_dyn_entries * sizeof(NVDynValue));
+  self->index_size = index_size;
+  memset(nv_table_get_index(self), 0, index_size * sizeof(guint16));
+  for (i = 0; i < self->num_dyn_entries; i++)
+    nv_table_index_insert(self, i);
+}
+
 NVEntry *
 nv_table_get_entry_slow(NVTable *self, NVHandle handle, NVDynValue **dyn_slot)
 {
@@ -253,6 +323,18 @@ nv_table_get_entry_slow(NVTable *self, NVHandle handle, NVDynValue **dyn_slot)
       return NULL;
     }
 
+  if (self->index_size)
+    {
+      m = nv_table_index_lookup(self, handle);
+      if (m < 0)
+        {
+          *dyn_slot = NULL;
+          return NULL;
+        }
+      *dyn_slot = &dyn_entries[m];
+      return nv_table_get_entry_at_ofs(self, NV_TABLE_DYNVALUE_OFS(dyn_entries[m]));
+    }
+
   /* open-coded binary search */
   *dyn_slot = NULL;
   l = 0;
@@ -288,10 +370,37 @@ nv_table_reserve_table_entry(NVTable *self, NVHandle handle, NVDynValue **dyn_sl
   if (G_UNLIKELY(!(*dyn_slot) && handle > self->num_static_entries))
     {
       /* this is a dynamic value */
-      NVDynValue *dyn_entries = nv_table_get_dyn_entries(self);;
+      NVDynValue *dyn_entries;
       gint l, h, m, ndx;
       gboolean found = FALSE;
 
+      if (!self->index_size && self->num_dyn_entries >= NV_TABLE_INDEX_THRESHOLD &&
+          nv_table_alloc_check(self, NV_TABLE_INDEX_MIN_SIZE * sizeof(guint16) + sizeof(NVDynValue)))
+        nv_table_rebuild_index(self, NV_TABLE_INDEX_MIN_SIZE);
+
+      if (self->index_size)
+        {
+          /* indexed table, the value is known to be missing, append it,
+           * growing the index to keep its load factor below 1/2 */
+          guint32 index_size = self->index_size;
+
+          if ((self->num_dyn_entries + 1) * 2 > index_size)
+            index_size <<= 1;
+          if (!nv_table_alloc_check(self, (index_size - self->index_size) * sizeof(guint16) + sizeof(NVDynValue)))
+            return FALSE;
+          if (index_size != self->index_size)
+            nv_table_rebuild_index(self, index_size);
+
+          dyn_entries = nv_table_get_dyn_entries(self);
+          ndx = self->num_dyn_entries++;
+          dyn_entries[ndx].handle = handle;
+          dyn_entries[ndx].ofs = 0;
+          nv_table_index_insert(self, ndx);
+          *dyn_slot = &dyn_entries[ndx];
+          return TRUE;
+        }
+
+      dyn_entries = nv_table_get_dyn_entries(self);
       if (!nv_table_alloc_check(self, sizeof(dyn_entries[0])))
         return FALSE;
 
@@ -418,7 +527,7 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
     {
       gchar *dst;
       /* this value already exists and the new value fits in the old space */
-      if (!entry->indirect)
+      if (!entry->indirect && !entry->external)
         {
           dst = entry->vdirect.data + entry->name_len + 1;
 
@@ -428,8 +537,9 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
         }
       else
         {
-          /* this was an indirect entry, convert it */
+          /* this was an indirect or external entry, convert it */
           entry->indirect = 0;
+          entry->external = 0;
           entry->vdirect.value_len = value_len;
           entry->name_len = name_len;
           memcpy(entry->vdirect.data, name, name_len + 1);
@@ -529,6 +639,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
         {
           /* previously a non-indirect entry, convert it */
           entry->indirect = 1;
+          entry->external = 0;
           if (handle >= self->num_static_entries)
             {
               entry->name_len = name_len;
@@ -572,6 +683,53 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
   return TRUE;
 }
 
+/*
+ * Stores a reference to @value instead of copying it, the caller must
+ * make sure that @value is NUL terminated and that it remains valid for
+ * the lifetime of the NVTable.
+ */
+gboolean
+nv_table_add_value_external(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gboolean *new_entry)
+{
+  NVEntry *entry;
+  NVDynValue *dyn_slot;
+  guint32 ofs;
+
+  if (new_entry)
+    *new_entry = FALSE;
+  entry = nv_table_get_entry(self, handle, &dyn_slot);
+  if (G_UNLIKELY(entry || value_len == 0 || value_len > NV_TABLE_MAX_BYTES))
+    {
+      /* overwriting an existing value, which may be referenced by others
+       * or may reuse its current space, is left to nv_table_add_value(),
+       * just like truncating values that are too long */
+      return nv_table_add_value(self, handle, name, name_len, value, value_len, new_entry);
+    }
+  if (new_entry)
+    *new_entry = TRUE;
+
+  if (!nv_table_reserve_table_entry(self, handle, &dyn_slot))
+    return FALSE;
+  entry = nv_table_alloc_value(self, NV_ENTRY_EXTERNAL_HDR + name_len + 1);
+  if (G_UNLIKELY(!entry))
+    return FALSE;
+
+  ofs = (nv_table_get_top(self) - (gchar *) entry);
+  entry->external = TRUE;
+  entry->vexternal.value_len = value_len;
+  memcpy(entry->vexternal.value_ptr, &value, sizeof(value));
+  if (handle >= self->num_static_entries)
+    {
+      entry->name_len = name_len;
+      memcpy(entry->vexternal.name, name, name_len + 1);
+    }
+  else
+    entry->name_len = 0;
+
+  nv_table_set_table_entry(self, handle, ofs, dyn_slot);
+  return TRUE;
+}
+
 static gboolean
 nv_table_call_foreach(NVHandle handle, NVEntry *entry, gpointer user_data)
 {
@@ -632,6 +790,7 @@ nv_table_clear(NVTable *self)
   g_assert(self->ref_cnt == 1);
   self->used = 0;
   self->num_dyn_entries = 0;
+  self->index_size = 0;
   memset(&self->static_entries[0], 0, self->num_static_entries * sizeof(self->static_entries[0]));
 }
 
@@ -642,6 +801,7 @@ nv_table_init(NVTable *self, gsize alloc_length, gint num_static_entries)
   self->size = alloc_length;
   self->used = 0;
   self->num_dyn_entries = 0;
+  self->index_size = 0;
   self->num_static_entries = num_static_entries;
   self->ref_cnt = 1;
   self->borrowed = FALSE;
@@ -702,7 +862,7 @@ nv_table_realloc(NVTable *self, NVTable **new)
       *new = g_malloc(new_size);
 
       /* we only copy the header first */
-      memcpy(*new, self, sizeof(NVTable) + self->num_static_entries * sizeof(self->static_entries[0]) + self->num_dyn_entries * sizeof(NVDynValue));
+      memcpy(*new, self, nv_table_get_header_size(self));
       (*new)->ref_cnt = 1;
       (*new)->borrowed = FALSE;
 
@@ -750,7 +910,7 @@ nv_table_clone(NVTable *self, gint additional_space)
     new_size = self->size + (NV_TABLE_BOUND(additional_space));
 
   new = g_malloc(new_size);
-  memcpy(new, self, sizeof(NVTable) + self->num_static_entries * sizeof(self->static_entries[0]) + self->num_dyn_entries * sizeof(NVDynValue));
+  memcpy(new, self, nv_table_get_header_size(self));
   new->size = new_size;
   new->ref_cnt = 1;
   new->borrowed = FALSE;
@@ -27,6 +27,8 @@
 
 #include "syslog-ng.h"
 
+#include <string.h>
+
 typedef struct _NVTable NVTable;
 typedef struct _NVRegistry NVRegistry;
 typedef struct _NVDynValue NVDynValue;
@@ -102,7 +104,7 @@ nv_registry_get_handle_name(NVRegistry *self, NVHandle handle, gssize *length)
 struct _NVEntry
 {
   /* negative offset, counting from string table top, e.g. start of the string is at @top + ofs */
-  guint8 indirect:1, referenced:1;
+  guint8 indirect:1, referenced:1, external:1;
   guint8 name_len;
   guint32 alloc_len;
   union
@@ -121,21 +123,41 @@ struct _NVEntry
       guint8 type;
       gchar name[0];
     } vindirect;
+    struct
+    {
+      guint32 value_len;
+      /* pointer to the value stored outside of the NVTable, it is not
+       * aligned, use nv_entry_get_external_value() to access it */
+      gchar value_ptr[sizeof(gchar *)];
+      gchar name[0];
+    } vexternal;
   };
 };
 
 #define NV_ENTRY_DIRECT_HDR ((gsize) (&((NVEntry *) NULL)->vdirect.data))
 #define NV_ENTRY_INDIRECT_HDR (sizeof(NVEntry))
+#define NV_ENTRY_EXTERNAL_HDR ((gsize) (&((NVEntry *) NULL)->vexternal.name))
 
 static inline const gchar *
 nv_entry_get_name(NVEntry *self)
 {
   if (self->indirect)
     return self->vindirect.name;
+  else if (self->external)
+    return self->vexternal.name;
   else
     return self->vdirect.data;
 }
 
+static inline const gchar *
+nv_entry_get_external_value(NVEntry *self)
+{
+  const gchar *value;
+
+  memcpy(&value, self->vexternal.value_ptr, sizeof(value));
+  return value;
+}
+
 /*
  * Contains a set of ordered name-value pairs.
  *
@@ -161,7 +183,27 @@ nv_entry_get_name(NVEntry *self)
  *
  * Dynamic values:
  *   - a dynamically sized NVDynEntry array (contains ID + offset)
- *   - dynamic values are sorted by the global ID
+ *   - dynamic values are sorted by the global ID, until the table is
+ *     indexed (see below)
+ *
+ * Dynamic value index:
+ *   - once the number of dynamic values reaches a threshold, an open
+ *     addressed hash table is placed between the static value offsets and
+ *     the dynamic values: || static value offsets || index || dynamic values ||
+ *   - the index is a power of two sized guint16 array, containing the
+ *     position of the dynamic value + 1 (0 means an empty slot), slots are
+ *     selected by the low bits of the handle, collisions are resolved
+ *     by linear probing
+ *   - new dynamic values are appended to the end of the dynamic values
+ *     array, which is no longer sorted
+ *
+ * External values:
+ *   - an entry may point to a value stored outside of the NVTable (e.g. in
+ *     the buffer the message was read from), it is the responsibility of
+ *     the owner of the NVTable to keep that memory alive and NUL
+ *     terminated, as values are returned to the callers as C strings
+ *   - external values are converted to direct ones when they are
+ *     rewritten
  *
  * Memory allocation
  * =================
@@ -190,6 +232,8 @@ struct _NVTable
   guint8 num_static_entries;
   guint8 ref_cnt:7,
     borrowed:1; /* specifies if the memory used by NVTable was borrowed from the container struct */
+  /* number of slots in the dynamic value index, 0 if there's no index */
+  guint32 index_size;
 
   /* variable data, see memory layout in the comment above */
   union
@@ -210,6 +254,7 @@ struct _NVTable
 
 gboolean nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gboolean *new_entry);
 gboolean nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 ofs, guint32 len, gboolean *new_entry);
+gboolean nv_table_add_value_external(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gboolean *new_entry);
 
 gboolean nv_table_foreach(NVTable *self, NVRegistry *registry, NVTableForeachFunc func, gpointer user_data);
 gboolean nv_table_foreach_entry(NVTable *self, NVTableForeachEntryFunc func, gpointer user_data);
@@ -292,12 +337,18 @@ __nv_table_get_value(NVTable *self, NVHandle handle, guint16 num_static_entries,
       return null_string;
     }
 
-  if (!entry->indirect)
+  if (G_LIKELY(!entry->indirect && !entry->external))
     {
       if (length)
         *length = entry->vdirect.value_len;
       return entry->vdirect.data + entry->name_len + 1;
     }
+  else if (entry->external)
+    {
+      if (length)
+        *length = entry->vexternal.value_len;
+      return nv_entry_get_external_value(entry);
+    }
   return nv_table_resolve_indirect(self, entry, length);
 }
 
@@ -26,6 +26,7 @@
 #include "messages.h"
 #include "misc.h"
 #include "syslog-names.h"
+#include "logqueue.h"
 
 #include <string.h>
 
@@ -352,6 +353,11 @@ const gchar *tag_names[SC_TYPE_MAX] =
   /* [SC_TYPE_STORED]   = */  "stored",
   /* [SC_TYPE_SUPPRESSED] = */ "suppressed",
   /* [SC_TYPE_STAMP] = */ "stamp",
+  /* [SC_TYPE_MEMORY_USAGE] = */ "memory_usage",
+  /* [SC_TYPE_MATCHED] = */ "matched",
+  /* [SC_TYPE_EVAL_TIME] = */ "eval_time",
+  /* [SC_TYPE_STOLEN] = */ "stolen",
+  /* [SC_TYPE_BUSY_TIME] = */ "busy_time",
 };
 
 const gchar *source_names[SCS_MAX] =
@@ -385,6 +391,7 @@ const gchar *source_names[SCS_MAX] =
   "sender",
   "smtp",
   "amqp",
+  "filter",
 };
 
 
@@ -590,6 +597,12 @@ stats_reinit(GlobalConfig *cfg)
         }
       stats_unregister_counter(SCS_FACILITY | SCS_SOURCE, NULL, "other", SC_TYPE_PROCESSED, &facility_counters[FACILITY_MAX - 1]);
     }
+
+  if (!log_queue_total_memory_usage_counter)
+    {
+      stats_register_counter(0, SCS_GLOBAL, "log_queues", NULL, SC_TYPE_MEMORY_USAGE, &log_queue_total_memory_usage_counter);
+      stats_counter_set(log_queue_total_memory_usage_counter, log_queue_get_total_memory_usage() >> 10);
+    }
   stats_unlock();
 }
 
@@ -37,6 +37,11 @@ typedef enum
   SC_TYPE_STORED,    /* number of messages on disk */
   SC_TYPE_SUPPRESSED,/* number of messages suppressed */
   SC_TYPE_STAMP,     /* timestamp */
+  SC_TYPE_MEMORY_USAGE, /* memory used by queued messages, in KiB */
+  SC_TYPE_MATCHED,   /* number of messages matched */
+  SC_TYPE_EVAL_TIME, /* time spent evaluating, in microseconds */
+  SC_TYPE_STOLEN,    /* number of jobs stolen from other workers */
+  SC_TYPE_BUSY_TIME, /* time spent running jobs, in seconds */
   SC_TYPE_MAX
 } StatsCounterType;
 
@@ -72,6 +77,7 @@ enum
   SCS_SENDER         = 26,
   SCS_SMTP           = 27,
   SCS_AMQP           = 28,
+  SCS_FILTER         = 29,
   SCS_MAX,
   SCS_SOURCE_MASK    = 0xff
 };
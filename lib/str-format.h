@@ -33,6 +33,8 @@ gint format_int32_padded(GString *result, gint field_len, gchar pad_char, gint b
 gint format_uint64_padded(GString *result, gint field_len, gchar pad_char, gint base, guint64 value);
 gint format_int64_padded(GString *result, gint field_len, gchar pad_char, gint base, gint64 value);
 
+gboolean
+scan_month_abbrev(const gchar **buf, gint *left, gint *mon);
 gboolean
 scan_iso_timestamp(const gchar **buf, gint *left, struct tm *tm);
 gboolean
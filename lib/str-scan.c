@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "str-scan.h"
+
+#include <string.h>
+
+#if HAVE_X86_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+/*
+ * Word-at-a-time implementation, using an algorithm similar to what there's
+ * in libc memchr/strchr.
+ */
+static const guchar *
+find_eom_portable(const guchar *s, gsize n)
+{
+  const guchar *char_ptr;
+  const gulong *longword_ptr;
+  gulong longword, magic_bits, charmask;
+  gchar c;
+
+  c = '\n';
+
+  /* align input to long boundary */
+  for (char_ptr = s; n > 0 && ((gulong) char_ptr & (sizeof(longword) - 1)) != 0; ++char_ptr, n--)
+    {
+      if (*char_ptr == c || *char_ptr == '\0')
+        return char_ptr;
+    }
+
+  longword_ptr = (gulong *) char_ptr;
+
+#if GLIB_SIZEOF_LONG == 8
+  magic_bits = 0x7efefefefefefeffL;
+#elif GLIB_SIZEOF_LONG == 4
+  magic_bits = 0x7efefeffL;
+#else
+  #error "unknown architecture"
+#endif
+  memset(&charmask, c, sizeof(charmask));
+
+  while (n > sizeof(longword))
+    {
+      longword = *longword_ptr++;
+      if ((((longword + magic_bits) ^ ~longword) & ~magic_bits) != 0 ||
+          ((((longword ^ charmask) + magic_bits) ^ ~(longword ^ charmask)) & ~magic_bits) != 0)
+        {
+          gint i;
+
+          char_ptr = (const guchar *) (longword_ptr - 1);
+
+          for (i = 0; i < sizeof(longword); i++)
+            {
+              if (*char_ptr == c || *char_ptr == '\0')
+                return char_ptr;
+              char_ptr++;
+            }
+        }
+      n -= sizeof(longword);
+    }
+
+  char_ptr = (const guchar *) longword_ptr;
+
+  while (n-- > 0)
+    {
+      if (*char_ptr == c || *char_ptr == '\0')
+        return char_ptr;
+      ++char_ptr;
+    }
+
+  return NULL;
+}
+
+static gchar *
+find_cr_or_lf_portable(gchar *s, gsize n)
+{
+  gchar *char_ptr;
+  gulong *longword_ptr;
+  gulong longword, magic_bits, cr_charmask, lf_charmask;
+  const char CR = '\r';
+  const char LF = '\n';
+
+  /* align input to long boundary */
+  for (char_ptr = s; n > 0 && ((gulong) char_ptr & (sizeof(longword) - 1)) != 0; ++char_ptr, n--)
+    {
+      if (*char_ptr == CR || *char_ptr == LF)
+        return char_ptr;
+      else if (*char_ptr == 0)
+        return NULL;
+    }
+    
+  longword_ptr = (gulong *) char_ptr;
+
+#if GLIB_SIZEOF_LONG == 8
+  magic_bits = 0x7efefefefefefeffL;
+#elif GLIB_SIZEOF_LONG == 4
+  magic_bits = 0x7efefeffL; 
+#else
+  #error "unknown architecture"
+#endif
+  memset(&cr_charmask, CR, sizeof(cr_charmask));
+  memset(&lf_charmask, LF, sizeof(lf_charmask));
+    
+  while (n > sizeof(longword))
+    {
+      longword = *longword_ptr++;
+      if ((((longword + magic_bits) ^ ~longword) & ~magic_bits) != 0 ||
+          ((((longword ^ cr_charmask) + magic_bits) ^ ~(longword ^ cr_charmask)) & ~magic_bits) != 0 || 
+          ((((longword ^ lf_charmask) + magic_bits) ^ ~(longword ^ lf_charmask)) & ~magic_bits) != 0)
+        {
+          gint i;
+
+          char_ptr = (gchar *) (longword_ptr - 1);
+          
+          for (i = 0; i < sizeof(longword); i++)
+            {
+              if (*char_ptr == CR || *char_ptr == LF)
+                return char_ptr;
+              else if (*char_ptr == 0)
+                return NULL;
+              char_ptr++;
+            }
+        }
+      n -= sizeof(longword);
+    }
+
+  char_ptr = (gchar *) longword_ptr;
+
+  while (n-- > 0)
+    {
+      if (*char_ptr == CR || *char_ptr == LF)
+        return char_ptr;
+      else if (*char_ptr == 0)
+        return NULL;
+      ++char_ptr;
+    }
+
+  return NULL;
+}
+
+#if HAVE_X86_SIMD_DISPATCH
+
+/*
+ * The SIMD implementations compare 16 or 32 bytes at a time and use the
+ * first set bit of the comparison mask. Only complete blocks within the
+ * buffer are loaded, the rest is handed over to the narrower
+ * implementation.
+ */
+
+static const guchar * __attribute__((target("sse2")))
+find_eom_sse2(const guchar *s, gsize n)
+{
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i nul = _mm_setzero_si128();
+  __m128i block;
+  gint mask;
+
+  while (n >= sizeof(block))
+    {
+      block = _mm_loadu_si128((const __m128i *) s);
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, nl), _mm_cmpeq_epi8(block, nul)));
+      if (mask)
+        return s + __builtin_ctz(mask);
+      s += sizeof(block);
+      n -= sizeof(block);
+    }
+  return find_eom_portable(s, n);
+}
+
+static const guchar * __attribute__((target("avx2")))
+find_eom_avx2(const guchar *s, gsize n)
+{
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i nul = _mm256_setzero_si256();
+  __m256i block;
+  guint32 mask;
+
+  while (n >= sizeof(block))
+    {
+      block = _mm256_loadu_si256((const __m256i *) s);
+      mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, nl), _mm256_cmpeq_epi8(block, nul)));
+      if (mask)
+        return s + __builtin_ctz(mask);
+      s += sizeof(block);
+      n -= sizeof(block);
+    }
+  return find_eom_sse2(s, n);
+}
+
+static gchar * __attribute__((target("sse2")))
+find_cr_or_lf_sse2(gchar *s, gsize n)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const __m128i nul = _mm_setzero_si128();
+  __m128i block;
+  gint mask;
+
+  while (n >= sizeof(block))
+    {
+      block = _mm_loadu_si128((const __m128i *) s);
+      mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf)),
+                                            _mm_cmpeq_epi8(block, nul)));
+      if (mask)
+        {
+          s += __builtin_ctz(mask);
+          /* the string ends before any CR or LF */
+          return *s ? s : NULL;
+        }
+      s += sizeof(block);
+      n -= sizeof(block);
+    }
+  return find_cr_or_lf_portable(s, n);
+}
+
+static gchar * __attribute__((target("avx2")))
+find_cr_or_lf_avx2(gchar *s, gsize n)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const __m256i nul = _mm256_setzero_si256();
+  __m256i block;
+  guint32 mask;
+
+  while (n >= sizeof(block))
+    {
+      block = _mm256_loadu_si256((const __m256i *) s);
+      mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, cr), _mm256_cmpeq_epi8(block, lf)),
+                                                  _mm256_cmpeq_epi8(block, nul)));
+      if (mask)
+        {
+          s += __builtin_ctz(mask);
+          return *s ? s : NULL;
+        }
+      s += sizeof(block);
+      n -= sizeof(block);
+    }
+  return find_cr_or_lf_sse2(s, n);
+}
+
+#endif
+
+static const guchar *find_eom_select(const guchar *s, gsize n);
+static gchar *find_cr_or_lf_select(gchar *s, gsize n);
+
+typedef struct _StrScanFuncs
+{
+  const gchar *name;
+  const guchar *(*find_eom)(const guchar *s, gsize n);
+  gchar *(*find_cr_or_lf)(gchar *s, gsize n);
+} StrScanFuncs;
+
+static const StrScanFuncs str_scan_impls[STR_SCAN_MAX] =
+{
+  [STR_SCAN_PORTABLE] = { "portable", find_eom_portable, find_cr_or_lf_portable },
+#if HAVE_X86_SIMD_DISPATCH
+  [STR_SCAN_SSE2] = { "sse2", find_eom_sse2, find_cr_or_lf_sse2 },
+  [STR_SCAN_AVX2] = { "avx2", find_eom_avx2, find_cr_or_lf_avx2 },
+#else
+  [STR_SCAN_SSE2] = { "sse2", NULL, NULL },
+  [STR_SCAN_AVX2] = { "avx2", NULL, NULL },
+#endif
+};
+
+/* the implementation is selected on first use, the functions are
+ * published as a single pointer so that a thread never sees functions of
+ * different implementations */
+static const StrScanFuncs str_scan_select_funcs = { NULL, find_eom_select, find_cr_or_lf_select };
+static const StrScanFuncs *str_scan_current = &str_scan_select_funcs;
+
+static inline const StrScanFuncs *
+str_scan_get_current(void)
+{
+  return (const StrScanFuncs *) g_atomic_pointer_get((gpointer *) &str_scan_current);
+}
+
+static gboolean
+str_scan_is_supported(StrScanImpl impl)
+{
+  if ((gint) impl < 0 || impl >= STR_SCAN_MAX || !str_scan_impls[impl].find_eom)
+    return FALSE;
+
+#if HAVE_X86_SIMD_DISPATCH
+  __builtin_cpu_init();
+  if (impl == STR_SCAN_SSE2)
+    return __builtin_cpu_supports("sse2");
+  if (impl == STR_SCAN_AVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return TRUE;
+}
+
+/*
+ * Selects the implementation to be used by find_eom() and
+ * find_cr_or_lf(), returns FALSE if it is not supported by the build or
+ * the CPU. Threads scanning in parallel switch atomically, but it is
+ * meant to be used by tests and benchmarks.
+ */
+gboolean
+str_scan_set_impl(StrScanImpl impl)
+{
+  if (!str_scan_is_supported(impl))
+    return FALSE;
+
+  g_atomic_pointer_set((gpointer *) &str_scan_current, (gpointer) &str_scan_impls[impl]);
+  return TRUE;
+}
+
+const gchar *
+str_scan_get_impl_name(StrScanImpl impl)
+{
+  g_assert((gint) impl >= 0 && impl < STR_SCAN_MAX);
+  return str_scan_impls[impl].name;
+}
+
+/* picks the widest supported implementation, racing threads select the same one */
+static void
+str_scan_select_impl(void)
+{
+  StrScanImpl impl;
+
+  for (impl = STR_SCAN_MAX - 1; impl > STR_SCAN_PORTABLE; impl--)
+    {
+      if (str_scan_set_impl(impl))
+        return;
+    }
+  str_scan_set_impl(STR_SCAN_PORTABLE);
+}
+
+StrScanImpl
+str_scan_get_impl(void)
+{
+  if (str_scan_get_current() == &str_scan_select_funcs)
+    str_scan_select_impl();
+  return (StrScanImpl) (str_scan_get_current() - str_scan_impls);
+}
+
+static const guchar *
+find_eom_select(const guchar *s, gsize n)
+{
+  str_scan_select_impl();
+  return str_scan_get_current()->find_eom(s, n);
+}
+
+static gchar *
+find_cr_or_lf_select(gchar *s, gsize n)
+{
+  str_scan_select_impl();
+  return str_scan_get_current()->find_cr_or_lf(s, n);
+}
+
+/**
+ * Find the character terminating the buffer.
+ *
+ * NOTE: when looking for the end-of-message here, it either needs to be
+ * terminated via NUL or via NL, when terminating via NL we have to make
+ * sure that there's no NUL left in the message. This function iterates over
+ * the input data and returns a pointer to the first occurence of NL or NUL.
+ **/
+const guchar *
+find_eom(const guchar *s, gsize n)
+{
+  return str_scan_get_current()->find_eom(s, n);
+}
+
+/**
+ * Find CR or LF characters in the log message. Returns NULL if the
+ * string is terminated by a NUL character before either of them.
+ **/
+gchar *
+find_cr_or_lf(gchar *s, gsize n)
+{
+  return str_scan_get_current()->find_cr_or_lf(s, n);
+}
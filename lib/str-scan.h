@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef STR_SCAN_H_INCLUDED
+#define STR_SCAN_H_INCLUDED
+
+#include "syslog-ng.h"
+
+/* implementations of the scanning functions below */
+typedef enum
+{
+  STR_SCAN_PORTABLE,
+  STR_SCAN_SSE2,
+  STR_SCAN_AVX2,
+  STR_SCAN_MAX
+} StrScanImpl;
+
+const guchar *find_eom(const guchar *s, gsize n);
+gchar *find_cr_or_lf(gchar *s, gsize n);
+
+gboolean str_scan_set_impl(StrScanImpl impl);
+StrScanImpl str_scan_get_impl(void);
+const gchar *str_scan_get_impl_name(StrScanImpl impl);
+
+#endif
@@ -285,6 +285,7 @@ log_macro_expand(GString *result, gint id, gboolean escape, LogTemplateOptions *
 
   if (!opts)
     opts = &default_opts;
+  log_msg_ensure_parsed(msg);
   switch (id)
     {
     case M_FACILITY:
@@ -678,6 +679,39 @@ typedef struct _LogTemplateElem
   };
 } LogTemplateElem;
 
+/* The compiled template is flattened into an array of ops, the
+ * literals of which are merged into a single buffer. Common macros get
+ * their own ops instead of going through log_macro_expand(). */
+enum
+{
+  LTO_TEXT,
+  LTO_VALUE,
+  LTO_MACRO,
+  LTO_PRI,
+  LTO_HOST,
+  LTO_MSGHDR,
+  LTO_MESSAGE,
+  LTO_FUNC,
+};
+
+typedef struct _LogTemplateOp
+{
+  guint8 type;
+  guint16 msg_ref;
+  gsize text_len;
+  const gchar *text;
+  const gchar *default_value;
+  union
+  {
+    guint macro;
+    NVHandle value_handle;
+    LogTemplateElem *func;
+  };
+} LogTemplateOp;
+
+/* output estimated for a single non-literal op when sizing the result */
+#define LOG_TEMPLATE_OP_ESTIMATED_LEN 32
+
 
 /* simple template functions which take templates as arguments */
 
@@ -757,6 +791,16 @@ log_template_set_escape(LogTemplate *self, gboolean enable)
 static void
 log_template_reset_compiled(LogTemplate *self)
 {
+  g_free(self->program);
+  self->program = NULL;
+  self->program_len = 0;
+  g_free(self->literals);
+  self->literals = NULL;
+  self->literals_len = 0;
+  self->memoizable = FALSE;
+  self->depends_on_seq_num = FALSE;
+  self->depends_on_options = FALSE;
+
   while (self->compiled_template)
     {
       LogTemplateElem *e;
@@ -868,6 +912,113 @@ log_template_add_func_elem(LogTemplate *self, GString *text, gint argc, gchar *a
   return FALSE;
 }
 
+static LogTemplateOp *
+log_template_add_op(LogTemplate *self, guint8 type, guint16 msg_ref, const gchar *default_value)
+{
+  LogTemplateOp *op = &self->program[self->program_len++];
+
+  op->type = type;
+  op->msg_ref = msg_ref;
+  op->default_value = default_value;
+  return op;
+}
+
+static LogTemplateOp *
+log_template_add_macro_op(LogTemplate *self, LogTemplateElem *e)
+{
+  switch (e->macro)
+    {
+    case M_PRI:
+      return log_template_add_op(self, LTO_PRI, e->msg_ref, e->default_value);
+    case M_HOST:
+      return log_template_add_op(self, LTO_HOST, e->msg_ref, e->default_value);
+    case M_MSGHDR:
+      return log_template_add_op(self, LTO_MSGHDR, e->msg_ref, e->default_value);
+    case M_MESSAGE:
+      /* $MSG includes the header with older configurations */
+      if (!cfg_is_config_version_older(configuration, 0x0300))
+        return log_template_add_op(self, LTO_MESSAGE, e->msg_ref, e->default_value);
+      break;
+    }
+  return log_template_add_op(self, LTO_MACRO, e->msg_ref, e->default_value);
+}
+
+/* flattens compiled_template into program */
+static void
+log_template_compile_program(LogTemplate *self)
+{
+  LogTemplateElem *e;
+  LogTemplateOp *op;
+  GList *p;
+  gsize literal_ofs = 0;
+  gint num_elems = 0;
+
+  for (p = self->compiled_template; p; p = g_list_next(p))
+    {
+      e = (LogTemplateElem *) p->data;
+      self->literals_len += e->text_len;
+      num_elems++;
+    }
+
+  /* each element may turn into a literal and an op */
+  self->program = g_new0(LogTemplateOp, 2 * num_elems);
+  self->literals = g_malloc(self->literals_len + 1);
+  self->memoizable = TRUE;
+
+  for (p = self->compiled_template; p; p = g_list_next(p))
+    {
+      e = (LogTemplateElem *) p->data;
+      if (e->text_len)
+        {
+          memcpy(self->literals + literal_ofs, e->text, e->text_len);
+          if (self->program_len > 0 && self->program[self->program_len - 1].type == LTO_TEXT)
+            {
+              /* merge adjacent literals */
+              self->program[self->program_len - 1].text_len += e->text_len;
+            }
+          else
+            {
+              op = log_template_add_op(self, LTO_TEXT, 0, NULL);
+              op->text = self->literals + literal_ofs;
+              op->text_len = e->text_len;
+            }
+          literal_ofs += e->text_len;
+        }
+
+      switch (e->type)
+        {
+        case LTE_VALUE:
+          op = log_template_add_op(self, LTO_VALUE, e->msg_ref, e->default_value);
+          op->value_handle = e->value_handle;
+          break;
+        case LTE_MACRO:
+          if (e->macro == M_NONE)
+            break;
+          op = log_template_add_macro_op(self, e);
+          op->macro = e->macro;
+
+          if (e->macro == M_SEQNUM)
+            self->depends_on_seq_num = TRUE;
+          else if (e->macro == M_SYSUPTIME || e->macro >= M_CSTAMP_OFS + M_TIME_FIRST)
+            self->memoizable = FALSE;
+          else if (e->macro >= M_TIME_FIRST)
+            self->depends_on_options = TRUE;
+          break;
+        case LTE_FUNC:
+          op = log_template_add_op(self, LTO_FUNC, e->msg_ref, NULL);
+          op->func = e;
+
+          /* we can't tell what the arguments of the function use */
+          self->depends_on_seq_num = TRUE;
+          self->depends_on_options = TRUE;
+          break;
+        default:
+          g_assert_not_reached();
+        }
+    }
+  self->literals[literal_ofs] = 0;
+}
+
 static void
 parse_msg_ref(gchar **p, gint *msg_ref)
 {
@@ -1132,6 +1283,7 @@ log_template_compile(LogTemplate *self, const gchar *template, GError **error)
       g_string_free(last_text, TRUE);
     }
   self->compiled_template = g_list_reverse(self->compiled_template);
+  log_template_compile_program(self);
   return TRUE;
   
  error:
@@ -1144,23 +1296,42 @@ log_template_compile(LogTemplate *self, const gchar *template, GError **error)
   g_string_sprintf(last_text, "error in template: %s", self->template);
   log_template_add_macro_elem(self, M_NONE, last_text, NULL, 0);
   g_string_free(last_text, TRUE);
+  log_template_compile_program(self);
   return FALSE;
 }
 
+/* makes sure that @result has room for @len more bytes, so that it
+ * is not grown piecemeal while formatting */
+static inline void
+log_template_reserve_result(GString *result, gsize len)
+{
+  gsize old_len = result->len;
+
+  if (result->allocated_len <= old_len + len)
+    {
+      g_string_set_size(result, old_len + len);
+      g_string_truncate(result, old_len);
+    }
+}
+
 void
 log_template_append_format_with_context(LogTemplate *self, LogMessage **messages, gint num_messages, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result)
 {
-  GList *p;
-  LogTemplateElem *e;
-  
-  for (p = self->compiled_template; p; p = g_list_next(p))
+  const LogTemplateOp *op;
+  LogMessage *msg;
+  gint i;
+
+  log_template_reserve_result(result, self->literals_len + self->program_len * LOG_TEMPLATE_OP_ESTIMATED_LEN);
+  for (i = 0; i < self->program_len; i++)
     {
       gint msg_ndx;
+      gsize len;
 
-      e = (LogTemplateElem *) p->data;
-      if (e->text)
+      op = &self->program[i];
+      if (op->type == LTO_TEXT)
         {
-          g_string_append_len(result, e->text, e->text_len);
+          g_string_append_len(result, op->text, op->text_len);
+          continue;
         }
 
       /* NOTE: msg_ref is 1 larger than the index specified by the user in
@@ -1169,42 +1340,56 @@ log_template_append_format_with_context(LogTemplate *self, LogMessage **messages
        *
        * msg_ref == 0 means that the user didn't specify msg_ref
        * msg_ref >= 1 means that the user supplied the given msg_ref, 1 is equal to @0 */
-      if (e->msg_ref > num_messages)
+      if (op->msg_ref > num_messages)
         continue;
-      msg_ndx = num_messages - e->msg_ref;
+      msg_ndx = num_messages - op->msg_ref;
 
       /* value and macro can't understand a context, assume that no msg_ref means @0 */
-      if (e->msg_ref == 0)
+      if (op->msg_ref == 0)
         msg_ndx--;
+      msg = messages[msg_ndx];
 
-      switch (e->type)
+      len = result->len;
+      switch (op->type)
         {
-        case LTE_VALUE:
+        case LTO_VALUE:
           {
             const gchar *value = NULL;
             gssize value_len = -1;
 
-            value = log_msg_get_value(messages[msg_ndx], e->value_handle, &value_len);
+            value = log_msg_get_value(msg, op->value_handle, &value_len);
             if (value && value[0])
               result_append(result, value, value_len, self->escape);
-            else if (e->default_value)
-              result_append(result, e->default_value, -1, self->escape);
+            else if (op->default_value)
+              result_append(result, op->default_value, -1, self->escape);
             break;
           }
-        case LTE_MACRO:
+        case LTO_PRI:
+          format_uint32_padded(result, 0, 0, 10, msg->pri);
+          break;
+        case LTO_HOST:
+          if (G_LIKELY(!(msg->flags & LF_CHAINED_HOSTNAME)))
+            result_append_value(result, msg, LM_V_HOST, self->escape);
+          else
+            log_macro_expand(result, op->macro, self->escape, opts ? opts : &self->cfg->template_options, tz, seq_num, context_id, msg);
+          break;
+        case LTO_MSGHDR:
+          /* same as the fast path in log_macro_expand() */
+          if (G_LIKELY(msg->flags & LF_LEGACY_MSGHDR))
+            result_append_value(result, msg, LM_V_LEGACY_MSGHDR, self->escape);
+          else
+            log_macro_expand(result, op->macro, self->escape, opts ? opts : &self->cfg->template_options, tz, seq_num, context_id, msg);
+          break;
+        case LTO_MESSAGE:
+          result_append_value(result, msg, LM_V_MESSAGE, self->escape);
+          break;
+        case LTO_MACRO:
+          log_macro_expand(result, op->macro, self->escape, opts ? opts : &self->cfg->template_options, tz, seq_num, context_id, msg);
+          break;
+        case LTO_FUNC:
           {
-            gint len = result->len;
+            LogTemplateElem *e = op->func;
 
-            if (e->macro)
-              {
-                log_macro_expand(result, e->macro, self->escape, opts ? opts : &self->cfg->template_options, tz, seq_num, context_id, messages[msg_ndx]);
-                if (len == result->len && e->default_value)
-                  g_string_append(result, e->default_value);
-              }
-            break;
-          }
-        case LTE_FUNC:
-          {
             g_static_mutex_lock(&self->arg_lock);
             if (!self->arg_bufs)
               self->arg_bufs = g_ptr_array_sized_new(0);
@@ -1235,7 +1420,13 @@ log_template_append_format_with_context(LogTemplate *self, LogMessage **messages
             g_static_mutex_unlock(&self->arg_lock);
             break;
           }
+        default:
+          g_assert_not_reached();
         }
+
+      /* values handle their defaults themselves, macros get theirs if they expanded to nothing */
+      if (op->type != LTO_VALUE && len == result->len && op->default_value)
+        g_string_append(result, op->default_value);
     }
 }
 
@@ -1267,6 +1458,105 @@ log_template_format(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts,
   log_template_append_format(self, lm, opts, tz, seq_num, context_id, result);
 }
 
+/* a formatted template attached to a LogMessage */
+typedef struct _LogTemplateMemo
+{
+  LogMessageMemo super;
+  LogTemplate *template;
+  gint32 seq_num;
+  gint tz;
+  gint ts_format;
+  gint frac_digits;
+  gchar *time_zone;
+  gsize result_len;
+  gchar result[0];
+} LogTemplateMemo;
+
+static void
+log_template_memo_free(LogMessageMemo *s)
+{
+  LogTemplateMemo *self = (LogTemplateMemo *) s;
+
+  log_template_unref(self->template);
+  g_free(self->time_zone);
+  g_free(self);
+}
+
+static gboolean
+log_template_memo_matches(LogTemplateMemo *self, LogTemplate *template, LogTemplateOptions *opts, gint tz, gint32 seq_num)
+{
+  if (self->template != template)
+    return FALSE;
+  if (template->depends_on_seq_num && self->seq_num != seq_num)
+    return FALSE;
+  if (template->depends_on_options &&
+      (self->tz != tz ||
+       self->ts_format != opts->ts_format ||
+       self->frac_digits != opts->frac_digits ||
+       g_strcmp0(self->time_zone, opts->time_zone[tz]) != 0))
+    return FALSE;
+  return TRUE;
+}
+
+/*
+ * Formats @self just like log_template_append_format(), but remembers the
+ * result in @lm, so that other callers formatting the same template with
+ * equivalent options (e.g. destinations sharing a template) can reuse it.
+ * The result is reused until the message is changed.
+ */
+void
+log_template_append_format_cached(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, GString *result)
+{
+  LogTemplateOptions *key_opts = opts ? opts : &self->cfg->template_options;
+  LogMessageMemo *memo;
+  LogTemplateMemo *tmemo;
+  gsize start;
+  gint generation;
+
+  if (!self->memoizable)
+    {
+      log_template_append_format(self, lm, opts, tz, seq_num, NULL, result);
+      return;
+    }
+
+  generation = log_msg_get_memo_generation(lm);
+  for (memo = log_msg_get_memos(lm); memo; memo = memo->next)
+    {
+      if (memo->free_fn != log_template_memo_free || memo->generation != generation)
+        continue;
+
+      tmemo = (LogTemplateMemo *) memo;
+      if (log_template_memo_matches(tmemo, self, key_opts, tz, seq_num))
+        {
+          g_string_append_len(result, tmemo->result, tmemo->result_len);
+          return;
+        }
+    }
+
+  start = result->len;
+  log_template_append_format(self, lm, opts, tz, seq_num, NULL, result);
+
+  tmemo = g_malloc(sizeof(LogTemplateMemo) + result->len - start);
+  tmemo->super.free_fn = log_template_memo_free;
+  tmemo->super.generation = generation;
+  tmemo->template = log_template_ref(self);
+  tmemo->seq_num = seq_num;
+  tmemo->tz = tz;
+  tmemo->ts_format = key_opts->ts_format;
+  tmemo->frac_digits = key_opts->frac_digits;
+  tmemo->time_zone = g_strdup(key_opts->time_zone[tz]);
+  tmemo->result_len = result->len - start;
+  memcpy(tmemo->result, result->str + start, tmemo->result_len);
+  log_msg_add_memo(lm, &tmemo->super);
+}
+
+void
+log_template_format_cached(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, GString *result)
+{
+  g_string_truncate(result, 0);
+  log_template_append_format_cached(self, lm, opts, tz, seq_num, result);
+}
+
 LogTemplate *
 log_template_new(GlobalConfig *cfg, gchar *name)
 {
@@ -49,6 +49,16 @@ typedef struct _LogTemplate
   gchar *name;
   gchar *template;
   GList *compiled_template;
+  /* the flat form of compiled_template that is executed when formatting */
+  struct _LogTemplateOp *program;
+  gint program_len;
+  /* literal text of the program, stored contiguously */
+  gchar *literals;
+  gsize literals_len;
+  /* whether the output may be shared between callers, see log_template_format_cached() */
+  gboolean memoizable;
+  gboolean depends_on_seq_num;
+  gboolean depends_on_options;
   gboolean escape;
   gboolean def_inline;
   GlobalConfig *cfg;
@@ -193,6 +203,8 @@ void log_template_format(LogTemplate *self, LogMessage *lm, LogTemplateOptions *
 void log_template_append_format(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result);
 void log_template_append_format_with_context(LogTemplate *self, LogMessage **messages, gint num_messages, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result);
 void log_template_format_with_context(LogTemplate *self, LogMessage **messages, gint num_messages, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result);
+void log_template_format_cached(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, GString *result);
+void log_template_append_format_cached(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, GString *result);
 void log_template_append_format_recursive(LogTemplate *self, const LogTemplateInvokeArgs *args, GString *result);
 
 
@@ -43,8 +43,29 @@ typedef struct
 {
   gchar *name;
   LogTemplate *template;
+
+  /* the name after rekeying, set when the plan is compiled */
+  gchar *plan_name;
 } VPPairConf;
 
+enum
+{
+  VPE_UNRESOLVED = 0,
+  VPE_EXCLUDED,
+  VPE_INCLUDED,
+};
+
+/* the decision made for a name-value pair in the message payload */
+typedef struct
+{
+  gint state;
+  gchar *name;
+} VPPlanEntry;
+
+/* the plan entries are allocated in pages of 256 handles, as needed */
+#define VP_PLAN_PAGE_SIZE 256
+#define VP_PLAN_PAGES     (65536 / VP_PLAN_PAGE_SIZE)
+
 struct _ValuePairs
 {
   VPPatternSpec **patterns;
@@ -54,6 +75,16 @@ struct _ValuePairs
   /* guint32 as CfgFlagHandler only supports 32 bit integers */
   guint32 scopes;
   guint32 patterns_size;
+
+  /* the selection above compiled into a plan on first use: the macros
+   * selected by the scopes with excludes applied, and the decision for
+   * each NVHandle, with all names already rekeyed. Handles are resolved
+   * the first time they are seen in a message, so handles registered
+   * later are picked up without recompiling anything. */
+  GStaticMutex plan_lock;
+  gint plan_compiled;
+  GArray *plan_macros;
+  VPPlanEntry *plan_nvpairs[VP_PLAN_PAGES];
 };
 
 typedef enum
@@ -128,9 +159,12 @@ static CfgFlagHandler value_pair_scope[] =
   { "everything",         CFH_SET, offsetof(ValuePairs, scopes), VPS_EVERYTHING },
 };
 
+static void vp_plan_reset(ValuePairs *vp);
+
 gboolean
 value_pairs_add_scope(ValuePairs *vp, const gchar *scope)
 {
+  vp_plan_reset(vp);
   return cfg_process_flag(value_pair_scope, vp, scope);
 }
 
@@ -141,6 +175,7 @@ value_pairs_add_glob_pattern(ValuePairs *vp, const gchar *pattern,
   gint i;
   VPPatternSpec *p;
 
+  vp_plan_reset(vp);
   i = vp->patterns_size++;
   vp->patterns = g_renew(VPPatternSpec *, vp->patterns, vp->patterns_size);
 
@@ -154,8 +189,9 @@ value_pairs_add_glob_pattern(ValuePairs *vp, const gchar *pattern,
 void
 value_pairs_add_pair(ValuePairs *vp, GlobalConfig *cfg, const gchar *key, const gchar *value)
 {
-  VPPairConf *p = g_new(VPPairConf, 1);
+  VPPairConf *p = g_new0(VPPairConf, 1);
 
+  vp_plan_reset(vp);
   p->name = g_strdup(key);
   p->template = log_template_new(cfg, NULL);
   log_template_compile(p->template, value, NULL);
@@ -163,52 +199,256 @@ value_pairs_add_pair(ValuePairs *vp, GlobalConfig *cfg, const gchar *key, const
   g_ptr_array_add(vp->vpairs, p);
 }
 
+/*
+ * Plan compilation
+ */
+
 static gchar *
-vp_transform_apply (ValuePairs *vp, gchar *key)
+vp_plan_rekey(ValuePairs *vp, const gchar *name)
 {
+  ScratchBuffer *key;
+  gchar *result;
   GList *l;
-  gchar *ckey, *okey = g_strdup(key);
 
-  if (!vp->transforms)
-    return okey;
+  key = scratch_buffer_acquire();
+  g_string_assign(sb_string(key), name);
+  for (l = vp->transforms; l; l = g_list_next(l))
+    value_pairs_transform_set_apply_in_place((ValuePairsTransformSet *) l->data, key);
 
-  l = vp->transforms;
-  while (l)
+  result = g_strndup(sb_string(key)->str, sb_string(key)->len);
+  scratch_buffer_release(key);
+  return result;
+}
+
+static void
+vp_plan_add_macros(ValuePairs *vp, ValuePairSpec *set)
+{
+  gint i, j;
+
+  for (i = 0; set[i].name; i++)
     {
-      ValuePairsTransformSet *t = (ValuePairsTransformSet *)l->data;
-      ckey = value_pairs_transform_set_apply(t, okey);
-      g_free(okey);
-      okey = ckey;
-      l = g_list_next (l);
+      ValuePairSpec spec;
+      gboolean exclude = FALSE;
+
+      for (j = 0; j < vp->patterns_size; j++)
+        {
+          if (g_pattern_match_string(vp->patterns[j]->pattern, set[i].name))
+            exclude = !vp->patterns[j]->include;
+        }
+
+      if (exclude)
+        continue;
+
+      spec = set[i];
+      spec.name = vp_plan_rekey(vp, set[i].name);
+      spec.alt_name = NULL;
+      g_array_append_val(vp->plan_macros, spec);
     }
+}
+
+/* compiles the parts of the plan that do not depend on the message */
+static void
+vp_plan_compile(ValuePairs *vp)
+{
+  gint i;
+
+  if (G_LIKELY(g_atomic_int_get(&vp->plan_compiled)))
+    return;
+
+  g_static_mutex_lock(&vp->plan_lock);
+  if (!vp->plan_compiled)
+    {
+      vp->plan_macros = g_array_new(TRUE, TRUE, sizeof(ValuePairSpec));
+
+      if (vp->scopes & (VPS_RFC3164 + VPS_RFC5424 + VPS_SELECTED_MACROS))
+        vp_plan_add_macros(vp, rfc3164);
+
+      if (vp->scopes & VPS_RFC5424)
+        vp_plan_add_macros(vp, rfc5424);
+
+      if (vp->scopes & VPS_SELECTED_MACROS)
+        vp_plan_add_macros(vp, selected_macros);
+
+      if (vp->scopes & VPS_ALL_MACROS)
+        vp_plan_add_macros(vp, all_macros);
 
-  return ckey;
+      for (i = 0; i < vp->vpairs->len; i++)
+        {
+          VPPairConf *vpc = (VPPairConf *) g_ptr_array_index(vp->vpairs, i);
+
+          vpc->plan_name = vp_plan_rekey(vp, vpc->name);
+        }
+
+      g_atomic_int_set(&vp->plan_compiled, TRUE);
+    }
+  g_static_mutex_unlock(&vp->plan_lock);
+}
+
+/* decides whether a name-value pair in the payload is included */
+static VPPlanEntry *
+vp_plan_lookup_nvpair(ValuePairs *vp, NVHandle handle, const gchar *name)
+{
+  VPPlanEntry *page, *entry;
+  gboolean inc = FALSE;
+  gint j;
+
+  page = g_atomic_pointer_get(&vp->plan_nvpairs[handle / VP_PLAN_PAGE_SIZE]);
+  if (G_LIKELY(page))
+    {
+      entry = &page[handle % VP_PLAN_PAGE_SIZE];
+      if (G_LIKELY(g_atomic_int_get(&entry->state) != VPE_UNRESOLVED))
+        return entry;
+    }
+
+  g_static_mutex_lock(&vp->plan_lock);
+  page = vp->plan_nvpairs[handle / VP_PLAN_PAGE_SIZE];
+  if (!page)
+    {
+      page = g_new0(VPPlanEntry, VP_PLAN_PAGE_SIZE);
+      g_atomic_pointer_set(&vp->plan_nvpairs[handle / VP_PLAN_PAGE_SIZE], page);
+    }
+  entry = &page[handle % VP_PLAN_PAGE_SIZE];
+
+  if (entry->state == VPE_UNRESOLVED)
+    {
+      for (j = 0; j < vp->patterns_size; j++)
+        {
+          if (g_pattern_match_string(vp->patterns[j]->pattern, name))
+            inc = vp->patterns[j]->include;
+        }
+
+      /* NOTE: dot-nv-pairs include SDATA too */
+      if (((name[0] == '.' && (vp->scopes & VPS_DOT_NV_PAIRS)) ||
+           (name[0] != '.' && (vp->scopes & VPS_NV_PAIRS)) ||
+           (log_msg_is_handle_sdata(handle) && (vp->scopes & VPS_SDATA))) ||
+          inc)
+        {
+          entry->name = vp_plan_rekey(vp, name);
+          g_atomic_int_set(&entry->state, VPE_INCLUDED);
+        }
+      else
+        {
+          g_atomic_int_set(&entry->state, VPE_EXCLUDED);
+        }
+    }
+  g_static_mutex_unlock(&vp->plan_lock);
+  return entry;
+}
+
+/* only called while the configuration is being parsed */
+static void
+vp_plan_reset(ValuePairs *vp)
+{
+  gint i, j;
+
+  if (vp->plan_macros)
+    {
+      for (i = 0; i < vp->plan_macros->len; i++)
+        g_free(g_array_index(vp->plan_macros, ValuePairSpec, i).name);
+      g_array_free(vp->plan_macros, TRUE);
+      vp->plan_macros = NULL;
+    }
+
+  for (i = 0; i < vp->vpairs->len; i++)
+    {
+      VPPairConf *vpc = (VPPairConf *) g_ptr_array_index(vp->vpairs, i);
+
+      g_free(vpc->plan_name);
+      vpc->plan_name = NULL;
+    }
+
+  for (i = 0; i < VP_PLAN_PAGES; i++)
+    {
+      if (!vp->plan_nvpairs[i])
+        continue;
+      for (j = 0; j < VP_PLAN_PAGE_SIZE; j++)
+        g_free(vp->plan_nvpairs[i][j].name);
+      g_free(vp->plan_nvpairs[i]);
+      vp->plan_nvpairs[i] = NULL;
+    }
+  vp->plan_compiled = FALSE;
+}
+
+/*
+ * The selected name-value pairs are collected into a flat array of
+ * VPResultItem structures, which is then sorted in place. Both the array
+ * and the values that had to be produced for the message (formatted
+ * macros and templates) live in scratch buffers, names come from the
+ * plan, thus nothing is allocated per message once the buffers have
+ * grown large enough.
+ */
+typedef struct
+{
+  const gchar *name;
+
+  /* offset into the storage buffer while collecting, as it might be
+   * reallocated, a pointer once everything is collected; values not in
+   * the storage buffer are referenced directly */
+  const gchar *value;
+  gssize value_ofs;
+  gssize value_len;
+
+  /* the order of insertion, pairs added later override earlier ones */
+  gint order;
+} VPResultItem;
+
+typedef struct
+{
+  ValuePairs *vp;
+  LogMessage *msg;
+  gint32 seq_num;
+
+  /* copy values from the message payload to the storage buffer, to make
+   * them NUL terminated */
+  gboolean copy_values;
+
+  GString *items;
+  GString *storage;
+} VPResults;
+
+#define vp_results_item(r, i) (&((VPResultItem *) (r)->items->str)[i])
+#define vp_results_len(r)     ((r)->items->len / sizeof(VPResultItem))
+
+static void
+vp_results_add(VPResults *results, const gchar *name,
+               const gchar *value, gssize value_ofs, gssize value_len)
+{
+  VPResultItem item;
+
+  item.name = name;
+  item.order = vp_results_len(results);
+  item.value_len = value_len;
+  if (value && results->copy_values)
+    {
+      item.value = NULL;
+      item.value_ofs = results->storage->len;
+      g_string_append_len(results->storage, value, value_len);
+      g_string_append_c(results->storage, 0);
+    }
+  else
+    {
+      item.value = value;
+      item.value_ofs = value_ofs;
+    }
+  g_string_append_len(results->items, (gchar *) &item, sizeof(item));
 }
 
 /* runs over the name-value pairs requested by the user (e.g. with value_pairs_add_pair) */
 static void
 vp_pairs_foreach(gpointer data, gpointer user_data)
 {
-  ValuePairs *vp = ((gpointer *)user_data)[0];
-  LogMessage *msg = ((gpointer *)user_data)[2];
-  gint32 seq_num = GPOINTER_TO_INT (((gpointer *)user_data)[3]);
-  GTree *scope_set = ((gpointer *)user_data)[5];
-  ScratchBuffer *sb = scratch_buffer_acquire();
+  VPResults *results = (VPResults *) user_data;
   VPPairConf *vpc = (VPPairConf *)data;
+  gssize ofs = results->storage->len;
 
-  log_template_format((LogTemplate *)vpc->template, msg, NULL, LTZ_LOCAL,
-                      seq_num, NULL, sb_string(sb));
+  log_template_append_format((LogTemplate *)vpc->template, results->msg, NULL, LTZ_LOCAL,
+                             results->seq_num, NULL, results->storage);
 
-  if (!sb_string(sb)->str[0])
-    {
-      scratch_buffer_release(sb);
-      return;
-    }
+  if (results->storage->len == ofs)
+    return;
 
-  g_tree_insert(scope_set, vp_transform_apply(vp, vpc->name),
-                sb_string(sb)->str);
-  g_string_steal(sb_string(sb));
-  scratch_buffer_release(sb);
+  g_string_append_c(results->storage, 0);
+  vp_results_add(results, vpc->plan_name, NULL, ofs, results->storage->len - ofs - 1);
 }
 
 /* runs over the LogMessage nv-pairs, and inserts them unless excluded */
@@ -217,118 +457,168 @@ vp_msg_nvpairs_foreach(NVHandle handle, gchar *name,
                        const gchar *value, gssize value_len,
                        gpointer user_data)
 {
-  ValuePairs *vp = ((gpointer *)user_data)[0];
-  GTree *scope_set = ((gpointer *)user_data)[5];
-  gint j;
-  gboolean inc = FALSE;
+  VPResults *results = (VPResults *) user_data;
+  VPPlanEntry *entry;
 
-  for (j = 0; j < vp->patterns_size; j++)
-    {
-      if (g_pattern_match_string(vp->patterns[j]->pattern, name))
-        inc = vp->patterns[j]->include;
-    }
-
-  /* NOTE: dot-nv-pairs include SDATA too */
-  if (((name[0] == '.' && (vp->scopes & VPS_DOT_NV_PAIRS)) ||
-       (name[0] != '.' && (vp->scopes & VPS_NV_PAIRS)) ||
-       (log_msg_is_handle_sdata(handle) && (vp->scopes & VPS_SDATA))) ||
-      inc)
-    {
-      /* NOTE: the key is a borrowed reference in the hash, and value is freed */
-      g_tree_insert(scope_set, vp_transform_apply(vp, name), g_strndup(value, value_len));
-    }
+  entry = vp_plan_lookup_nvpair(results->vp, handle, name);
+  if (entry->state == VPE_INCLUDED)
+    vp_results_add(results, entry->name, value, -1, value_len);
 
   return FALSE;
 }
 
-/* runs over a set of ValuePairSpec structs and merges them into the value-pair set */
+/* runs over the macros selected by the plan */
 static void
-vp_merge_set(ValuePairs *vp, LogMessage *msg, gint32 seq_num, ValuePairSpec *set, GTree *dest)
+vp_merge_macros(VPResults *results)
 {
+  ValuePairSpec *set = (ValuePairSpec *) results->vp->plan_macros->data;
   gint i;
-  ScratchBuffer *sb = scratch_buffer_acquire();
 
   for (i = 0; set[i].name; i++)
     {
-      gint j;
-      gboolean exclude = FALSE;
-
-      for (j = 0; j < vp->patterns_size; j++)
-        {
-          if (g_pattern_match_string(vp->patterns[j]->pattern, set[i].name))
-            exclude = !vp->patterns[j]->include;
-        }
-
-      if (exclude)
-	continue;
-
       switch (set[i].type)
         {
         case VPT_MACRO:
-          log_macro_expand(sb_string(sb), set[i].id, FALSE, NULL, LTZ_LOCAL, seq_num, NULL, msg);
-          break;
+          {
+            gssize ofs = results->storage->len;
+
+            log_macro_expand(results->storage, set[i].id, FALSE, NULL, LTZ_LOCAL, results->seq_num, NULL, results->msg);
+            if (results->storage->len == ofs)
+              continue;
+            g_string_append_c(results->storage, 0);
+            vp_results_add(results, set[i].name, NULL, ofs, results->storage->len - ofs - 1);
+            break;
+          }
         case VPT_NVPAIR:
           {
             const gchar *nv;
             gssize len;
 
-            nv = log_msg_get_value(msg, (NVHandle) set[i].id, &len);
-            g_string_append_len(sb_string(sb), nv, len);
+            nv = log_msg_get_value(results->msg, (NVHandle) set[i].id, &len);
+            if (len == 0)
+              continue;
+            vp_results_add(results, set[i].name, nv, -1, len);
             break;
           }
         default:
           g_assert_not_reached();
         }
-
-      if (!sb_string(sb)->str[0])
-	continue;
-
-      g_tree_insert(dest, vp_transform_apply(vp, set[i].name), sb_string(sb)->str);
-      g_string_steal(sb_string(sb));
     }
-  scratch_buffer_release(sb);
 }
 
-void
-value_pairs_foreach_sorted (ValuePairs *vp, VPForeachFunc func,
-                            GCompareDataFunc compare_func,
-                            LogMessage *msg, gint32 seq_num, gpointer user_data)
+static gint
+vp_results_item_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
 {
-  gpointer args[] = { vp, func, msg, GINT_TO_POINTER (seq_num), user_data, NULL };
-  GTree *scope_set;
+  const VPResultItem *item_a = (const VPResultItem *) a;
+  const VPResultItem *item_b = (const VPResultItem *) b;
+  GCompareDataFunc compare_func = (GCompareDataFunc) user_data;
+  gint r;
+
+  r = compare_func(item_a->name, item_b->name, NULL);
+  if (r != 0)
+    return r;
+  return item_a->order - item_b->order;
+}
 
-  scope_set = g_tree_new_full((GCompareDataFunc)compare_func, NULL,
-                              (GDestroyNotify)g_free,
-                              (GDestroyNotify)g_free);
-  args[5] = scope_set;
+static void
+vp_results_foreach(ValuePairs *vp, VPForeachLenFunc func,
+                   GCompareDataFunc compare_func,
+                   LogMessage *msg, gint32 seq_num,
+                   gboolean copy_values,
+                   gpointer user_data)
+{
+  ScratchBuffer *items = scratch_buffer_acquire();
+  ScratchBuffer *storage = scratch_buffer_acquire();
+  VPResults results;
+  gint i, len;
+  gboolean aborted = FALSE;
+
+  results.vp = vp;
+  results.msg = msg;
+  results.seq_num = seq_num;
+  results.copy_values = copy_values;
+  results.items = sb_string(items);
+  results.storage = sb_string(storage);
+
+  vp_plan_compile(vp);
 
   /*
    * Build up the base set
    */
+  log_msg_ensure_parsed(msg);
   if (vp->scopes & (VPS_NV_PAIRS + VPS_DOT_NV_PAIRS + VPS_SDATA) ||
       vp->patterns_size > 0)
     nv_table_foreach(msg->payload, logmsg_registry,
-                     (NVTableForeachFunc) vp_msg_nvpairs_foreach, args);
+                     (NVTableForeachFunc) vp_msg_nvpairs_foreach, &results);
 
-  if (vp->scopes & (VPS_RFC3164 + VPS_RFC5424 + VPS_SELECTED_MACROS))
-    vp_merge_set(vp, msg, seq_num, rfc3164, scope_set);
+  vp_merge_macros(&results);
 
-  if (vp->scopes & VPS_RFC5424)
-    vp_merge_set(vp, msg, seq_num, rfc5424, scope_set);
+  /* Merge the explicit key-value pairs too */
+  g_ptr_array_foreach(vp->vpairs, (GFunc)vp_pairs_foreach, &results);
 
-  if (vp->scopes & VPS_SELECTED_MACROS)
-    vp_merge_set(vp, msg, seq_num, selected_macros, scope_set);
+  /* now that the storage buffer is final, resolve the offsets */
+  len = vp_results_len(&results);
+  for (i = 0; i < len; i++)
+    {
+      VPResultItem *item = vp_results_item(&results, i);
 
-  if (vp->scopes & VPS_ALL_MACROS)
-    vp_merge_set(vp, msg, seq_num, all_macros, scope_set);
+      if (!item->value)
+        item->value = results.storage->str + item->value_ofs;
+    }
 
-  /* Merge the explicit key-value pairs too */
-  g_ptr_array_foreach(vp->vpairs, (GFunc)vp_pairs_foreach, args);
+  g_qsort_with_data(results.items->str, len, sizeof(VPResultItem),
+                    vp_results_item_cmp, (gpointer) compare_func);
 
-  /* Aaand we run it through the callback! */
-  g_tree_foreach(scope_set, (GTraverseFunc)func, user_data);
+  /* Aaand we run it through the callback! When the same name was
+   * added multiple times, the last one wins. */
+  for (i = 0; i < len && !aborted; i++)
+    {
+      VPResultItem *item = vp_results_item(&results, i);
+
+      if (i + 1 < len && compare_func(item->name, vp_results_item(&results, i + 1)->name, NULL) == 0)
+        continue;
+      aborted = func(item->name, item->value, item->value_len, user_data);
+    }
 
-  g_tree_destroy(scope_set);
+  scratch_buffer_release(storage);
+  scratch_buffer_release(items);
+}
+
+typedef struct
+{
+  VPForeachFunc func;
+  gpointer user_data;
+} VPForeachAdapter;
+
+static gboolean
+vp_foreach_adapter(const gchar *name, const gchar *value, gssize value_len, gpointer user_data)
+{
+  VPForeachAdapter *adapter = (VPForeachAdapter *) user_data;
+
+  return adapter->func(name, value, adapter->user_data);
+}
+
+void
+value_pairs_foreach_sorted (ValuePairs *vp, VPForeachFunc func,
+                            GCompareDataFunc compare_func,
+                            LogMessage *msg, gint32 seq_num, gpointer user_data)
+{
+  VPForeachAdapter adapter = { func, user_data };
+
+  vp_results_foreach(vp, vp_foreach_adapter, compare_func, msg, seq_num, TRUE, &adapter);
+}
+
+/*
+ * Same as value_pairs_foreach_sorted(), but values are passed along with
+ * their length and are not necessarily NUL terminated, which saves
+ * copying the ones that come straight from the message.
+ */
+void
+value_pairs_foreach_sorted_len(ValuePairs *vp, VPForeachLenFunc func,
+                               GCompareDataFunc compare_func,
+                               LogMessage *msg, gint32 seq_num, gpointer user_data)
+{
+  vp_results_foreach(vp, func, compare_func, msg, seq_num, FALSE, user_data);
 }
 
 void
@@ -579,6 +869,7 @@ value_pairs_new(void)
 
   vp = g_new0(ValuePairs, 1);
   vp->vpairs = g_ptr_array_sized_new(8);
+  g_static_mutex_init(&vp->plan_lock);
 
   if (!value_pair_sets_initialized)
     {
@@ -617,6 +908,9 @@ value_pairs_free (ValuePairs *vp)
   gint i;
   GList *l;
 
+  vp_plan_reset(vp);
+  g_static_mutex_free(&vp->plan_lock);
+
   for (i = 0; i < vp->vpairs->len; i++)
     vp_free_pair(g_ptr_array_index(vp->vpairs, i));
 
@@ -643,6 +937,7 @@ value_pairs_free (ValuePairs *vp)
 void
 value_pairs_add_transforms(ValuePairs *vp, gpointer vpts)
 {
+  vp_plan_reset(vp);
   vp->transforms = g_list_append(vp->transforms, vpts);
 }
 
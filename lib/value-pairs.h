@@ -30,6 +30,7 @@
 
 typedef struct _ValuePairs ValuePairs;
 typedef gboolean (*VPForeachFunc)(const gchar *name, const gchar *value, gpointer user_data);
+typedef gboolean (*VPForeachLenFunc)(const gchar *name, const gchar *value, gssize value_len, gpointer user_data);
 
 typedef gboolean (*VPWalkValueCallbackFunc)(const gchar *name, const gchar *prefix,
                                             const gchar *value,
@@ -49,6 +50,10 @@ void value_pairs_foreach_sorted(ValuePairs *vp, VPForeachFunc func,
                                 GCompareDataFunc compare_func,
                                 LogMessage *msg, gint32 seq_num,
                                 gpointer user_data);
+void value_pairs_foreach_sorted_len(ValuePairs *vp, VPForeachLenFunc func,
+                                    GCompareDataFunc compare_func,
+                                    LogMessage *msg, gint32 seq_num,
+                                    gpointer user_data);
 void value_pairs_foreach(ValuePairs *vp, VPForeachFunc func,
                          LogMessage *msg, gint32 seq_num,
                          gpointer user_data);
@@ -232,24 +232,36 @@ value_pairs_transform_set_free(ValuePairsTransformSet *vpts)
   g_free(vpts);
 }
 
+/* rekeys the name in @key in place, if it matches the pattern of the set */
+gboolean
+value_pairs_transform_set_apply_in_place(ValuePairsTransformSet *vpts, ScratchBuffer *key)
+{
+  GList *l;
+
+  if (!g_pattern_match_string(vpts->pattern, sb_string(key)->str))
+    return FALSE;
+
+  l = vpts->transforms;
+  while (l)
+    {
+      value_pairs_transform_apply((ValuePairsTransform *)l->data, key);
+      l = l->next;
+    }
+  return TRUE;
+}
+
 gchar *
 value_pairs_transform_set_apply(ValuePairsTransformSet *vpts, gchar *key)
 {
   if (g_pattern_match_string(vpts->pattern, key))
     {
-      GList *l;
       ScratchBuffer *sb;
       gchar *new_key;
 
       sb = scratch_buffer_acquire ();
       g_string_assign(sb_string(sb), key);
 
-      l = vpts->transforms;
-      while (l)
-        {
-          value_pairs_transform_apply((ValuePairsTransform *)l->data, sb);
-          l = l->next;
-        }
+      value_pairs_transform_set_apply_in_place(vpts, sb);
 
       new_key = sb_string(sb)->str;
       g_string_steal(sb_string(sb));
@@ -40,6 +40,8 @@ typedef struct
   gboolean input_is_a_stream;
   gboolean inject_eagain;
   gboolean eof_is_eagain;
+  /* number of read_batch() calls */
+  gint batch_count;
 } LogTransportMock;
 
 gssize
@@ -98,6 +100,43 @@ log_transport_mock_read_method(LogTransport *s, gpointer buf, gsize count, GSock
   return count;
 }
 
+/* returns the records up to the next EOF/error marker, as a single batch */
+static gint
+log_transport_mock_read_batch_method(LogTransport *s, LogTransportDatagram *dgrams, gint count)
+{
+  LogTransportMock *self = (LogTransportMock *) s;
+  gint i;
+
+  for (i = 0; i < count && self->current_iov_ndx < self->iov_cnt; i++)
+    {
+      struct iovec *current_iov = &self->iov[self->current_iov_ndx];
+
+      if (GPOINTER_TO_UINT(current_iov->iov_base) < 4096)
+        {
+          if (i > 0)
+            break;
+
+          /* error injection */
+          self->current_iov_ndx++;
+          errno = GPOINTER_TO_UINT(current_iov->iov_base);
+          return -1;
+        }
+
+      dgrams[i].len = MIN(current_iov->iov_len, dgrams[i].buflen);
+      memcpy(dgrams[i].buf, current_iov->iov_base, dgrams[i].len);
+      dgrams[i].sa = g_sockaddr_inet_new("1.2.3.4", 5555);
+      self->current_iov_ndx++;
+    }
+  self->batch_count++;
+
+  if (i == 0 && self->eof_is_eagain)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+  return i;
+}
+
 static void
 log_transport_mock_init(LogTransportMock *self, gchar *read_buffer1, gssize read_buffer_length1, va_list va)
 {
@@ -181,3 +220,24 @@ log_transport_mock_endless_records_new(gchar *read_buffer1, gssize read_buffer_l
   self->eof_is_eagain = TRUE;
   return &self->super;
 }
+
+LogTransport *
+log_transport_mock_batched_records_new(gchar *read_buffer1, gssize read_buffer_length1, ...)
+{
+  LogTransportMock *self = g_new0(LogTransportMock, 1);
+  va_list va;
+
+  va_start(va, read_buffer_length1);
+  log_transport_mock_init(self, read_buffer1, read_buffer_length1, va);
+  va_end(va);
+  self->super.read_batch = log_transport_mock_read_batch_method;
+  return &self->super;
+}
+
+gint
+log_transport_mock_get_batch_count(LogTransport *s)
+{
+  LogTransportMock *self = (LogTransportMock *) s;
+
+  return self->batch_count;
+}
@@ -44,4 +44,10 @@ log_transport_mock_records_new(gchar *read_buffer1, gssize read_buffer_length1,
 LogTransport *
 log_transport_mock_endless_records_new(gchar *read_buffer1, gssize read_buffer_length1, ...);
 
+/* records returned by read_batch(), up to the next error injection */
+LogTransport *
+log_transport_mock_batched_records_new(gchar *read_buffer1, gssize read_buffer_length1, ...);
+
+gint log_transport_mock_get_batch_count(LogTransport *s);
+
 #endif
@@ -42,6 +42,8 @@ static CfgLexerKeyword afamqp_keywords[] = {
   { "username",			KW_USERNAME },
   { "password",			KW_PASSWORD },
   { "log_fifo_size",		KW_LOG_FIFO_SIZE  },
+  { "log_fifo_bytes",		KW_LOG_FIFO_BYTES, 0x0304 },
+  { "log_fifo_priority",	KW_LOG_FIFO_PRIORITY, 0x0304 },
   { "body",			KW_BODY },
   { NULL }
 };
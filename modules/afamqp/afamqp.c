@@ -35,6 +35,9 @@
 #include <amqp.h>
 #include <amqp_framing.h>
 
+/* the number of messages fetched from the queue at once */
+#define AFAMQP_BATCH_SIZE 64
+
 typedef struct
 {
   LogDestDriver super;
@@ -59,6 +62,7 @@ typedef struct
 
   StatsCounterItem *dropped_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
 
   ValuePairs *vp;
 
@@ -457,35 +461,42 @@ afamqp_worker_publish(AMQPDestDriver *self, LogMessage *msg)
 static gboolean
 afamqp_worker_insert(AMQPDestDriver *self)
 {
-  gboolean success;
-  LogMessage *msg;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gboolean success = TRUE;
+  LogMessage *msgs[AFAMQP_BATCH_SIZE];
+  LogPathOptions path_options[AFAMQP_BATCH_SIZE];
+  LogPathOptions path_options_init = LOG_PATH_OPTIONS_INIT;
+  gint count, i;
 
   afamqp_dd_connect(self, TRUE);
 
+  for (i = 0; i < AFAMQP_BATCH_SIZE; i++)
+    path_options[i] = path_options_init;
+
   g_mutex_lock(self->queue_mutex);
   log_queue_reset_parallel_push(self->queue);
-  success = log_queue_pop_head(self->queue, &msg, &path_options, FALSE, FALSE);
+  count = log_queue_pop_head_batch(self->queue, msgs, path_options, AFAMQP_BATCH_SIZE, FALSE, FALSE);
   g_mutex_unlock(self->queue_mutex);
-  if (!success)
-    return TRUE;
 
-  msg_set_context(msg);
-  success = afamqp_worker_publish (self, msg);
-  msg_set_context(NULL);
-
-  if (success)
-    {
-      stats_counter_inc(self->stored_messages);
-      step_sequence_number(&self->seq_num);
-      log_msg_ack(msg, &path_options);
-      log_msg_unref(msg);
-    }
-  else
+  for (i = 0; i < count && success; i++)
     {
-      g_mutex_lock(self->queue_mutex);
-      log_queue_push_head(self->queue, msg, &path_options);
-      g_mutex_unlock(self->queue_mutex);
+      msg_set_context(msgs[i]);
+      success = afamqp_worker_publish (self, msgs[i]);
+      msg_set_context(NULL);
+
+      if (success)
+        {
+          stats_counter_inc(self->stored_messages);
+          step_sequence_number(&self->seq_num);
+          log_msg_ack(msgs[i], &path_options[i]);
+          log_msg_unref(msgs[i]);
+        }
+      else
+        {
+          /* put back the failed message and the rest of the batch */
+          g_mutex_lock(self->queue_mutex);
+          log_queue_push_head_batch(self->queue, &msgs[i], &path_options[i], count - i);
+          g_mutex_unlock(self->queue_mutex);
+        }
     }
 
   return success;
@@ -534,6 +545,7 @@ afamqp_worker_thread(gpointer arg)
     }
 
   afamqp_dd_disconnect(self);
+  log_msg_free_thread_cache();
 
   msg_debug("Worker thread finished",
             evt_tag_str("driver", self->super.super.id), NULL);
@@ -599,10 +611,13 @@ afamqp_dd_init(LogPipe *s)
   stats_register_counter(0, SCS_AMQP | SCS_DESTINATION,
                          self->super.super.id, afamqp_dd_format_stats_instance(self),
                          SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_register_counter(0, SCS_AMQP | SCS_DESTINATION,
+                         self->super.super.id, afamqp_dd_format_stats_instance(self),
+                         SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
 
   log_queue_set_counters(self->queue, self->stored_messages,
-                         self->dropped_messages);
+                         self->dropped_messages, self->memory_usage);
   afamqp_dd_start_thread(self);
 
   return TRUE;
@@ -615,7 +630,7 @@ afamqp_dd_deinit(LogPipe *s)
 
   afamqp_dd_stop_thread(self);
 
-  log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_counters(self->queue, NULL, NULL, NULL);
   stats_lock();
   stats_unregister_counter(SCS_AMQP | SCS_DESTINATION,
                            self->super.super.id, afamqp_dd_format_stats_instance(self),
@@ -623,6 +638,9 @@ afamqp_dd_deinit(LogPipe *s)
   stats_unregister_counter(SCS_AMQP | SCS_DESTINATION,
                            self->super.super.id, afamqp_dd_format_stats_instance(self),
                            SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_AMQP | SCS_DESTINATION,
+                           self->super.super.id, afamqp_dd_format_stats_instance(self),
+                           SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
   if (!log_dest_driver_deinit_method(s))
     return FALSE;
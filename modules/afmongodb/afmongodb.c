@@ -36,6 +36,9 @@
 
 #include "mongo.h"
 
+/* the number of documents inserted using a single insert command */
+#define AFMONGODB_BATCH_SIZE 64
+
 typedef struct
 {
   gchar *name;
@@ -64,6 +67,7 @@ typedef struct
 
   StatsCounterItem *dropped_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
 
   time_t last_msg_stamp;
 
@@ -88,7 +92,7 @@ typedef struct
   gchar *ns;
 
   GString *current_value;
-  bson *bson;
+  bson *bson[AFMONGODB_BATCH_SIZE];
 } MongoDBDestDriver;
 
 /*
@@ -377,40 +381,53 @@ afmongodb_vp_process_value(const gchar *name, const gchar *prefix,
 static gboolean
 afmongodb_worker_insert (MongoDBDestDriver *self)
 {
-  gboolean success;
+  gboolean success = TRUE;
   guint8 *oid;
-  LogMessage *msg;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msgs[AFMONGODB_BATCH_SIZE];
+  LogPathOptions path_options[AFMONGODB_BATCH_SIZE];
+  LogPathOptions path_options_init = LOG_PATH_OPTIONS_INIT;
+  gint32 seq_num;
+  gint count, i;
 
   afmongodb_dd_connect(self, TRUE);
 
+  for (i = 0; i < AFMONGODB_BATCH_SIZE; i++)
+    path_options[i] = path_options_init;
+
   g_mutex_lock(self->queue_mutex);
   log_queue_reset_parallel_push(self->queue);
-  success = log_queue_pop_head(self->queue, &msg, &path_options, FALSE, FALSE);
+  count = log_queue_pop_head_batch(self->queue, msgs, path_options, AFMONGODB_BATCH_SIZE, FALSE, FALSE);
   g_mutex_unlock(self->queue_mutex);
-  if (!success)
+  if (count == 0)
     return TRUE;
 
-  msg_set_context(msg);
+  /* the whole batch is sent using a single insert command */
+  seq_num = self->seq_num;
+  for (i = 0; i < count; i++)
+    {
+      msg_set_context(msgs[i]);
 
-  bson_reset (self->bson);
+      bson_reset (self->bson[i]);
 
-  oid = mongo_util_oid_new_with_time (self->last_msg_stamp, self->seq_num);
-  bson_append_oid (self->bson, "_id", oid);
-  g_free (oid);
+      oid = mongo_util_oid_new_with_time (self->last_msg_stamp, seq_num);
+      bson_append_oid (self->bson[i], "_id", oid);
+      g_free (oid);
 
-  value_pairs_walk(self->vp,
-                   afmongodb_vp_obj_start,
-                   afmongodb_vp_process_value,
-                   afmongodb_vp_obj_end,
-                   msg, self->seq_num, self->bson);
-  bson_finish (self->bson);
+      value_pairs_walk(self->vp,
+                       afmongodb_vp_obj_start,
+                       afmongodb_vp_process_value,
+                       afmongodb_vp_obj_end,
+                       msgs[i], seq_num, self->bson[i]);
+      bson_finish (self->bson[i]);
+      step_sequence_number(&seq_num);
+    }
 
-  if (!mongo_sync_cmd_insert_n(self->conn, self->ns, 1,
-                               (const bson **)&self->bson))
+  if (!mongo_sync_cmd_insert_n(self->conn, self->ns, count,
+                               (const bson **)self->bson))
     {
       msg_error("Network error while inserting into MongoDB",
                 evt_tag_int("time_reopen", self->time_reopen),
+                evt_tag_int("batch_size", count),
                 NULL);
       success = FALSE;
     }
@@ -419,15 +436,18 @@ afmongodb_worker_insert (MongoDBDestDriver *self)
 
   if (success)
     {
-      stats_counter_inc(self->stored_messages);
-      step_sequence_number(&self->seq_num);
-      log_msg_ack(msg, &path_options);
-      log_msg_unref(msg);
+      stats_counter_add(self->stored_messages, count);
+      self->seq_num = seq_num;
+      for (i = 0; i < count; i++)
+        {
+          log_msg_ack(msgs[i], &path_options[i]);
+          log_msg_unref(msgs[i]);
+        }
     }
   else
     {
       g_mutex_lock(self->queue_mutex);
-      log_queue_push_head(self->queue, msg, &path_options);
+      log_queue_push_head_batch(self->queue, msgs, path_options, count);
       g_mutex_unlock(self->queue_mutex);
     }
 
@@ -438,6 +458,7 @@ static gpointer
 afmongodb_worker_thread (gpointer arg)
 {
   MongoDBDestDriver *self = (MongoDBDestDriver *)arg;
+  gint i;
 
   msg_debug ("Worker thread started",
 	     evt_tag_str("driver", self->super.super.id),
@@ -449,7 +470,8 @@ afmongodb_worker_thread (gpointer arg)
 
   self->current_value = g_string_sized_new(256);
 
-  self->bson = bson_new_sized(4096);
+  for (i = 0; i < AFMONGODB_BATCH_SIZE; i++)
+    self->bson[i] = bson_new_sized(4096);
 
   while (!self->writer_thread_terminate)
     {
@@ -493,7 +515,9 @@ afmongodb_worker_thread (gpointer arg)
   g_free (self->ns);
   g_string_free (self->current_value, TRUE);
 
-  bson_free (self->bson);
+  for (i = 0; i < AFMONGODB_BATCH_SIZE; i++)
+    bson_free (self->bson[i]);
+  log_msg_free_thread_cache ();
 
   msg_debug ("Worker thread finished",
 	     evt_tag_str("driver", self->super.super.id),
@@ -596,9 +620,12 @@ afmongodb_dd_init(LogPipe *s)
   stats_register_counter(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
 			 afmongodb_dd_format_stats_instance(self),
 			 SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_register_counter(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
+			 afmongodb_dd_format_stats_instance(self),
+			 SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
 
-  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages, self->memory_usage);
   afmongodb_dd_start_thread(self);
 
   return TRUE;
@@ -611,7 +638,7 @@ afmongodb_dd_deinit(LogPipe *s)
 
   afmongodb_dd_stop_thread(self);
 
-  log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_counters(self->queue, NULL, NULL, NULL);
   stats_lock();
   stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
 			   afmongodb_dd_format_stats_instance(self),
@@ -619,6 +646,9 @@ afmongodb_dd_deinit(LogPipe *s)
   stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
 			   afmongodb_dd_format_stats_instance(self),
 			   SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
+			   afmongodb_dd_format_stats_instance(self),
+			   SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
   if (!log_dest_driver_deinit_method(s))
     return FALSE;
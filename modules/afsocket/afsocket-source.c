@@ -49,6 +49,8 @@ typedef struct _AFSocketSourceConnection
   struct _AFSocketSourceDriver *owner;
   LogPipe *reader;
   int sock;
+  /* the so-reuseport() shard this connection was received on */
+  gint shard;
   GSockAddr *peer_addr;
 } AFSocketSourceConnection;
 
@@ -96,6 +98,12 @@ afsocket_sc_stats_instance(AFSocketSourceConnection *self)
       if (self->owner->bind_addr)
         {
           g_sockaddr_format(self->owner->bind_addr, buf, sizeof(buf), GSA_ADDRESS_ONLY);
+          if (self->owner->so_reuseport > 1)
+            {
+              gint len = strlen(buf);
+
+              g_snprintf(buf + len, sizeof(buf) - len, "#%d", self->shard);
+            }
           return buf;
         }
       else
@@ -214,7 +222,7 @@ afsocket_sc_free(LogPipe *s)
 }
 
 AFSocketSourceConnection *
-afsocket_sc_new(AFSocketSourceDriver *owner, GSockAddr *peer_addr, int fd)
+afsocket_sc_new(AFSocketSourceDriver *owner, GSockAddr *peer_addr, int fd, gint shard)
 {
   AFSocketSourceConnection *self = g_new0(AFSocketSourceConnection, 1);
 
@@ -229,6 +237,7 @@ afsocket_sc_new(AFSocketSourceDriver *owner, GSockAddr *peer_addr, int fd)
 
   self->peer_addr = g_sockaddr_ref(peer_addr);
   self->sock = fd;
+  self->shard = shard;
   return self;
 }
 
@@ -301,6 +310,14 @@ afsocket_sd_set_max_connections(LogDriver *s, gint max_connections)
   self->max_connections = max_connections;
 }
 
+void
+afsocket_sd_set_so_reuseport(LogDriver *s, gint shards)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+
+  self->so_reuseport = shards;
+}
+
 #if BUILD_WITH_SSL
 void
 afsocket_sd_set_tls_context(LogDriver *s, TLSContext *tls_context)
@@ -311,21 +328,34 @@ afsocket_sd_set_tls_context(LogDriver *s, TLSContext *tls_context)
 }
 #endif
 
+static inline gint
+afsocket_sd_num_shards(AFSocketSourceDriver *self)
+{
+  return MAX(self->so_reuseport, 1);
+}
+
+/* NOTE: the first shard uses the same names as a driver without
+ * so-reuseport(), so the sockets are kept when it is turned on */
 static inline gchar *
-afsocket_sd_format_persist_name(AFSocketSourceDriver *self, gboolean listener_name)
+afsocket_sd_format_persist_name(AFSocketSourceDriver *self, gboolean listener_name, gint shard)
 {
   static gchar persist_name[128];
   gchar buf[64];
-
-  g_snprintf(persist_name, sizeof(persist_name),
-             listener_name ? "afsocket_sd_listen_fd(%s,%s)" : "afsocket_sd_connections(%s,%s)",
-             (self->sock_type == SOCK_STREAM) ? "stream" : "dgram",
-             g_sockaddr_format(self->bind_addr, buf, sizeof(buf), GSA_FULL));
+  gint len;
+
+  len = g_snprintf(persist_name, sizeof(persist_name),
+                   listener_name ? "afsocket_sd_listen_fd(%s,%s" : "afsocket_sd_connections(%s,%s",
+                   (self->sock_type == SOCK_STREAM) ? "stream" : "dgram",
+                   g_sockaddr_format(self->bind_addr, buf, sizeof(buf), GSA_FULL));
+  if (shard > 0)
+    g_snprintf(persist_name + len, sizeof(persist_name) - len, ",%d)", shard);
+  else
+    g_snprintf(persist_name + len, sizeof(persist_name) - len, ")");
   return persist_name;
 }
 
 gboolean
-afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_addr, GSockAddr *local_addr, gint fd)
+afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_addr, GSockAddr *local_addr, gint fd, gint shard)
 {
   gchar buf[MAX_SOCKADDR_STRING], buf2[MAX_SOCKADDR_STRING];
 #if ENABLE_TCP_WRAPPER
@@ -352,7 +382,8 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 
 #endif
 
-  if (self->num_connections >= self->max_connections)
+  /* SOCK_DGRAM sources have one connection per so-reuseport() shard */
+  if (self->sock_type == SOCK_STREAM && self->num_connections >= self->max_connections)
     {
       msg_error("Number of allowed concurrent connections reached, rejecting connection",
                 evt_tag_str("client", g_sockaddr_format(client_addr, buf, sizeof(buf), GSA_FULL)),
@@ -365,7 +396,7 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
     {
       AFSocketSourceConnection *conn;
 
-      conn = afsocket_sc_new(self, client_addr, fd);
+      conn = afsocket_sc_new(self, client_addr, fd, shard);
       if (log_pipe_init(&conn->super, NULL))
         {
           afsocket_sd_add_connection(self,conn);
@@ -386,7 +417,8 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 static void
 afsocket_sd_accept(gpointer s)
 {
-  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+  AFSocketSourceListener *listener = (AFSocketSourceListener *) s;
+  AFSocketSourceDriver *self = listener->owner;
   GSockAddr *peer_addr;
   gchar buf1[256], buf2[256];
   gint new_fd;
@@ -397,7 +429,7 @@ afsocket_sd_accept(gpointer s)
     {
       GIOStatus status;
 
-      status = g_accept(self->fd, &new_fd, &peer_addr);
+      status = g_accept(listener->fd, &new_fd, &peer_addr);
       if (status == G_IO_STATUS_AGAIN)
         {
           /* no more connections to accept */
@@ -419,7 +451,7 @@ afsocket_sd_accept(gpointer s)
       g_fd_set_nonblock(new_fd, TRUE);
       g_fd_set_cloexec(new_fd, TRUE);
 
-      res = afsocket_sd_process_connection(self, peer_addr, self->bind_addr, new_fd);
+      res = afsocket_sd_process_connection(self, peer_addr, self->bind_addr, new_fd, listener->shard);
 
       if (res)
         {
@@ -471,27 +503,65 @@ afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnectio
 }
 
 static void
-afsocket_sd_start_watches(AFSocketSourceDriver *self)
+afsocket_sd_start_watches(AFSocketSourceListener *listener)
+{
+  IV_FD_INIT(&listener->listen_fd);
+  listener->listen_fd.fd = listener->fd;
+  listener->listen_fd.cookie = listener;
+  listener->listen_fd.handler_in = afsocket_sd_accept;
+  iv_fd_register(&listener->listen_fd);
+}
+
+static void
+afsocket_sd_stop_watches(AFSocketSourceListener *listener)
 {
-  IV_FD_INIT(&self->listen_fd);
-  self->listen_fd.fd = self->fd;
-  self->listen_fd.cookie = self;
-  self->listen_fd.handler_in = afsocket_sd_accept;
-  iv_fd_register(&self->listen_fd);
+  if (iv_fd_registered (&listener->listen_fd))
+    iv_fd_unregister(&listener->listen_fd);
 }
 
+/* a socket kept from the previous configuration can only be reused if it
+ * was bound the same way as the sockets we are about to open */
+static gboolean
+afsocket_sd_is_socket_reusable(AFSocketSourceDriver *self, gint fd)
+{
+#ifdef SO_REUSEPORT
+  gint reuseport = 0;
+  socklen_t len = sizeof(reuseport);
+
+  if (afsocket_sd_num_shards(self) > 1 &&
+      (getsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuseport, &len) < 0 || !reuseport))
+    return FALSE;
+#endif
+  return TRUE;
+}
+
+/* releases the shards opened by a failed afsocket_sd_init(), as deinit is
+ * not called for a pipe whose init has failed */
 static void
-afsocket_sd_stop_watches(AFSocketSourceDriver *self)
+afsocket_sd_close_shards(AFSocketSourceDriver *self)
 {
-  if (iv_fd_registered (&self->listen_fd))
-    iv_fd_unregister(&self->listen_fd);
+  gint i;
+
+  for (i = 0; i < self->num_listeners; i++)
+    {
+      afsocket_sd_stop_watches(&self->listeners[i]);
+      close(self->listeners[i].fd);
+    }
+  g_free(self->listeners);
+  self->listeners = NULL;
+  self->num_listeners = 0;
+
+  afsocket_sd_kill_connection_list(self->connections);
+  g_list_free(self->connections);
+  self->connections = NULL;
+  self->num_connections = 0;
 }
 
 gboolean
 afsocket_sd_init(LogPipe *s)
 {
   AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
-  gint sock;
+  gint sock, shard;
   gboolean res = FALSE;
   GlobalConfig *cfg = log_pipe_get_config(s);
 
@@ -539,7 +609,16 @@ afsocket_sd_init(LogPipe *s)
     {
       GList *p;
 
-      self->connections = cfg_persist_config_fetch(cfg, afsocket_sd_format_persist_name(self, FALSE));
+      self->connections = cfg_persist_config_fetch(cfg, afsocket_sd_format_persist_name(self, FALSE, 0));
+      if (self->sock_type == SOCK_DGRAM && self->connections &&
+          (g_list_length(self->connections) != afsocket_sd_num_shards(self) ||
+           !afsocket_sd_is_socket_reusable(self, ((AFSocketSourceConnection *) self->connections->data)->sock)))
+        {
+          /* so-reuseport() has changed, reopen the sockets */
+          afsocket_sd_kill_connection_list(self->connections);
+          g_list_free(self->connections);
+          self->connections = NULL;
+        }
 
       self->num_connections = 0;
       for (p = self->connections; p; p = p->next)
@@ -554,63 +633,87 @@ afsocket_sd_init(LogPipe *s)
   sock = -1;
   if (self->sock_type == SOCK_STREAM)
     {
-      if (self->connections_kept_alive_accross_reloads)
+      self->listeners = g_new0(AFSocketSourceListener, afsocket_sd_num_shards(self));
+      for (shard = 0; shard < afsocket_sd_num_shards(self); shard++)
         {
-          /* NOTE: this assumes that fd 0 will never be used for listening fds,
-           * main.c opens fd 0 so this assumption can hold */
-          sock = GPOINTER_TO_UINT(cfg_persist_config_fetch(cfg, afsocket_sd_format_persist_name(self, TRUE))) - 1;
-        }
+          AFSocketSourceListener *listener = &self->listeners[shard];
 
-      if (sock == -1)
-        {
-          if (!afsocket_sd_acquire_socket(self, &sock))
-            return self->super.super.optional;
-          if (sock == -1 && !afsocket_open_socket(self->bind_addr, self->sock_type, self->sock_protocol, &sock))
-            return self->super.super.optional;
-        }
+          sock = -1;
+          if (self->connections_kept_alive_accross_reloads)
+            {
+              /* NOTE: this assumes that fd 0 will never be used for listening fds,
+               * main.c opens fd 0 so this assumption can hold */
+              sock = GPOINTER_TO_UINT(cfg_persist_config_fetch(cfg, afsocket_sd_format_persist_name(self, TRUE, shard))) - 1;
+              if (sock != -1 && !afsocket_sd_is_socket_reusable(self, sock))
+                {
+                  close(sock);
+                  sock = -1;
+                }
+            }
 
-      /* set up listening source */
-      if (listen(sock, self->listen_backlog) < 0)
-        {
-          msg_error("Error during listen()",
-                    evt_tag_errno(EVT_TAG_OSERROR, errno),
-                    NULL);
-          close(sock);
-          return FALSE;
-        }
+          if (sock == -1)
+            {
+              if (shard == 0 && !afsocket_sd_acquire_socket(self, &sock))
+                goto error_optional;
+              if (sock == -1 && !afsocket_open_socket(self->bind_addr, self->sock_type, self->sock_protocol, self->so_reuseport > 1, &sock))
+                goto error_optional;
+            }
 
-      if (self->setup_socket && !self->setup_socket(self, sock))
-        {
-          close(sock);
-          return FALSE;
-        }
+          /* set up listening source */
+          if (listen(sock, self->listen_backlog) < 0)
+            {
+              msg_error("Error during listen()",
+                        evt_tag_errno(EVT_TAG_OSERROR, errno),
+                        NULL);
+              close(sock);
+              goto error;
+            }
+
+          if (self->setup_socket && !self->setup_socket(self, sock))
+            {
+              close(sock);
+              goto error;
+            }
 
-      self->fd = sock;
-      afsocket_sd_start_watches(self);
+          listener->owner = self;
+          listener->fd = sock;
+          listener->shard = shard;
+          self->num_listeners++;
+          afsocket_sd_start_watches(listener);
+        }
       res = TRUE;
     }
   else
     {
-      if (!self->connections)
+      /* we either have all shards in self->connections, or open them now */
+      for (shard = g_list_length(self->connections); shard < afsocket_sd_num_shards(self); shard++)
         {
-          if (!afsocket_sd_acquire_socket(self, &sock))
-            return self->super.super.optional;
-          if (sock == -1 && !afsocket_open_socket(self->bind_addr, self->sock_type, self->sock_protocol, &sock))
-            return self->super.super.optional;
+          sock = -1;
+          if (shard == 0 && !afsocket_sd_acquire_socket(self, &sock))
+            goto error_optional;
+          if (sock == -1 && !afsocket_open_socket(self->bind_addr, self->sock_type, self->sock_protocol, self->so_reuseport > 1, &sock))
+            goto error_optional;
 
           if (!self->setup_socket(self, sock))
             {
               close(sock);
-              return FALSE;
+              goto error;
+            }
+          if (!afsocket_sd_process_connection(self, NULL, self->bind_addr, sock, shard))
+            {
+              close(sock);
+              goto error;
             }
         }
-      self->fd = -1;
-
-      /* we either have self->connections != NULL, or sock contains a new fd */
-      if (self->connections || afsocket_sd_process_connection(self, NULL, self->bind_addr, sock))
-        res = TRUE;
+      res = TRUE;
     }
   return res;
+
+ error_optional:
+  res = self->super.super.optional;
+ error:
+  afsocket_sd_close_shards(self);
+  return res;
 }
 
 static void
@@ -641,32 +744,42 @@ afsocket_sd_deinit(LogPipe *s)
         {
           log_pipe_deinit((LogPipe *) p->data);
         }
-      cfg_persist_config_add(cfg, afsocket_sd_format_persist_name(self, FALSE), self->connections, (GDestroyNotify) afsocket_sd_kill_connection_list, FALSE);
+      cfg_persist_config_add(cfg, afsocket_sd_format_persist_name(self, FALSE, 0), self->connections, (GDestroyNotify) afsocket_sd_kill_connection_list, FALSE);
     }
   self->connections = NULL;
 
   if (self->sock_type == SOCK_STREAM)
     {
-      afsocket_sd_stop_watches(self);
-      if (!self->connections_kept_alive_accross_reloads)
-        {
-          msg_verbose("Closing listener fd",
-                      evt_tag_int("fd", self->fd),
-                      NULL);
-          close(self->fd);
-        }
-      else
+      gint i;
+
+      for (i = 0; i < self->num_listeners; i++)
         {
-          /* NOTE: the fd is incremented by one when added to persistent config
-           * as persist config cannot store NULL */
+          AFSocketSourceListener *listener = &self->listeners[i];
 
-          cfg_persist_config_add(cfg, afsocket_sd_format_persist_name(self, TRUE), GUINT_TO_POINTER(self->fd + 1), afsocket_sd_close_fd, FALSE);
+          afsocket_sd_stop_watches(listener);
+          if (!self->connections_kept_alive_accross_reloads)
+            {
+              msg_verbose("Closing listener fd",
+                          evt_tag_int("fd", listener->fd),
+                          NULL);
+              close(listener->fd);
+            }
+          else
+            {
+              /* NOTE: the fd is incremented by one when added to persistent config
+               * as persist config cannot store NULL */
+
+              cfg_persist_config_add(cfg, afsocket_sd_format_persist_name(self, TRUE, listener->shard), GUINT_TO_POINTER(listener->fd + 1), afsocket_sd_close_fd, FALSE);
+            }
         }
+      g_free(self->listeners);
+      self->listeners = NULL;
+      self->num_listeners = 0;
     }
   else if (self->sock_type == SOCK_DGRAM)
     {
-      /* we don't need to close the listening fd here as we have a
-       * single connection which will close it */
+      /* we don't need to close the listening fds here as each of them
+       * belongs to a connection which will close it */
 
       ;
     }
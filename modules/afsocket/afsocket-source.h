@@ -37,6 +37,15 @@
 
 typedef struct _AFSocketSourceDriver AFSocketSourceDriver;
 
+/* a listening SOCK_STREAM socket, there's one for each so-reuseport() shard */
+typedef struct _AFSocketSourceListener
+{
+  AFSocketSourceDriver *owner;
+  struct iv_fd listen_fd;
+  gint fd;
+  gint shard;
+} AFSocketSourceListener;
+
 struct _AFSocketSourceDriver
 {
   LogSrcDriver super;
@@ -45,8 +54,11 @@ struct _AFSocketSourceDriver
     connections_kept_alive_accross_reloads:1,
     require_tls:1,
     window_size_initialized:1;
-  struct iv_fd listen_fd;
-  gint fd;
+  AFSocketSourceListener *listeners;
+  gint num_listeners;
+  /* number of sockets bound to bind_addr using SO_REUSEPORT, each
+   * SOCK_DGRAM socket gets its own LogReader, 0 if not used */
+  gint so_reuseport;
   /* SOCK_DGRAM or SOCK_STREAM or other SOCK_XXX values used by the socket() call */
   gint sock_type;
   /* protocol parameter for the socket() call, 0 for default or IPPROTO_XXX for specific transports */
@@ -91,6 +103,7 @@ struct _AFSocketSourceDriver
 void afsocket_sd_set_transport(LogDriver *s, const gchar *transport);
 void afsocket_sd_set_keep_alive(LogDriver *self, gint enable);
 void afsocket_sd_set_max_connections(LogDriver *self, gint max_connections);
+void afsocket_sd_set_so_reuseport(LogDriver *self, gint shards);
 #if BUILD_WITH_SSL
 void afsocket_sd_set_tls_context(LogDriver *s, TLSContext *tls_context);
 #else
@@ -81,7 +81,7 @@ afsocket_setup_socket(gint fd, SocketOptions *sock_options, AFSocketDirection di
 }
 
 gboolean
-afsocket_open_socket(GSockAddr *bind_addr, gint sock_type, gint sock_protocol, int *fd)
+afsocket_open_socket(GSockAddr *bind_addr, gint sock_type, gint sock_protocol, gboolean so_reuseport, int *fd)
 {
   gint sock;
 
@@ -93,6 +93,26 @@ afsocket_open_socket(GSockAddr *bind_addr, gint sock_type, gint sock_protocol, i
 
       g_fd_set_nonblock(sock, TRUE);
       g_fd_set_cloexec(sock, TRUE);
+      if (so_reuseport)
+        {
+#ifdef SO_REUSEPORT
+          gint on = 1;
+
+          if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+            {
+              msg_error("Error setting SO_REUSEPORT on socket",
+                        evt_tag_errno(EVT_TAG_OSERROR, errno),
+                        NULL);
+              close(sock);
+              return FALSE;
+            }
+#else
+          msg_error("so-reuseport() was specified, but SO_REUSEPORT is not supported on this platform",
+                    NULL);
+          close(sock);
+          return FALSE;
+#endif
+        }
       saved_caps = g_process_cap_save();
       g_process_cap_modify(CAP_NET_BIND_SERVICE, TRUE);
       g_process_cap_modify(CAP_DAC_OVERRIDE, TRUE);
@@ -42,6 +42,6 @@ typedef struct _SocketOptions
 } SocketOptions;
 
 gboolean afsocket_setup_socket(gint fd, SocketOptions *sock_options, AFSocketDirection dir);
-gboolean afsocket_open_socket(GSockAddr *bind_addr, gint sock_type, gint sock_protocol, int *fd);
+gboolean afsocket_open_socket(GSockAddr *bind_addr, gint sock_type, gint sock_protocol, gboolean so_reuseport, int *fd);
 
 #endif
@@ -40,6 +40,8 @@ static CfgLexerKeyword afsql_keywords[] = {
   { "indexes",            KW_INDEXES },
   { "values",             KW_VALUES },
   { "log_fifo_size",      KW_LOG_FIFO_SIZE },
+  { "log_fifo_bytes",     KW_LOG_FIFO_BYTES, 0x0304 },
+  { "log_fifo_priority",  KW_LOG_FIFO_PRIORITY, 0x0304 },
   { "frac_digits",        KW_FRAC_DIGITS },
   { "session_statements", KW_SESSION_STATEMENTS, 0x0302 },
   { "host",               KW_HOST },
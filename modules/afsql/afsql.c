@@ -102,6 +102,7 @@ typedef struct _AFSqlDestDriver
 
   StatsCounterItem *dropped_messages;
   StatsCounterItem *stored_messages;
+  StatsCounterItem *memory_usage;
 
   GHashTable *dbd_options;
   GHashTable *dbd_options_numeric;
@@ -119,6 +120,9 @@ typedef struct _AFSqlDestDriver
   dbi_conn dbi_ctx;
   GHashTable *validated_tables;
   guint32 failed_message_counter;
+  /* with explicit commits, a message given up on after num_retries
+   * failures is still on the backlog, it is skipped when it comes again */
+  LogMessage *dropped_msg;
 } AFSqlDestDriver;
 
 static gboolean dbi_initialized = FALSE;
@@ -127,6 +131,9 @@ static const char *s_freetds = "freetds";
 
 #define MAX_FAILED_ATTEMPTS 3
 
+/* the number of messages fetched from the queue at once */
+#define AFSQL_BATCH_SIZE 64
+
 void
 afsql_dd_add_dbd_option(LogDriver *s, const gchar *name, const gchar *value)
 {
@@ -609,6 +616,7 @@ afsql_dd_commit_txn(AFSqlDestDriver *self, gboolean lock)
   if (success)
     {
       log_queue_ack_backlog(self->queue, self->flush_lines_queued);
+      self->failed_message_counter = 0;
     }
   else
     {
@@ -828,39 +836,86 @@ afsql_dd_construct_query(AFSqlDestDriver *self, GString *table,
   return query_string;
 }
 
+typedef enum
+{
+  AFSQL_INSERT_SUCCESS,
+  /* the INSERT failed, the failure handler decides what to do */
+  AFSQL_INSERT_FAILED,
+  /* the connection should be closed and the destination suspended */
+  AFSQL_INSERT_SUSPEND,
+} AFSqlInsertResult;
+
+/* a message given up on with explicit commits is acked along with the
+ * transaction instead of being inserted, as it is on the backlog */
+static AFSqlInsertResult
+afsql_dd_skip_dropped_msg(AFSqlDestDriver *self, LogMessage *msg)
+{
+  if (self->flush_lines_queued == 0 && !afsql_dd_begin_txn(self))
+    return AFSQL_INSERT_SUSPEND;
+
+  log_msg_unref(self->dropped_msg);
+  self->dropped_msg = NULL;
+  stats_counter_inc(self->dropped_messages);
+
+  self->flush_lines_queued++;
+  if (self->flush_lines && self->flush_lines_queued == self->flush_lines && !afsql_dd_commit_txn(self, TRUE))
+    return AFSQL_INSERT_SUSPEND;
+
+  log_msg_unref(msg);
+  return AFSQL_INSERT_SUCCESS;
+}
+
+/*
+ * With explicit commits, the messages of the uncommitted transaction
+ * (including the current batch) are on the backlog. The transaction is
+ * rolled back as the connection gets closed, so the backlog is rewound
+ * and the whole transaction is retried, instead of putting the failed
+ * messages back to the queue once more.
+ */
+static void
+afsql_dd_insert_txn_fail_handler(AFSqlDestDriver *self, LogMessage *msg, AFSqlInsertResult result)
+{
+  if (result == AFSQL_INSERT_FAILED)
+    {
+      if (self->failed_message_counter < self->num_retries - 1)
+        {
+          self->failed_message_counter++;
+        }
+      else
+        {
+          msg_error("Multiple failures while inserting this record into the database, message dropped",
+                    evt_tag_int("attempts", self->num_retries),
+                    NULL);
+          if (self->dropped_msg)
+            log_msg_unref(self->dropped_msg);
+          self->dropped_msg = log_msg_ref(msg);
+          self->failed_message_counter = 0;
+        }
+    }
+
+  g_mutex_lock(self->db_thread_mutex);
+  log_queue_reset_parallel_push(self->queue);
+  log_queue_rewind_backlog(self->queue);
+  g_mutex_unlock(self->db_thread_mutex);
+  self->flush_lines_queued = 0;
+}
+
 /**
- * afsql_dd_insert_db:
+ * afsql_dd_insert_msg:
  *
  * This function is running in the database thread
  *
- * Returns: FALSE to indicate that the connection should be closed and
- * this destination suspended for time_reopen() time.
+ * Inserts a single message, the message is consumed if
+ * AFSQL_INSERT_SUCCESS is returned.
  **/
-static gboolean
-afsql_dd_insert_db(AFSqlDestDriver *self)
+static AFSqlInsertResult
+afsql_dd_insert_msg(AFSqlDestDriver *self, LogMessage *msg, LogPathOptions *path_options)
 {
   GString *table, *query_string;
-  LogMessage *msg;
   gboolean success;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
-
-  afsql_dd_connect(self);
-
-  g_mutex_lock(self->db_thread_mutex);
 
-  /* FIXME: this is a workaround because of the non-proper locking semantics
-   * of the LogQueue.  It might happen that the _queue() method sees 0
-   * elements in the queue, while the thread is still busy processing the
-   * previous message.  In that case arming the parallel push callback is
-   * not needed and will cause assertions to fail.  This is ugly and should
-   * be fixed by properly defining the "blocking" semantics of the LogQueue
-   * object w/o having to rely on user-code messing with parallel push
-   * callbacks. */
-  log_queue_reset_parallel_push(self->queue);
-  success = log_queue_pop_head(self->queue, &msg, &path_options, (self->flags & AFSQL_DDF_EXPLICIT_COMMITS), FALSE);
-  g_mutex_unlock(self->db_thread_mutex);
-  if (!success)
-    return TRUE;
+  if (G_UNLIKELY(msg == self->dropped_msg))
+    return afsql_dd_skip_dropped_msg(self, msg);
 
   msg_set_context(msg);
 
@@ -872,38 +927,112 @@ afsql_dd_insert_db(AFSqlDestDriver *self)
                 evt_tag_int("time_reopen", self->time_reopen),
                 NULL);
       msg_set_context(NULL);
-      g_string_free(table, TRUE);
-      return afsql_dd_insert_fail_handler(self, msg, &path_options);
+      return AFSQL_INSERT_FAILED;
     }
 
   query_string = afsql_dd_construct_query(self, table, msg);
+  g_string_free(table, TRUE);
 
   if (self->flush_lines_queued == 0 && !afsql_dd_begin_txn(self))
-    return FALSE;
+    {
+      g_string_free(query_string, TRUE);
+      msg_set_context(NULL);
+      return AFSQL_INSERT_SUSPEND;
+    }
 
   success = afsql_dd_run_query(self, query_string->str, FALSE, NULL);
-  if (success && self->flush_lines_queued != -1)
+  g_string_free(query_string, TRUE);
+  msg_set_context(NULL);
+
+  if (!success)
+    return AFSQL_INSERT_FAILED;
+
+  step_sequence_number(&self->seq_num);
+
+  if (self->flush_lines_queued != -1)
     {
       self->flush_lines_queued++;
 
       if (self->flush_lines && self->flush_lines_queued == self->flush_lines && !afsql_dd_commit_txn(self, TRUE))
-        return FALSE;
+        return AFSQL_INSERT_SUSPEND;
     }
 
-  g_string_free(table, TRUE);
-  g_string_free(query_string, TRUE);
+  /* we only ACK if each INSERT is a separate transaction, otherwise the
+   * message is acked from the backlog once the transaction is committed */
+  if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) == 0)
+    {
+      log_msg_ack(msg, path_options);
+      self->failed_message_counter = 0;
+    }
+  log_msg_unref(msg);
 
-  msg_set_context(NULL);
+  return AFSQL_INSERT_SUCCESS;
+}
 
-  if (!success)
-    return afsql_dd_insert_fail_handler(self, msg, &path_options);
+/**
+ * afsql_dd_insert_db:
+ *
+ * This function is running in the database thread
+ *
+ * Returns: FALSE to indicate that the connection should be closed and
+ * this destination suspended for time_reopen() time.
+ **/
+static gboolean
+afsql_dd_insert_db(AFSqlDestDriver *self)
+{
+  LogMessage *msgs[AFSQL_BATCH_SIZE];
+  LogPathOptions path_options[AFSQL_BATCH_SIZE];
+  LogPathOptions path_options_init = LOG_PATH_OPTIONS_INIT;
+  gint count, max, i;
 
-  /* we only ACK if each INSERT is a separate transaction */
-  if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) == 0)
-    log_msg_ack(msg, &path_options);
-  log_msg_unref(msg);
-  step_sequence_number(&self->seq_num);
-  self->failed_message_counter = 0;
+  afsql_dd_connect(self);
+
+  for (i = 0; i < AFSQL_BATCH_SIZE; i++)
+    path_options[i] = path_options_init;
+
+  /* with explicit commits, don't fetch beyond the end of the current
+   * transaction, so that a commit always finishes a batch */
+  max = AFSQL_BATCH_SIZE;
+  if (self->flush_lines > 0 && self->flush_lines_queued >= 0)
+    max = MIN(max, self->flush_lines - self->flush_lines_queued);
+
+  g_mutex_lock(self->db_thread_mutex);
+
+  /* FIXME: this is a workaround because of the non-proper locking semantics
+   * of the LogQueue.  It might happen that the _queue() method sees 0
+   * elements in the queue, while the thread is still busy processing the
+   * previous message.  In that case arming the parallel push callback is
+   * not needed and will cause assertions to fail.  This is ugly and should
+   * be fixed by properly defining the "blocking" semantics of the LogQueue
+   * object w/o having to rely on user-code messing with parallel push
+   * callbacks. */
+  log_queue_reset_parallel_push(self->queue);
+  count = log_queue_pop_head_batch(self->queue, msgs, path_options, max, (self->flags & AFSQL_DDF_EXPLICIT_COMMITS), FALSE);
+  g_mutex_unlock(self->db_thread_mutex);
+
+  for (i = 0; i < count; i++)
+    {
+      AFSqlInsertResult result;
+
+      result = afsql_dd_insert_msg(self, msgs[i], &path_options[i]);
+      if (result == AFSQL_INSERT_SUCCESS)
+        continue;
+
+      if (self->flags & AFSQL_DDF_EXPLICIT_COMMITS)
+        {
+          /* the batch is on the backlog, drop our references */
+          afsql_dd_insert_txn_fail_handler(self, msgs[i], result);
+          for (; i < count; i++)
+            log_msg_unref(msgs[i]);
+          return FALSE;
+        }
+
+      /* put back the rest of the batch, they will be retried */
+      log_queue_push_head_batch(self->queue, &msgs[i + 1], &path_options[i + 1], count - i - 1);
+      if (result == AFSQL_INSERT_FAILED)
+        return afsql_dd_insert_fail_handler(self, msgs[i], &path_options[i]);
+      return FALSE;
+    }
 
   return TRUE;
 }
@@ -989,6 +1118,7 @@ afsql_dd_database_thread(gpointer arg)
     }
 
   afsql_dd_disconnect(self);
+  log_msg_free_thread_cache();
 
   msg_verbose("Database thread finished",
               evt_tag_str("driver", self->super.super.id),
@@ -1060,10 +1190,11 @@ afsql_dd_init(LogPipe *s)
   stats_lock();
   stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
   stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
 
   self->queue = log_dest_driver_acquire_queue(&self->super, afsql_dd_format_persist_name(self));
-  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
+  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages, self->memory_usage);
   if (!self->fields)
     {
       GList *col, *value;
@@ -1175,6 +1306,7 @@ afsql_dd_init(LogPipe *s)
   stats_lock();
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
 
   return FALSE;
@@ -1187,11 +1319,12 @@ afsql_dd_deinit(LogPipe *s)
 
   afsql_dd_stop_thread(self);
 
-  log_queue_set_counters(self->queue, NULL, NULL);
+  log_queue_set_counters(self->queue, NULL, NULL, NULL);
 
   stats_lock();
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
   stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_MEMORY_USAGE, &self->memory_usage);
   stats_unlock();
 
   if (!log_dest_driver_deinit_method(s))
@@ -1239,6 +1372,8 @@ afsql_dd_free(LogPipe *s)
   gint i;
 
   log_template_options_destroy(&self->template_options);
+  if (self->dropped_msg)
+    log_msg_unref(self->dropped_msg);
   if (self->queue)
     log_queue_unref(self->queue);
   for (i = 0; i < self->fields_len; i++)
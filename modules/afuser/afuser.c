@@ -64,6 +64,8 @@ afuser_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options,
   if (self->disable_until && self->disable_until > now)
     goto finish;
   
+  /* the timestamp is only filled in by the parse, which may have been deferred */
+  log_msg_ensure_parsed(msg);
   timestamp = g_string_sized_new(0);
   log_stamp_format(&msg->timestamps[LM_TS_STAMP], timestamp, TS_FMT_FULL, -1, 0);
   g_snprintf(buf, sizeof(buf), "%s %s %s\n",
@@ -29,6 +29,9 @@
 #include "cfg.h"
 #include "value-pairs.h"
 #include "vptransform.h"
+#include "scratch-buffers.h"
+
+#include <string.h>
 
 typedef struct _TFJsonState
 {
@@ -60,10 +63,14 @@ typedef struct
 {
   gboolean need_comma;
   GString *buffer;
+
+  /* the names of the currently open objects, each followed by a dot,
+   * just like they appear at the beginning of the keys */
+  GString *path;
 } json_state_t;
 
 static inline void
-g_string_append_escaped(GString *dest, const char *str)
+g_string_append_escaped(GString *dest, const char *str, gssize len)
 {
   /* Assumes ASCII!  Keep in sync with the switch! */
   static const unsigned char json_exceptions[UCHAR_MAX + 1] =
@@ -76,105 +83,115 @@ g_string_append_escaped(GString *dest, const char *str)
       [0x1f] = 1, ['\\'] = 1, ['"'] = 1
     };
 
-  const unsigned char *p;
+  const unsigned char *p, *end, *start;
 
+  if (len < 0)
+    len = strlen(str);
   p = (unsigned char *)str;
+  end = p + len;
 
-  while (*p)
+  while (p < end && *p)
     {
-      if (json_exceptions[*p] == 0)
-        g_string_append_c(dest, *p);
-      else
+      /* copy runs of characters that need no escaping in one go */
+      start = p;
+      while (p < end && *p && json_exceptions[*p] == 0)
+        p++;
+      g_string_append_len(dest, (const gchar *) start, p - start);
+      if (p >= end || !*p)
+        break;
+
+      /* Keep in sync with json_exceptions! */
+      switch (*p)
         {
-          /* Keep in sync with json_exceptions! */
-          switch (*p)
-            {
-            case '\b':
-              g_string_append(dest, "\\b");
-              break;
-            case '\n':
-              g_string_append(dest, "\\n");
-              break;
-            case '\r':
-              g_string_append(dest, "\\r");
-              break;
-            case '\t':
-              g_string_append(dest, "\\t");
-              break;
-            case '\\':
-              g_string_append(dest, "\\\\");
-              break;
-            case '"':
-              g_string_append(dest, "\\\"");
-              break;
-            default:
-              {
-                static const char json_hex_chars[16] = "0123456789abcdef";
-
-                g_string_append(dest, "\\u00");
-                g_string_append_c(dest, json_hex_chars[(*p) >> 4]);
-                g_string_append_c(dest, json_hex_chars[(*p) & 0xf]);
-                break;
-              }
-            }
+        case '\b':
+          g_string_append(dest, "\\b");
+          break;
+        case '\n':
+          g_string_append(dest, "\\n");
+          break;
+        case '\r':
+          g_string_append(dest, "\\r");
+          break;
+        case '\t':
+          g_string_append(dest, "\\t");
+          break;
+        case '\\':
+          g_string_append(dest, "\\\\");
+          break;
+        case '"':
+          g_string_append(dest, "\\\"");
+          break;
+        default:
+          {
+            static const char json_hex_chars[16] = "0123456789abcdef";
+
+            g_string_append(dest, "\\u00");
+            g_string_append_c(dest, json_hex_chars[(*p) >> 4]);
+            g_string_append_c(dest, json_hex_chars[(*p) & 0xf]);
+            break;
+          }
         }
       p++;
     }
 }
 
+/*
+ * The pairs arrive sorted by name, so the ones sharing a dotted prefix
+ * are next to each other. We only need to compare the name with the path
+ * of the objects we are in: close the ones that are not a prefix of the
+ * name and open the ones that are missing.
+ */
 static gboolean
-tf_json_obj_start(const gchar *name,
-                  const gchar *prefix, gpointer *prefix_data,
-                  const gchar *prev, gpointer *prev_data,
-                  gpointer user_data)
+tf_json_value(const gchar *name, const gchar *value, gssize value_len,
+              gpointer user_data)
 {
   json_state_t *state = (json_state_t *)user_data;
+  const gchar *key, *dot;
+  gsize common = 0, i;
 
-  if (state->need_comma)
-    g_string_append_c(state->buffer, ',');
-
-  if (name)
+  /* find the objects that remain open */
+  while (common < state->path->len)
     {
-      g_string_append_c(state->buffer, '"');
-      g_string_append_escaped(state->buffer, name);
-      g_string_append(state->buffer, "\":{");
+      dot = strchr(state->path->str + common, '.');
+      if (strncmp(state->path->str + common, name + common, dot - (state->path->str + common) + 1) != 0)
+        break;
+      common = dot - state->path->str + 1;
     }
-  else
-    g_string_append_c(state->buffer, '{');
-
-  state->need_comma = FALSE;
 
-  return FALSE;
-}
-
-static gboolean
-tf_json_obj_end(const gchar *name,
-                const gchar *prefix, gpointer *prefix_data,
-                const gchar *prev, gpointer *prev_data,
-                gpointer user_data)
-{
-  json_state_t *state = (json_state_t *)user_data;
-
-  g_string_append_c(state->buffer, '}');
+  /* close the rest */
+  for (i = common; i < state->path->len; i++)
+    {
+      if (state->path->str[i] == '.')
+        {
+          g_string_append_c(state->buffer, '}');
+          state->need_comma = TRUE;
+        }
+    }
+  g_string_truncate(state->path, common);
 
-  state->need_comma = TRUE;
+  /* open the missing ones */
+  key = name + common;
+  while ((dot = strchr(key, '.')) != NULL)
+    {
+      if (state->need_comma)
+        g_string_append_c(state->buffer, ',');
 
-  return FALSE;
-}
+      g_string_append_c(state->buffer, '"');
+      g_string_append_escaped(state->buffer, key, dot - key);
+      g_string_append(state->buffer, "\":{");
+      state->need_comma = FALSE;
 
-static gboolean
-tf_json_value(const gchar *name, const gchar *prefix, const gchar *value,
-              gpointer *prefix_data, gpointer user_data)
-{
-  json_state_t *state = (json_state_t *)user_data;
+      g_string_append_len(state->path, key, dot - key + 1);
+      key = dot + 1;
+    }
 
   if (state->need_comma)
     g_string_append_c(state->buffer, ',');
 
   g_string_append_c(state->buffer, '"');
-  g_string_append_escaped(state->buffer, name);
+  g_string_append_escaped(state->buffer, key, -1);
   g_string_append(state->buffer, "\":\"");
-  g_string_append_escaped(state->buffer, value);
+  g_string_append_escaped(state->buffer, value, value_len);
   g_string_append_c(state->buffer, '"');
 
   state->need_comma = TRUE;
@@ -182,17 +199,35 @@ tf_json_value(const gchar *name, const gchar *prefix, const gchar *value,
   return FALSE;
 }
 
+static gint
+tf_json_cmp(const gchar *s1, const gchar *s2)
+{
+  return strcmp(s2, s1);
+}
+
 static void
 tf_json_append(GString *result, ValuePairs *vp, LogMessage *msg)
 {
   json_state_t state;
+  ScratchBuffer *path;
+  gsize i;
 
+  path = scratch_buffer_acquire();
   state.need_comma = FALSE;
   state.buffer = result;
+  state.path = sb_string(path);
+
+  g_string_append_c(result, '{');
+  value_pairs_foreach_sorted_len(vp, tf_json_value, (GCompareDataFunc) tf_json_cmp,
+                                 msg, 0, &state);
+  for (i = 0; i < state.path->len; i++)
+    {
+      if (state.path->str[i] == '.')
+        g_string_append_c(result, '}');
+    }
+  g_string_append_c(result, '}');
 
-  value_pairs_walk(vp,
-                   tf_json_obj_start, tf_json_value, tf_json_obj_end,
-                   msg, 0, &state);
+  scratch_buffer_release(path);
 }
 
 static void
@@ -24,10 +24,13 @@
 #include "scratch-buffers.h"
 
 #include <string.h>
-#include <ctype.h>
 
-#include <json.h>
-#include <json_object_private.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* the same nesting limit json-c uses by default */
+#define JSON_PARSER_MAX_DEPTH 32
 
 struct _LogJSONParser
 {
@@ -37,6 +40,25 @@ struct _LogJSONParser
   gint marker_len;
 };
 
+/*
+ * The parser below is a recursive descent tokenizer that works directly on
+ * the input string: values are set in the LogMessage as soon as they are
+ * recognized, without building a document tree first. The name of the
+ * value being parsed (prefix + path) is kept in a single scratch buffer
+ * that grows and shrinks as we enter and leave objects and arrays, string
+ * values without escape sequences are set straight from the input.
+ */
+typedef struct _LogJSONScanner
+{
+  const gchar *pos;
+  const gchar *end;
+  const gchar *error;
+  gint depth;
+  LogMessage *msg;
+  GString *key;
+  GString *value;
+} LogJSONScanner;
+
 void
 log_json_parser_set_prefix (LogParser *p, const gchar *prefix)
 {
@@ -56,151 +78,485 @@ log_json_parser_set_marker (LogParser *p, const gchar *marker)
   self->marker_len = strlen(marker);
 }
 
-static void
-log_json_parser_process_object (struct json_object *jso,
-                                const gchar *prefix,
-                                LogMessage *msg);
+static inline gboolean
+log_json_scanner_is_space (gchar c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
 
-static void
-log_json_parser_process_single (struct json_object *jso,
-                                const gchar *prefix,
-                                const gchar *obj_key,
-                                LogMessage *msg)
+static inline void
+log_json_scanner_skip_whitespace (LogJSONScanner *self)
 {
-  ScratchBuffer *key, *value;
-  gboolean parsed = FALSE;
+  const gchar *p = self->pos;
 
-  key = scratch_buffer_acquire ();
-  value = scratch_buffer_acquire ();
+  /* most of the time there is at most a single space between tokens */
+  if (p < self->end && !log_json_scanner_is_space (*p))
+    return;
+
+#ifdef __SSE2__
+  while (self->end - p >= 16)
+    {
+      __m128i chunk = _mm_loadu_si128 ((const __m128i *) p);
+      __m128i space;
+      guint mask;
+
+      space = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, _mm_set1_epi8 (' ')),
+                                          _mm_cmpeq_epi8 (chunk, _mm_set1_epi8 ('\n'))),
+                            _mm_or_si128 (_mm_cmpeq_epi8 (chunk, _mm_set1_epi8 ('\r')),
+                                          _mm_cmpeq_epi8 (chunk, _mm_set1_epi8 ('\t'))));
+      mask = ~_mm_movemask_epi8 (space) & 0xFFFF;
+      if (mask)
+        {
+          self->pos = p + __builtin_ctz (mask);
+          return;
+        }
+      p += 16;
+    }
+#endif
+  while (p < self->end && log_json_scanner_is_space (*p))
+    p++;
+  self->pos = p;
+}
+
+/* returns the first '"' or '\\' at or after @p, or @end */
+static inline const gchar *
+log_json_scanner_find_string_special (const gchar *p, const gchar *end)
+{
+#ifdef __SSE2__
+  while (end - p >= 16)
+    {
+      __m128i chunk = _mm_loadu_si128 ((const __m128i *) p);
+      guint mask;
+
+      mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, _mm_set1_epi8 ('"')),
+                                              _mm_cmpeq_epi8 (chunk, _mm_set1_epi8 ('\\'))));
+      if (mask)
+        return p + __builtin_ctz (mask);
+      p += 16;
+    }
+#endif
+  while (p < end && *p != '"' && *p != '\\')
+    p++;
+  return p;
+}
+
+static gboolean
+log_json_scanner_parse_hex4 (LogJSONScanner *self, const gchar *p, gunichar *result)
+{
+  gint i;
+
+  *result = 0;
+  if (self->end - p < 4)
+    return FALSE;
+  for (i = 0; i < 4; i++)
+    {
+      gint digit = g_ascii_xdigit_value (p[i]);
+
+      if (digit < 0)
+        return FALSE;
+      *result = (*result << 4) + digit;
+    }
+  return TRUE;
+}
+
+/*
+ * Parses a string token, self->pos points right after the opening quote.
+ * Strings without escape sequences are returned as a pointer into the
+ * input, otherwise they are decoded into @buffer (after its current
+ * contents) and @str points into @buffer.
+ */
+static gboolean
+log_json_scanner_parse_string (LogJSONScanner *self, GString *buffer, const gchar **str, gsize *str_len)
+{
+  const gchar *p, *start;
+  gsize buffer_start = buffer->len;
+
+  start = self->pos;
+  p = log_json_scanner_find_string_special (start, self->end);
+  if (G_LIKELY (p < self->end && *p == '"'))
+    {
+      *str = start;
+      *str_len = p - start;
+      self->pos = p + 1;
+      return TRUE;
+    }
 
-  switch (json_object_get_type (jso))
-    {
-    case json_type_boolean:
-      parsed = TRUE;
-      if (json_object_get_boolean (jso))
-        g_string_assign (sb_string (value), "true");
-      else
-        g_string_assign (sb_string (value), "false");
-      break;
-    case json_type_double:
-      parsed = TRUE;
-      g_string_printf (sb_string (value), "%f",
-                       json_object_get_double (jso));
-      break;
-    case json_type_int:
-      parsed = TRUE;
-      g_string_printf (sb_string (value), "%i",
-                       json_object_get_int (jso));
-      break;
-    case json_type_string:
-      parsed = TRUE;
-      g_string_assign (sb_string (value),
-                       json_object_get_string (jso));
-      break;
-    case json_type_object:
-      if (prefix)
-        g_string_assign (sb_string (key), prefix);
-      g_string_append (sb_string (key), obj_key);
-      g_string_append_c (sb_string (key), '.');
-      log_json_parser_process_object (jso, sb_string (key)->str, msg);
-      break;
-    case json_type_array:
-      {
-        gint i, plen;
-
-        g_string_assign (sb_string (key), obj_key);
-
-        plen = sb_string (key)->len;
-
-        for (i = 0; i < json_object_array_length (jso); i++)
-          {
-            g_string_truncate (sb_string (key), plen);
-            g_string_append_printf (sb_string (key), "[%d]", i);
-            log_json_parser_process_single (json_object_array_get_idx (jso, i),
-                                            prefix,
-                                            sb_string (key)->str, msg);
-          }
+  while (1)
+    {
+      gunichar c;
+
+      g_string_append_len (buffer, start, p - start);
+      if (p >= self->end)
+        {
+          self->error = "unterminated string";
+          return FALSE;
+        }
+      if (*p == '"')
         break;
-      }
-    default:
+
+      /* escape sequence */
+      if (p + 1 >= self->end)
+        {
+          self->error = "unterminated string";
+          return FALSE;
+        }
+      switch (p[1])
+        {
+        case '"':
+        case '\\':
+        case '/':
+          g_string_append_c (buffer, p[1]);
+          break;
+        case 'b':
+          g_string_append_c (buffer, '\b');
+          break;
+        case 'f':
+          g_string_append_c (buffer, '\f');
+          break;
+        case 'n':
+          g_string_append_c (buffer, '\n');
+          break;
+        case 'r':
+          g_string_append_c (buffer, '\r');
+          break;
+        case 't':
+          g_string_append_c (buffer, '\t');
+          break;
+        case 'u':
+          if (!log_json_scanner_parse_hex4 (self, p + 2, &c))
+            {
+              self->error = "invalid \\u escape sequence";
+              return FALSE;
+            }
+          p += 4;
+          if (c >= 0xD800 && c < 0xDC00)
+            {
+              gunichar low;
+
+              /* UTF-16 surrogate pair */
+              if (self->end - p >= 8 && p[2] == '\\' && p[3] == 'u' &&
+                  log_json_scanner_parse_hex4 (self, p + 4, &low) &&
+                  low >= 0xDC00 && low < 0xE000)
+                {
+                  c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                  p += 6;
+                }
+              else
+                c = 0xFFFD;
+            }
+          else if (c >= 0xDC00 && c < 0xE000)
+            c = 0xFFFD;
+          g_string_append_unichar (buffer, c);
+          break;
+        default:
+          self->error = "invalid escape sequence";
+          return FALSE;
+        }
+      start = p + 2;
+      p = log_json_scanner_find_string_special (start, self->end);
+    }
+
+  *str = buffer->str + buffer_start;
+  *str_len = buffer->len - buffer_start;
+  self->pos = p + 1;
+  return TRUE;
+}
+
+static void
+log_json_scanner_set_value (LogJSONScanner *self, const gchar *value, gsize value_len)
+{
+  log_msg_set_value (self->msg,
+                     log_msg_get_value_handle (self->key->str),
+                     value, value_len);
+}
+
+/*
+ * Numbers are formatted the same way json-c did it: integers are clamped
+ * to 32 bits, anything with a fraction or an exponent is printed using
+ * "%f".
+ */
+static gboolean
+log_json_scanner_parse_number (LogJSONScanner *self)
+{
+  const gchar *p = self->pos;
+  gboolean is_double = FALSE;
+  gchar buf[512];
+  gint len;
+
+  if (*p == '-')
+    p++;
+  if (p >= self->end || !g_ascii_isdigit (*p))
+    {
+      self->error = "invalid number";
+      return FALSE;
+    }
+  while (p < self->end && g_ascii_isdigit (*p))
+    p++;
+  if (p < self->end && *p == '.')
+    {
+      is_double = TRUE;
+      p++;
+      while (p < self->end && g_ascii_isdigit (*p))
+        p++;
+    }
+  if (p < self->end && (*p == 'e' || *p == 'E'))
+    {
+      is_double = TRUE;
+      p++;
+      if (p < self->end && (*p == '+' || *p == '-'))
+        p++;
+      while (p < self->end && g_ascii_isdigit (*p))
+        p++;
+    }
+
+  /* strtod() & co need a NUL terminated string */
+  g_string_truncate (self->value, 0);
+  g_string_append_len (self->value, self->pos, p - self->pos);
+  self->pos = p;
+
+  if (is_double)
+    {
+      len = g_snprintf (buf, sizeof (buf), "%f", g_ascii_strtod (self->value->str, NULL));
+    }
+  else
+    {
+      gint64 value = g_ascii_strtoll (self->value->str, NULL, 10);
+
+      len = g_snprintf (buf, sizeof (buf), "%i", (gint) CLAMP (value, G_MININT32, G_MAXINT32));
+    }
+  log_json_scanner_set_value (self, buf, len);
+  return TRUE;
+}
+
+static gboolean
+log_json_scanner_parse_literal (LogJSONScanner *self, const gchar *literal, gsize literal_len)
+{
+  if ((gsize) (self->end - self->pos) < literal_len ||
+      memcmp (self->pos, literal, literal_len) != 0)
+    {
+      self->error = "invalid literal";
+      return FALSE;
+    }
+  self->pos += literal_len;
+  return TRUE;
+}
+
+static gboolean log_json_scanner_parse_object (LogJSONScanner *self);
+static gboolean log_json_scanner_parse_array (LogJSONScanner *self);
+
+/* parses a value, its name is in self->key */
+static gboolean
+log_json_scanner_parse_value (LogJSONScanner *self)
+{
+  const gchar *str;
+  gsize str_len;
+
+  log_json_scanner_skip_whitespace (self);
+  if (self->pos >= self->end)
+    {
+      self->error = "unexpected end of input";
+      return FALSE;
+    }
+
+  switch (*self->pos)
+    {
+    case '"':
+      self->pos++;
+      g_string_truncate (self->value, 0);
+      if (!log_json_scanner_parse_string (self, self->value, &str, &str_len))
+        return FALSE;
+      log_json_scanner_set_value (self, str, str_len);
+      return TRUE;
+    case '{':
+      g_string_append_c (self->key, '.');
+      return log_json_scanner_parse_object (self);
+    case '[':
+      return log_json_scanner_parse_array (self);
+    case 't':
+      if (!log_json_scanner_parse_literal (self, "true", 4))
+        return FALSE;
+      log_json_scanner_set_value (self, "true", 4);
+      return TRUE;
+    case 'f':
+      if (!log_json_scanner_parse_literal (self, "false", 5))
+        return FALSE;
+      log_json_scanner_set_value (self, "false", 5);
+      return TRUE;
+    case 'n':
+      if (!log_json_scanner_parse_literal (self, "null", 4))
+        return FALSE;
       msg_error ("JSON parser encountered an unknown type, skipping",
-                 evt_tag_str ("key", obj_key), NULL);
-      break;
+                 evt_tag_str ("key", self->key->str), NULL);
+      return TRUE;
+    default:
+      if (*self->pos != '-' && !g_ascii_isdigit (*self->pos))
+        {
+          self->error = "unexpected character";
+          return FALSE;
+        }
+      return log_json_scanner_parse_number (self);
     }
+}
 
-  if (parsed)
+/* self->pos points to the opening brace, self->key contains the prefix of
+ * the member names */
+static gboolean
+log_json_scanner_parse_object (LogJSONScanner *self)
+{
+  gsize prefix_len = self->key->len;
+  const gchar *name;
+  gsize name_len;
+
+  if (++self->depth > JSON_PARSER_MAX_DEPTH)
     {
-      if (prefix)
+      self->error = "nesting too deep";
+      return FALSE;
+    }
+
+  self->pos++;
+  log_json_scanner_skip_whitespace (self);
+  if (self->pos < self->end && *self->pos == '}')
+    goto finish;
+
+  while (1)
+    {
+      log_json_scanner_skip_whitespace (self);
+      if (self->pos >= self->end || *self->pos != '"')
+        {
+          self->error = "object member name expected";
+          return FALSE;
+        }
+      self->pos++;
+
+      g_string_truncate (self->key, prefix_len);
+      if (!log_json_scanner_parse_string (self, self->key, &name, &name_len))
+        return FALSE;
+      if (name != self->key->str + prefix_len)
+        g_string_append_len (self->key, name, name_len);
+
+      log_json_scanner_skip_whitespace (self);
+      if (self->pos >= self->end || *self->pos != ':')
+        {
+          self->error = "':' expected";
+          return FALSE;
+        }
+      self->pos++;
+
+      if (!log_json_scanner_parse_value (self))
+        return FALSE;
+
+      log_json_scanner_skip_whitespace (self);
+      if (self->pos < self->end && *self->pos == ',')
         {
-          g_string_assign (sb_string (key), prefix);
-          g_string_append (sb_string (key), obj_key);
-          log_msg_set_value (msg,
-                             log_msg_get_value_handle (sb_string (key)->str),
-                             sb_string (value)->str, sb_string (value)->len);
+          self->pos++;
+          continue;
         }
-      else
-        log_msg_set_value (msg,
-                           log_msg_get_value_handle (obj_key),
-                           sb_string (value)->str, sb_string (value)->len);
+      if (self->pos < self->end && *self->pos == '}')
+        break;
+      self->error = "',' or '}' expected";
+      return FALSE;
     }
 
-  scratch_buffer_release (key);
-  scratch_buffer_release (value);
+ finish:
+  self->pos++;
+  self->depth--;
+  g_string_truncate (self->key, prefix_len);
+  return TRUE;
 }
 
-static void
-log_json_parser_process_object (struct json_object *jso,
-                                const gchar *prefix,
-                                LogMessage *msg)
+/* self->pos points to the opening bracket, self->key contains the name of
+ * the array, elements are named name[0], name[1], ... */
+static gboolean
+log_json_scanner_parse_array (LogJSONScanner *self)
 {
-  struct json_object_iter itr;
+  gsize name_len = self->key->len;
+  gint i = 0;
 
-  json_object_object_foreachC (jso, itr)
+  if (++self->depth > JSON_PARSER_MAX_DEPTH)
     {
-      log_json_parser_process_single (itr.val, prefix, itr.key, msg);
+      self->error = "nesting too deep";
+      return FALSE;
     }
+
+  self->pos++;
+  log_json_scanner_skip_whitespace (self);
+  if (self->pos < self->end && *self->pos == ']')
+    goto finish;
+
+  while (1)
+    {
+      g_string_truncate (self->key, name_len);
+      g_string_append_printf (self->key, "[%d]", i++);
+
+      if (!log_json_scanner_parse_value (self))
+        return FALSE;
+
+      log_json_scanner_skip_whitespace (self);
+      if (self->pos < self->end && *self->pos == ',')
+        {
+          self->pos++;
+          continue;
+        }
+      if (self->pos < self->end && *self->pos == ']')
+        break;
+      self->error = "',' or ']' expected";
+      return FALSE;
+    }
+
+ finish:
+  self->pos++;
+  self->depth--;
+  g_string_truncate (self->key, name_len);
+  return TRUE;
 }
 
 static gboolean
 log_json_parser_process (LogParser *s, LogMessage **pmsg, const LogPathOptions *path_options, const gchar *input, gsize input_len)
 {
   LogJSONParser *self = (LogJSONParser *) s;
-  struct json_object *jso;
-  struct json_tokener *tok;
+  LogJSONScanner scanner;
+  ScratchBuffer *key, *value;
+  gboolean success;
 
+  scanner.end = input + input_len;
   if (self->marker)
     {
-      if (strncmp(input, self->marker, self->marker_len) != 0)
+      if (input_len < (gsize) self->marker_len ||
+          strncmp(input, self->marker, self->marker_len) != 0)
         return FALSE;
       input += self->marker_len;
-
-      while (isspace(*input))
-        input++;
     }
+  scanner.pos = input;
+  scanner.depth = 0;
+  scanner.error = NULL;
 
-  tok = json_tokener_new ();
-  jso = json_tokener_parse_ex (tok, input, input_len);
-  if (tok->err != json_tokener_success)
+  log_json_scanner_skip_whitespace (&scanner);
+  if (scanner.pos >= scanner.end || *scanner.pos != '{')
     {
       msg_error ("Unparsable JSON stream encountered",
-                 evt_tag_str ("error", json_tokener_errors[tok->err]), NULL);
-      json_tokener_free (tok);
+                 evt_tag_str ("error", "the top level value must be an object"), NULL);
       return FALSE;
     }
-  json_tokener_free (tok);
 
-  if (!jso)
+  key = scratch_buffer_acquire ();
+  value = scratch_buffer_acquire ();
+  if (self->prefix)
+    g_string_assign (sb_string (key), self->prefix);
+
+  scanner.msg = log_msg_make_writable(pmsg, path_options);
+  scanner.key = sb_string (key);
+  scanner.value = sb_string (value);
+  success = log_json_scanner_parse_object (&scanner);
+  if (!success)
     {
-      msg_error ("Unparsable JSON stream encountered", NULL);
-      return FALSE;
+      msg_error ("Unparsable JSON stream encountered",
+                 evt_tag_str ("error", scanner.error),
+                 evt_tag_int ("position", scanner.pos - input), NULL);
     }
 
-  log_msg_make_writable(pmsg, path_options);
-  log_json_parser_process_object (jso, self->prefix, *pmsg);
-
-  json_object_put (jso);
-
-  return TRUE;
+  scratch_buffer_release (key);
+  scratch_buffer_release (value);
+  return success;
 }
 
 static LogPipe *
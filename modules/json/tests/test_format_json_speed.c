@@ -0,0 +1,93 @@
+#include "template_lib.h"
+#include "apphook.h"
+#include "plugin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+gboolean success = TRUE;
+gboolean verbose = FALSE;
+
+#define BENCHMARK_COUNT 100000
+#define BENCHMARK_WARMUP 1000
+
+void
+testcase(const gchar *template)
+{
+  LogTemplate *templ;
+  LogMessage *msg;
+  GString *res = g_string_sized_new(1024);
+  GString *expected;
+  GTimeVal start, end;
+  gint i;
+
+  msg = create_sample_message();
+  log_msg_set_value(msg, log_msg_get_value_handle("kernel.SUBSYSTEM"), "pci", -1);
+  log_msg_set_value(msg, log_msg_get_value_handle("kernel.DEVICE.type"), "pci", -1);
+  log_msg_set_value(msg, log_msg_get_value_handle("kernel.DEVICE.name"), "0000:02:00.0", -1);
+  log_msg_set_value(msg, log_msg_get_value_handle(".classifier.rule_id"), "1234-5678", -1);
+  templ = compile_template(template);
+
+  /* warm up caches, and remember the output to check that formatting is stable */
+  log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
+  expected = g_string_new(res->str);
+  for (i = 1; i < BENCHMARK_WARMUP; i++)
+    log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
+
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
+    }
+  g_get_current_time(&end);
+  printf("      %-90s speed: %12.3f msg/sec\n", template, i * 1e6 / g_time_val_diff(&end, &start));
+
+  if (res->len == 0 || strcmp(res->str, expected->str) != 0)
+    {
+      fprintf(stderr, "FAIL: template output changed while benchmarking, template=%s, first=%s, last=%s\n", template, expected->str, res->str);
+      success = FALSE;
+    }
+  else if (verbose)
+    {
+      fprintf(stderr, "PASS: template=%s, output=%s\n", template, res->str);
+    }
+
+  g_string_free(expected, TRUE);
+  g_string_free(res, TRUE);
+  log_template_unref(templ);
+  log_msg_unref(msg);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  if (argc > 1)
+    verbose = TRUE;
+
+  app_startup();
+  putenv("TZ=MET-1METDST");
+  tzset();
+  init_template_tests();
+  plugin_load_module("json-plugin", configuration, NULL);
+
+  testcase("$(format-json MSG=$MSG)");
+  testcase("$(format-json --scope rfc3164)");
+  testcase("$(format-json --scope rfc5424)");
+  testcase("$(format-json --scope nv-pairs)");
+  testcase("$(format-json --scope all-nv-pairs)");
+  testcase("$(format-json --scope selected-macros --scope nv-pairs)");
+  testcase("$(format-json --key kernel.* --rekey kernel.* --shift 7)");
+
+  /* nested objects, closed and reopened as the names move around the tree */
+  testcase("$(format-json msg.text=$MSG msg.id=42 host=bzorp)");
+  testcase("$(format-json a.b.c=1 a.b.d=2 a.e=3 f=4 g.h.i=5 g.h.j=6 g.k=7)");
+  testcase("$(format-json --key kernel.* --key .classifier.* --scope rfc3164)");
+
+  deinit_template_tests();
+  app_shutdown();
+
+  if (success)
+    return 0;
+  return 1;
+}
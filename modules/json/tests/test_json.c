@@ -1,6 +1,9 @@
 #include "template_lib.h"
 #include "apphook.h"
 #include "plugin.h"
+#include "jsonparser.h"
+
+#include <string.h>
 
 void
 test_format_json(void)
@@ -16,6 +19,20 @@ test_format_json(void)
   assert_template_format("$(format-json .foo=bar)", "{\"_foo\":\"bar\"}");
 }
 
+void
+test_format_json_nesting(void)
+{
+  /* only whole name components open an object */
+  assert_template_format("$(format-json msg.a=1 msg-x=2)", "{\"msg\":{\"a\":\"1\"},\"msg-x\":\"2\"}");
+  assert_template_format("$(format-json msg.a=1 msgx.b=2)", "{\"msgx\":{\"b\":\"2\"},\"msg\":{\"a\":\"1\"}}");
+
+  /* objects are closed and reopened as the names move around the tree */
+  assert_template_format("$(format-json a.b.c=1 a.b.d=2 a.e=3 f=4)",
+                         "{\"f\":\"4\",\"a\":{\"e\":\"3\",\"b\":{\"d\":\"2\",\"c\":\"1\"}}}");
+  assert_template_format("$(format-json a.b.c=1 a.d.e=2)", "{\"a\":{\"d\":{\"e\":\"2\"},\"b\":{\"c\":\"1\"}}}");
+  assert_template_format("$(format-json x.y.z=1 w=2)", "{\"x\":{\"y\":{\"z\":\"1\"}},\"w\":\"2\"}");
+}
+
 void
 test_format_json_rekey(void)
 {
@@ -23,6 +40,86 @@ test_format_json_rekey(void)
                          "{\"_msg\":{\"text\":\"dotted\"}}");
 }
 
+static LogMessage *
+parse_json(const gchar *prefix, const gchar *marker, const gchar *json)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogParser *parser;
+  LogMessage *msg;
+  gboolean success;
+
+  parser = (LogParser *) log_json_parser_new();
+  if (prefix)
+    log_json_parser_set_prefix(parser, prefix);
+  if (marker)
+    log_json_parser_set_marker(parser, marker);
+
+  msg = log_msg_new_empty();
+  success = parser->process(parser, &msg, &path_options, json, strlen(json));
+  log_pipe_unref(&parser->super);
+  if (!success)
+    {
+      log_msg_unref(msg);
+      return NULL;
+    }
+  return msg;
+}
+
+static void
+assert_json_value(LogMessage *msg, const gchar *name, const gchar *expected)
+{
+  assert_string(log_msg_get_value(msg, log_msg_get_value_handle(name), NULL), expected,
+                "json-parser() produced an unexpected value, name=%s", name);
+}
+
+void
+test_json_parser(void)
+{
+  LogMessage *msg;
+
+  msg = parse_json(NULL, NULL, "{\"str\": \"value\", \"int\": 42, \"neg\": -42, \"dbl\": 1.5,"
+                               " \"big\": 99999999999, \"yes\": true, \"no\": false, \"null\": null}");
+  assert_not_null(msg, "failed to parse valid JSON");
+  assert_json_value(msg, "str", "value");
+  assert_json_value(msg, "int", "42");
+  assert_json_value(msg, "neg", "-42");
+  assert_json_value(msg, "dbl", "1.500000");
+  assert_json_value(msg, "big", "2147483647");
+  assert_json_value(msg, "yes", "true");
+  assert_json_value(msg, "no", "false");
+  assert_json_value(msg, "null", "");
+  log_msg_unref(msg);
+
+  msg = parse_json(NULL, NULL, "{\"msg\": {\"text\": \"foo\", \"ids\": [1, [2, 3], {\"id\": 4}]}, \"empty\": {}}");
+  assert_not_null(msg, "failed to parse valid JSON");
+  assert_json_value(msg, "msg.text", "foo");
+  assert_json_value(msg, "msg.ids[0]", "1");
+  assert_json_value(msg, "msg.ids[1][0]", "2");
+  assert_json_value(msg, "msg.ids[1][1]", "3");
+  assert_json_value(msg, "msg.ids[2].id", "4");
+  log_msg_unref(msg);
+
+  msg = parse_json(NULL, NULL, "{\"esc\": \"a\\\"b\\\\c\\/d\\t\\u00e1\\ud83d\\ude00\", \"k\\u00e9y\": \"v\"}");
+  assert_not_null(msg, "failed to parse valid JSON");
+  assert_json_value(msg, "esc", "a\"b\\c/d\t\xc3\xa1\xf0\x9f\x98\x80");
+  assert_json_value(msg, "k\xc3\xa9y", "v");
+  log_msg_unref(msg);
+
+  msg = parse_json(".json.", "@cee:", "@cee: {\"a\": {\"b\": \"c\"}, \"arr\": [\"x\"]}");
+  assert_not_null(msg, "failed to parse valid JSON with marker");
+  assert_json_value(msg, ".json.a.b", "c");
+  assert_json_value(msg, ".json.arr[0]", "x");
+  log_msg_unref(msg);
+
+  assert_null(parse_json(NULL, "@cee:", "{\"a\": 1}"), "JSON without the marker was accepted");
+  assert_null(parse_json(NULL, NULL, "[1, 2]"), "non-object top level value was accepted");
+  assert_null(parse_json(NULL, NULL, "{\"a\": 1,}"), "trailing comma was accepted");
+  assert_null(parse_json(NULL, NULL, "{\"a\": \"unterminated"), "unterminated string was accepted");
+  assert_null(parse_json(NULL, NULL, "{\"a\" 1}"), "missing colon was accepted");
+  assert_null(parse_json(NULL, NULL, "{\"a\": tru}"), "invalid literal was accepted");
+  assert_null(parse_json(NULL, NULL, "{\"a\": \"\\q\"}"), "invalid escape was accepted");
+}
+
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
@@ -33,7 +130,9 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   plugin_load_module("json-plugin", configuration, NULL);
 
   test_format_json();
+  test_format_json_nesting();
   test_format_json_rekey();
+  test_json_parser();
 
   deinit_template_tests();
   app_shutdown();
@@ -28,11 +28,16 @@
 #include "misc.h"
 #include "cfg.h"
 #include "str-format.h"
+#include "tls-support.h"
 
 #include <regex.h>
 #include <ctype.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*
  * Used in log_msg_parse_date(). Need to differentiate because Tru64's strptime
  * works differently than the rest of the supported systems.
@@ -48,6 +53,26 @@ static const char repeat_msg_string[] = "last message repeated";
 static NVHandle is_synced;
 static NVHandle cisco_seqid;
 
+/* the result of the last mktime() call made by log_msg_parse_date(),
+ * timestamps within the same minute only differ in the seconds field, so
+ * for those we can skip mktime() and the timezone lookups */
+typedef struct _DateParseCache
+{
+  gboolean valid;
+  gint year, mon, mday, hour, min, isdst;
+  time_t minute_start;
+  glong local_zone_offset;
+  gint hour_adjust;
+} DateParseCache;
+
+TLS_BLOCK_START
+{
+  DateParseCache date_parse_cache;
+}
+TLS_BLOCK_END;
+
+#define date_parse_cache  __tls_deref(date_parse_cache)
+
 static gboolean
 log_msg_parse_pri(LogMessage *self, const guchar **data, gint *length, guint flags, guint16 default_pri)
 {
@@ -99,6 +124,22 @@ log_msg_parse_skip_chars(LogMessage *self, const guchar **data, gint *length, co
   gint left = *length;
   gint num_skipped = 0;
 
+  /* skipping a single character (usually spaces) is the common case */
+  if (chars[0] && !chars[1])
+    {
+      while (max_len && left && *src == (guchar) chars[0])
+        {
+          src++;
+          left--;
+          num_skipped++;
+          if (max_len >= 0)
+            max_len--;
+        }
+      *data = src;
+      *length = left;
+      return num_skipped;
+    }
+
   while (max_len && left && strchr(chars, *src))
     {
       src++;
@@ -211,6 +252,145 @@ log_msg_parse_seq(LogMessage *self, const guchar **data, gint *length)
   return TRUE;
 }
 
+/*
+ * Fast path for the common timestamp layouts: the positions of the digits
+ * among the first 16 characters are classified at once and the fields
+ * are decoded without further checks. Anything unusual (e.g. spaces
+ * within numbers) is left to the generic scan_*_timestamp() functions.
+ */
+
+/* returns a bitmask of the digit positions in the 16 bytes at @src */
+static inline guint32
+log_msg_classify_digits(const guchar *src)
+{
+#ifdef __SSE2__
+  __m128i block = _mm_loadu_si128((const __m128i *) src);
+
+  /* bytes above 0x7f are negative, so they are not matched either */
+  return _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)),
+                                         _mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1))));
+#else
+  guint32 mask = 0;
+  gint i;
+
+  for (i = 0; i < 16; i++)
+    {
+      if (src[i] >= '0' && src[i] <= '9')
+        mask |= 1 << i;
+    }
+  return mask;
+#endif
+}
+
+static inline gint
+log_msg_decode_2digits(const guchar *src)
+{
+  return (src[0] - '0') * 10 + (src[1] - '0');
+}
+
+/* YYYY-MM-DDTHH:MM:SS */
+#define ISO_TIMESTAMP_DIGITS   (0x000F | (0x3 << 5) | (0x3 << 8) | (0x3 << 11) | (0x3 << 14))
+
+static gboolean
+log_msg_parse_iso_timestamp_fast(const guchar **data, gint *length, struct tm *tm)
+{
+  const guchar *src = *data;
+
+  if (*length < 19 ||
+      (log_msg_classify_digits(src) & ISO_TIMESTAMP_DIGITS) != ISO_TIMESTAMP_DIGITS ||
+      src[4] != '-' || src[7] != '-' || src[10] != 'T' || src[13] != ':' || src[16] != ':' ||
+      src[17] < '0' || src[17] > '9' || src[18] < '0' || src[18] > '9')
+    return FALSE;
+
+  tm->tm_year = log_msg_decode_2digits(src) * 100 + log_msg_decode_2digits(src + 2) - 1900;
+  tm->tm_mon = log_msg_decode_2digits(src + 5) - 1;
+  tm->tm_mday = log_msg_decode_2digits(src + 8);
+  tm->tm_hour = log_msg_decode_2digits(src + 11);
+  tm->tm_min = log_msg_decode_2digits(src + 14);
+  tm->tm_sec = log_msg_decode_2digits(src + 17);
+  *data = src + 19;
+  *length -= 19;
+  return TRUE;
+}
+
+/* MMM DD HH:MM:SS, the first digit of the day may be a space */
+#define BSD_TIMESTAMP_DIGITS   ((0x1 << 5) | (0x3 << 7) | (0x3 << 10) | (0x3 << 13))
+
+static gboolean
+log_msg_parse_bsd_timestamp_fast(const guchar **data, gint *length, struct tm *tm)
+{
+  const guchar *src = *data;
+  gint left = 3;
+  gint mon;
+
+  /* the classification looks at 16 bytes, so we need one more than the timestamp */
+  if (*length < 16 ||
+      (log_msg_classify_digits(src) & BSD_TIMESTAMP_DIGITS) != BSD_TIMESTAMP_DIGITS ||
+      src[3] != ' ' || src[6] != ' ' || src[9] != ':' || src[12] != ':' ||
+      (src[4] != ' ' && (src[4] < '0' || src[4] > '9')))
+    return FALSE;
+
+  if (!scan_month_abbrev((const gchar **) &src, &left, &mon))
+    return FALSE;
+  src = *data;
+
+  tm->tm_mon = mon;
+  tm->tm_mday = (src[4] == ' ' ? 0 : (src[4] - '0') * 10) + (src[5] - '0');
+  tm->tm_hour = log_msg_decode_2digits(src + 7);
+  tm->tm_min = log_msg_decode_2digits(src + 10);
+  tm->tm_sec = log_msg_decode_2digits(src + 13);
+  *data = src + 15;
+  *length -= 15;
+  return TRUE;
+}
+
+/*
+ * Converts the broken down local time in @tm to time_t just like
+ * mktime() does, also returning the local timezone offset at that time
+ * and the number of hours mktime() had to shift tm_hour (see the zone
+ * barrier note in log_msg_parse_date()).
+ *
+ * The computation is done for the start of the minute and is cached per
+ * thread, the seconds are added afterwards.
+ */
+static time_t
+log_msg_parse_mktime(struct tm *tm, glong *local_zone_offset, gint *hour_adjust)
+{
+  DateParseCache *cache = &date_parse_cache;
+  gint sec = tm->tm_sec;
+  gint unnormalized_hour = tm->tm_hour;
+
+  if (G_LIKELY(cache->valid &&
+               tm->tm_min == cache->min &&
+               tm->tm_hour == cache->hour &&
+               tm->tm_mday == cache->mday &&
+               tm->tm_mon == cache->mon &&
+               tm->tm_year == cache->year &&
+               tm->tm_isdst == cache->isdst))
+    {
+      *local_zone_offset = cache->local_zone_offset;
+      *hour_adjust = cache->hour_adjust;
+      return cache->minute_start + sec;
+    }
+
+  cache->year = tm->tm_year;
+  cache->mon = tm->tm_mon;
+  cache->mday = tm->tm_mday;
+  cache->hour = tm->tm_hour;
+  cache->min = tm->tm_min;
+  cache->isdst = tm->tm_isdst;
+
+  tm->tm_sec = 0;
+  cache->minute_start = cached_mktime(tm);
+  cache->local_zone_offset = get_local_timezone_ofs(cache->minute_start);
+  cache->hour_adjust = tm->tm_hour - unnormalized_hour;
+  cache->valid = TRUE;
+
+  *local_zone_offset = cache->local_zone_offset;
+  *hour_adjust = cache->hour_adjust;
+  return cache->minute_start + sec;
+}
+
 /* FIXME: this function should really be exploded to a lot of smaller functions... (Bazsi) */
 static gboolean
 log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint parse_flags, glong assume_timezone)
@@ -219,7 +399,8 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
   gint left = *length;
   GTimeVal now;
   struct tm tm;
-  gint unnormalized_hour;
+  glong local_zone_offset;
+  gint hour_adjust;
 
   cached_g_current_time(&now);
 
@@ -254,7 +435,8 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
        * time-zone barriers */
 
       cached_localtime(&now.tv_sec, &tm);
-      if (!scan_iso_timestamp((const gchar **) &src, &left, &tm))
+      if (!log_msg_parse_iso_timestamp_fast(&src, &left, &tm) &&
+          !scan_iso_timestamp((const gchar **) &src, &left, &tm))
         {
           goto error;
         }
@@ -305,8 +487,7 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
       /* we convert it to UTC */
 
       tm.tm_isdst = -1;
-      unnormalized_hour = tm.tm_hour;
-      self->timestamps[LM_TS_STAMP].tv_sec = cached_mktime(&tm);
+      self->timestamps[LM_TS_STAMP].tv_sec = log_msg_parse_mktime(&tm, &local_zone_offset, &hour_adjust);
     }
   else if ((parse_flags & LP_SYSLOG_PROTOCOL) == 0)
     {
@@ -329,8 +510,7 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
           tm.tm_isdst = -1;
 
           /* NOTE: no timezone information in the message, assume it is local time */
-          unnormalized_hour = tm.tm_hour;
-          self->timestamps[LM_TS_STAMP].tv_sec = cached_mktime(&tm);
+          self->timestamps[LM_TS_STAMP].tv_sec = log_msg_parse_mktime(&tm, &local_zone_offset, &hour_adjust);
           self->timestamps[LM_TS_STAMP].tv_usec = 0;
         }
       else if (left >= 21 && src[3] == ' ' && src[6] == ' ' && src[9] == ':' && src[12] == ':' && src[15] == ' ' &&
@@ -344,8 +524,7 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
           tm.tm_isdst = -1;
 
           /* NOTE: no timezone information in the message, assume it is local time */
-          unnormalized_hour = tm.tm_hour;
-          self->timestamps[LM_TS_STAMP].tv_sec = cached_mktime(&tm);
+          self->timestamps[LM_TS_STAMP].tv_sec = log_msg_parse_mktime(&tm, &local_zone_offset, &hour_adjust);
           self->timestamps[LM_TS_STAMP].tv_usec = 0;
 
         }
@@ -357,7 +536,8 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
 
           cached_localtime(&now.tv_sec, &nowtm);
           tm = nowtm;
-          if (!scan_bsd_timestamp((const gchar **) &src, &left, &tm))
+          if (!log_msg_parse_bsd_timestamp_fast(&src, &left, &tm) &&
+              !scan_bsd_timestamp((const gchar **) &src, &left, &tm))
             goto error;
 
           if (left > 0 && src[0] == '.')
@@ -396,8 +576,7 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
             tm.tm_year++;
 
           /* NOTE: no timezone information in the message, assume it is local time */
-          unnormalized_hour = tm.tm_hour;
-          self->timestamps[LM_TS_STAMP].tv_sec = cached_mktime(&tm);
+          self->timestamps[LM_TS_STAMP].tv_sec = log_msg_parse_mktime(&tm, &local_zone_offset, &hour_adjust);
           self->timestamps[LM_TS_STAMP].tv_usec = usec;
         }
       else
@@ -416,8 +595,9 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
    * by adding the local timezone offset at the specific time to get UTC,
    * which means that tv_sec becomes as if tm was in the 00:00 timezone.
    * Also we have to take into account that at the zone barriers an hour
-   * might be skipped or played twice this is what the
-   * (tm.tm_hour - * unnormalized_hour) part fixes up. */
+   * might be skipped or played twice this is what the hour_adjust part
+   * fixes up. Both the local offset and hour_adjust are returned by
+   * log_msg_parse_mktime(). */
 
   if (self->timestamps[LM_TS_STAMP].zone_offset == -1)
     {
@@ -425,11 +605,11 @@ log_msg_parse_date(LogMessage *self, const guchar **data, gint *length, guint pa
     }
   if (self->timestamps[LM_TS_STAMP].zone_offset == -1)
     {
-      self->timestamps[LM_TS_STAMP].zone_offset = get_local_timezone_ofs(self->timestamps[LM_TS_STAMP].tv_sec);
+      self->timestamps[LM_TS_STAMP].zone_offset = local_zone_offset;
     }
   self->timestamps[LM_TS_STAMP].tv_sec = self->timestamps[LM_TS_STAMP].tv_sec +
-                                              get_local_timezone_ofs(self->timestamps[LM_TS_STAMP].tv_sec) -
-                                              (tm.tm_hour - unnormalized_hour) * 3600 - self->timestamps[LM_TS_STAMP].zone_offset;
+                                              local_zone_offset -
+                                              hour_adjust * 3600 - self->timestamps[LM_TS_STAMP].zone_offset;
 
   *data = src;
   *length = left;
@@ -1047,6 +1227,36 @@ log_msg_parse_syslog_proto(const MsgFormatOptions *parse_options, const guchar *
   return TRUE;
 }
 
+/*
+ * Checks whether the BSD message following the PRI starts with a
+ * timestamp and a hostname, e.g. "Jan 10 01:00:00 bzorp ", without
+ * parsing it.  Only the messages having both are formatted the same way
+ * as they were received, the parser has to fill in the rest otherwise.
+ */
+static gboolean
+log_msg_has_legacy_header(const MsgFormatOptions *parse_options, const guchar *src, gint left)
+{
+  struct tm tm;
+  gint i;
+
+  if ((parse_options->flags & (LP_SYSLOG_PROTOCOL | LP_EXPECT_HOSTNAME)) != LP_EXPECT_HOSTNAME ||
+      parse_options->bad_hostname)
+    return FALSE;
+
+  if (!log_msg_parse_bsd_timestamp_fast(&src, &left, &tm) || *src != ' ')
+    return FALSE;
+  src++;
+  left--;
+
+  if ((left >= sizeof(aix_fwd_string) - 1 && memcmp(src, aix_fwd_string, sizeof(aix_fwd_string) - 1) == 0) ||
+      (left >= sizeof(repeat_msg_string) - 1 && memcmp(src, repeat_msg_string, sizeof(repeat_msg_string) - 1) == 0))
+    return FALSE;
+
+  /* the program name is followed by ':' or '[', a hostname by a space */
+  for (i = 0; i < left && (g_ascii_isalnum(src[i]) || src[i] == '-' || src[i] == '_' || src[i] == '.'); i++)
+    ;
+  return i > 0 && i < left && src[i] == ' ';
+}
 
 void
 syslog_format_handler(const MsgFormatOptions *parse_options,
@@ -1072,6 +1282,23 @@ syslog_format_handler(const MsgFormatOptions *parse_options,
   if (parse_options->flags & LP_LOCAL)
     self->flags |= LF_LOCAL;
 
+  if ((parse_options->flags & LP_LAZY_PARSE) && parse_options->lazy_options)
+    {
+      const guchar *src = data;
+      gint left = length;
+
+      /* the PRI is cheap and is needed for the stats and the facility
+       * and level filters, the rest is parsed when first used */
+      if (log_msg_parse_pri(self, &src, &left, parse_options->flags, parse_options->default_pri))
+        {
+          log_msg_set_value(self, LM_V_MESSAGE, (gchar *) data, length);
+          log_msg_set_unparsed(self, parse_options->lazy_options);
+          if (log_msg_has_legacy_header(parse_options, src, left))
+            self->flags |= LF_STATE_UNPARSED_HEADER;
+          return;
+        }
+    }
+
   self->initial_parse = TRUE;
   if (parse_options->flags & LP_SYSLOG_PROTOCOL)
     success = log_msg_parse_syslog_proto(parse_options, data, length, self);
@@ -14,6 +14,7 @@ source s_inetssl { tcp(port(%(ssl_port_number)d) tls(peer-verify(none) cert-file
 source s_pipe { pipe("log-pipe" flags(expect-hostname)); pipe("log-padded-pipe" pad_size(2048) flags(expect-hostname)); };
 source s_file { file("log-file"); };
 source s_network { network(transport(udp) port(%(port_number_network)s)); network(transport(tcp) port(%(port_number_network)s)); };
+source s_reuseport { tcp(port(%(port_number_reuseport)d) so-reuseport(4)); udp(port(%(port_number_reuseport)d) so-reuseport(4)); };
 source s_catchall { unix-stream("log-stream-catchall" flags(expect-hostname)); };
 
 source s_syslog { syslog(port(%(port_number_syslog)d) transport("tcp") so_rcvbuf(131072)); syslog(port(%(port_number_syslog)d) transport("udp") so_rcvbuf(131072)); };
@@ -23,7 +24,7 @@ filter f_input1 { message("input_drivers"); };
 destination d_input1 { file("test-input1.log"); logstore("test-input1.lgs"); };
 destination d_input1_new { file("test-input1_new.log" flags(syslog-protocol)); logstore("test-input1_new.lgs"); };
 
-log { source(s_int); source(s_unix); source(s_inet); source(s_inetssl); source(s_pipe); source(s_file); source(s_network);
+log { source(s_int); source(s_unix); source(s_inet); source(s_inetssl); source(s_pipe); source(s_file); source(s_network); source(s_reuseport);
         log { filter(f_input1); destination(d_input1); };
 };
 
@@ -110,6 +111,9 @@ def test_input_drivers():
         SocketSender(AF_INET, ('localhost', ssl_port_number), dgram=0, send_by_bytes=1, ssl=1),
         SocketSender(AF_INET, ('localhost', port_number_network), dgram=1, terminate_seq='\n'),
         SocketSender(AF_INET, ('localhost', port_number_network), dgram=0),
+        SocketSender(AF_INET, ('localhost', port_number_reuseport), dgram=1, terminate_seq='\n'),
+        SocketSender(AF_INET, ('localhost', port_number_reuseport), dgram=0),
+        SocketSender(AF_INET, ('localhost', port_number_reuseport), dgram=0, send_by_bytes=1),
         FileSender('log-pipe'),
         FileSender('log-pipe', send_by_bytes=1),
         FileSender('log-padded-pipe', padding=2048),
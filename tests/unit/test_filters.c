@@ -101,6 +101,13 @@ create_pcre_regexp_match(gchar* regexp, gint flags)
 }
 #endif
 
+FilterExprNode *
+optimize(FilterExprNode *f)
+{
+  f->init(f, configuration);
+  return f;
+}
+
 void
 testcase(gchar *msg,
          FilterExprNode *f,
@@ -209,6 +216,54 @@ testcase_with_backref_chk(gchar *msg,
       exit(1);                                                  \
     }
 
+#define MSG_USER_DEBUG "<15> openvpn[2499]: PTHREAD support initialized"
+#define MSG_DAEMON_DEBUG "<31> openvpn[2499]: PTHREAD support initialized"
+
+void
+test_optimized_filters(void)
+{
+  FilterExprNode *f;
+  LogMessage *msgs[2];
+  gint i;
+
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", optimize(fop_and_new(create_posix_regexp_match("PTHREAD", 0), filter_facility_new(facility_bits("user")))), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", optimize(fop_and_new(create_posix_regexp_match("PTHREAD", 0), filter_facility_new(facility_bits("daemon")))), 0);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", optimize(fop_or_new(create_posix_regexp_match("^PTHREAD$", 0), filter_level_new(level_bits("debug")))), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", optimize(fop_or_new(create_posix_regexp_match("^PTHREAD$", 0), filter_level_new(level_bits("emerg")))), 0);
+
+  /* nested operations are flattened */
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           optimize(fop_and_new(fop_and_new(create_posix_regexp_match("PTHREAD", 0), filter_level_new(level_bits("debug"))),
+                                fop_and_new(filter_facility_new(facility_bits("user")), create_posix_regexp_match("openvpn", 0)))), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized",
+           optimize(fop_and_new(fop_and_new(create_posix_regexp_match("PTHREAD", 0), filter_level_new(level_bits("debug"))),
+                                fop_or_new(filter_facility_new(facility_bits("daemon")), create_posix_regexp_match("^openvpn$", 0)))), 0);
+
+  /* constant folding, level() with all levels always matches */
+  f = optimize(fop_or_new(create_posix_regexp_match("^PTHREAD$", 0), filter_level_new(level_range("debug", "emerg"))));
+  TEST_ASSERT(f->constant);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", f, 1);
+
+  f = optimize(fop_and_new(create_posix_regexp_match("^PTHREAD$", 0), filter_level_new(level_range("debug", "emerg"))));
+  TEST_ASSERT(!f->constant);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", f, 0);
+
+  /* the results stay the same while the order adapts to the traffic */
+  configuration->adaptive_filters = TRUE;
+  f = optimize(fop_and_new(filter_level_new(level_bits("debug")), filter_facility_new(facility_bits("daemon"))));
+  configuration->adaptive_filters = FALSE;
+  msgs[0] = log_msg_new(MSG_USER_DEBUG, strlen(MSG_USER_DEBUG), NULL, &parse_options);
+  msgs[1] = log_msg_new(MSG_DAEMON_DEBUG, strlen(MSG_DAEMON_DEBUG), NULL, &parse_options);
+  for (i = 0; i < 100000; i++)
+    {
+      TEST_ASSERT(!filter_expr_eval(f, msgs[0]));
+      TEST_ASSERT(filter_expr_eval(f, msgs[1]));
+    }
+  log_msg_unref(msgs[0]);
+  log_msg_unref(msgs[1]);
+  filter_expr_unref(f);
+}
+
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
@@ -323,6 +378,7 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_and_new(create_posix_regexp_match("^PTHREAD$", 0), create_posix_regexp_match(" PTHREAD ", 0)), 0);
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_and_new(create_posix_regexp_match(" PAD ", 0), create_posix_regexp_match("^PTHREAD$", 0)), 0);
 
+  test_optimized_filters();
 
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("alma"), create_template("korte"), KW_LT), 1);
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("alma"), create_template("korte"), KW_LE), 1);
@@ -1,6 +1,7 @@
 #include "misc.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void
 testcase(gchar *msg, gsize msg_len, gsize eom_ofs)
@@ -24,8 +25,8 @@ testcase(gchar *msg, gsize msg_len, gsize eom_ofs)
     }
 }
 
-int
-main()
+static void
+test_short_buffers(void)
 {
   testcase("a\nb\nc\n",  6,  1);
   testcase("ab\nb\nc\n",  7,  2);
@@ -107,6 +108,50 @@ main()
   testcase("abcdefghijklmnopqrstuvwx", 24, -1);
   testcase("abcdefghijklmnopqrstuvwxy", 25, -1);
   testcase("abcdefghijklmnopqrstuvwxyz", 26, -1);
+}
 
+/* exercises each offset in and around the vectorized blocks */
+static void
+test_long_buffers(void)
+{
+  gchar buf[256];
+  gint i;
+
+  memset(buf, 'a', sizeof(buf));
+  testcase(buf, sizeof(buf), -1);
+  for (i = 0; i < sizeof(buf); i++)
+    {
+      buf[i] = '\r';
+      testcase(buf, sizeof(buf), i);
+      buf[i] = '\n';
+      testcase(buf, sizeof(buf), i);
+      /* not found if it is past the end of the buffer */
+      testcase(buf, i, -1);
+      /* or if the string is terminated before it */
+      if (i > 0)
+        {
+          buf[i - 1] = '\0';
+          testcase(buf, sizeof(buf), -1);
+          buf[i - 1] = 'a';
+        }
+      buf[i] = 'a';
+    }
+}
+
+int
+main()
+{
+  StrScanImpl impl;
+
+  for (impl = STR_SCAN_PORTABLE; impl < STR_SCAN_MAX; impl++)
+    {
+      if (!str_scan_set_impl(impl))
+        {
+          fprintf(stderr, "SKIP: %s is not supported\n", str_scan_get_impl_name(impl));
+          continue;
+        }
+      test_short_buffers();
+      test_long_buffers();
+    }
   return 0;
 }
@@ -0,0 +1,129 @@
+#include "syslog-ng.h"
+#include "str-scan.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCHMARK_BUFFER_SIZE (8 * 1024 * 1024)
+#define BENCHMARK_ROUNDS 10
+
+static gchar *buffer;
+static gint num_lines;
+
+/* fills the buffer with lines whose length resembles a typical syslog
+ * stream: mostly 60-200 byte lines with an occassional long one */
+static void
+generate_lines(void)
+{
+  gchar *p = buffer;
+  gchar *end = buffer + BENCHMARK_BUFFER_SIZE;
+  gint len;
+
+  srand(42);
+  while (p < end)
+    {
+      if (rand() % 100 == 0)
+        len = 1024 + rand() % 3072;
+      else
+        len = 60 + rand() % 140;
+
+      if (len > end - p)
+        len = end - p;
+      memset(p, 'a' + rand() % 26, len - 1);
+      p[len - 1] = '\n';
+      p += len;
+      num_lines++;
+    }
+}
+
+static void
+print_result(const gchar *title, StrScanImpl impl, GTimeVal *start, GTimeVal *end)
+{
+  glong usecs = g_time_val_diff(end, start);
+
+  printf("      %-15s %-10s speed: %10.3f MB/sec, %12.3f lines/sec\n",
+         title, str_scan_get_impl_name(impl),
+         (gdouble) BENCHMARK_ROUNDS * BENCHMARK_BUFFER_SIZE / usecs,
+         (gdouble) BENCHMARK_ROUNDS * num_lines * 1e6 / usecs);
+}
+
+static gboolean
+benchmark_find_eom(StrScanImpl impl)
+{
+  GTimeVal start, end;
+  const guchar *p, *eom;
+  gint i, found = 0;
+
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    {
+      p = (const guchar *) buffer;
+      while ((eom = find_eom(p, (const guchar *) buffer + BENCHMARK_BUFFER_SIZE - p)))
+        {
+          p = eom + 1;
+          found++;
+        }
+    }
+  g_get_current_time(&end);
+  print_result("find_eom", impl, &start, &end);
+
+  if (found != BENCHMARK_ROUNDS * num_lines)
+    {
+      fprintf(stderr, "FAIL: find_eom found %d lines instead of %d, impl=%s\n", found, BENCHMARK_ROUNDS * num_lines, str_scan_get_impl_name(impl));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+benchmark_find_cr_or_lf(StrScanImpl impl)
+{
+  GTimeVal start, end;
+  gchar *p, *eol;
+  gint i, found = 0;
+
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_ROUNDS; i++)
+    {
+      p = buffer;
+      while ((eol = find_cr_or_lf(p, buffer + BENCHMARK_BUFFER_SIZE - p)))
+        {
+          p = eol + 1;
+          found++;
+        }
+    }
+  g_get_current_time(&end);
+  print_result("find_cr_or_lf", impl, &start, &end);
+
+  if (found != BENCHMARK_ROUNDS * num_lines)
+    {
+      fprintf(stderr, "FAIL: find_cr_or_lf found %d lines instead of %d, impl=%s\n", found, BENCHMARK_ROUNDS * num_lines, str_scan_get_impl_name(impl));
+      return FALSE;
+    }
+  return TRUE;
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  gboolean success = TRUE;
+  StrScanImpl impl;
+
+  buffer = g_malloc(BENCHMARK_BUFFER_SIZE);
+  generate_lines();
+
+  for (impl = STR_SCAN_PORTABLE; impl < STR_SCAN_MAX; impl++)
+    {
+      if (!str_scan_set_impl(impl))
+        {
+          printf("      %-15s %-10s not supported\n", "", str_scan_get_impl_name(impl));
+          continue;
+        }
+      success &= benchmark_find_eom(impl);
+      success &= benchmark_find_cr_or_lf(impl);
+    }
+
+  g_free(buffer);
+  return success ? 0 : 1;
+}
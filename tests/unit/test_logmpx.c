@@ -0,0 +1,209 @@
+#include "syslog-ng.h"
+#include "syslog-names.h"
+#include "logmpx.h"
+#include "filter.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "plugin.h"
+#include "stats.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+MsgFormatOptions parse_options;
+
+#define NUM_SINKS 5
+
+enum
+{
+  F_USER,
+  F_PROG,
+  F_KERN,
+  NUM_FILTERS
+};
+
+typedef struct _CountingPipe
+{
+  LogPipe super;
+  gint count;
+} CountingPipe;
+
+static void
+counting_pipe_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  CountingPipe *self = (CountingPipe *) s;
+
+  self->count++;
+  log_msg_drop(msg, path_options);
+}
+
+static CountingPipe *
+counting_pipe_new(void)
+{
+  CountingPipe *self = g_new0(CountingPipe, 1);
+
+  log_pipe_init_instance(&self->super);
+  self->super.queue = counting_pipe_queue;
+  return self;
+}
+
+static GlobalConfig *
+create_config(gboolean optimize_filters)
+{
+  GlobalConfig *cfg;
+
+  cfg = cfg_new(0x0304);
+  cfg->stats_level = 3;
+  cfg->optimize_filters = optimize_filters;
+  stats_reinit(cfg);
+  return cfg;
+}
+
+static LogPipe *
+add_pipe(GlobalConfig *cfg, LogPipe *pipe)
+{
+  g_ptr_array_add(cfg->tree.initialized_pipes, pipe);
+  return pipe;
+}
+
+/* builds a branch: a do-nothing head, clones of the filters listed in
+ * @filter_ids (terminated by -1) and a sink, the first clone of each
+ * filter is stored in @instances */
+static LogPipe *
+add_branch(GlobalConfig *cfg, LogMultiplexer *mpx, LogPipe **filters, LogFilterPipe **instances, gint *filter_ids, CountingPipe *sink, guint32 flags)
+{
+  LogPipe *head, *last;
+  gint i;
+
+  head = last = add_pipe(cfg, log_pipe_new());
+  head->flags |= flags;
+  for (i = 0; filter_ids[i] >= 0; i++)
+    {
+      LogFilterPipe *filter = (LogFilterPipe *) add_pipe(cfg, log_pipe_clone(filters[filter_ids[i]]));
+
+      filter->name = g_strdup(((LogFilterPipe *) filters[filter_ids[i]])->name);
+      if (!instances[filter_ids[i]])
+        instances[filter_ids[i]] = filter;
+      log_pipe_append(last, &filter->super);
+      last = &filter->super;
+    }
+  log_pipe_append(last, &sink->super);
+  log_multiplexer_add_next_hop(mpx, head);
+  return head;
+}
+
+static void
+testcase(gboolean optimize_filters, const gchar *msg_str, gint *expected_sinks, gint *expected_evals)
+{
+  GlobalConfig *cfg = create_config(optimize_filters);
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogPipe *filters[NUM_FILTERS];
+  LogFilterPipe *instances[NUM_FILTERS] = { NULL };
+  CountingPipe *sinks[NUM_SINKS];
+  LogMultiplexer *mpx;
+  LogMessage *msg;
+  guint32 evals[NUM_FILTERS];
+  gint i;
+
+  filters[F_USER] = log_filter_pipe_new(filter_facility_new(1 << (LOG_USER >> 3)));
+  filters[F_PROG] = log_filter_pipe_new(filter_re_new(LM_V_PROGRAM));
+  filter_re_set_regexp((FilterRE *) ((LogFilterPipe *) filters[F_PROG])->expr, "^prog$");
+  filter_re_set_flags((FilterRE *) ((LogFilterPipe *) filters[F_PROG])->expr, 0);
+  filters[F_KERN] = log_filter_pipe_new(filter_facility_new(1 << (LOG_KERN >> 3)));
+  ((LogFilterPipe *) filters[F_USER])->name = g_strdup("f_user");
+  ((LogFilterPipe *) filters[F_PROG])->name = g_strdup("f_prog");
+  ((LogFilterPipe *) filters[F_KERN])->name = g_strdup("f_kern");
+  for (i = 0; i < NUM_SINKS; i++)
+    sinks[i] = (CountingPipe *) add_pipe(cfg, &counting_pipe_new()->super);
+
+  mpx = (LogMultiplexer *) add_pipe(cfg, &log_multiplexer_new(0)->super);
+  add_branch(cfg, mpx, filters, instances, (gint []) { F_USER, -1 }, sinks[0], 0);
+  add_branch(cfg, mpx, filters, instances, (gint []) { F_USER, F_PROG, -1 }, sinks[1], 0);
+  add_branch(cfg, mpx, filters, instances, (gint []) { F_USER, F_PROG, -1 }, sinks[2], PIF_BRANCH_FINAL);
+  add_branch(cfg, mpx, filters, instances, (gint []) { F_KERN, -1 }, sinks[3], 0);
+  add_branch(cfg, mpx, filters, instances, (gint []) { -1 }, sinks[4], PIF_BRANCH_FALLBACK);
+
+  if (!cfg_tree_start(&cfg->tree))
+    {
+      fprintf(stderr, "Error starting the processing tree\n");
+      exit(1);
+    }
+
+  if (optimize_filters != (mpx->branches != NULL))
+    {
+      fprintf(stderr, "Decision DAG mismatch, optimize_filters=%d, compiled=%d\n", optimize_filters, mpx->branches != NULL);
+      exit(1);
+    }
+
+  /* facility() filters are answered by the routing table */
+  if (optimize_filters && (!mpx->branches[0].pri_routed || mpx->branches[1].pri_routed || !mpx->branches[3].pri_routed))
+    {
+      fprintf(stderr, "Priority routing mismatch\n");
+      exit(1);
+    }
+
+  for (i = 0; i < NUM_FILTERS; i++)
+    evals[i] = stats_counter_get(instances[i]->evaluated_messages);
+
+  msg = log_msg_new(msg_str, strlen(msg_str), NULL, &parse_options);
+  path_options.ack_needed = FALSE;
+  log_pipe_queue(&mpx->super, msg, &path_options);
+
+  for (i = 0; i < NUM_SINKS; i++)
+    {
+      if (sinks[i]->count != expected_sinks[i])
+        {
+          fprintf(stderr, "Delivery mismatch, msg=%s, optimize_filters=%d, sink=%d, count=%d, expected=%d\n",
+                  msg_str, optimize_filters, i, sinks[i]->count, expected_sinks[i]);
+          exit(1);
+        }
+    }
+  for (i = 0; i < NUM_FILTERS; i++)
+    {
+      guint32 count = stats_counter_get(instances[i]->evaluated_messages) - evals[i];
+
+      if (count != expected_evals[i])
+        {
+          fprintf(stderr, "Evaluation count mismatch, msg=%s, optimize_filters=%d, filter=%s, count=%d, expected=%d\n",
+                  msg_str, optimize_filters, instances[i]->name, count, expected_evals[i]);
+          exit(1);
+        }
+    }
+
+  cfg_tree_stop(&cfg->tree);
+  for (i = 0; i < NUM_FILTERS; i++)
+    log_pipe_unref(filters[i]);
+  cfg_free(cfg);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0304);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  /* user.err: the first three branches match, the third is final */
+  testcase(FALSE, "<11> prog: message", (gint []) { 1, 1, 1, 0, 0 }, (gint []) { 3, 2, 0 });
+  testcase(TRUE, "<11> prog: message", (gint []) { 1, 1, 1, 0, 0 }, (gint []) { 1, 1, 0 });
+
+  /* user.info from another program */
+  testcase(FALSE, "<14> other: message", (gint []) { 1, 0, 0, 0, 0 }, (gint []) { 3, 2, 1 });
+  testcase(TRUE, "<14> other: message", (gint []) { 1, 0, 0, 0, 0 }, (gint []) { 1, 1, 0 });
+
+  /* kern.err */
+  testcase(FALSE, "<3> prog: message", (gint []) { 0, 0, 0, 1, 0 }, (gint []) { 3, 0, 1 });
+  testcase(TRUE, "<3> prog: message", (gint []) { 0, 0, 0, 1, 0 }, (gint []) { 1, 0, 0 });
+
+  /* daemon.info: nothing matches, delivered to the fallback branch */
+  testcase(FALSE, "<30> prog: message", (gint []) { 0, 0, 0, 0, 1 }, (gint []) { 3, 0, 1 });
+  testcase(TRUE, "<30> prog: message", (gint []) { 0, 0, 0, 0, 1 }, (gint []) { 1, 0, 0 });
+
+  app_shutdown();
+  return 0;
+}
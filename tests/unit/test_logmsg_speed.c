@@ -0,0 +1,151 @@
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "logpipe.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "stats.h"
+#include "plugin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+MsgFormatOptions parse_options;
+
+#define BENCHMARK_COUNT 200000
+#define BENCHMARK_WINDOW 1000
+
+#define MSG_STR "<155>2006-02-11T10:34:56.156+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép"
+
+static StatsCounterItem *cache_hits;
+static StatsCounterItem *cache_misses;
+
+static void
+print_result(const gchar *title, gint count, GTimeVal *start, GTimeVal *end, guint32 hits, guint32 misses)
+{
+  hits = stats_counter_get(cache_hits) - hits;
+  misses = stats_counter_get(cache_misses) - misses;
+  printf("      %-50s speed: %12.3f msg/sec, cache hit ratio: %6.2f%%\n",
+         title, count * 1e6 / g_time_val_diff(end, start),
+         hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+/* allocates, clones and frees messages in the same thread */
+void
+testcase_alloc_clone_free(void)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg, *clone;
+  GTimeVal start, end;
+  guint32 hits, misses;
+  gint i;
+
+  hits = stats_counter_get(cache_hits);
+  misses = stats_counter_get(cache_misses);
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      msg = log_msg_new(MSG_STR, strlen(MSG_STR), NULL, &parse_options);
+      clone = log_msg_clone_cow(msg, &path_options);
+      log_msg_unref(msg);
+      log_msg_unref(clone);
+    }
+  g_get_current_time(&end);
+  print_result("new + clone_cow + unref", i, &start, &end, hits, misses);
+}
+
+/* keeps a window of live messages, similar to a source with flow-control */
+void
+testcase_alloc_window(void)
+{
+  LogMessage *window[BENCHMARK_WINDOW];
+  GTimeVal start, end;
+  guint32 hits, misses;
+  gint i, j;
+
+  hits = stats_counter_get(cache_hits);
+  misses = stats_counter_get(cache_misses);
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i += BENCHMARK_WINDOW)
+    {
+      for (j = 0; j < BENCHMARK_WINDOW; j++)
+        window[j] = log_msg_new(MSG_STR, strlen(MSG_STR), NULL, &parse_options);
+      for (j = 0; j < BENCHMARK_WINDOW; j++)
+        log_msg_unref(window[j]);
+    }
+  g_get_current_time(&end);
+  print_result("new + unref, window of 1000 messages", i, &start, &end, hits, misses);
+}
+
+static gpointer
+threaded_free(gpointer user_data)
+{
+  GAsyncQueue *queue = (GAsyncQueue *) user_data;
+  LogMessage *msg;
+
+  while ((msg = g_async_queue_pop(queue)) != GINT_TO_POINTER(-1))
+    log_msg_unref(msg);
+  log_msg_free_thread_cache();
+  return NULL;
+}
+
+/* messages are allocated by the main thread, freed by another one, the
+ * blocks find their way back through the depot */
+void
+testcase_cross_thread_free(void)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  GAsyncQueue *queue;
+  GThread *thread;
+  LogMessage *msg;
+  GTimeVal start, end;
+  guint32 hits, misses;
+  gint i;
+
+  queue = g_async_queue_new();
+  thread = g_thread_create(threaded_free, queue, TRUE, NULL);
+
+  hits = stats_counter_get(cache_hits);
+  misses = stats_counter_get(cache_misses);
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      msg = log_msg_new(MSG_STR, strlen(MSG_STR), NULL, &parse_options);
+      g_async_queue_push(queue, log_msg_clone_cow(msg, &path_options));
+      log_msg_unref(msg);
+    }
+  g_async_queue_push(queue, GINT_TO_POINTER(-1));
+  g_thread_join(thread);
+  g_get_current_time(&end);
+  print_result("new + clone_cow, unref in another thread", i, &start, &end, hits, misses);
+
+  g_async_queue_unref(queue);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0300);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  stats_lock();
+  stats_register_counter(0, SCS_GLOBAL, "msg_alloc_cache_hits", NULL, SC_TYPE_PROCESSED, &cache_hits);
+  stats_register_counter(0, SCS_GLOBAL, "msg_alloc_cache_misses", NULL, SC_TYPE_PROCESSED, &cache_misses);
+  stats_unlock();
+
+  testcase_alloc_clone_free();
+  testcase_alloc_window();
+  testcase_cross_thread_free();
+
+  stats_lock();
+  stats_unregister_counter(SCS_GLOBAL, "msg_alloc_cache_hits", NULL, SC_TYPE_PROCESSED, &cache_hits);
+  stats_unregister_counter(SCS_GLOBAL, "msg_alloc_cache_misses", NULL, SC_TYPE_PROCESSED, &cache_misses);
+  stats_unlock();
+
+  app_shutdown();
+  return 0;
+}
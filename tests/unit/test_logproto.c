@@ -494,6 +494,76 @@ test_log_proto_text_server_multi_read(void)
 #endif
 }
 
+static LogMessage *
+fetch_zero_copy_message(LogProtoServer *proto)
+{
+  const guchar *msg = NULL;
+  gsize msg_len = 0;
+  GSockAddr *saddr = NULL;
+  gboolean may_read = TRUE;
+  LogMessageBuffer *buffer;
+  LogMessage *log_msg;
+  LogProtoStatus status;
+
+  do
+    {
+      status = log_proto_server_fetch(proto, &msg, &msg_len, &saddr, &may_read);
+    }
+  while (status == LPS_SUCCESS && msg == NULL && may_read);
+  assert_proto_server_status(proto, status, LPS_SUCCESS);
+  g_sockaddr_unref(saddr);
+
+  buffer = log_proto_server_get_buffer(proto);
+  assert_true(buffer != NULL, "zero-copy server did not return its buffer");
+  log_msg = log_msg_new_from_buffer((const gchar *) msg, msg_len, NULL, &parse_options, buffer);
+  log_msg_buffer_unref(buffer);
+  return log_msg;
+}
+
+static void
+assert_zero_copy_message(LogMessage *msg, const gchar *host, const gchar *program, const gchar *pid, const gchar *message)
+{
+  /* values are returned as C strings, they must be NUL terminated even
+   * if they are borrowed from the buffer */
+  assert_log_message_value(msg, LM_V_HOST, host);
+  assert_log_message_value(msg, LM_V_PROGRAM, program);
+  assert_log_message_value(msg, LM_V_PID, pid);
+  assert_log_message_value(msg, LM_V_MESSAGE, message);
+}
+
+static void
+test_log_proto_text_server_zero_copy(void)
+{
+  LogProtoServer *proto;
+  LogMessage *first, *second, *third;
+
+  log_proto_testcase_begin("test_log_proto_text_server_zero_copy");
+  proto_server_options.zero_copy = TRUE;
+  proto = log_proto_text_server_new(
+            log_transport_mock_records_new(
+              "<13>Oct 11 22:14:15 host1 prog1[1234]: first message\n"
+              "<13>Oct 11 22:14:15 host2 prog2[5]: second\r\n", -1,
+              /* no EOL, the last message is flushed at EOF */
+              "<13>Oct 11 22:14:15 host3 prog3[67]: third", -1,
+              LTM_EOF),
+            get_inited_proto_server_options());
+
+  first = fetch_zero_copy_message(proto);
+  second = fetch_zero_copy_message(proto);
+  third = fetch_zero_copy_message(proto);
+  assert_proto_server_fetch_failure(proto, LPS_EOF, NULL);
+  log_proto_server_free(proto);
+
+  /* the messages outlive the server and the buffer they were read from */
+  assert_zero_copy_message(first, "host1", "prog1", "1234", "first message");
+  assert_zero_copy_message(second, "host2", "prog2", "5", "second");
+  assert_zero_copy_message(third, "host3", "prog3", "67", "third");
+  log_msg_unref(first);
+  log_msg_unref(second);
+  log_msg_unref(third);
+  log_proto_testcase_end();
+}
+
 static void
 test_log_proto_text_server(void)
 {
@@ -504,6 +574,7 @@ test_log_proto_text_server(void)
   test_log_proto_text_server_ucs4();
   test_log_proto_text_server_iso8859_2();
   test_log_proto_text_server_multi_read();
+  test_log_proto_text_server_zero_copy();
 }
 
 /****************************************************************************************
@@ -649,6 +720,64 @@ test_log_proto_dgram_server_eof_handling(void)
   log_proto_testcase_end();
 }
 
+static void
+test_log_proto_dgram_server_batched(void)
+{
+  LogTransport *transport;
+  LogProtoServer *proto;
+  GIOCondition cond;
+  gint fd;
+
+  log_proto_testcase_begin("test_log_proto_dgram_server_batched");
+  proto_server_options.max_msg_size = 32;
+  transport = log_transport_mock_batched_records_new(
+                "first", -1,
+                "second\n", -1,
+                "0123456789ABCDEF0123456789ABCDEF", -1,
+                LTM_INJECT_ERROR(EIO),
+                LTM_EOF);
+  proto = log_proto_dgram_server_new(transport, get_inited_proto_server_options());
+
+  assert_proto_server_fetch(proto, "first", -1);
+  assert_true(log_proto_server_prepare(proto, &fd, &cond), "datagrams left in the batch were not signalled by prepare()");
+  assert_proto_server_fetch(proto, "second\n", -1);
+  assert_proto_server_fetch(proto, "0123456789ABCDEF0123456789ABCDEF", -1);
+  assert_false(log_proto_server_prepare(proto, &fd, &cond), "prepare() signalled pending datagrams after the batch was consumed");
+  assert_gint(log_transport_mock_get_batch_count(transport), 1, "datagrams were not received in a single batch");
+
+  assert_proto_server_fetch_failure(proto, LPS_ERROR, "I/O error occurred while reading");
+  log_proto_server_free(proto);
+  log_proto_testcase_end();
+}
+
+static void
+test_log_proto_dgram_server_zero_copy(void)
+{
+  LogProtoServer *proto;
+  LogMessage *first, *second;
+
+  log_proto_testcase_begin("test_log_proto_dgram_server_zero_copy");
+  proto_server_options.zero_copy = TRUE;
+  /* the first datagram fills the buffer, its terminating byte is past the data */
+  proto_server_options.max_msg_size = strlen("<13>Oct 11 22:14:15 host1 prog1[1234]: first");
+  proto = log_proto_dgram_server_new(
+            log_transport_mock_records_new(
+              "<13>Oct 11 22:14:15 host1 prog1[1234]: first", -1,
+              "<13>Oct 11 22:14:15 host2 prog2[5]: second", -1,
+              LTM_EOF),
+            get_inited_proto_server_options());
+
+  first = fetch_zero_copy_message(proto);
+  second = fetch_zero_copy_message(proto);
+  log_proto_server_free(proto);
+
+  assert_zero_copy_message(first, "host1", "prog1", "1234", "first");
+  assert_zero_copy_message(second, "host2", "prog2", "5", "second");
+  log_msg_unref(first);
+  log_msg_unref(second);
+  log_proto_testcase_end();
+}
+
 static void
 test_log_proto_dgram_server(void)
 {
@@ -657,6 +786,8 @@ test_log_proto_dgram_server(void)
   test_log_proto_dgram_server_invalid_ucs4();
   test_log_proto_dgram_server_iso_8859_2();
   test_log_proto_dgram_server_eof_handling();
+  test_log_proto_dgram_server_batched();
+  test_log_proto_dgram_server_zero_copy();
 }
 
 /****************************************************************************************
@@ -1,10 +1,12 @@
 #include "logqueue.h"
 #include "logqueue-fifo.h"
 #include "logpipe.h"
+#include "logsource.h"
 #include "apphook.h"
 #include "plugin.h"
 #include "mainloop.h"
 #include "tls-support.h"
+#include "syslog-names.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -122,7 +124,258 @@ testcase_zero_diskbuf_alternating_send_acks()
   log_queue_unref(q);
 }
 
+void
+testcase_batch_pop_and_backlog_acks()
+{
+  LogQueue *q;
+  LogMessage *msgs[16];
+  LogPathOptions path_options[16];
+  gint i, count, popped = 0;
+
+  q = log_queue_fifo_new(OVERFLOW_SIZE, NULL);
+  fed_messages = 0;
+  acked_messages = 0;
+  for (i = 0; i < 10; i++)
+    feed_some_messages(&q, 10, TRUE);
+
+  while ((count = log_queue_pop_head_batch(q, msgs, path_options, 16, TRUE, FALSE)) > 0)
+    {
+      for (i = 0; i < count; i++)
+        log_msg_unref(msgs[i]);
+      popped += count;
+    }
+  if (popped != fed_messages || log_queue_get_length(q) != 0)
+    {
+      fprintf(stderr, "batch pop did not return all messages: fed_messages=%d, popped=%d\n", fed_messages, popped);
+      exit(1);
+    }
+
+  /* rewind and pop everything again, then ack them in two rounds */
+  log_queue_rewind_backlog(q);
+  popped = 0;
+  while ((count = log_queue_pop_head_batch(q, msgs, path_options, 16, TRUE, FALSE)) > 0)
+    {
+      for (i = 0; i < count; i++)
+        log_msg_unref(msgs[i]);
+      popped += count;
+    }
+  app_ack_some_messages(q, fed_messages / 2);
+  app_ack_some_messages(q, fed_messages - fed_messages / 2);
+  if (popped != fed_messages || fed_messages != acked_messages)
+    {
+      fprintf(stderr, "did not receive enough acknowledgements: fed_messages=%d, popped=%d, acked_messages=%d\n", fed_messages, popped, acked_messages);
+      exit(1);
+    }
+
+  log_queue_unref(q);
+}
+
+void
+testcase_memory_usage_limit()
+{
+  LogQueue *q;
+  gint64 msg_size, len;
+
+  q = log_queue_fifo_new(OVERFLOW_SIZE, NULL);
+  fed_messages = 0;
+  acked_messages = 0;
+
+  /* measure the size of a single message */
+  feed_some_messages(&q, 1, TRUE);
+  msg_size = q->memory_usage;
+  if (msg_size <= 0)
+    {
+      fprintf(stderr, "memory usage is not accounted: memory_usage=%" G_GINT64_FORMAT "\n", msg_size);
+      exit(1);
+    }
+
+  log_queue_set_memory_usage_limit(q, 10 * msg_size);
+  feed_some_messages(&q, 99, TRUE);
+
+  len = log_queue_get_length(q);
+  if (len != 10 || q->memory_usage > 10 * msg_size || acked_messages != fed_messages - 10)
+    {
+      fprintf(stderr, "memory limit was not enforced: queue_len=%" G_GINT64_FORMAT ", memory_usage=%" G_GSSIZE_FORMAT ", acked_messages=%d\n",
+              len, q->memory_usage, acked_messages);
+      exit(1);
+    }
+
+  send_some_messages(q, len, FALSE);
+  if (q->memory_usage != 0 || acked_messages != fed_messages)
+    {
+      fprintf(stderr, "memory usage was not released: memory_usage=%" G_GSSIZE_FORMAT ", fed_messages=%d, acked_messages=%d\n",
+              q->memory_usage, fed_messages, acked_messages);
+      exit(1);
+    }
+
+  log_queue_unref(q);
+}
+
+typedef struct _TestQueueDest
+{
+  LogPipe super;
+  LogQueue *queue;
+} TestQueueDest;
+
+static void
+test_queue_dest_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  LogPathOptions local_options = *path_options;
+
+  local_options.flow_control_requested = TRUE;
+  log_queue_push_tail(((TestQueueDest *) s)->queue, msg, &local_options);
+}
+
+/* flow-controlled messages are not dropped at the memory limit, their
+ * source is suspended instead until the queue makes progress */
+void
+testcase_memory_usage_limit_suspends_source()
+{
+  LogSourceOptions source_options;
+  LogSource *source;
+  TestQueueDest dest;
+  gssize limit;
+  gint64 len;
+
+  log_pipe_init_instance(&dest.super);
+  dest.super.queue = test_queue_dest_queue;
+  dest.queue = log_queue_fifo_new(OVERFLOW_SIZE, NULL);
+  log_pipe_init(&dest.super, configuration);
+
+  log_source_options_defaults(&source_options);
+  source_options.init_window_size = 1000;
+  log_source_options_init(&source_options, configuration, "test_logqueue");
+  source = g_new0(LogSource, 1);
+  log_source_init_instance(source);
+  log_source_set_options(source, &source_options, 0, SCS_INTERNAL, "test_logqueue", NULL, FALSE);
+  log_pipe_append(&source->super, &dest.super);
+  log_pipe_init(&source->super, configuration);
+
+  fed_messages = 0;
+  limit = 0;
+  while (log_source_free_to_send(source) && fed_messages < 100)
+    {
+      char *msg_str = "<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép";
+      LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+      LogMessage *msg;
+
+      msg = log_msg_new(msg_str, strlen(msg_str), NULL, &parse_options);
+      log_pipe_queue(&source->super, msg, &path_options);
+      fed_messages++;
+      if (fed_messages == 1)
+        {
+          limit = 10 * dest.queue->memory_usage;
+          log_queue_set_memory_usage_limit(dest.queue, limit);
+        }
+    }
+
+  len = log_queue_get_length(dest.queue);
+  if (log_source_free_to_send(source) || len != fed_messages || dest.queue->memory_usage <= limit)
+    {
+      fprintf(stderr, "source was not suspended at the memory limit: fed_messages=%d, queue_len=%" G_GINT64_FORMAT ", memory_usage=%" G_GSSIZE_FORMAT "\n",
+              fed_messages, len, dest.queue->memory_usage);
+      exit(1);
+    }
+
+  send_some_messages(dest.queue, 1, FALSE);
+  if (!log_source_free_to_send(source))
+    {
+      fprintf(stderr, "source was not resumed after an ack\n");
+      exit(1);
+    }
+
+  send_some_messages(dest.queue, len - 1, FALSE);
+  log_pipe_deinit(&source->super);
+  log_pipe_unref(&source->super);
+  log_source_options_destroy(&source_options);
+  log_pipe_deinit(&dest.super);
+  log_queue_unref(dest.queue);
+}
+
+#define SEVERITY_EMERG 0
+#define SEVERITY_ERR   3
+#define SEVERITY_DEBUG 7
+
+void
+feed_messages_with_pri(LogQueue *q, gint n, gint pri)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gchar *msg_str;
+  gint i;
+
+  path_options.ack_needed = TRUE;
+  msg_str = g_strdup_printf("<%d>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: priority test", pri);
+  for (i = 0; i < n; i++)
+    {
+      msg = log_msg_new(msg_str, strlen(msg_str), NULL, &parse_options);
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = test_ack;
+      log_queue_push_tail(q, msg, &path_options);
+      fed_messages++;
+    }
+  g_free(msg_str);
+}
+
+void
+testcase_priority_lanes()
+{
+  LogQueue *q;
+  LogMessage *msg;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint i;
+
+  q = log_queue_fifo_new(10, NULL);
+  log_queue_fifo_set_priority(q, TRUE);
+  fed_messages = 0;
+  acked_messages = 0;
+
+  /* a full queue of debug messages, followed by emergencies and more debug
+   * messages: the emergencies replace the debug messages, the rest of the
+   * debug messages are dropped */
+  feed_messages_with_pri(q, 10, SEVERITY_DEBUG);
+  feed_messages_with_pri(q, 5, SEVERITY_EMERG);
+  feed_messages_with_pri(q, 5, SEVERITY_DEBUG);
+  feed_messages_with_pri(q, 1, SEVERITY_ERR);
+
+  /* rewinding puts the messages back to the front of their lanes */
+  for (i = 0; i < 3; i++)
+    {
+      log_queue_pop_head(q, &msg, &path_options, TRUE, FALSE);
+      log_msg_unref(msg);
+    }
+  log_queue_rewind_backlog(q);
+
+  for (i = 0; i < 10; i++)
+    {
+      gint expected_pri = i < 5 ? SEVERITY_EMERG : (i == 5 ? SEVERITY_ERR : SEVERITY_DEBUG);
+
+      if (!log_queue_pop_head(q, &msg, &path_options, TRUE, FALSE))
+        {
+          fprintf(stderr, "priority queue returned too few messages: popped=%d\n", i);
+          exit(1);
+        }
+      if ((msg->pri & LOG_PRIMASK) != expected_pri)
+        {
+          fprintf(stderr, "priority queue returned messages in the wrong order: index=%d, severity=%d, expected=%d\n",
+                  i, msg->pri & LOG_PRIMASK, expected_pri);
+          exit(1);
+        }
+      log_msg_unref(msg);
+    }
+  log_queue_ack_backlog(q, 10);
+
+  if (log_queue_get_length(q) != 0 || fed_messages != acked_messages)
+    {
+      fprintf(stderr, "priority queue lost messages: queue_len=%" G_GINT64_FORMAT ", fed_messages=%d, acked_messages=%d\n",
+              log_queue_get_length(q), fed_messages, acked_messages);
+      exit(1);
+    }
+  log_queue_unref(q);
+}
+
 #define FEEDERS 1
+#define MAX_FEEDERS 16
 #define MESSAGES_PER_FEEDER 50000
 #define MESSAGES_SUM (FEEDERS * MESSAGES_PER_FEEDER)
 #define TEST_RUNS 10
@@ -157,6 +410,7 @@ main_loop_io_worker_invoke_finish_callbacks(void)
 
 GStaticMutex tlock;
 glong sum_time;
+gint messages_sum = MESSAGES_SUM;
 
 gpointer
 threaded_feed(gpointer args)
@@ -219,7 +473,7 @@ threaded_consume(gpointer st)
   /* just to make sure time is properly cached */
   iv_init();
 
-  while (msg_count < MESSAGES_SUM)
+  while (msg_count < messages_sum)
     {
       gint slept = 0;
       msg = NULL;
@@ -307,6 +561,51 @@ testcase_with_threads()
   fprintf(stderr, "Feed speed: %.2lf\n", (double) TEST_RUNS * MESSAGES_SUM * 1000000 / sum_time);
 }
 
+/* measures the throughput of a single queue with an increasing number of
+ * producers, the consumer pushes every 10th message back as above */
+void
+testcase_feed_scaling()
+{
+  LogQueue *q;
+  GThread *thread_feed[MAX_FEEDERS], *thread_consume;
+  gpointer args[MAX_FEEDERS][2];
+  GTimeVal start, end;
+  gint feeders, j;
+  gpointer result;
+
+  log_queue_set_max_threads(MAX_FEEDERS);
+  for (feeders = 1; feeders <= MAX_FEEDERS; feeders *= 2)
+    {
+      messages_sum = feeders * MESSAGES_PER_FEEDER;
+      q = log_queue_fifo_new(messages_sum, NULL);
+
+      g_get_current_time(&start);
+      for (j = 0; j < feeders; j++)
+        {
+          args[j][0] = q;
+          args[j][1] = GINT_TO_POINTER(j);
+          thread_feed[j] = g_thread_create(threaded_feed, args[j], TRUE, NULL);
+        }
+
+      thread_consume = g_thread_create(threaded_consume, q, TRUE, NULL);
+
+      for (j = 0; j < feeders; j++)
+        g_thread_join(thread_feed[j]);
+      result = g_thread_join(thread_consume);
+      g_get_current_time(&end);
+
+      if (result)
+        {
+          fprintf(stderr, "Consumer failed with %d feeders\n", feeders);
+          exit(1);
+        }
+      fprintf(stderr, "Feeders: %2d, throughput: %.2lf msg/sec\n", feeders,
+              (double) messages_sum * 1000000 / g_time_val_diff(&end, &start));
+      log_queue_unref(q);
+    }
+  messages_sum = MESSAGES_SUM;
+}
+
 int
 main()
 {
@@ -326,11 +625,22 @@ main()
   fprintf(stderr,"Start testcase_with_threads\n");
   testcase_with_threads();
 
+  fprintf(stderr,"Start testcase_feed_scaling\n");
+  testcase_feed_scaling();
+
 #if 1
   fprintf(stderr,"Start testcase_zero_diskbuf_alternating_send_acks\n");
   testcase_zero_diskbuf_alternating_send_acks();
   fprintf(stderr,"Start testcase_zero_diskbuf_and_normal_acks\n");
   testcase_zero_diskbuf_and_normal_acks();
+  fprintf(stderr,"Start testcase_batch_pop_and_backlog_acks\n");
+  testcase_batch_pop_and_backlog_acks();
+  fprintf(stderr,"Start testcase_memory_usage_limit\n");
+  testcase_memory_usage_limit();
+  fprintf(stderr,"Start testcase_memory_usage_limit_suspends_source\n");
+  testcase_memory_usage_limit_suspends_source();
+  fprintf(stderr,"Start testcase_priority_lanes\n");
+  testcase_priority_lanes();
 #endif
   return 0;
 }
@@ -0,0 +1,349 @@
+#include "testutils.h"
+#include "logqueue-disk.h"
+#include "persist-state.h"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#define TEST_DISK_BUF_DIR      "test_logqueue_disk.d"
+#define TEST_PERSIST_FILE      "test_logqueue_disk.persist"
+#define TEST_PERSIST_NAME      "test_logqueue_disk"
+#define TEST_DISK_BUF_SIZE     LOG_QUEUE_DISK_MIN_SIZE
+
+gint acked_messages = 0;
+
+static void
+test_ack(LogMessage *msg, gpointer user_data)
+{
+  acked_messages++;
+}
+
+static void
+cleanup_disk_buffer(void)
+{
+  const gchar *filename;
+  GDir *dir;
+
+  dir = g_dir_open(TEST_DISK_BUF_DIR, 0, NULL);
+  if (dir)
+    {
+      while ((filename = g_dir_read_name(dir)))
+        {
+          gchar *path = g_build_filename(TEST_DISK_BUF_DIR, filename, NULL);
+
+          unlink(path);
+          g_free(path);
+        }
+      g_dir_close(dir);
+    }
+  g_mkdir(TEST_DISK_BUF_DIR, 0700);
+  unlink(TEST_PERSIST_FILE);
+  acked_messages = 0;
+}
+
+static gboolean
+segment_exists(guint32 id)
+{
+  gchar *filename = g_strdup_printf("%s/%s-%08x.qseg", TEST_DISK_BUF_DIR, TEST_PERSIST_NAME, id);
+  gboolean result = g_file_test(filename, G_FILE_TEST_EXISTS);
+
+  g_free(filename);
+  return result;
+}
+
+static PersistState *
+open_persist_state(void)
+{
+  PersistState *state = persist_state_new(TEST_PERSIST_FILE);
+
+  assert_true(persist_state_start(state), "Error starting persist_state object");
+  return state;
+}
+
+static void
+close_persist_state(PersistState *state)
+{
+  persist_state_commit(state);
+  persist_state_free(state);
+}
+
+static LogQueue *
+open_disk_queue(gint qout_size, PersistState *state)
+{
+  LogQueue *q;
+
+  q = log_queue_disk_new(qout_size, TEST_DISK_BUF_SIZE, TEST_DISK_BUF_DIR, state, TEST_PERSIST_NAME);
+  assert_not_null(q, "Error opening disk queue");
+  return q;
+}
+
+static void
+feed_messages(LogQueue *q, gint first, gint n, gint padding)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint i;
+
+  path_options.ack_needed = TRUE;
+  for (i = first; i < first + n; i++)
+    {
+      LogMessage *msg = log_msg_new_empty();
+      GString *value = g_string_sized_new(padding + 16);
+
+      g_string_printf(value, "%d ", i);
+      while (value->len < padding)
+        g_string_append_c(value, 'x');
+      log_msg_set_value(msg, LM_V_MESSAGE, value->str, value->len);
+      g_string_free(value, TRUE);
+
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = test_ack;
+      log_queue_push_tail(q, msg, &path_options);
+    }
+}
+
+/* pops @n messages, checking that they are numbered from @first onwards */
+static void
+send_messages(LogQueue *q, gint first, gint n, gboolean push_to_backlog)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gint i;
+
+  for (i = first; i < first + n; i++)
+    {
+      assert_true(log_queue_pop_head(q, &msg, &path_options, push_to_backlog, FALSE),
+                  "Disk queue is empty, expected message %d", i);
+      assert_gint(atoi(log_msg_get_value(msg, LM_V_MESSAGE, NULL)), i, "Disk queue returned messages out of order");
+      log_msg_ack(msg, &path_options);
+      log_msg_unref(msg);
+    }
+}
+
+static void
+assert_queue_empty(LogQueue *q)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+
+  assert_gint(log_queue_get_length(q), 0, "Disk queue is not empty");
+  assert_false(log_queue_pop_head(q, &msg, &path_options, FALSE, FALSE), "Disk queue returned a message while empty");
+}
+
+static void
+test_push_pop_in_memory(void)
+{
+  LogQueue *q;
+
+  testcase_begin("%s", __FUNCTION__);
+  cleanup_disk_buffer();
+  q = open_disk_queue(10, NULL);
+
+  feed_messages(q, 0, 5, 0);
+  assert_gint(log_queue_get_length(q), 5, "Disk queue length mismatch");
+  assert_gint(acked_messages, 0, "Messages kept in memory must not be acked before they are sent");
+
+  send_messages(q, 0, 5, FALSE);
+  assert_gint(acked_messages, 5, "Sent messages were not acked");
+  assert_queue_empty(q);
+  log_queue_unref(q);
+  testcase_end();
+}
+
+static void
+test_push_pop_ack_rewind(void)
+{
+  LogQueue *q;
+
+  testcase_begin("%s", __FUNCTION__);
+  cleanup_disk_buffer();
+  q = open_disk_queue(2, NULL);
+
+  /* two messages are kept in memory, the rest goes to the disk and is
+   * acked right away */
+  feed_messages(q, 0, 10, 0);
+  assert_gint(log_queue_get_length(q), 10, "Disk queue length mismatch");
+  assert_gint(acked_messages, 8, "Messages written to the disk were not acked");
+
+  send_messages(q, 0, 10, TRUE);
+  assert_gint(log_queue_get_length(q), 0, "Messages in the backlog are counted in the queue length");
+
+  log_queue_rewind_backlog(q);
+  assert_gint(log_queue_get_length(q), 10, "Rewound messages are missing from the queue");
+  send_messages(q, 0, 10, TRUE);
+
+  log_queue_ack_backlog(q, 4);
+  log_queue_rewind_backlog(q);
+  send_messages(q, 4, 6, TRUE);
+  log_queue_ack_backlog(q, 6);
+  assert_gint(acked_messages, 10, "Acked message count mismatch");
+  assert_queue_empty(q);
+  log_queue_unref(q);
+  testcase_end();
+}
+
+static void
+test_restart_recovery(void)
+{
+  PersistState *state;
+  LogQueue *q;
+
+  testcase_begin("%s", __FUNCTION__);
+  cleanup_disk_buffer();
+  state = open_persist_state();
+  q = open_disk_queue(2, state);
+
+  feed_messages(q, 0, 10, 0);
+  send_messages(q, 0, 3, TRUE);
+  log_queue_ack_backlog(q, 3);
+  /* sent, but not acked yet, these have to be delivered again */
+  send_messages(q, 3, 2, TRUE);
+
+  log_queue_persist_state(q, state);
+  close_persist_state(state);
+  log_queue_unref(q);
+
+  state = open_persist_state();
+  q = open_disk_queue(2, state);
+  assert_gint(log_queue_get_length(q), 7, "Unacked messages were not restored");
+  send_messages(q, 3, 7, TRUE);
+  log_queue_ack_backlog(q, 7);
+  assert_queue_empty(q);
+  log_queue_persist_state(q, state);
+  close_persist_state(state);
+  log_queue_unref(q);
+  testcase_end();
+}
+
+static void
+test_restart_saves_in_memory_messages(void)
+{
+  PersistState *state;
+  LogQueue *q;
+
+  testcase_begin("%s", __FUNCTION__);
+  cleanup_disk_buffer();
+  state = open_persist_state();
+  q = open_disk_queue(10, state);
+
+  /* all of these are kept in memory, they are written to the disk when
+   * the queue is freed, after the state was saved */
+  feed_messages(q, 0, 5, 0);
+  send_messages(q, 0, 2, TRUE);
+
+  log_queue_persist_state(q, state);
+  close_persist_state(state);
+  log_queue_unref(q);
+  assert_gint(acked_messages, 5, "Messages saved to the disk were not acked");
+
+  state = open_persist_state();
+  q = open_disk_queue(10, state);
+  assert_gint(log_queue_get_length(q), 5, "In-memory messages were not saved");
+  send_messages(q, 0, 5, FALSE);
+  assert_queue_empty(q);
+  close_persist_state(state);
+  log_queue_unref(q);
+  testcase_end();
+}
+
+#define SEGMENT_TEST_PADDING     16384
+#define SEGMENT_TEST_MESSAGES    40
+
+static void
+test_segment_switch(void)
+{
+  PersistState *state;
+  LogQueue *q;
+
+  testcase_begin("%s", __FUNCTION__);
+  cleanup_disk_buffer();
+  state = open_persist_state();
+  q = open_disk_queue(0, state);
+
+  /* about 15 of these fit in a segment */
+  feed_messages(q, 0, SEGMENT_TEST_MESSAGES, SEGMENT_TEST_PADDING);
+  assert_gint(log_queue_get_length(q), SEGMENT_TEST_MESSAGES, "Disk queue length mismatch");
+  assert_true(segment_exists(1) && segment_exists(2) && segment_exists(3), "Messages were not split to segments");
+
+  send_messages(q, 0, SEGMENT_TEST_MESSAGES / 2, TRUE);
+  log_queue_ack_backlog(q, SEGMENT_TEST_MESSAGES / 2);
+  assert_false(segment_exists(1), "Acked segment was not removed");
+
+  send_messages(q, SEGMENT_TEST_MESSAGES / 2, SEGMENT_TEST_MESSAGES / 2, TRUE);
+  log_queue_rewind_backlog(q);
+  send_messages(q, SEGMENT_TEST_MESSAGES / 2, SEGMENT_TEST_MESSAGES / 2, TRUE);
+  log_queue_ack_backlog(q, SEGMENT_TEST_MESSAGES / 2);
+  assert_false(segment_exists(2), "Acked segment was not removed");
+  assert_queue_empty(q);
+
+  log_queue_persist_state(q, state);
+  close_persist_state(state);
+  log_queue_unref(q);
+  testcase_end();
+}
+
+static void
+test_restart_with_stale_state(void)
+{
+  PersistState *state;
+  LogQueue *q;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessage *msg;
+  gint first, i;
+
+  testcase_begin("%s", __FUNCTION__);
+  cleanup_disk_buffer();
+  state = open_persist_state();
+  q = open_disk_queue(0, state);
+  log_queue_persist_state(q, state);
+
+  feed_messages(q, 0, SEGMENT_TEST_MESSAGES, SEGMENT_TEST_PADDING);
+  send_messages(q, 0, SEGMENT_TEST_MESSAGES / 2, TRUE);
+  log_queue_ack_backlog(q, SEGMENT_TEST_MESSAGES / 2);
+  assert_false(segment_exists(1), "Acked segment was not removed");
+
+  /* the state is not saved again, as if syslog-ng crashed, it still
+   * refers to the removed first segment */
+  close_persist_state(state);
+  log_queue_unref(q);
+
+  state = open_persist_state();
+  q = open_disk_queue(0, state);
+
+  /* messages acked after the state was saved may be delivered again, but
+   * nothing may be lost */
+  assert_true(log_queue_pop_head(q, &msg, &path_options, FALSE, FALSE), "Stored messages were lost");
+  first = atoi(log_msg_get_value(msg, LM_V_MESSAGE, NULL));
+  log_msg_unref(msg);
+  assert_true(first > 0 && first <= SEGMENT_TEST_MESSAGES / 2, "Unexpected first message after restart; first=%d", first);
+  for (i = first + 1; i < SEGMENT_TEST_MESSAGES; i++)
+    send_messages(q, i, 1, FALSE);
+  assert_queue_empty(q);
+
+  close_persist_state(state);
+  log_queue_unref(q);
+  testcase_end();
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  configuration = cfg_new(VERSION_VALUE);
+
+  test_push_pop_in_memory();
+  test_push_pop_ack_rewind();
+  test_restart_recovery();
+  test_restart_saves_in_memory_messages();
+  test_segment_switch();
+  test_restart_with_stale_state();
+
+  cleanup_disk_buffer();
+  g_rmdir(TEST_DISK_BUF_DIR);
+  cfg_free(configuration);
+  app_shutdown();
+  return 0;
+}
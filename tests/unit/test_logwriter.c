@@ -8,6 +8,7 @@
 #include "timeutils.h"
 #include "plugin.h"
 #include "logqueue-fifo.h"
+#include "logmpx.h"
 
 #include <time.h>
 #include <stdlib.h>
@@ -86,6 +87,141 @@ testcase(gchar *msg_string, gboolean input_is_rfc5424, gchar *template, guint wr
   g_string_free(res, TRUE);
 }
 
+static gint
+count_valid_memos(LogMessage *msg)
+{
+  LogMessageMemo *memo;
+  gint count = 0;
+
+  for (memo = log_msg_get_memos(msg); memo; memo = memo->next)
+    {
+      if (log_msg_memo_is_valid(msg, memo))
+        count++;
+    }
+  return count;
+}
+
+static void
+pop_and_format(LogWriter *writer, LogQueue *queue, LogMessage *expected_msg, gchar *expected_value)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  GString *res = g_string_sized_new(128);
+  LogMessage *msg;
+
+  if (!log_queue_pop_head(queue, &msg, &path_options, FALSE, FALSE) || msg != expected_msg)
+    {
+      fprintf(stderr,"Template cache testcase failed; the message was not delivered to the writer unchanged\n");
+      exit(1);
+    }
+  log_writer_format_log(writer, msg, res);
+  if (strcmp(res->str, expected_value) != 0)
+    {
+      fprintf(stderr,"Template cache testcase failed; result: %s, expected: %s\n", res->str, expected_value);
+      exit(1);
+    }
+  log_msg_unref(msg);
+  g_string_free(res, TRUE);
+}
+
+/* writers sharing a template format a message delivered to both of them
+ * only once, even though they format it after the multiplexer is done
+ * with it */
+void
+testcase_template_cache_through_mpx(void)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogWriterOptions opt = {0};
+  LogWriter *writers[2];
+  LogQueue *queues[2];
+  LogMultiplexer *mpx;
+  LogTemplate *templ;
+  LogMessage *msg;
+  GString *res = g_string_sized_new(128);
+  gint i;
+
+  opt.options = LWO_NO_MULTI_LINE | LWO_NO_STATS | LWO_SHARE_STATS | LWO_TEMPLATE_CACHE;
+  opt.template_options.time_zone_info[LTZ_SEND] = time_zone_info_new(NULL);
+  templ = log_template_new(configuration, "dummy");
+  log_template_compile(templ, "$HOST $MSG\n", NULL);
+  opt.template = templ;
+
+  mpx = log_multiplexer_new(0);
+  for (i = 0; i < 2; i++)
+    {
+      queues[i] = log_queue_fifo_new(1000, NULL);
+      writers[i] = (LogWriter *) log_writer_new(LW_FORMAT_FILE);
+      log_writer_set_options(writers[i], NULL, &opt, 0, 0, NULL, NULL);
+      log_writer_set_queue((LogPipe *) writers[i], queues[i]);
+      log_multiplexer_add_next_hop(mpx, (LogPipe *) writers[i]);
+    }
+
+  msg = init_msg("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: message", FALSE);
+  log_pipe_queue(&mpx->super, log_msg_ref(msg), &path_options);
+
+  for (i = 0; i < 2; i++)
+    pop_and_format(writers[i], queues[i], msg, "bzorp message\n");
+  if (count_valid_memos(msg) != 1)
+    {
+      fprintf(stderr,"Template cache testcase failed; the shared template was formatted %d times\n", count_valid_memos(msg));
+      exit(1);
+    }
+
+  /* a change made in place is not hidden by the cached result */
+  log_msg_make_writable(&msg, &path_options);
+  log_msg_set_value(msg, LM_V_HOST, "kismacska", -1);
+  log_writer_format_log(writers[0], msg, res);
+  if (strcmp(res->str, "kismacska message\n") != 0 || count_valid_memos(msg) != 1)
+    {
+      fprintf(stderr,"Template cache testcase failed; stale result after changing the message: %s\n", res->str);
+      exit(1);
+    }
+
+  for (i = 0; i < 2; i++)
+    log_pipe_unref((LogPipe *) writers[i]);
+  log_pipe_unref(&mpx->super);
+  log_template_unref(templ);
+  time_zone_info_free(opt.template_options.time_zone_info[LTZ_SEND]);
+  log_msg_unref(msg);
+  g_string_free(res, TRUE);
+}
+
+/* messages whose parsing was deferred are only forwarded as received if
+ * that is what formatting them would produce */
+void
+testcase_forward_unparsed(gchar *msg_string, gchar *expected_value)
+{
+  MsgFormatOptions lazy_parse_options;
+  LogWriterOptions opt = {0};
+  LogWriter *writer;
+  LogMessage *msg;
+  GString *res = g_string_sized_new(128);
+
+  msg_format_options_defaults(&lazy_parse_options);
+  lazy_parse_options.flags |= LP_LAZY_PARSE;
+  msg_format_options_init(&lazy_parse_options, configuration);
+
+  opt.options = LWO_NO_MULTI_LINE | LWO_NO_STATS | LWO_SHARE_STATS;
+  opt.template_options.time_zone_info[LTZ_SEND] = time_zone_info_new(NULL);
+  writer = (LogWriter *) log_writer_new(LW_FORMAT_PROTO);
+  log_writer_set_options(writer, NULL, &opt, 0, 0, NULL, NULL);
+  log_writer_set_queue((LogPipe *) writer, log_queue_fifo_new(1000, NULL));
+
+  msg = log_msg_new(msg_string, strlen(msg_string), NULL, &lazy_parse_options);
+  log_msg_set_value(msg, LM_V_HOST_FROM, "kismacska", 9);
+  log_writer_format_log(writer, msg, res);
+  if (strcmp(res->str, expected_value) != 0)
+    {
+      fprintf(stderr,"Forward unparsed testcase failed; result: %s, expected: %s\n", res->str, expected_value);
+      exit(1);
+    }
+
+  log_pipe_unref((LogPipe *) writer);
+  time_zone_info_free(opt.template_options.time_zone_info[LTZ_SEND]);
+  log_msg_unref(msg);
+  msg_format_options_destroy(&lazy_parse_options);
+  g_string_free(res, TRUE);
+}
+
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
@@ -145,6 +281,13 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase(msg_zero_pri, FALSE, NULL,   LW_FORMAT_PROTO, expected_msg_zero_pri_str);
   testcase(msg_zero_pri, FALSE, "$PRI", LW_FORMAT_PROTO, expected_msg_zero_pri_str_t);
 
+  testcase_template_cache_through_mpx();
+
+  testcase_forward_unparsed("<15>Jan 10 01:00:00 bzorp openvpn[2499]: PTHREAD support initialized",
+                            "<15>Jan 10 01:00:00 bzorp openvpn[2499]: PTHREAD support initialized\n");
+  testcase_forward_unparsed("<15>Jan 10 01:00:00 openvpn[2499]: PTHREAD support initialized",
+                            "<15>Jan 10 01:00:00 kismacska openvpn[2499]: PTHREAD support initialized\n");
+
   app_shutdown();
   return 0;
 }
@@ -98,6 +98,86 @@ testcase_replace(const gchar *log, const gchar *re, gchar *replacement, const gc
   return 0;
 }
 
+static LogMatcher *
+create_matcher(LogMatcher *m, const gchar *pattern, gint matcher_flags)
+{
+  log_matcher_set_flags(m, matcher_flags | LMF_MATCH_ONLY);
+  log_matcher_compile(m, pattern);
+  return m;
+}
+
+/* matchers is NULL terminated, expected_decided is the number of matchers
+ * the set is expected to answer without running the matcher itself */
+int
+testcase_matcher_set(const gchar *log, LogMatcher *matchers[], gint expected_decided)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMatcherSet *set;
+  LogMessage *msg;
+  const gchar *value;
+  gssize value_len;
+  gboolean result;
+  gint i, decided = 0;
+
+  msg = log_msg_new(log, strlen(log), NULL, &parse_options);
+  value = log_msg_get_value(msg, LM_V_MESSAGE, &value_len);
+
+  set = log_matcher_set_new();
+  for (i = 0; matchers[i]; i++)
+    {
+      if (log_matcher_set_add(set, matchers[i]) != i)
+        {
+          fprintf(stderr, "Testcase matcher set failure, unexpected member index. pattern=%s\n", matchers[i]->pattern);
+          exit(1);
+        }
+    }
+
+  for (i = 0; matchers[i]; i++)
+    {
+      if (!log_matcher_set_lookup(set, i, msg, value, value_len, &result))
+        continue;
+      decided++;
+      if (result != log_matcher_match(matchers[i], msg, LM_V_MESSAGE, value, value_len))
+        {
+          fprintf(stderr, "Testcase matcher set failure. pattern=%s, value=%s, result=%d\n", matchers[i]->pattern, value, result);
+          exit(1);
+        }
+    }
+  if (decided != expected_decided)
+    {
+      fprintf(stderr, "Testcase matcher set failure. decided=%d, expected=%d\n", decided, expected_decided);
+      exit(1);
+    }
+
+  /* the members share a single scan of the value */
+  if (!log_msg_get_memos(msg) || log_msg_get_memos(msg)->next)
+    {
+      fprintf(stderr, "Testcase matcher set failure, the value was not scanned exactly once\n");
+      exit(1);
+    }
+
+  /* the results are not reused once the message is changed */
+  log_msg_make_writable(&msg, &path_options);
+  if (log_msg_memo_is_valid(msg, log_msg_get_memos(msg)))
+    {
+      fprintf(stderr, "Testcase matcher set failure, the results were reused after making the message writable\n");
+      exit(1);
+    }
+
+  /* once compiled, the set is closed */
+  if (log_matcher_set_add(set, matchers[0]) != -1)
+    {
+      fprintf(stderr, "Testcase matcher set failure, member added to a compiled set\n");
+      exit(1);
+    }
+
+  for (i = 0; matchers[i]; i++)
+    log_matcher_unref(matchers[i]);
+  log_matcher_set_unref(set);
+  log_msg_unref(msg);
+  return 0;
+}
+
 int
 main()
 {
@@ -153,8 +233,48 @@ main()
   /* match in iso-8859-2 never matches */
   testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: \xe1rv\xedzt\xfbr\xf5t\xfck\xf6rf\xfar\xf3g\xe9p", "\xe1rv\xed*", 0, FALSE, log_matcher_glob_new());
 
+  /* matcher sets, string matchers are always decided by the set, regexps
+   * and globs only when their required literal is missing */
+  testcase_matcher_set("<155>2006-02-11T10:34:56+01:00 bzorp kernel: eth0 link is up",
+                       (LogMatcher *[])
+                       {
+                         create_matcher(log_matcher_string_new(), "eth0 link is up", 0),
+                         create_matcher(log_matcher_string_new(), "ETH0", LMF_PREFIX | LMF_ICASE),
+                         create_matcher(log_matcher_string_new(), "down", LMF_SUBSTRING),
+                         create_matcher(log_matcher_posix_re_new(), "link (is|was) down", 0),
+                         create_matcher(log_matcher_posix_re_new(), "failed: [0-9]+", 0),
+                         create_matcher(log_matcher_posix_re_new(), "(?i)TIMEOUT", 0),
+                         create_matcher(log_matcher_posix_re_new(), "^eth[0-9]", 0),
+                         create_matcher(log_matcher_posix_re_new(), "up|down", 0),
+                         create_matcher(log_matcher_glob_new(), "*carrier*", 0),
+                         create_matcher(log_matcher_glob_new(), "eth0*", 0),
+                         NULL
+                       }, 6);
+  testcase_matcher_set("<155>2006-02-11T10:34:56+01:00 bzorp kernel: ",
+                       (LogMatcher *[])
+                       {
+                         create_matcher(log_matcher_string_new(), "", 0),
+                         create_matcher(log_matcher_string_new(), "eth0", LMF_SUBSTRING),
+                         create_matcher(log_matcher_posix_re_new(), "eth0", 0),
+                         NULL
+                       }, 2);
+
 
 #if ENABLE_PCRE
+  /* caseless UTF-8 patterns have no literal, "(?i)disk" matches "diſk" */
+  testcase_matcher_set("<155>2006-02-11T10:34:56+01:00 bzorp kernel: diſk sda1 failed: I/O error",
+                       (LogMatcher *[])
+                       {
+                         create_matcher(log_matcher_pcre_re_new(), "(?i)disk", LMF_UTF8),
+                         create_matcher(log_matcher_pcre_re_new(), "disk", LMF_UTF8),
+                         create_matcher(log_matcher_pcre_re_new(), "(?i)DISK", 0),
+                         create_matcher(log_matcher_pcre_re_new(), "I/O (error|failure)", 0),
+                         create_matcher(log_matcher_pcre_re_new(), "timeout", 0),
+                         create_matcher(log_matcher_pcre_re_new(), "FAILED", LMF_ICASE | LMF_UTF8),
+                         create_matcher(log_matcher_pcre_re_new(), "(?i)failed", 0),
+                         NULL
+                       }, 3);
+
   testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép", "árvíz", "favíz", "favíztűrőtükörfúrógép", 0, log_matcher_pcre_re_new());
   testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép", "^tűrő", "faró", "árvíztűrőtükörfúrógép", 0, log_matcher_pcre_re_new());
   testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép", "tűrő", "", "árvíztükörfúrógép", 0, log_matcher_pcre_re_new());
@@ -0,0 +1,216 @@
+#include "testutils.h"
+#include "ml-worker-pool.h"
+#include "apphook.h"
+
+#include <string.h>
+#include <iv.h>
+
+/* the blocked job gives up after this many seconds, so that a broken steal
+ * fails the test instead of hanging it */
+#define STEAL_TIMEOUT 10
+
+typedef struct _TestJob
+{
+  MlWorkItem item;
+  MlWorkerPool *pool;
+  GThread *thread;
+  gboolean moved;
+  gint runs;
+  gint limit;
+} TestJob;
+
+static GMutex *test_lock;
+static GCond *test_cond;
+static gboolean blocked_job_started;
+static gboolean blocked_job_released;
+static gint pending_jobs;
+static gint threads_started;
+static gint threads_stopped;
+
+static void
+test_thread_start(gint id)
+{
+  g_atomic_int_inc(&threads_started);
+}
+
+static void
+test_thread_stop(gint id)
+{
+  g_atomic_int_inc(&threads_stopped);
+}
+
+static void
+test_job_record_thread(TestJob *self)
+{
+  if (!self->thread)
+    self->thread = g_thread_self();
+  else if (self->thread != g_thread_self())
+    self->moved = TRUE;
+  self->runs++;
+}
+
+static void
+test_job_work(gpointer s)
+{
+  test_job_record_thread((TestJob *) s);
+}
+
+/* resubmits the job until it ran @limit times */
+static void
+test_job_completion(gpointer s)
+{
+  TestJob *self = (TestJob *) s;
+
+  if (self->runs < self->limit)
+    {
+      ml_worker_pool_submit(self->pool, &self->item);
+      return;
+    }
+  if (--pending_jobs == 0)
+    iv_quit();
+}
+
+static void
+test_job_init(TestJob *self, MlWorkerPool *pool, gint limit, void (*work)(gpointer s))
+{
+  memset(self, 0, sizeof(*self));
+  ml_work_item_init(&self->item);
+  self->item.cookie = self;
+  self->item.work = work;
+  self->item.completion = test_job_completion;
+  self->pool = pool;
+  self->limit = limit;
+  pending_jobs++;
+}
+
+/* runs until the job submitted after it runs, which has to be stolen as
+ * it is queued to the same worker */
+static void
+test_blocked_job_work(gpointer s)
+{
+  GTimeVal timeout;
+
+  test_job_record_thread((TestJob *) s);
+
+  g_get_current_time(&timeout);
+  g_time_val_add(&timeout, STEAL_TIMEOUT * G_USEC_PER_SEC);
+
+  g_mutex_lock(test_lock);
+  blocked_job_started = TRUE;
+  g_cond_broadcast(test_cond);
+  while (!blocked_job_released && g_cond_timed_wait(test_cond, test_lock, &timeout))
+    ;
+  g_mutex_unlock(test_lock);
+}
+
+static void
+test_releasing_job_work(gpointer s)
+{
+  test_job_record_thread((TestJob *) s);
+
+  g_mutex_lock(test_lock);
+  blocked_job_released = TRUE;
+  g_cond_broadcast(test_cond);
+  g_mutex_unlock(test_lock);
+}
+
+static void
+test_jobs_stick_to_their_worker(void)
+{
+  MlWorkerPool *pool;
+  TestJob first, second;
+
+  testcase_begin("%s", __FUNCTION__);
+  pool = ml_worker_pool_new(4, FALSE, NULL, NULL);
+  test_job_init(&first, pool, 100, test_job_work);
+  test_job_init(&second, pool, 100, test_job_work);
+
+  ml_worker_pool_submit(pool, &first.item);
+  ml_worker_pool_submit(pool, &second.item);
+  iv_main();
+
+  assert_gint(first.runs, 100, "Job was not run the expected number of times");
+  assert_gint(second.runs, 100, "Job was not run the expected number of times");
+  assert_false(first.moved, "Job was moved to another worker although its own was idle");
+  assert_false(second.moved, "Job was moved to another worker although its own was idle");
+  assert_true(first.item.worker != second.item.worker, "New jobs were not distributed between the workers");
+  assert_true(first.thread != second.thread, "Jobs on different workers were run by the same thread");
+
+  ml_worker_pool_free(pool);
+  testcase_end();
+}
+
+static void
+test_busy_worker_is_stolen_from(void)
+{
+  MlWorkerPool *pool;
+  TestJob blocked, releasing;
+
+  testcase_begin("%s", __FUNCTION__);
+  pool = ml_worker_pool_new(2, FALSE, NULL, NULL);
+  test_job_init(&blocked, pool, 1, test_blocked_job_work);
+  test_job_init(&releasing, pool, 1, test_releasing_job_work);
+
+  ml_worker_pool_submit(pool, &blocked.item);
+  g_mutex_lock(test_lock);
+  while (!blocked_job_started)
+    g_cond_wait(test_cond, test_lock);
+  g_mutex_unlock(test_lock);
+
+  /* queued behind the blocked job */
+  releasing.item.worker = blocked.item.worker;
+  ml_worker_pool_submit(pool, &releasing.item);
+  iv_main();
+
+  assert_true(blocked_job_released, "Job queued behind a busy worker was not stolen by the idle one");
+  assert_true(releasing.thread != blocked.thread, "Stolen job was run by the busy worker");
+  assert_true(releasing.item.worker != blocked.item.worker, "Stolen job was not moved to the worker that stole it");
+
+  ml_worker_pool_free(pool);
+  testcase_end();
+}
+
+static void
+test_shutdown_stops_started_threads(void)
+{
+  MlWorkerPool *pool;
+  TestJob first, second;
+
+  testcase_begin("%s", __FUNCTION__);
+  threads_started = threads_stopped = 0;
+  pool = ml_worker_pool_new(4, FALSE, test_thread_start, test_thread_stop);
+  test_job_init(&first, pool, 10, test_job_work);
+  test_job_init(&second, pool, 10, test_job_work);
+
+  ml_worker_pool_submit(pool, &first.item);
+  ml_worker_pool_submit(pool, &second.item);
+  iv_main();
+  ml_worker_pool_free(pool);
+
+  assert_true(threads_started >= 2, "Worker threads were not started; started=%d", threads_started);
+  assert_gint(threads_stopped, threads_started, "Not every started worker thread was stopped");
+
+  /* workers are started lazily, a pool that never ran anything has no threads */
+  threads_started = threads_stopped = 0;
+  pool = ml_worker_pool_new(4, FALSE, test_thread_start, test_thread_stop);
+  ml_worker_pool_free(pool);
+  assert_gint(threads_started, 0, "Worker threads were started without any job");
+  testcase_end();
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  test_lock = g_mutex_new();
+  test_cond = g_cond_new();
+
+  test_jobs_stick_to_their_worker();
+  test_busy_worker_is_stolen_from();
+  test_shutdown_stops_started_threads();
+
+  g_cond_free(test_cond);
+  g_mutex_free(test_lock);
+  app_shutdown();
+  return 0;
+}
@@ -324,6 +324,16 @@ test_log_messages_can_be_parsed()
            "PTHREAD support initialized", // msg
            NULL, "2499", NULL, ignore_sdata_pairs
            );
+  /* same minute as the next one, the second is parsed using the cached
+   * start of the minute */
+  testcase("<7>2006-10-29T01:59:00.156+01:00 bzorp openvpn[2499]: PTHREAD support initialized", LP_EXPECT_HOSTNAME, NULL,
+           7,             // pri
+           1162083540, 156000, 3600,    // timestamp (sec/usec/zone)
+           "bzorp",        // host
+           "openvpn",        // openvpn
+           "PTHREAD support initialized", // msg
+           NULL, "2499", NULL, ignore_sdata_pairs
+           );
   testcase("<7>2006-10-29T01:59:59.156+01:00 bzorp openvpn[2499]: PTHREAD support initialized", LP_EXPECT_HOSTNAME, NULL,
            7,             // pri
            1162083599, 156000, 3600,    // timestamp (sec/usec/zone)
@@ -870,6 +880,55 @@ testcase("<132>1 2006-10-29T01:59:59.156+01:00 mymachine evntslog - - [a i=\"]ok
 /*############################*/
 }
 
+void
+test_lazy_parse(void)
+{
+  MsgFormatOptions lazy_parse_options;
+  LogMessage *msg;
+  GString *raw;
+  gchar *raw_msg = "<15>Jan 10 01:00:00 bzorp openvpn[2499]: PTHREAD support initialized";
+
+  testcase_begin("Testing deferred parsing of the message header; msg='%s'", raw_msg);
+
+  msg_format_options_defaults(&lazy_parse_options);
+  lazy_parse_options.flags |= LP_LAZY_PARSE;
+  msg_format_options_init(&lazy_parse_options, configuration);
+
+  msg = log_msg_new(raw_msg, strlen(raw_msg), NULL, &lazy_parse_options);
+  assert_guint16(msg->pri, 15, "PRI is expected to be parsed on reception");
+  assert_true((msg->flags & LF_STATE_UNPARSED) != 0, "Header is expected to be unparsed");
+  assert_true((msg->flags & LF_STATE_UNPARSED_HEADER) != 0, "Timestamp and hostname are expected to be detected");
+
+  raw = g_string_sized_new(0);
+  assert_true(log_msg_append_unparsed(msg, raw), "Unparsed message is expected to be available");
+  assert_string(raw->str, raw_msg, "Unparsed message differs from the received one");
+
+  /* the first access parses the message */
+  assert_log_message_value(msg, LM_V_HOST, "bzorp");
+  assert_true((msg->flags & LF_STATE_UNPARSED) == 0, "Header is expected to be parsed on first use");
+  assert_log_message_value(msg, LM_V_PROGRAM, "openvpn");
+  assert_log_message_value(msg, LM_V_PID, "2499");
+  assert_log_message_value(msg, LM_V_MESSAGE, "PTHREAD support initialized");
+  assert_guint16(msg->pri, 15, "Unexpected message priority");
+
+  g_string_truncate(raw, 0);
+  assert_false(log_msg_append_unparsed(msg, raw), "Parsed message is not expected to be forwarded as received");
+
+  g_string_free(raw, TRUE);
+  log_msg_unref(msg);
+
+  /* the parser falls back to $HOST_FROM, so this can't be forwarded as received */
+  raw_msg = "<15>Jan 10 01:00:00 openvpn[2499]: PTHREAD support initialized";
+  msg = log_msg_new(raw_msg, strlen(raw_msg), NULL, &lazy_parse_options);
+  assert_true((msg->flags & LF_STATE_UNPARSED) != 0, "Header is expected to be unparsed");
+  assert_false((msg->flags & LF_STATE_UNPARSED_HEADER) != 0, "Message without a hostname is detected to have one");
+  log_msg_unref(msg);
+
+  msg_format_options_destroy(&lazy_parse_options);
+
+  testcase_end();
+}
+
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
@@ -879,6 +938,7 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   init_and_load_syslogformat_module();
 
   test_log_messages_can_be_parsed();
+  test_lazy_parse();
 
   deinit_syslogformat_module();
   app_shutdown();
@@ -0,0 +1,120 @@
+#include "testutils.h"
+#include "msg_parse_lib.h"
+
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BENCHMARK_COUNT 200000
+
+static void
+testcase(const gchar *title, const gchar *msg_str, guint32 parse_flags)
+{
+  LogMessage *msg;
+  GTimeVal start, end;
+  gint i, len = strlen(msg_str);
+
+  parse_options.flags = parse_flags;
+
+  /* warm up the caches and make sure the message is parsed successfully */
+  msg = log_msg_new(msg_str, len, NULL, &parse_options);
+  assert_false(strncmp(log_msg_get_value(msg, LM_V_MESSAGE, NULL), "Error processing log message", 28) == 0,
+               "message could not be parsed, msg=%s", msg_str);
+  log_msg_unref(msg);
+
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      msg = log_msg_new(msg_str, len, NULL, &parse_options);
+      log_msg_unref(msg);
+    }
+  g_get_current_time(&end);
+  printf("      %-40s speed: %12.3f msg/sec\n", title, i * 1e6 / g_time_val_diff(&end, &start));
+}
+
+/* measures the cost of timestamp parsing: the messages either differ in
+ * the seconds field only (the date parse cache is hit), or each one is in
+ * a different minute, which needs a full mktime() just like without the
+ * cache */
+static void
+testcase_timestamp(const gchar *title, const gchar *format, gboolean same_minute, guint32 parse_flags)
+{
+  gchar msg_str[60][256];
+  gint msg_len[60];
+  LogMessage *msg;
+  GTimeVal start, end;
+  gint i;
+
+  parse_options.flags = parse_flags;
+  for (i = 0; i < 60; i++)
+    {
+      if (same_minute)
+        g_snprintf(msg_str[i], sizeof(msg_str[i]), format, 10, 34, i);
+      else
+        g_snprintf(msg_str[i], sizeof(msg_str[i]), format, i % 24, i, 56);
+      msg_len[i] = strlen(msg_str[i]);
+    }
+
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      msg = log_msg_new(msg_str[i % 60], msg_len[i % 60], NULL, &parse_options);
+      log_msg_unref(msg);
+    }
+  g_get_current_time(&end);
+  printf("      %-40s speed: %12.3f ns/msg\n", title, g_time_val_diff(&end, &start) * 1e3 / i);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  putenv("TZ=MET-1METDST");
+  tzset();
+  init_and_load_syslogformat_module();
+
+  testcase("RFC3164",
+           "<155>Feb 11 10:34:56 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+           LP_EXPECT_HOSTNAME);
+  testcase("RFC3164, check-hostname",
+           "<155>Feb 11 10:34:56 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+           LP_EXPECT_HOSTNAME | LP_CHECK_HOSTNAME);
+  testcase("RFC3164, no hostname",
+           "<155>Feb  1 10:34:56 syslog-ng[23323]: árvíztűrőtükörfúrógép",
+           0);
+  testcase("RFC3164, ISO timestamp",
+           "<155>2006-02-11T10:34:56.156+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+           LP_EXPECT_HOSTNAME);
+  testcase("RFC3164, Cisco sequence id",
+           "<189>29: foo: *Apr 29 13:58:40.411: %SYS-5-CONFIG_I: Configured from console by console",
+           LP_EXPECT_HOSTNAME);
+  testcase("RFC5424",
+           "<165>1 2003-10-11T22:14:15.003Z mymachine.example.com evntslog - ID47 - An application event log entry...",
+           LP_SYSLOG_PROTOCOL);
+  testcase("RFC5424, structured data",
+           "<165>1 2003-10-11T22:14:15.003Z mymachine.example.com evntslog - ID47 [exampleSDID@0 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"] An application event log entry...",
+           LP_SYSLOG_PROTOCOL);
+
+  testcase_timestamp("BSD timestamp, every minute different",
+                     "<155>Feb 11 %02d:%02d:%02d bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+                     FALSE, LP_EXPECT_HOSTNAME);
+  testcase_timestamp("BSD timestamp, same minute",
+                     "<155>Feb 11 %02d:%02d:%02d bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+                     TRUE, LP_EXPECT_HOSTNAME);
+  testcase_timestamp("ISO timestamp, every minute different",
+                     "<155>2006-02-11T%02d:%02d:%02d.156+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+                     FALSE, LP_EXPECT_HOSTNAME);
+  testcase_timestamp("ISO timestamp, same minute",
+                     "<155>2006-02-11T%02d:%02d:%02d.156+01:00 bzorp syslog-ng[23323]: árvíztűrőtükörfúrógép",
+                     TRUE, LP_EXPECT_HOSTNAME);
+
+  deinit_syslogformat_module();
+  app_shutdown();
+  return 0;
+}
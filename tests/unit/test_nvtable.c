@@ -729,6 +729,115 @@ test_nvtable_lookup()
     }
 }
 
+/* builds a table with @num_values dynamic values, growing it as needed,
+ * which exercises the dynamic value index across reallocations */
+static NVTable *
+build_nvtable_with_dyn_values(gint num_values, NVHandle *handles)
+{
+  NVTable *tab;
+  gchar name[16];
+  gint i;
+
+  tab = nv_table_new(STATIC_VALUES, 4, 256);
+  for (i = 0; i < num_values; i++)
+    {
+      /* spread out the handles, in descending order to make the sorted
+       * layout work hard */
+      handles[i] = DYN_HANDLE + (num_values - i) * 7;
+      g_snprintf(name, sizeof(name), "VAL%d", handles[i]);
+      while (!nv_table_add_value(tab, handles[i], name, strlen(name), name, strlen(name), NULL))
+        {
+          NVTable *new_tab;
+
+          TEST_ASSERT(nv_table_realloc(tab, &new_tab));
+          tab = new_tab;
+        }
+    }
+  return tab;
+}
+
+#define LOOKUP_BENCHMARK_COUNT 1000000
+
+void
+test_nvtable_lookup_speed(gint num_values)
+{
+  NVTable *tab, *clone;
+  NVHandle handles[200];
+  gchar name[16];
+  GTimeVal start, end;
+  gssize len;
+  gint i, sum = 0;
+
+  g_assert(num_values <= G_N_ELEMENTS(handles));
+  tab = build_nvtable_with_dyn_values(num_values, handles);
+
+  /* check that all values are found, both in the original and in a clone */
+  clone = nv_table_clone(tab, 64);
+  for (i = 0; i < num_values; i++)
+    {
+      g_snprintf(name, sizeof(name), "VAL%d", handles[i]);
+      TEST_NVTABLE_ASSERT(tab, handles[i], name, strlen(name));
+      TEST_NVTABLE_ASSERT(clone, handles[i], name, strlen(name));
+    }
+  TEST_ASSERT(nv_table_get_value(tab, DYN_HANDLE, &len) == null_string);
+  nv_table_unref(clone);
+
+  g_get_current_time(&start);
+  for (i = 0; i < LOOKUP_BENCHMARK_COUNT; i++)
+    {
+      nv_table_get_value(tab, handles[i % num_values], &len);
+      sum += len;
+    }
+  g_get_current_time(&end);
+  TEST_ASSERT(sum > 0);
+  fprintf(stderr, "Dynamic value lookup speed, values: %3d, speed: %12.3f lookups/sec\n", num_values,
+          LOOKUP_BENCHMARK_COUNT * 1e6 / g_time_val_diff(&end, &start));
+  nv_table_unref(tab);
+}
+
+void
+test_nvtable_external(void)
+{
+  NVTable *tab, *clone;
+  gchar value[64];
+  gboolean success;
+  gint i;
+
+  for (i = 0; i < sizeof(value); i++)
+    value[i] = 'A' + (i % 26);
+
+  fprintf(stderr, "Testing external values\n");
+  tab = nv_table_new(STATIC_VALUES, STATIC_VALUES, 256);
+
+  /* external values point into the caller's buffer */
+  success = nv_table_add_value_external(tab, STATIC_HANDLE, STATIC_NAME, strlen(STATIC_NAME), value, 32, NULL);
+  TEST_ASSERT(success == TRUE);
+  success = nv_table_add_value_external(tab, DYN_HANDLE, DYN_NAME, strlen(DYN_NAME), value + 16, 16, NULL);
+  TEST_ASSERT(success == TRUE);
+  TEST_NVTABLE_ASSERT(tab, STATIC_HANDLE, value, 32);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE, value + 16, 16);
+  TEST_ASSERT(nv_table_get_value(tab, STATIC_HANDLE, NULL) == value);
+
+  /* indirect values referencing an external one */
+  success = nv_table_add_value_indirect(tab, DYN_HANDLE + 1, "VAL18", 5, STATIC_HANDLE, 0, 4, 8, NULL);
+  TEST_ASSERT(success == TRUE);
+  TEST_NVTABLE_ASSERT(tab, DYN_HANDLE + 1, value + 4, 8);
+
+  /* clones keep referencing the same buffer */
+  clone = nv_table_clone(tab, 64);
+  TEST_NVTABLE_ASSERT(clone, STATIC_HANDLE, value, 32);
+  TEST_NVTABLE_ASSERT(clone, DYN_HANDLE, value + 16, 16);
+
+  /* overwriting an external value copies the new value */
+  success = nv_table_add_value(clone, STATIC_HANDLE, STATIC_NAME, strlen(STATIC_NAME), "foobar", 6, NULL);
+  TEST_ASSERT(success == TRUE);
+  TEST_NVTABLE_ASSERT(clone, STATIC_HANDLE, "foobar", 6);
+  TEST_NVTABLE_ASSERT(clone, DYN_HANDLE + 1, value + 4, 8);
+  TEST_NVTABLE_ASSERT(tab, STATIC_HANDLE, value, 32);
+  nv_table_unref(clone);
+  nv_table_unref(tab);
+}
+
 void
 test_nvtable(void)
 {
@@ -736,6 +845,10 @@ test_nvtable(void)
   test_nvtable_indirect();
   test_nvtable_others();
   test_nvtable_lookup();
+  test_nvtable_external();
+  test_nvtable_lookup_speed(10);
+  test_nvtable_lookup_speed(50);
+  test_nvtable_lookup_speed(200);
 }
 
 int
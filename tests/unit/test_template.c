@@ -2,6 +2,7 @@
 
 #include "syslog-ng.h"
 #include "logmsg.h"
+#include "logpipe.h"
 #include "templates.h"
 #include "misc.h"
 #include "apphook.h"
@@ -239,6 +240,63 @@ test_compat(void)
   configuration->user_version = old_version;
 }
 
+static void
+test_timestamp_cache(void)
+{
+  gint old_frac_digits = configuration->template_options.frac_digits;
+
+  /* the formatted second is cached, the fraction and zone must still follow the settings */
+  assert_template_format("$ISODATE $ISODATE", "2006-02-11T10:34:56.000+01:00 2006-02-11T10:34:56.000+01:00");
+  configuration->template_options.frac_digits = 0;
+  assert_template_format("$ISODATE $DATE", "2006-02-11T10:34:56+01:00 Feb 11 10:34:56");
+  configuration->template_options.frac_digits = 6;
+  assert_template_format("$R_ISODATE $R_DATE", "2006-02-11T19:58:35.639000+01:00 Feb 11 19:58:35.639000");
+  configuration->template_options.frac_digits = old_frac_digits;
+  assert_template_format("$ISODATE $R_ISODATE $ISODATE", "2006-02-11T10:34:56.000+01:00 2006-02-11T19:58:35.639+01:00 2006-02-11T10:34:56.000+01:00");
+}
+
+static void
+test_cached_format(void)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogTemplate *templ, *seq_templ;
+  LogMessage *msg;
+  LogMessageMemo *memos;
+  GString *res = g_string_sized_new(128);
+
+  msg = create_sample_message();
+  templ = compile_template("$HOST $ISODATE");
+  seq_templ = compile_template("$HOST $SEQNUM");
+
+  /* the message does not need to be write-protected to be cached */
+  log_template_format_cached(templ, msg, NULL, LTZ_LOCAL, 1, res);
+  log_template_format_cached(templ, msg, NULL, LTZ_LOCAL, 2, res);
+  assert_string(res->str, "bzorp 2006-02-11T10:34:56.000+01:00", "cached template result mismatch");
+  assert_true(log_msg_get_memos(msg) && !log_msg_get_memos(msg)->next, "sequence number independent template was formatted more than once");
+
+  log_template_format_cached(seq_templ, msg, NULL, LTZ_LOCAL, 1, res);
+  assert_string(res->str, "bzorp 1", "cached template result mismatch");
+  log_template_format_cached(seq_templ, msg, NULL, LTZ_LOCAL, 2, res);
+  assert_string(res->str, "bzorp 2", "cached template result ignores the sequence number");
+  log_template_format_cached(seq_templ, msg, NULL, LTZ_LOCAL, 1, res);
+  assert_string(res->str, "bzorp 1", "cached template result mismatch");
+
+  /* changing the message makes the results stale, but they are kept
+   * until the message is freed as others may still be looking at them */
+  memos = log_msg_get_memos(msg);
+  log_msg_make_writable(&msg, &path_options);
+  assert_true(log_msg_get_memos(msg) == memos, "cached template results were freed while the message is alive");
+  assert_false(log_msg_memo_is_valid(msg, memos), "cached template results were kept valid after making the message writable");
+  log_msg_set_value(msg, LM_V_HOST, "kismacska", -1);
+  log_template_format_cached(templ, msg, NULL, LTZ_LOCAL, 1, res);
+  assert_string(res->str, "kismacska 2006-02-11T10:34:56.000+01:00", "stale cached template result was used");
+
+  g_string_free(res, TRUE);
+  log_template_unref(templ);
+  log_template_unref(seq_templ);
+  log_msg_unref(msg);
+}
+
 static void
 test_multi_thread(void)
 {
@@ -268,6 +326,8 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   test_message_refs();
   test_syntax_errors();
   test_compat();
+  test_timestamp_cache();
+  test_cached_format();
   test_multi_thread();
 
   /* multi-threaded expansion */
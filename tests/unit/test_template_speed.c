@@ -19,7 +19,12 @@ MsgFormatOptions parse_options;
 /* Beginning of Message character encoded in UTF8 */
 #define BOM "\xEF\xBB\xBF"
 
-#define BENCHMARK_COUNT 10000
+#define BENCHMARK_COUNT 100000
+#define BENCHMARK_WARMUP 1000
+
+/* summed over all testcases, to compare builds with a single number */
+gint64 total_formats = 0;
+gint64 total_usec = 0;
 
 void
 testcase(const gchar *msg_str, gboolean syslog_proto, gchar *template)
@@ -27,6 +32,8 @@ testcase(const gchar *msg_str, gboolean syslog_proto, gchar *template)
   LogTemplate *templ;
   LogMessage *msg;
   GString *res = g_string_sized_new(1024);
+  GString *expected;
+  GError *error = NULL;
   static TimeZoneInfo *tzinfo = NULL;
   gint i;
   GTimeVal start, end;
@@ -60,16 +67,42 @@ testcase(const gchar *msg_str, gboolean syslog_proto, gchar *template)
   msg->timestamps[LM_TS_RECVD].zone_offset = get_local_timezone_ofs(1139684315);
 
   templ = log_template_new(configuration, "dummy");
-  log_template_compile(templ, template, NULL);
-  g_get_current_time(&start);
+  if (!log_template_compile(templ, template, &error))
+    {
+      fprintf(stderr, "FAIL: error compiling template, template=%s, error=%s\n", template, error->message);
+      g_clear_error(&error);
+      success = FALSE;
+      goto exit;
+    }
+
+  /* warm up caches, and remember the output to check that formatting is stable */
+  log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
+  expected = g_string_new(res->str);
+  for (i = 1; i < BENCHMARK_WARMUP; i++)
+    log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
 
+  g_get_current_time(&start);
   for (i = 0; i < BENCHMARK_COUNT; i++)
     {
       log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
     }
   g_get_current_time(&end);
   printf("      %-90.*s speed: %12.3f msg/sec\n", (int) strlen(template) - 1, template, i * 1e6 / g_time_val_diff(&end, &start));
+  total_formats += i;
+  total_usec += g_time_val_diff(&end, &start);
 
+  if (res->len == 0 || strcmp(res->str, expected->str) != 0)
+    {
+      fprintf(stderr, "FAIL: template output changed while benchmarking, template=%s, first=%s, last=%s\n", template, expected->str, res->str);
+      success = FALSE;
+    }
+  else if (verbose)
+    {
+      fprintf(stderr, "PASS: template=%s, output=%s\n", template, res->str);
+    }
+  g_string_free(expected, TRUE);
+
+ exit:
   log_template_unref(templ);
   g_string_free(res, TRUE);
   log_msg_unref(msg);
@@ -149,6 +182,9 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase("<155>1 2006-02-11T10:34:56.156+01:00 bzorp syslog-ng 23323 ID47 [exampleSDID@0 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"][examplePriority@0 class=\"high\"] " BOM "árvíztűrőtükörfúrógép", TRUE,
            "$DATE ${HOST:--} ${PROGRAM:--} ${PID:--} ${MSGID:--} ${SDATA:--} $MSG\n");
 
+  if (total_usec > 0)
+    printf("      %-90s speed: %12.3f msg/sec\n", "all templates", total_formats * 1e6 / total_usec);
+
   app_shutdown();
 
   if (success)
@@ -97,6 +97,49 @@ testcase(const gchar *scope, const gchar *exclude, const gchar *expected, GPtrAr
   value_pairs_free(vp);
 }
 
+gboolean
+vp_find_key_foreach(const gchar *name, const gchar *value, gpointer user_data)
+{
+  gpointer *args = (gpointer *) user_data;
+
+  if (strcmp(name, (gchar *) args[0]) == 0)
+    args[1] = GINT_TO_POINTER(TRUE);
+  return FALSE;
+}
+
+/* the selection is compiled into a plan on first use, handles registered
+ * afterwards have to be picked up */
+void
+test_handles_registered_after_first_use(void)
+{
+  ValuePairs *vp;
+  LogMessage *msg = create_message();
+  gpointer args[2];
+
+  vp = value_pairs_new();
+  value_pairs_add_scope(vp, "nv-pairs");
+
+  args[0] = "late.handle";
+  args[1] = GINT_TO_POINTER(FALSE);
+  value_pairs_foreach(vp, vp_find_key_foreach, msg, 11, args);
+  if (args[1])
+    {
+      fprintf(stderr, "late.handle found before it was set\n");
+      success = FALSE;
+    }
+
+  log_msg_set_value(msg, log_msg_get_value_handle("late.handle"), "value", -1);
+  value_pairs_foreach(vp, vp_find_key_foreach, msg, 11, args);
+  if (!args[1])
+    {
+      fprintf(stderr, "late.handle registered after the first use of value-pairs is not found in the result set\n");
+      success = FALSE;
+    }
+
+  log_msg_unref(msg);
+  value_pairs_free(vp);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -142,6 +185,8 @@ main(int argc, char *argv[])
   testcase("everything", NULL, ".SDATA.EventData@18372.4.Data,.SDATA.Keywords@18372.4.Keyword,.SDATA.meta.sequenceId,.SDATA.meta.sysUpTime,.SDATA.origin.ip,AMPM,BSDTAG,CC_DATE,CC_DAY,CC_FULLDATE,CC_HOUR,CC_ISODATE,CC_MIN,CC_MONTH,CC_MONTH_ABBREV,CC_MONTH_NAME,CC_MONTH_WEEK,CC_SEC,CC_STAMP,CC_TZ,CC_TZOFFSET,CC_UNIXTIME,CC_WEEK,CC_WEEKDAY,CC_WEEK_DAY,CC_WEEK_DAY_ABBREV,CC_WEEK_DAY_NAME,CC_YEAR,CC_YEAR_DAY,DATE,DAY,FACILITY,FACILITY_NUM,FULLDATE,HOST,HOUR,HOUR12,ISODATE,LEVEL,LEVEL_NUM,LOGHOST,MESSAGE,MIN,MONTH,MONTH_ABBREV,MONTH_NAME,MONTH_WEEK,MSEC,MSG,MSGHDR,MSGID,PID,PRI,PRIORITY,PROGRAM,R_AMPM,R_DATE,R_DAY,R_FULLDATE,R_HOUR,R_HOUR12,R_ISODATE,R_MIN,R_MONTH,R_MONTH_ABBREV,R_MONTH_NAME,R_MONTH_WEEK,R_MSEC,R_SEC,R_STAMP,R_TZ,R_TZOFFSET,R_UNIXTIME,R_USEC,R_WEEK,R_WEEKDAY,R_WEEK_DAY,R_WEEK_DAY_ABBREV,R_WEEK_DAY_NAME,R_YEAR,R_YEAR_DAY,SDATA,SEC,SEQNUM,SOURCEIP,STAMP,SYSUPTIME,S_AMPM,S_DATE,S_DAY,S_FULLDATE,S_HOUR,S_HOUR12,S_ISODATE,S_MIN,S_MONTH,S_MONTH_ABBREV,S_MONTH_NAME,S_MONTH_WEEK,S_MSEC,S_SEC,S_STAMP,S_TZ,S_TZOFFSET,S_UNIXTIME,S_USEC,S_WEEK,S_WEEKDAY,S_WEEK_DAY,S_WEEK_DAY_ABBREV,S_WEEK_DAY_NAME,S_YEAR,S_YEAR_DAY,TAG,TAGS,TZ,TZOFFSET,UNIXTIME,USEC,WEEK,WEEKDAY,WEEK_DAY,WEEK_DAY_ABBREV,WEEK_DAY_NAME,YEAR,YEAR_DAY", transformers);
   g_ptr_array_free(transformers, TRUE);
 
+  test_handles_registered_after_first_use();
+
   app_shutdown();
   if (success)
     return 0;